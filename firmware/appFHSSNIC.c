@@ -54,13 +54,17 @@ __xdata u8 g_Channels[MAX_CHANNELS];
 
 __xdata u16 g_NIC_ID;
 
+__xdata HOP_DATA_t hopdata;
+__xdata TX_SCHED_t txsched;
+__xdata ACQ_DATA_t acqdata;
+
 
 // queue of messages to transmit.  may be used for FHSS, or to send LONG messages
 // first byte of each message indicates its length
 __xdata u8 g_txMsgQueue[MAX_TX_MSGS][MAX_TX_MSGLEN+1];
 
 ////////// internal functions /////////
-void t2IntHandler(void) __interrupt (T2_VECTOR);
+void hopIntHandler(void);
 void t3IntHandler(void) __interrupt (T3_VECTOR);
 int appHandleEP5(void);
 
@@ -72,6 +76,7 @@ void PHY_set_channel(__xdata u16 chan)
     RFOFF;
     // set the channel
     CHANNR = chan;
+    RF_CONFIG_CHANGED();
     // if we want to transmit in this time slot, it needs to happen after a minimum delay
     RFRX;
 }
@@ -91,22 +96,324 @@ void MAC_initChannels(void)
     //macdata.MAC_threshold = 0;
 }
 
-void begin_hopping(__xdata u8 T2_offset)
+/**************************** HOP CLOCK *****************************/
+void MAC_advance_chanidx(void)
+{
+    if (++macdata.curChanIdx >= macdata.NumChannelHops)
+    {
+        macdata.curChanIdx = 0;
+    }
+}
+
+void hop_advance(void)
+{
+    // move the schedule forward one dwell, carrying the fractional tick so long runs don't drift
+    __xdata u16 acc;
+
+    hopdata.tLastHop = hopdata.tNextHop;
+    acc = hopdata.frac + (u8)hopdata.dwellQ8;
+    hopdata.tNextHop += (hopdata.dwellQ8 >> 8) + (acc >> 8);
+    hopdata.frac = (u8)acc;
+}
+
+void hop_arm(void)
 {
-    // reset the T2 clock settings based on T1 clock an offset
-    T2CT -= T2_offset;
-    T2CT -= MAC_TIMER_STATIC_DIFF;
-    // start the T2 clock interrupt
-    T2CTL |= T2CTL_INT;
-    T2IE = 1;
-    
+    // T1CC1L is buffered until T1CC1H is written
+    T1CC1L = (u8)hopdata.tNextHop;
+    T1CC1H = (u8)(hopdata.tNextHop >> 8);
+}
+
+u8 hop_set_dwell(__xdata u32 dwell_us, __xdata u32 sync_offset_us)
+{
+    if (dwell_us < FHSS_MIN_DWELL_US)
+        dwell_us = FHSS_MIN_DWELL_US;
+    if (dwell_us > FHSS_MAX_DWELL_US)
+        dwell_us = FHSS_MAX_DWELL_US;
+
+    // the sync frame has to land inside the dwell (this also keeps the tick math below in a u32)
+    if (sync_offset_us > dwell_us)
+        return RC_ERR_BAD_ARG;
+
+    __critical {
+        hopdata.dwellUs = dwell_us;
+        hopdata.nominalQ8 = HOP_US_TO_TICKS_Q8(dwell_us);
+        hopdata.dwellQ8 = hopdata.nominalQ8;
+        hopdata.driftQ8 = 0;
+        hopdata.syncOffset = HOP_US_TO_TICKS(sync_offset_us);
+    }
+    return RC_NO_ERROR;
+}
+
+void begin_hopping(__xdata u32 T1_offset)
+{
+    // T1_offset is how long ago (in T1 ticks) the current dwell began.  0 means "right now".
+    __xdata u32 now;
+
+    T1CCTL1 &= ~T1CCTL1_IM;
+    T1_READ32(now);
+
+    hopdata.tNextHop = now - T1_offset;
+    hopdata.frac = 0;
+    hop_advance();
+    while ((s32)(hopdata.tNextHop - now) < HOP_MIN_LEAD_TICKS)
+    {
+        hop_advance();
+        MAC_advance_chanidx();
+    }
+
+    hopdata.phaseErr = 0;
+    hopdata.maxPhaseErr = 0;
+    hopdata.syncCount = 0;
+    hopdata.lateHops = 0;
+    MAC_tx_sched_reset();
+
+    // T1 channel 1 in compare mode, interrupt when T1CNT hits the low word of tNextHop
+    __critical {
+        hop_arm();
+        T1_CLEAR_IF(T1CTL_CH1IF);
+        T1CCTL1 = T1CCTL1_IM | T1CCTL1_MODE;
+    }
 }
 
 void stop_hopping(void)
 {
-    // disable T2 interrupt
-    T2CTL &= ~T2CTL_INT;
-    
+    // disable T1 channel 1 compare interrupt
+    T1CCTL1 &= ~T1CCTL1_IM;
+}
+
+void MAC_sync_correct(__xdata u32 tSFD, __xdata u32 phase)
+{
+    // PLL-style correction of the hop clock from the SFD time of a frame the master says it sent
+    // 'phase' ticks (up to its SFD) into its dwell.  hopdata.syncOffset trims any fixed lag on top.
+    // the phase term pulls the current slot boundaries toward the master, the frequency term folds
+    // the persistent part of the error into the dwell length.
+    __xdata s32 err;
+    __xdata s32 limit;
+    __xdata u32 now;
+
+    tSFD -= phase;
+    __critical {
+        err = (s32)(tSFD - hopdata.tLastHop - hopdata.syncOffset);
+    }
+
+    // anything more than half a dwell away isn't the sync frame for this slot
+    limit = (s32)(hopdata.dwellQ8 >> 9);
+    if (err > limit || err < -limit)
+        return;
+
+    if (err > 0x7fff)
+        hopdata.phaseErr = 0x7fff;
+    else if (err < -0x7fff)
+        hopdata.phaseErr = -0x7fff;
+    else
+        hopdata.phaseErr = (s16)err;
+
+    if (hopdata.phaseErr < 0 && (u16)(-hopdata.phaseErr) > hopdata.maxPhaseErr)
+        hopdata.maxPhaseErr = -hopdata.phaseErr;
+    else if (hopdata.phaseErr > 0 && (u16)hopdata.phaseErr > hopdata.maxPhaseErr)
+        hopdata.maxPhaseErr = hopdata.phaseErr;
+
+    hopdata.syncCount++;
+    hopdata.tLastSync = tSFD + phase;
+
+    limit = (s32)(hopdata.nominalQ8 >> HOP_PLL_MAX_DRIFT_SHIFT);
+    hopdata.driftQ8 += err * (256 >> HOP_PLL_KI_SHIFT);
+    if (hopdata.driftQ8 > limit)
+        hopdata.driftQ8 = limit;
+    else if (hopdata.driftQ8 < -limit)
+        hopdata.driftQ8 = -limit;
+
+    err >>= HOP_PLL_KP_SHIFT;
+
+    T1_READ32(now);
+    __critical {
+        hopdata.dwellQ8 = hopdata.nominalQ8 + hopdata.driftQ8;
+        hopdata.tLastHop += err;
+        hopdata.tNextHop += err;
+        if ((s32)(hopdata.tNextHop - now) < HOP_MIN_LEAD_TICKS)
+            hopdata.tNextHop = now + HOP_MIN_LEAD_TICKS;
+        hop_arm();
+    }
+}
+
+/**************************** TX SCHEDULER *****************************/
+void MAC_tx_sched_reset(void)
+{
+    // clear the statistics and slot counters.  the frame overhead learned so far is kept, and the rest of
+    // the calibration is redone now:  MAC_tx_fits() and MAC_sfd_lag() can't wait for the next rollover
+    __xdata u16 frameTicks = txsched.frameTicks;
+
+    memset(&txsched, 0, sizeof(txsched));
+    txsched.frameTicks = frameTicks;
+    txsched.curSlot = hopdata.hopCount;
+    MAC_tx_sched_calibrate();
+}
+
+void MAC_tx_sched_calibrate(void)
+{
+    // estimate on-air time per byte from the data rate:  Rdata = (256+DRATE_M) * 2^DRATE_E * Fref / 2^28
+    // and one T1 tick is 128/Fref, so one byte is 2^28 / ((256+DRATE_M) << DRATE_E) ticks in Q4
+    __xdata u32 ticks;
+
+    txsched.byteTicksQ4 = 0x10000000UL / ((u32)(256 + MDMCFG3) << (MDMCFG4 & 0xf));
+    if (MDMCFG2 & 0x08)             // manchester doubles the chips per bit
+        txsched.byteTicksQ4 <<= 1;
+    if (MDMCFG1 & 0x80)             // so does FEC
+        txsched.byteTicksQ4 <<= 1;
+
+    if (!txsched.frameTicks)
+    {
+        ticks = ((FHSS_TX_OVERHEAD_BYTES * txsched.byteTicksQ4) >> 4) + HOP_US_TO_TICKS(FHSS_TX_SETTLE_US);
+        txsched.frameTicks = (ticks > 0xffff) ? 0xffff : (u16)ticks;
+    }
+
+    // let listeners retune before we talk:  FHSS_TX_SLEEP_DELAY, but never more than a quarter dwell
+    ticks = hopdata.nominalQ8 >> 10;
+    if (ticks > HOP_US_TO_TICKS(FHSS_TX_SLEEP_DELAY * 1000UL))
+        ticks = HOP_US_TO_TICKS(FHSS_TX_SLEEP_DELAY * 1000UL);
+    txsched.leadTicks = (u16)ticks;
+    txsched.tailTicks = HOP_US_TO_TICKS(FHSS_TX_TAIL_US);
+}
+
+void MAC_tx_slot_rollover(__xdata u32 hopCount)
+{
+    // close out the accounting for the dwell we just left
+    txsched.slots++;
+    txsched.slotHist[(txsched.slotFrames < TX_SLOT_HIST) ? txsched.slotFrames : TX_SLOT_HIST-1]++;
+    if (txsched.slotFrames > txsched.maxSlotFrames)
+        txsched.maxSlotFrames = txsched.slotFrames;
+    txsched.lastSlotBusy = txsched.slotBusy;
+    if (txsched.slotBusy > txsched.maxSlotBusy)
+        txsched.maxSlotBusy = txsched.slotBusy;
+    if (txsched.slotFlags & TXS_DEFERRED)
+        txsched.deferred++;
+
+    txsched.curSlot = hopCount;
+    txsched.slotFrames = 0;
+    txsched.slotBusy = 0;
+    txsched.slotFlags = 0;
+
+    MAC_tx_sched_calibrate();
+}
+
+__xdata u8 MAC_tx_fits(__xdata u16 len, __xdata u32 now, __xdata u32 tLastHop, __xdata u32 tNextHop)
+{
+    // can a frame of len bytes go out now and be off the air before the next hop?
+    __xdata u32 need;
+    __xdata u32 usable;
+
+    need = txsched.frameTicks + ((len * txsched.byteTicksQ4) >> 4) + txsched.tailTicks;
+    usable = tNextHop - tLastHop - txsched.leadTicks;
+
+    if (need > usable)
+    {
+        // this will never fit in a dwell.  send it at the top of one and let the hop wait for it
+        if (txsched.slotFrames == 0)
+        {
+            txsched.oversize++;
+            return 1;
+        }
+        return 0;
+    }
+
+    return ((s32)(tNextHop - now) >= (s32)need);
+}
+
+void MAC_tx_account(__xdata u16 len, __xdata u32 tStart, __xdata u32 hopCount)
+{
+    __xdata u32 tEnd;
+    __xdata u32 busy;
+    __xdata u32 payload;
+
+    T1_READ32(tEnd);
+    busy = tEnd - tStart;
+    if (busy > 0xffff)
+        busy = 0xffff;
+
+    txsched.framesSent++;
+    txsched.slotFrames++;
+    txsched.busyTicks += busy;
+    txsched.slotBusy += (u16)busy;
+
+    // learn the fixed part of a frame's air time.  grow quickly, shrink slowly
+    payload = (len * txsched.byteTicksQ4) >> 4;
+    busy = (busy > payload) ? busy - payload : 0;
+    if (busy > txsched.frameTicks)
+        txsched.frameTicks += (u16)((busy - txsched.frameTicks + 1) >> 1);
+    else
+        txsched.frameTicks -= (u16)((txsched.frameTicks - busy) >> 3);
+
+    // the hop interrupt won't retune under a transmit (oversize frames), so catch up now
+    if (hopdata.hopCount != hopCount)
+        MAC_set_chanidx(macdata.curChanIdx);
+}
+
+void MAC_tx_slot(void)
+{
+    // called from the main loop while hopping.  sends the SYNCINGMASTER beacon and as many queued
+    // messages as fit in what's left of the current dwell.  anything that doesn't fit waits for the next.
+    __xdata u8 packet[sizeof(FHSS_BEACON_t) + 1];       // transmit() may shuffle in a length byte
+    __xdata FHSS_BEACON_t * __xdata beacon = (__xdata FHSS_BEACON_t*)packet;
+    __xdata u32 now, tStart, tLastHop, tNextHop, hopCount;
+    __xdata u8 len;
+
+    while (1)
+    {
+        __critical {
+            hopCount = hopdata.hopCount;
+            tLastHop = hopdata.tLastHop;
+            tNextHop = hopdata.tNextHop;
+        }
+
+        if (hopCount != txsched.curSlot)
+            MAC_tx_slot_rollover(hopCount);
+
+        T1_READ32(now);
+        if ((s32)(now - tLastHop) < (s32)txsched.leadTicks)
+            return;
+
+        // each dwell starts with our sync master discovery beacon frame
+        if (macdata.mac_state == MAC_STATE_SYNCINGMASTER)
+        {
+            if (txsched.slotFlags & TXS_BEACONED)
+                return;
+            if (!MAC_tx_fits(sizeof(FHSS_BEACON_t), now, tLastHop, tNextHop))
+                return;
+
+            beacon->chanIdx = macdata.curChanIdx;
+            memcpy(beacon->magic, FHSS_BEACON_MAGIC, sizeof(beacon->magic));
+            beacon->cellID = g_NIC_ID;
+            beacon->numChanHops = macdata.NumChannelHops;
+
+            T1_READ32(tStart);
+            beacon->phase = tStart - tLastHop;
+            transmit(packet, sizeof(FHSS_BEACON_t), 0, 0);
+            MAC_tx_account(sizeof(FHSS_BEACON_t), tStart, hopCount);
+            txsched.slotFlags |= TXS_BEACONED;
+            macdata.synched_chans++;
+            return;     // don't want to do anything else if we're in this state.
+        }
+
+        len = g_txMsgQueue[macdata.txMsgIdxDone][0];
+        if (!len)
+            return;
+
+        if (!MAC_tx_fits(len, now, tLastHop, tNextHop))
+        {
+            txsched.slotFlags |= TXS_DEFERRED;
+            return;
+        }
+
+        T1_READ32(tStart);
+        transmit(&g_txMsgQueue[macdata.txMsgIdxDone][!(PKTCTRL0&1)], len, 0, 0);
+        MAC_tx_account(len, tStart, hopCount);
+        g_txMsgQueue[macdata.txMsgIdxDone][0] = 0;
+
+        if (++macdata.txMsgIdxDone >= MAX_TX_MSGS)
+        {
+            macdata.txMsgIdxDone = 0;
+        }
+    }
 }
 
 
@@ -135,6 +442,7 @@ __xdata u8 transmit_long(__xdata u8* __xdata buf, __xdata u16 len, __xdata u8 bl
 
     // setup infinite mode, length, and the variables that will last for and manage the whole transmission
     rfTxTotalTXLen = len;
+    rfTxPktLen = len;
                 //debughex16(rfTxTotalTXLen);
     rfTxBufferEnd = MAX_TX_MSGLEN + 1; // add 1 for length byte
                 //debughex16(rfTxBufferEnd);
@@ -284,11 +592,46 @@ __xdata u8 MAC_tx(__xdata u8* __xdata msg, __xdata u8 len)
     return RC_NO_ERROR;
 }
 
+__code u8 preambleBytes[] = {2, 3, 4, 6, 8, 12, 16, 24};
+
+__xdata u32 MAC_sfd_lag(void)
+{
+    // ticks from a master calling transmit() to its SFD arriving here:  calibration + preamble + sync word
+    __xdata u8 bytes;
+
+    bytes = preambleBytes[(MDMCFG1 >> 4) & 7];
+    bytes += ((MDMCFG2 & 3) == 3) ? 4 : 2;      // 30/32 sync mode sends the sync word twice
+    return HOP_US_TO_TICKS(FHSS_TX_SETTLE_US) + ((bytes * txsched.byteTicksQ4) >> 4);
+}
+
+void MAC_acq_start(void)
+{
+    __xdata u32 now;
+
+    T1_READ32(now);
+    acqdata.tStart = now;
+    acqdata.tWindow = now;
+    acqdata.acqTicks = 0;
+    acqdata.chanIdx = macdata.curChanIdx;
+    if (acqdata.chanIdx >= macdata.NumChannelHops)
+        acqdata.chanIdx = 0;
+    acqdata.channelsTried = 1;
+    acqdata.framesHeard = 0;
+    acqdata.beaconsRejected = 0;
+    acqdata.cellID = 0;
+    acqdata.result = ACQ_SEARCHING;
+
+    macdata.mac_state = MAC_STATE_SYNCHING;
+    macdata.tLastStateChange = clock;
+
+    MAC_tx_sched_calibrate();       // MAC_sfd_lag() needs the byte time
+    MAC_set_chanidx(acqdata.chanIdx);
+}
+
 void MAC_sync(__xdata u16 CellID)
 {
-    // this should be implemented for a specific MAC/PHY.  too many details are left out here.
-    // what are we synching to?  need to determine if we have a network id to sync with?
-    // wait on a channel until MAX_SYNC_TIMEOUT
+    // listen for a SYNCINGMASTER beacon from CellID (0 takes any cell) and lock the hop clock to it.
+    // the search itself runs from the main loop (MAC_acq_poll) so USB stays alive while we look.
     //
     // do we want to check current state?  this should probably only be allowed from
     // NONHOPPING or DISCOVERY...
@@ -301,30 +644,129 @@ void MAC_sync(__xdata u16 CellID)
     // first disable hopping 
     stop_hopping();
 
-    // FIXME: what happens if the first channel is jammed?  make this random or make it try several
-    macdata.curChanIdx = 0;
-    while (1)
+    // store the cell we're seeking.  since this search will use other parts of the code...
+    macdata.desperatelySeeking = CellID;
+
+    MAC_acq_start();
+}
+
+__xdata FHSS_BEACON_t * MAC_rx_beacon(__xdata u8 buffer)
+{
+    // the beacon in a received buffer, or 0 if it holds anything else
+    __xdata u8 len;
+    __xdata FHSS_BEACON_t * __xdata beacon;
+
+    if (PKTCTRL0&1)     // variable length packets have a leading "length" byte, let's skip it
     {
-        MAC_set_chanidx(macdata.curChanIdx);
-        while (MARCSTATE != MARC_STATE_RX)
-            ;
-        if ((RSSI&0x7f) < 0x60)
-            break;
+        len = rfrxbuf[buffer][0];
+        beacon = (__xdata FHSS_BEACON_t*)&rfrxbuf[buffer][1];
+    } else {
+        len = PKTLEN;
+        beacon = (__xdata FHSS_BEACON_t*)&rfrxbuf[buffer][0];
+    }
 
-        macdata.curChanIdx++;
-        blink(10,10);
+    if (len < sizeof(FHSS_BEACON_t) || strncmp((char*)beacon->magic, FHSS_BEACON_MAGIC, sizeof(beacon->magic)))
+        return 0;
+    return beacon;
+}
+
+void MAC_acq_beacon(__xdata FHSS_BEACON_t * __xdata beacon)
+{
+    // a beacon tells us where the master is in its pattern (chanIdx) and how far into the dwell it
+    // was when it started sending (phase).  work back from our SFD time to the start of that dwell.
+    __xdata u32 now;
+    __xdata u32 tDwell;
+
+    if ((macdata.desperatelySeeking && beacon->cellID != macdata.desperatelySeeking) ||
+            beacon->numChanHops != macdata.NumChannelHops ||
+            beacon->chanIdx >= macdata.NumChannelHops)
+    {
+        acqdata.beaconsRejected++;
+        return;
     }
 
-    // set state =  SYNC
-    macdata.mac_state = MAC_STATE_SYNCHING;
+    tDwell = rf_tLastRecv - MAC_sfd_lag() - beacon->phase;
 
-    // store the main timer value for beginning of this phase.
+    macdata.curChanIdx = beacon->chanIdx;
+    macdata.mac_state = MAC_STATE_SYNCHED;
     macdata.tLastStateChange = clock;
 
-    // store the cell we're seeking.  since this search will use other parts of the code...
-    macdata.desperatelySeeking = CellID;
+    T1_READ32(now);
+    begin_hopping(now - tDwell);
+    MAC_set_chanidx(macdata.curChanIdx);    // begin_hopping() may have moved on if we were slow
+
+    acqdata.acqTicks = rf_tLastRecv - acqdata.tStart;
+    acqdata.cellID = beacon->cellID;
+    acqdata.result = ACQ_LOCKED;
+
+    debug("network packet(sync)");
+    debughex32(acqdata.acqTicks);
+}
+
+void MAC_acq_poll(void)
+{
+    // called from the main loop while SYNCHING
+    __xdata u32 now;
+    __xdata u8 buffer;
+    __xdata u8 len;
+    __xdata FHSS_BEACON_t * __xdata beacon;
+
+    if (rfif)
+    {
+        lastCode[0] = 0xd;
+        IEN2 &= ~IEN2_RFIE;   // FIXME: is this ok?
+
+        if(rfif & RFIF_IRQ_DONE)
+        {
+            buffer = !rfRxCurrentBuffer;
+            if(rfRxProcessed[buffer] == RX_UNPROCESSED)
+            {
+                acqdata.framesHeard++;
+
+                if (PKTCTRL0&1)     // variable length packets have a leading "length" byte, let's skip it
+                {
+                    len = rfrxbuf[buffer][0];
+                    beacon = (__xdata FHSS_BEACON_t*)&rfrxbuf[buffer][1];
+                } else {
+                    len = PKTLEN;
+                    beacon = (__xdata FHSS_BEACON_t*)&rfrxbuf[buffer][0];
+                }
+
+                if (MAC_rx_beacon(buffer))
+                    MAC_acq_beacon(beacon);
+
+                // we've received a packet.  deliver it.
+                txdata(APP_NIC, NIC_RECV, len, (u8*)beacon);
+
+                /* Set receive buffer to processed so it can be used again */
+                rfRxProcessed[buffer] = RX_PROCESSED;
+            }
+        }
 
-    // at MAX_SYNC_TIMEOUT,start activesync, where i become the cell master/time master, and periodically transmit beacons.
+        __critical { rfif = 0; }
+        IEN2 |= IEN2_RFIE;
+    }
+
+    if (macdata.mac_state != MAC_STATE_SYNCHING)
+        return;
+
+    T1_READ32(now);
+    if (acqdata.timeoutMs && (now - acqdata.tStart) >= HOP_MS_TO_TICKS(acqdata.timeoutMs))
+    {
+        debug("FHSS sync timeout");
+        acqdata.result = ACQ_TIMEOUT;
+        MAC_stop_sync();
+        return;
+    }
+
+    if ((now - acqdata.tWindow) >= HOP_MS_TO_TICKS(acqdata.sniffMs))
+    {
+        // nothing for us here (or the channel is jammed).  step backwards through the pattern
+        acqdata.chanIdx = (acqdata.chanIdx ? acqdata.chanIdx : macdata.NumChannelHops) - 1;
+        acqdata.channelsTried++;
+        acqdata.tWindow = now;
+        MAC_set_chanidx(acqdata.chanIdx);
+    }
 }
 
 void MAC_stop_sync(void)
@@ -387,130 +829,53 @@ __xdata u8 MAC_getNextChannel(void)
 
 
 /************************** Timer Interrupt Vectors **************************/
-void t2IntHandler(void) __interrupt (T2_VECTOR)  // interrupt handler should trigger on T2 overflow
+void hopIntHandler(void)    // called from t1IntHandler on T1 channel 1 compare
 {
-    __xdata u8 packet[28];
+    __xdata u32 now;
 
-    // timer2 controls hopping.
-    // if the system is not supposed to be hopping, T2 Interrupt should be disabled
+    // the T1 hop clock controls hopping.
+    // if the system is not supposed to be hopping, the T1 channel 1 interrupt should be disabled
     // otherwise....
     //
-    // if we are here, the T2CT must have cycled.  increment rf_MAC_timer
-    if (++rf_MAC_timer == macdata.MAC_threshold)
-        rf_MAC_timer = 0;   // since we're 0-based, MAC_threshold is actually past the end of our state machine, which makes it 0 *right now*
-    
-    switch (rf_MAC_timer)
+    // T1CC1 only holds the low 16 bits of tNextHop, so the compare matches once per T1 wrap.
+    T1_READ32(now);
+    if ((s32)(now - hopdata.tNextHop) < 0)
+        return;
+
+    hop_advance();
+    hopdata.hopCount++;
+    MAC_advance_chanidx();
+
+    // if we were held off past the next slot as well, stay on the pattern rather than hop twice
+    while ((s32)(hopdata.tNextHop - now) < HOP_MIN_LEAD_TICKS)
     {
-        case 0:     // change channels
-            // mark last hop time
-            macdata.tLastHop = T2CT | (rf_MAC_timer<<8);        // should this be based on clock and T1?
-            
-            // change to the next channel
-            if (++macdata.curChanIdx >= macdata.NumChannelHops)
-            {
-                macdata.curChanIdx = 0;
-            }
+        hop_advance();
+        hopdata.hopCount++;
+        hopdata.lateHops++;
+        MAC_advance_chanidx();
+    }
+    hop_arm();
+
+    // mark last hop time
+    macdata.tLastHop = (u16)hopdata.tLastHop;
 
 #ifndef DEBUG_HOPPING
-            // if we are transmitting, don't change.  this helps with certain faster hopping systems where the packet is intended to take longer than the dwell time
-            if (MARCSTATE == MARC_STATE_TX)
-                return;
+    // if we are transmitting, don't change.  this helps with certain faster hopping systems where the packet is intended to take longer than the dwell time
+    if (MARCSTATE == MARC_STATE_TX)
+        return;
 #endif
 
-            // actually change the channel to our new index
-            MAC_set_chanidx(macdata.curChanIdx);
-            
+    // actually change the channel to our new index
+    MAC_set_chanidx(macdata.curChanIdx);
+
 #ifdef DEBUG_HOPPING
-            debug("hop");
-            RFOFF;
-            RFTX;        // for debugging purposes, we'll just transmit carrier at each hop
-            //LED = !LED;
-            while(MARCSTATE != MARC_STATE_TX);
-            return;
-    
+    debug("hop");
+    RFOFF;
+    RFTX;        // for debugging purposes, we'll just transmit carrier at each hop
+    //LED = !LED;
+    while(MARCSTATE != MARC_STATE_TX);
+    return;
 #endif
-            break;
-            
-        case 1:
-            //only on the first tick do we send our sync master discovery beacon frame
-            if (macdata.mac_state == MAC_STATE_SYNCINGMASTER)
-            {
-                sleepMillis(FHSS_TX_SLEEP_DELAY);
-                packet[0] = 28;
-                packet[1] = macdata.curChanIdx & 0xff;
-                packet[2] = macdata.curChanIdx >> 8;
-                packet[3] =  'B';
-                packet[4] =  'L';
-                packet[5] =  'A';
-                packet[6] =  'H';
-                packet[7] =  'B';
-                packet[8] =  'L';
-                packet[9] =  'A';
-                packet[10] = 'H';
-                packet[11] = 'B';
-                packet[12] = 'L';
-                packet[13] = 'A';
-                packet[14] = 'H';
-                packet[15] = 'B';
-                packet[16] = 'L';
-                packet[17] = 'A';
-                packet[18] = 'H';
-                packet[19] = 'B';
-                packet[20] = 'L';
-                packet[21] = 'A';
-                packet[22] = 'H';
-                packet[23] = 'B';
-                packet[24] = 'L';
-                packet[25] = 'A';
-                packet[26] = 'H';
-                packet[27] = ' ';
-
-                transmit((__xdata u8*)&packet[1], 28, 0, 0);
-                macdata.synched_chans++;
-                break;      // don't want to do anything else if we're in this state.
-            }
-            break;
-            
-        default:    // all other ticks we can transmit
-            // if we are the SYNC_MASTER and are in the process of "doing the SYNC"
-            // we need to transmit something indicating the channel we're on
-            switch (macdata.mac_state)
-            {
-                case MAC_STATE_SYNCINGMASTER:
-                case MAC_STATE_SYNC_MASTER:
-                    if (100 < (clock - macdata.tLastStateChange))   // periodically shift back to beaconing
-                    {
-                        debug("SYNCH_MASTER -> SYNCINGMASTER");
-                        macdata.mac_state = MAC_STATE_SYNCINGMASTER;
-                        macdata.tLastStateChange = clock;
-                    }
-                    // flow into SYNCHED to behave just like any other synched node (transmitting, etc...)
-                case MAC_STATE_SYNCHED:
-                    // if the queue is not empty, wait but then tx.
-                    // FIXME: this currently sends only once per hop.  this may or may not be appropriate, but it's simple to implement.
-
-                    /*if (T2CT < 10 || T2CT > 246)      // always 0xff, i mean, we're *in* the interrupt handler after all.
-                    {
-                        debughex(T2CT);
-                        return;
-                    }*/
-
-                    if ( g_txMsgQueue[macdata.txMsgIdxDone][0])      // if length byte >0
-                    {
-                        //LED = !LED;
-                        sleepMillis(FHSS_TX_SLEEP_DELAY);
-                        transmit(&g_txMsgQueue[macdata.txMsgIdxDone][!(PKTCTRL0&1)], g_txMsgQueue[macdata.txMsgIdxDone][0], 0, 0);
-                        // FIXME: rudimentary FHSS_tx in interrupt handler, make more elegant (with confirmation or somesuch?)
-                        g_txMsgQueue[macdata.txMsgIdxDone][0] = 0;
-
-                        if (++macdata.txMsgIdxDone >= MAX_TX_MSGS)
-                        {
-                            macdata.txMsgIdxDone = 0;
-                        }
-                        debug("FHSSxmit done");
-                    }
-            }
-    }
 }
 
 void t3IntHandler(void) __interrupt (T3_VECTOR)
@@ -539,49 +904,17 @@ void init_FHSS(void)
     macdata.mac_state = MAC_STATE_NONHOPPING;   // this is basic NIC functionality
 
 
-    // Timer Setup:
-#ifndef IMME
-    // 100ms at 24mhz
-    //T2PR = 0x92;        
-    //T2CTL |= T2CTL_TIP_64;  // 64, 128, 256, 1024
-
-    // 150ms at 24mhz
-    T2PR = 0xdc;        
-    T2CTL |= T2CTL_TIP_64;  // 64, 128, 256, 1024
-
-    // 200ms at 24mhz
-    //T2PR = 0x92;        
-    //T2CTL |= T2CTL_TIP_128;  // 64, 128, 256, 1024
-    
-    // 250ms at 24mhz
-    //T2PR = 0xb7;        
-    //T2CTL |= T2CTL_TIP_128;  // 64, 128, 256, 1024
-    
-    // 300ms at 24mhz
-    //T2PR = 0xdc;        
-    //T2CTL |= T2CTL_TIP_128;  // 64, 128, 256, 1024
-#else
-    // 100ms at 26mhz
-    //T2PR = 0x9f;        
-    //T2CTL |= T2CTL_TIP_64;  // 64, 128, 256, 1024
-
-    // 150ms at 26mhz
-    T2PR = 0xee;        
-    T2CTL |= T2CTL_TIP_64;  // 64, 128, 256, 1024
-
-    // 200ms at 26mhz
-    //T2PR = 0x9f;        
-    //T2CTL |= T2CTL_TIP_128;  // 64, 128, 256, 1024
-
-    // 250ms at 26mhz
-    //T2PR = 0xc6;        
-    //T2CTL |= T2CTL_TIP_128;  // 64, 128, 256, 1024
-    
-    // 300ms at 26mhz
-    //T2PR = 0xee;        
-    //T2CTL |= T2CTL_TIP_128;  // 64, 128, 256, 1024
-#endif
-    T2CTL |= T2CTL_TIG;
+    // Hop clock Setup:
+    // hops are scheduled off T1 channel 1 compare (see t1IntHandler), dwell time is set in
+    // microseconds and may be changed from the host with FHSS_SET_MAC_PERIOD
+    memset(&hopdata, 0, sizeof(hopdata));
+    hop_set_dwell(FHSS_DEFAULT_DWELL_US, 0);
+    MAC_tx_sched_reset();
+
+    memset(&acqdata, 0, sizeof(acqdata));
+    acqdata.sniffMs = FHSS_ACQ_DEFAULT_SNIFF_MS;
+    acqdata.timeoutMs = FHSS_ACQ_DEFAULT_TIMEOUT_MS;
+    registerCb_t1ch1(hopIntHandler);
 
 
     // setup TIMER 3
@@ -602,6 +935,85 @@ void init_MAC(void)
  ************************************************************************************************/
 __xdata u8 processbuffer;
 __xdata u8 *__xdata chan_table;
+__xdata HUNT_DATA_t huntdata;
+
+void hunt_calibrate(void)
+{
+    // calibrate each step once, so the sweep only has to write FSCAL back instead of waiting on SCAL
+    __xdata u8 * __xdata cal = (__xdata u8*)rfrxbuf;
+    __xdata u8 chan;
+
+    for (chan = 0; chan < huntdata.steps; chan++)
+    {
+        CHANNR = chan;
+        rfCalibrate();
+        *cal++ = FSCAL3;
+        *cal++ = FSCAL2;
+        *cal++ = FSCAL1;
+    }
+}
+
+void hunt_flush(__xdata u8 count)
+{
+    txdata( APP_SPECAN, HUNT_QUEUE, count * sizeof(HUNT_HIT_t), (__xdata u8*)rfrxbuf + HUNT_HITS_OFFSET );
+}
+
+void hunt_sweep(void)
+{
+    __xdata u8 * __xdata cal = (__xdata u8*)rfrxbuf;
+    __xdata HUNT_HIT_t * __xdata hits = (__xdata HUNT_HIT_t*)((__xdata u8*)rfrxbuf + HUNT_HITS_OFFSET);
+    __xdata u32 tSweep, tStep, now;
+    __xdata u8 chan, rssi, status, hit;
+    __xdata u8 count = 0;
+
+    T1_READ32(tSweep);
+    for (chan = 0; chan < huntdata.steps; chan++)
+    {
+        /* tune radio from the cached calibration and start RX */
+        RFOFF;
+        CHANNR = chan;
+        FSCAL3 = *cal++;
+        FSCAL2 = *cal++;
+        FSCAL1 = *cal++;
+        RFRX;
+
+        T1_READ32(tStep);
+        do {
+            T1_READ32(now);
+        } while ((now - tStep) < huntdata.settleTicks);
+
+        rssi = RSSI;
+        status = PKTSTATUS;
+
+        if (huntdata.flags & HUNT_CS)
+            hit = status & PKTSTATUS_CS;
+        else
+            hit = ((rssi ^ 0x80) >= huntdata.rssiThresh);
+
+        if (hit)
+        {
+            hits[count].chan = chan;
+            hits[count].rssi = rssi;
+            hits[count].pktstatus = status;
+            hits[count].timestamp = now;
+            huntdata.hits++;
+            if (++count == HUNT_MAX_HITS)
+            {
+                hunt_flush(count);
+                count = 0;
+            }
+        }
+    }
+
+    /* end RX */
+    RFOFF;
+    RF_CONFIG_CHANGED();
+    huntdata.sweeps++;
+    huntdata.sweepTicks = now - tSweep;
+
+    if (count)
+        hunt_flush(count);
+}
 
 /* appMainInit() is called *before Interrupts are enabled* for various initialization things. */
 void appMainInit(void)
@@ -620,6 +1032,14 @@ void appMainInit(void)
  * do not block if you want USB to work.                                                           */
 void appMainLoop(void)
 {
+    __xdata FHSS_BEACON_t * __xdata beacon;
+
+    // tell the host its copy of the radio config is stale, once until it reads it again
+    if (rfConfigGen != rfConfigGenSeen && !rfConfigNotified)
+    {
+        rfConfigNotified = 1;
+        txdata(APP_NIC, NIC_RF_CONFIG_STALE, 1, (__xdata u8*)&rfConfigGen);
+    }
 
     switch  (macdata.mac_state)
     {
@@ -654,47 +1074,25 @@ void appMainLoop(void)
 
             /* end RX */
             RFOFF;
+            RF_CONFIG_CHANGED();
             txdata( APP_SPECAN, SPECAN_QUEUE, (u8)macdata.synched_chans, (__xdata u8*)&chan_table[0] );
             break;
 
-        case MAC_STATE_SYNCHING:
-            // FIXME: need to compare part of the packet to desperatelySeeking;
-            // FIXME: TIMEOUT??  do we just stay in SYNCHING forever1?!?
-            if (rfif)
-            {
-                lastCode[0] = 0xd;
-                IEN2 &= ~IEN2_RFIE;   // FIXME: is this ok?
-
-                if(rfif & RFIF_IRQ_DONE)
-                {
-                    // FIXME: do something with desperatelySeeking here.
-                    // FIXME: OR... use protocol knowledge to dynamically generate a hopping pattern from this discovered cell
-                    macdata.mac_state = MAC_STATE_SYNCHED;
-                    begin_hopping((u8)(rf_tLastRecv & 0xff));       // synching happens within
-                    // we've received a packet with the proper sync word and settings.  
-                    debug("network packet(sync)");
-                    debughex16((u16)rf_tLastRecv);
-                    debug((__code u8*)&rfrxbuf[rfRxCurrentBuffer][0]);
-
-                    // now back to usual programming
-                    processbuffer = !rfRxCurrentBuffer;
-                    if(rfRxProcessed[processbuffer] == RX_UNPROCESSED)
-                    {   
-                        // we've received a packet.  deliver it.
-                        if (PKTCTRL0&1)     // variable length packets have a leading "length" byte, let's skip it
-                            txdata(APP_NIC, NIC_RECV, (u8)rfrxbuf[processbuffer][0], (u8*)&rfrxbuf[processbuffer][1]);
-                        else
-                            txdata(APP_NIC, NIC_RECV, PKTLEN, (u8*)&rfrxbuf[processbuffer]);
+        case MAC_STATE_PREP_HUNT:
+            RFOFF;
+            RFTXRXIE = 0;           // the FSCAL table and hit batch live in rfrxbuf
+            PKTCTRL1 =  0xE5;       // highest PQT, address check, append_status
+            MCSM0 &= ~0x30;         // no auto-cal, we write FSCAL ourselves
+            hunt_calibrate();
+            macdata.mac_state = MAC_STATE_HUNT;
+            // fall through:  start the first sweep right away
 
-                        /* Set receive buffer to processed so it can be used again */
-                        rfRxProcessed[processbuffer] = RX_PROCESSED;
-                    }
-                    rfif &= ~RFIF_IRQ_DONE;
-                }
-            }
+        case MAC_STATE_HUNT:
+            hunt_sweep();
+            break;
 
-            __critical { rfif = 0; }
-            IEN2 |= IEN2_RFIE;
+        case MAC_STATE_SYNCHING:
+            MAC_acq_poll();
             break;
 
         case MAC_STATE_DISCOVERY:
@@ -723,6 +1121,8 @@ void appMainLoop(void)
                         else
                             txdata(APP_NIC, NIC_RECV, PKTLEN, (u8*)&rfrxbuf[processbuffer]);
 
+                        stats.rxDelivered++;
+
                         /* Set receive buffer to processed so it can be used again */
                         rfRxProcessed[processbuffer] = RX_PROCESSED;
                     }
@@ -735,6 +1135,7 @@ void appMainLoop(void)
             break;
 
         case MAC_STATE_SYNCINGMASTER:
+            MAC_tx_slot();
             // if we've done one loop, stop
             if (macdata.synched_chans >= macdata.NumChannelHops)
             {
@@ -743,7 +1144,17 @@ void appMainLoop(void)
             break;
         // perhaps we should just make this "default:"
         case MAC_STATE_SYNC_MASTER:
+            if (100 < (clock - macdata.tLastStateChange))   // periodically shift back to beaconing
+            {
+                debug("SYNCH_MASTER -> SYNCINGMASTER");
+                macdata.mac_state = MAC_STATE_SYNCINGMASTER;
+                macdata.synched_chans = 0;
+                macdata.tLastStateChange = clock;
+                break;
+            }
+            // flow into SYNCHED to behave just like any other synched node (transmitting, etc...)
         case MAC_STATE_SYNCHED:
+            MAC_tx_slot();
         case MAC_STATE_NONHOPPING:
             // this is where we handle the RF packet
             if (rfif)
@@ -756,6 +1167,17 @@ void appMainLoop(void)
                     processbuffer = !rfRxCurrentBuffer;
                     if(rfRxProcessed[processbuffer] == RX_UNPROCESSED)
                     {   
+                        // only the master's beacons say where in its dwell they went out (data frames go
+                        // wherever the slot scheduler fits them, and other slaves talk too), so only they
+                        // steer the hop clock
+                        if (macdata.mac_state == MAC_STATE_SYNCHED && (rfif & RFIF_IRQ_DONE))
+                        {
+                            beacon = MAC_rx_beacon(processbuffer);
+                            if (beacon && beacon->numChanHops == macdata.NumChannelHops &&
+                                    (!acqdata.cellID || beacon->cellID == acqdata.cellID))
+                                MAC_sync_correct(rf_tLastRecv, beacon->phase + MAC_sfd_lag());
+                        }
+
                         // we've received a packet.  deliver it.
                         if (PKTCTRL0&1)     // variable length packets have a leading "length" byte, let's skip it
                         {
@@ -764,6 +1186,8 @@ void appMainLoop(void)
                             txdata(APP_NIC, NIC_RECV, rfRxInfMode ? rfRxLargeLen : PKTLEN, (u8*)&rfrxbuf[processbuffer]);
                         }
 
+                        stats.rxDelivered++;
+
                         /* Set receive buffer to processed so it can be used again */
                         rfRxProcessed[processbuffer] = RX_PROCESSED;
                     }
@@ -816,6 +1240,36 @@ int appHandleEP5(void)
                     appReturn( 1, buf);
                     break;
 
+                case RFCAT_START_HUNT:
+                    // buf: u8 steps, u8 rssi threshold, u8 flags, u16 settle time (us)
+                    if (!buf[0])
+                    {
+                        // no channels to sweep
+                        buf[0] = RC_ERR_BAD_ARG;
+                        appReturn( 1, buf);
+                        break;
+                    }
+                    stop_hopping();
+                    huntdata.steps = buf[0];
+                    huntdata.rssiThresh = buf[1];
+                    huntdata.flags = buf[2];
+                    huntdata.settleTicks = HOP_US_TO_TICKS(buf[3] | (buf[4] << 8));
+                    if (!huntdata.settleTicks)
+                        huntdata.settleTicks = HOP_US_TO_TICKS(HUNT_DEFAULT_SETTLE_US);
+                    huntdata.sweeps = 0;
+                    huntdata.hits = 0;
+                    huntdata.sweepTicks = 0;
+                    macdata.mac_state = MAC_STATE_PREP_HUNT;
+                    appReturn( 1, buf);
+                    break;
+
+                case RFCAT_STOP_HUNT:
+                    macdata.mac_state = MAC_STATE_NONHOPPING;
+                    startRX();          // give rfrxbuf back to the receiver
+                    RFRX;
+                    appReturn( sizeof(huntdata), (__xdata u8*)&huntdata);
+                    break;
+
                 case NIC_XMIT:
                     // this needs to place buf data into the FHSS txMsgQueue    - really?
                     // certainly don't want to allow this function if we're HOPPING.  that would be baaaaaaaaad.
@@ -863,6 +1317,7 @@ int appHandleEP5(void)
                         rfRxLargeLen = 0;
                         IdleMode();
                     }
+                    RF_CONFIG_CHANGED();
                     txdata(ep5.OUTapp, ep5.OUTcmd, 1, (__xdata u8*)&rfRxLargeLen);
                     break;
 
@@ -895,6 +1350,23 @@ int appHandleEP5(void)
                     appReturn( 1, (__xdata u8*) &rfAmpMode);
                     break;
 
+                case NIC_SET_RF_REGS:
+                    // buf: (register offset from 0xdf00, value) pairs.  returns MARCSTATE, registers written
+                    len = setRFRegisters(buf, ep5.OUTlen >> 1);
+                    buf[0] = MARCSTATE;
+                    buf[1] = (u8)len;
+                    appReturn( 2, buf);
+                    break;
+
+                case NIC_GET_RF_CONFIG:
+                    // returns the config generation, then the 0xdf00 register block
+                    rfConfigGenSeen = rfConfigGen;
+                    rfConfigNotified = 0;
+                    buf[0] = rfConfigGen;
+                    memcpy(&buf[1], (__xdata u8*)RF_CFG_REG_BASE, RF_CFG_BLOCK_LEN);
+                    appReturn( RF_CFG_BLOCK_LEN + 1, buf);
+                    break;
+
                 case NIC_SET_ID:
                     // fixme: sending 8 bit to 16 bit function???
                     MAC_set_NIC_ID(buf[0]);
@@ -1075,29 +1547,72 @@ int appHandleEP5(void)
                     break;
 
                 case FHSS_GET_MAC_DATA:
-                    macdata.MAC_timer = rf_MAC_timer;
+                    macdata.MAC_timer = (u16)hopdata.hopCount;
                     appReturn( sizeof(macdata), (__xdata u8*)&macdata);
                     break;
 
+                case FHSS_SET_MAC_PERIOD:
+                    // buf: u32 dwell time (us), u32 offset into the dwell the master sends its frames (us)
+                    // returns the dwell time accepted, or a single RC_ERR_BAD_ARG byte
+                    buf[0] = hop_set_dwell(*(__xdata u32*)&buf[0], *(__xdata u32*)&buf[4]);
+                    if (buf[0] != RC_NO_ERROR)
+                    {
+                        appReturn( 1, buf);
+                        break;
+                    }
+                    appReturn( 4, (__xdata u8*)&hopdata.dwellUs);
+                    break;
+
+                case FHSS_GET_HOP_STATUS:
+                    appReturn( sizeof(hopdata), (__xdata u8*)&hopdata);
+                    break;
+
+                case FHSS_GET_TX_STATS:
+                    // buf[0]:  nonzero clears the counters once they're sent
+                    appReturn( sizeof(txsched), (__xdata u8*)&txsched);
+                    if (buf[0])
+                        MAC_tx_sched_reset();
+                    break;
+
                 case FHSS_START_SYNC:
-                    MAC_sync(buf[0]);
+                    MAC_sync(buf[0] | (buf[1] << 8));
                     appReturn( 1, buf);
                     break;
+
+                case FHSS_SET_ACQ_PARAMS:
+                    // buf: u32 sniff window (ms), u32 timeout (ms)
+                    acqdata.sniffMs = *(__xdata u32*)&buf[0];
+                    acqdata.timeoutMs = *(__xdata u32*)&buf[4];
+                    if (!acqdata.sniffMs)
+                        acqdata.sniffMs = 1;
+                    if (acqdata.sniffMs > FHSS_ACQ_MAX_MS)
+                        acqdata.sniffMs = FHSS_ACQ_MAX_MS;
+                    if (acqdata.timeoutMs > FHSS_ACQ_MAX_MS)
+                        acqdata.timeoutMs = FHSS_ACQ_MAX_MS;
+                    appReturn( 8, (__xdata u8*)&acqdata.sniffMs);
+                    break;
+
+                case FHSS_GET_ACQ_STATUS:
+                    appReturn( sizeof(acqdata), (__xdata u8*)&acqdata);
+                    break;
                     
                 case FHSS_SET_STATE:
                     // store the main timer value for beginning of this phase.
                     macdata.tLastStateChange = clock;
                     macdata.mac_state = (u8)buf[0];
                     
-                    // if macdata.mac_state is > 2, make sure the T2 interrupt is set
-                    // if macdata.mac_state <= 2, make sure T2 interrupt is ignored
+                    // if macdata.mac_state is > 2, make sure the hop clock is running
+                    // if macdata.mac_state <= 2, make sure the hop clock is stopped
                     switch (macdata.mac_state)
                     {
                         case MAC_STATE_NONHOPPING:
                         case MAC_STATE_DISCOVERY:
+                            stop_hopping();
+                            break;
+
                         case MAC_STATE_SYNCHING:
-                            
                             stop_hopping();
+                            MAC_acq_start();
                             break;
 
                         case MAC_STATE_SYNCINGMASTER:
@@ -1344,6 +1859,8 @@ void initBoard(void)
 }
 
 
+// bench.c brings its own main() and drives the pieces directly
+#ifndef BENCHMARK
 void main (void)
 {
     initBoard();
@@ -1363,9 +1880,11 @@ void main (void)
 
     while (1)
     {  
+        STATS_LOOP_MARK();
         usbProcessEvents();
         appMainLoop();
     }
 
 }
+#endif
 
@@ -0,0 +1,348 @@
+#include "cc1111rf.h"
+#include "cc1111_aes.h"
+#include "chipcon_dma.h"
+#include "global.h"
+#include "FHSS.h"
+#include "nic.h"
+#include "cc1111usb.h"
+
+#include <string.h>
+
+/*************************************************************************************************
+ * firmware microbenchmarks, built with "make bench" and run under ucsim's s51 by s51bench.py.   *
+ *                                                                                               *
+ * s51 is a plain 8052:  the chipcon registers are just memory there, so sim_hw_poll() stands in *
+ * for the radio, usb and aes cores wherever the firmware busy-waits on them (see SIM_HW_POLL).  *
+ * cycles are counted on the 8052's timer 0, which ticks once per s51 machine cycle and is held  *
+ * while sim_hw_poll() runs, so the numbers are firmware time only.  they're s51 cycles, not     *
+ * cc1111 clocks:  compare them with each other, not with a stopwatch.                           *
+ *                                                                                               *
+ * results go out the 8052 serial port, one "bench <name> <ops> <cycles> <min> <max> <ovf>" line *
+ * (hex) per benchmark, and "bench done" at the end.                                             *
+ *************************************************************************************************/
+
+// the 8052 bits s51 does model.  on the cc1111 these addresses are port interrupt and usart
+// registers, none of which the code under test touches.
+__sfr __at (0x89) SIM_TMOD;
+__sfr __at (0x8A) SIM_TL0;
+__sfr __at (0x8C) SIM_TH0;
+__sfr __at (0x8D) SIM_TH1;
+__sfr __at (0x98) SIM_SCON;
+__sfr __at (0x99) SIM_SBUF;
+__sbit __at (0x8C) SIM_TR0;
+__sbit __at (0x8D) SIM_TF0;
+__sbit __at (0x8E) SIM_TR1;
+__sbit __at (0x99) SIM_TI;
+
+#define BENCH_START()   do { SIM_TH0 = 0; SIM_TL0 = 0; SIM_TF0 = 0; SIM_TR0 = 1; } while (0)
+#define BENCH_STOP()    SIM_TR0 = 0
+#define BENCH_CYCLES()  (((u16)SIM_TH0 << 8) | SIM_TL0)
+
+#define BENCH_TX_LEN    32
+#define BENCH_AES_LEN   128
+
+// from appFHSSNIC.c
+void hopIntHandler(void);
+
+__xdata u16 benchOverhead;          // an empty BENCH_START()/BENCH_STOP()
+__xdata u16 benchMark;              // timer 0 when sim_hw_poll() saw the TX strobe
+__xdata u32 benchTotal;
+__xdata u16 benchMin, benchMax, benchOps;
+__xdata u8 benchOverflow;
+
+__xdata u8 benchBuf[BENCH_AES_LEN + 1];
+
+// called through a pointer:  the handlers end in RETI, which is a RET when no interrupt is live
+void (* __xdata benchIsr)(void);
+
+
+/*************************************************************************************************
+ * the hardware, as far as the code under test can tell                                          *
+ *************************************************************************************************/
+void sim_hw_poll(void)
+{
+    __bit running = SIM_TR0;
+
+    SIM_TR0 = 0;
+
+    // the radio goes wherever it was last strobed, and a transmit is over as soon as it's looked at
+    switch (RFST)
+    {
+        case RFST_STX:
+            if (MARCSTATE != MARC_STATE_TX)
+            {
+                benchMark = BENCH_CYCLES();
+                MARCSTATE = MARC_STATE_TX;
+            }
+            else
+            {
+                MARCSTATE = MARC_STATE_IDLE;
+                RFST = RFST_SNOP;
+            }
+            break;
+        case RFST_SRX:
+            MARCSTATE = MARC_STATE_RX;
+            break;
+        case RFST_SCAL:
+        case RFST_SIDLE:
+            MARCSTATE = MARC_STATE_IDLE;
+            break;
+    }
+
+    // dma and aes finish instantly, the host takes IN packets as soon as they're ready
+    DMAIRQ |= DMAARM & 0x1f;
+    DMAARM = 0;
+    ENCCS |= ENCCS_RDY;
+    USBCSIL &= ~USBCSIL_INPKT_RDY;
+
+    SIM_TR0 = running;
+}
+
+
+/*************************************************************************************************
+ * bookkeeping and output                                                                        *
+ *************************************************************************************************/
+void benchBegin(void)
+{
+    benchTotal = 0;
+    benchMin = 0xffff;
+    benchMax = 0;
+    benchOps = 0;
+    benchOverflow = 0;
+}
+
+// one timed run covering ops operations
+void benchAccount(__xdata u16 cycles, __xdata u8 ops)
+{
+    if (SIM_TF0)
+        benchOverflow = 1;
+    cycles -= benchOverhead;
+
+    benchTotal += cycles;
+    benchOps += ops;
+    if (cycles < benchMin)
+        benchMin = cycles;
+    if (cycles > benchMax)
+        benchMax = cycles;
+}
+
+void putch(char c)
+{
+    while (!SIM_TI)
+        ;
+    SIM_TI = 0;
+    SIM_SBUF = c;
+}
+
+void putstr(char* s)
+{
+    while (*s)
+        putch(*s++);
+}
+
+void puthex(__xdata u32 val)
+{
+    __xdata u8 shift = 32;
+
+    putch(' ');
+    do {
+        shift -= 4;
+        putch("0123456789abcdef"[(val >> shift) & 0xf]);
+    } while (shift);
+}
+
+void benchReport(char* name)
+{
+    putstr("bench ");
+    putstr(name);
+    puthex(benchOps);
+    puthex(benchTotal);
+    puthex(benchMin);
+    puthex(benchMax);
+    puthex(benchOverflow);
+    putstr("\r\n");
+}
+
+
+/*************************************************************************************************
+ * the benchmarks                                                                                *
+ *************************************************************************************************/
+// one byte in through the RFTXRX handler
+void benchRxIsr(void)
+{
+    __xdata u8 loop;
+
+    benchBegin();
+    rfRxInfMode = 0;
+    rfRxCurrentBuffer = 0;
+    rfRxCounter[0] = 0;
+    MARCSTATE = MARC_STATE_RX;
+    benchIsr = rfTxRxIntHandler;
+
+    for (loop = 0; loop < 64; loop++)
+    {
+        RFD = loop;
+        BENCH_START();
+        benchIsr();
+        BENCH_STOP();
+        benchAccount(BENCH_CYCLES(), 1);
+    }
+    benchReport("rx_isr_byte");
+}
+
+// ...and one out
+void benchTxIsr(void)
+{
+    __xdata u8 loop;
+
+    benchBegin();
+    rfTxInfMode = 0;
+    rfTxCurBufIdx = 0;
+    rfTxBufferEnd = sizeof(benchBuf);
+    rfTxCounter = 0;
+    rfTxTotalTXLen = 64;
+    rftxbuf = benchBuf;
+    MARCSTATE = MARC_STATE_TX;
+    benchIsr = rfTxRxIntHandler;
+
+    for (loop = 0; loop < 64; loop++)
+    {
+        BENCH_START();
+        benchIsr();
+        BENCH_STOP();
+        benchAccount(BENCH_CYCLES(), 1);
+    }
+    MARCSTATE = MARC_STATE_IDLE;
+    benchReport("tx_isr_byte");
+}
+
+// transmit() from the call to the TX strobe:  a variable length packet, so it shuffles for the
+// length byte too
+void benchTransmit(void)
+{
+    __xdata u8 loop, idx;
+
+    benchBegin();
+    PKTCTRL0 = (PKTCTRL0 & ~PKTCTRL0_LENGTH_CONFIG) | PKTCTRL0_LENGTH_CONFIG_VAR;
+    rfAESMode = AES_CRYPTO_NONE;
+
+    for (loop = 0; loop < 16; loop++)
+    {
+        for (idx = 0; idx < BENCH_TX_LEN; idx++)
+            benchBuf[idx] = idx;
+        RFST = RFST_SIDLE;
+        MARCSTATE = MARC_STATE_IDLE;
+
+        BENCH_START();
+        transmit(benchBuf, BENCH_TX_LEN, 0, 0);
+        BENCH_STOP();
+        benchAccount(benchMark, 1);
+    }
+    benchReport("transmit_setup_32");
+}
+
+// doAES() over several blocks, so the per-call setup is spread out
+void benchAES(void)
+{
+    __xdata u8 loop;
+
+    benchBegin();
+    for (loop = 0; loop < 8; loop++)
+    {
+        ENCCS |= ENCCS_RDY;
+        BENCH_START();
+        doAES(benchBuf, benchBuf, BENCH_AES_LEN, ENCCS_CMD_ENC, ENCCS_MODE_CBC);
+        BENCH_STOP();
+        benchAccount(BENCH_CYCLES(), BENCH_AES_LEN / 16);
+    }
+    benchReport("doAES_block");
+}
+
+// txdata() with everything in one frame, then with a message that takes four.  the rx buffer is
+// just somewhere big enough to send from
+void benchTxdata(__xdata u16 len, __xdata u8 frames, char* name)
+{
+    __xdata u8 loop;
+
+    benchBegin();
+    for (loop = 0; loop < 16; loop++)
+    {
+        USBINDEX = 5;
+        USBCSIL = 0;
+        BENCH_START();
+        txdata(APP_NIC, NIC_RECV, len, (__xdata u8*)rfrxbuf[0]);
+        BENCH_STOP();
+        benchAccount(BENCH_CYCLES(), frames);
+    }
+    benchReport(name);
+}
+
+// a hop, taken the way the hardware takes it:  T1 channel 1 compare into t1IntHandler
+void benchHop(void)
+{
+    __xdata u8 loop;
+
+    benchBegin();
+    memset(&hopdata, 0, sizeof(hopdata));
+    macdata.NumChannels = DEFAULT_NUM_CHANS;
+    macdata.NumChannelHops = DEFAULT_NUM_CHANHOPS;
+    macdata.curChanIdx = 0;
+    MAC_initChannels();
+    hop_set_dwell(FHSS_DEFAULT_DWELL_US, 0);
+    registerCb_t1ch1(hopIntHandler);
+    benchIsr = t1IntHandler;
+    RFST = RFST_SRX;
+    MARCSTATE = MARC_STATE_RX;
+
+    for (loop = 0; loop < 16; loop++)
+    {
+        // due right now, on a clock that isn't moving
+        clock = 0;
+        T1CNTL = 0;
+        T1CNTH = 0;
+        T1CTL = T1CTL_CH1IF;
+        hopdata.tNextHop = 0;
+
+        BENCH_START();
+        benchIsr();
+        BENCH_STOP();
+        benchAccount(BENCH_CYCLES(), 1);
+    }
+    registerCb_t1ch1(0);
+    benchReport("hop_t1isr");
+}
+
+
+void main (void)
+{
+    // the bits of initialization that don't wait on clocks that aren't there
+    initDMA();
+    initAES();
+    initUSB();
+    init_RF();
+
+    // timer 0 counts cycles, serial mode 1 off timer 1 for the results.  no interrupts, the
+    // handlers under test are called directly
+    EA = 0;
+    SIM_TMOD = 0x21;
+    SIM_TH1 = 0xff;
+    SIM_TR1 = 1;
+    SIM_SCON = 0x52;
+
+    BENCH_START();
+    BENCH_STOP();
+    benchOverhead = 0;
+    benchOverhead = BENCH_CYCLES();
+
+    benchRxIsr();
+    benchTxIsr();
+    benchTransmit();
+    benchAES();
+    benchTxdata(EP5IN_MAX_PACKET_SIZE - 5, 1, "txdata_frame");
+    benchTxdata(EP5IN_MAX_PACKET_SIZE * 4 - 5, 4, "txdata_frame_x4");
+    benchHop();
+
+    putstr("bench done\r\n");
+    while (1)
+        ;
+}
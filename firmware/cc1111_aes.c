@@ -46,7 +46,7 @@ void setAES(__xdata u8* __xdata buf, __xdata u8 command, __xdata u8 mode)
 {
     // wait for co-processor to be ready
     while(!(ENCCS & ENCCS_RDY))
-        ;
+        SIM_HW_POLL();
 
     // prepare DMA for transfer
     aesdmai->srcAddrH = (u8) ((u16) buf >> 8);
@@ -59,7 +59,7 @@ void setAES(__xdata u8* __xdata buf, __xdata u8 command, __xdata u8 mode)
 
     // wait for co-processor to finish
     while(!(ENCCS & ENCCS_RDY))
-        ;
+        SIM_HW_POLL();
 }
 
 // pad a buffer to multiple of 16 bytes. caller must ensure
@@ -91,7 +91,7 @@ void doAES(__xdata u8* __xdata inbuf, __xdata u8* __xdata outbuf, __xdata u16 le
 
     // wait for co-processor to be ready
     while(!(ENCCS & ENCCS_RDY))
-        ;
+        SIM_HW_POLL();
 
     for(bufp= 0 ; bufp < len ; bufp += 16)
     {
@@ -118,7 +118,7 @@ void doAES(__xdata u8* __xdata inbuf, __xdata u8* __xdata outbuf, __xdata u16 le
 
         // wait for co-processor to finish
         while(!(ENCCS & ENCCS_RDY))
-            ;
+            SIM_HW_POLL();
     }
 }
 
@@ -27,6 +27,7 @@ volatile __xdata u16 rfTxRepeatLen = 0;
 volatile __xdata u16 rfTxRepeatOffset = 0;
 volatile __xdata u16 rfTxTotalTXLen = 0;
 volatile __xdata u8 rfTxInfMode = 0;
+volatile __xdata u16 rfTxPktLen = 0;   // bytes the current transmit puts on the air, for stats.txBytes
 
 __xdata u16 txTotal; // debugger to confirm long transmit number of bytes tx'd
 
@@ -38,10 +39,13 @@ volatile __xdata u8 rfAESMode = AES_CRYPTO_NONE;
 // amplifier external to CC1111
 volatile __xdata u8 rfAmpMode = 0;
 
+volatile __xdata u8 rfConfigGen = 0;
+volatile __xdata u8 rfConfigGenSeen = 0;
+volatile __xdata u8 rfConfigNotified = 0;
+
 volatile u8 rfif;
 volatile __xdata u8 rf_status;
-volatile __xdata u16 rf_MAC_timer;
-volatile __xdata u16 rf_tLastRecv;
+volatile __xdata u32 rf_tLastRecv;
 #ifdef RFDMA
 volatile __xdata DMA_DESC rfDMA;
 #endif
@@ -62,18 +66,61 @@ void setFreq(u32 freq)
     FREQ2 = num >> 16;
     FREQ1 = (num>>8) & 0xff;
     FREQ0 = num & 0xff;
+    RF_CONFIG_CHANGED();
 }
 
 void resetRFSTATE(void)
 {
 	// like RFOFF but without changing amplifier configuration
-	RFST = RFST_SIDLE; while ((MARCSTATE) != MARC_STATE_IDLE);
+	RFST = RFST_SIDLE; while ((MARCSTATE) != MARC_STATE_IDLE) SIM_HW_POLL();
 
     RFST = rf_status;
     while (rf_status != RFST_SIDLE && MARCSTATE == MARC_STATE_IDLE)
         ;    
 }
 
+// calibrate the frequency synthesizer from IDLE.  unlike RFCAL, make sure calibration actually
+// started before waiting for IDLE again, the strobe takes a few cycles to show in MARCSTATE
+void rfCalibrate(void)
+{
+    __xdata u16 countdown = 1000;
+
+    RFST = RFST_SCAL;
+    while (MARCSTATE == MARC_STATE_IDLE && --countdown)
+        ;
+    // a calibration takes ~800us, don't hang the main loop if the radio never gets there
+    countdown = 0xffff;
+    while (MARCSTATE != MARC_STATE_IDLE && --countdown)
+        ;
+}
+
+// apply a batch of radio register writes with a single IDLE/calibrate cycle, then return to
+// rf_status.  regs holds (offset from 0xdf00, value) pairs, offsets that aren't configuration
+// registers are skipped.  returns the number of registers written.
+u8 setRFRegisters(__xdata u8* __xdata regs, __xdata u8 count)
+{
+    __xdata u8 applied = 0;
+
+    RFOFF;
+    while (count--)
+    {
+        if (regs[0] < RF_CFG_REG_COUNT)
+        {
+            *(__xdata u8*)(RF_CFG_REG_BASE + regs[0]) = regs[1];
+            applied++;
+        }
+        regs += 2;
+    }
+
+    // FS_AUTOCAL=01 (calibrate when going from IDLE to RX/TX) means the strobe back recalibrates
+    // anyway.  00 is manual, 10/11 only calibrate on the way back to IDLE, so do it here
+    if ((MCSM0 & 0x30) != 0x10)
+        rfCalibrate();
+
+    resetRFSTATE();
+    return applied;
+}
+
 // enter RX mode    (this is significant!  don't do lightly or quickly!)
 void RxMode(void)
 {
@@ -137,16 +184,16 @@ void init_RF(void)
     rfRxCounter[SECOND_BUFFER] = 0;
 
 
-    // setup TIMER 2  (MAC timer)
+    // setup TIMER 2
     // NOTE:
-    // !!! any changes to TICKSPD will change the calculation of MAC timer speed !!!
+    // !!! any changes to TICKSPD will change the calculation of T1 (clock / hop clock) speed !!!
     //
     // free running mode
     // time freq:
     //
     // TICKSPD = Fref (24mhz for cc1111, 26mhz for cc1110)
     //
-    // ********************* ALSO IN appFHSSNIC.c: init_FHSS()  **************************
+    // FHSS hopping no longer uses T2, see the T1 hop clock in appFHSSNIC.c
     CLKCON &= 0xc7;
 
     T2PR = 0;
@@ -219,6 +266,7 @@ u8 transmit(__xdata u8* __xdata buf, __xdata u16 len, __xdata u16 repeat, __xdat
 
     while (MARCSTATE == MARC_STATE_TX)
     {
+            SIM_HW_POLL();
             LED = ledMode & !LED;
 #ifdef USBDEVICE
             usbProcessEvents();
@@ -329,6 +377,14 @@ u8 transmit(__xdata u8* __xdata buf, __xdata u16 len, __xdata u16 repeat, __xdat
         }
     }
 
+    // what goes out on the air, counted when the radio says it's done
+    if (rfTxInfMode)
+        rfTxPktLen = rfTxTotalTXLen;
+    else if ((PKTCTRL0 & PKTCTRL0_LENGTH_CONFIG) == PKTCTRL0_LENGTH_CONFIG_VAR)
+        rfTxPktLen = buf[0] + 1;
+    else
+        rfTxPktLen = PKTLEN;
+
     // point tx buffer at userdata //
     rftxbuf = buf;
 
@@ -396,6 +452,7 @@ u8 transmit(__xdata u8* __xdata buf, __xdata u16 len, __xdata u16 repeat, __xdat
         countdown = 60000;
         while (MARCSTATE != MARC_STATE_TX && --countdown)
         {
+            SIM_HW_POLL();
             // FIXME: if we never end up in TX, why not?  seeing it in RX atm...  what's setting it there?  we can't have missed the whole tx!  we're not *that* slow!  although if other interrupts occurred?
             LED = ledMode & !LED;
 #ifdef USBDEVICE
@@ -411,6 +468,7 @@ u8 transmit(__xdata u8* __xdata buf, __xdata u16 len, __xdata u16 repeat, __xdat
 
         while (MARCSTATE == MARC_STATE_TX)
         {
+            SIM_HW_POLL();
             LED = ledMode & !LED;
 #ifndef IMME
             usbProcessEvents();
@@ -590,6 +648,7 @@ void rfTxRxIntHandler(void) __interrupt (RFTXRX_VECTOR)  // interrupt handler sh
                         // we should bail here, because the next buffer is empty, so we've had a usb buff fill underrun
                         macdata.mac_state = MAC_STATE_NONHOPPING;
                         lastCode[1] = LCE_DROPPED_PACKET;
+                        stats.txStarved++;
                         resetRFSTATE();
                         LED = 0;
                     }
@@ -622,6 +681,7 @@ void rfIntHandler(void) __interrupt (RF_VECTOR)  // interrupt handler should tri
     // which events trigger this interrupt is determined by RFIM (set in init_RF())
     // note: S1CON should be cleared before handling the RFIF flags.
     lastCode[0] = LC_RF_VECTOR;
+    stats.rfIsr++;
     S1CON &= ~(S1CON_RFIF_0 | S1CON_RFIF_1);
 
     // store the data from RFIF for main loop code to access and deal with.
@@ -630,8 +690,8 @@ void rfIntHandler(void) __interrupt (RF_VECTOR)  // interrupt handler should tri
     if (RFIF & RFIF_IRQ_SFD)
     {
         // mark the last time we received a packet.  this will be used for MAC layer decisions in 
-        // some protocols like FHSS
-        rf_tLastRecv = T2CT | (rf_MAC_timer << 8);
+        // some protocols like FHSS (drift correction of the hop clock)
+        T1_READ32(rf_tLastRecv);
         RFIF &= ~RFIF_IRQ_SFD;
     }
 
@@ -647,15 +707,24 @@ void rfIntHandler(void) __interrupt (RF_VECTOR)  // interrupt handler should tri
             DMAARM |= (0x80 | DMAARM0);
 #endif
             rfif &= ~( RFIF_IRQ_DONE | RFIF_IRQ_RXOVF | RFIF_IRQ_TIMEOUT );
+            if (RFIF & RFIF_IRQ_DONE)
+            {
+                stats.txPackets++;
+                stats.txBytes += rfTxPktLen;
+            }
         }
         else
         {
+            // byte counts are kept per packet, not in rfTxRxIntHandler()
+            if (RFIF & RFIF_IRQ_DONE)
+                stats.rxBytes += rfRxCounter[rfRxCurrentBuffer];
 
             // FIXME: rfRxCurrentBuffer is used for both recv and sending on.... this should be separate.
             if(rfRxProcessed[!rfRxCurrentBuffer] == RX_PROCESSED)
             {
                 // EXPECTED RESULT - RX complete.
                 //
+                stats.rxPackets++;
                 /* CRYPTO if required */
                 if(rfAESMode & AES_CRYPTO_IN_ENABLE)
                 {
@@ -690,6 +759,8 @@ void rfIntHandler(void) __interrupt (RF_VECTOR)  // interrupt handler should tri
                 // contingency - Packet Not Handled!
                 /* Main app didn't process previous packet yet, drop this one */
                 lastCode[1] = LCE_DROPPED_PACKET;
+                stats.rxPackets++;
+                stats.rxDropped++;
                 LED = ledMode & !LED;
                 rfRxCounter[rfRxCurrentBuffer] = 0;
                 LED = ledMode & !LED;
@@ -707,6 +778,7 @@ void rfIntHandler(void) __interrupt (RF_VECTOR)  // interrupt handler should tri
         // RX overflow, only way to get out of this is to restart receiver //
         //resetRf();
         lastCode[1] = LCE_RF_RXOVF;
+        stats.rxOverflows++;
         LED = ledMode & !LED;
 
         resetRFSTATE();
@@ -719,6 +791,7 @@ void rfIntHandler(void) __interrupt (RF_VECTOR)  // interrupt handler should tri
     {
         // Put radio into idle state //
         lastCode[1] = LCE_RF_TXUNF;
+        stats.txUnderflows++;
         LED = ledMode & !LED;
 
         resetRFSTATE();
@@ -128,6 +128,8 @@ int txdata(u8 app, u8 cmd, u16 len, __xdata u8* dataptr)      // assumed EP5 for
     USBINDEX=5;
 
     lastCode[0] = LC_TXDATA_START;
+    stats.usbInMsgs++;
+    stats.usbInBytes += len;
 
     while (firsttime || more_pkts)
     {
@@ -140,7 +142,9 @@ int txdata(u8 app, u8 cmd, u16 len, __xdata u8* dataptr)      // assumed EP5 for
         {
             //REALLYFASTBLINK();
             lastCode[1] = LCE_USB_EP5_TX_WHILE_INBUF_WRITTEN;
+            stats.usbInWaits++;
             loop--;
+            SIM_HW_POLL();
         }
         //LED = 0;    //FIXME: DEBUG
         
@@ -199,7 +203,8 @@ int txdata(u8 app, u8 cmd, u16 len, __xdata u8* dataptr)      // assumed EP5 for
         DMAARM |= usbdmaarm;
         DMAREQ |= usbdmaarm;
 
-        while (!(DMAIRQ & usbdmaarm));
+        while (!(DMAIRQ & usbdmaarm))
+            SIM_HW_POLL();
         DMAIRQ &= ~usbdmaarm;
         
         USBINDEX=5;
@@ -943,6 +948,7 @@ int handleOUTEP5(void)
         //USBCSOL |= USBCSOL_SEND_STALL;
         //blink(300,200);
         lastCode[1] = LCE_USB_EP5_OUT_WHILE_OUTBUF_WRITTEN;
+        stats.usbOutBusy++;
         return -1;
     }
 
@@ -1021,6 +1027,7 @@ int handleOUTEP5(void)
     {
         ep5.flags |= EP_OUTBUF_WRITTEN;                         // track that we've read into the OUTbuf
         ep5.OUTbytesleft = 0;
+        stats.usbOutMsgs++;
         USBINDEX = 5;
         usb_data.event &= ~USBD_OIF_OUTEP5IF;       // this indicates that we have more processing to do.  clear so we can reset in the interrupt handler...
         USBCSOL &= ~USBCSOL_OUTPKT_RDY;             // indicates to the USB controller that we're ready for another packet in the EP5 buffer
@@ -1036,6 +1043,7 @@ int handleOUTEP5(void)
 void processOUTEP5(void)
 {
     u16 loop;
+    __xdata u32 now;
     __xdata u8* __xdata  ptr; 
 
     // if the buffer is still being loaded or just plain empty, ignore this  (superfluous... may remove this check later)
@@ -1103,18 +1111,83 @@ void processOUTEP5(void)
                 txdata(ep5.OUTapp, ep5.OUTcmd, 2, (__xdata u8*)&(ep5.OUTbytesleft));
 
                 break;
+            case CMD_MEMOP:
+                // scatter-gather peek/poke: a list of reads and writes, run in order.
+                // the reply (everything read, back to back) is gathered into this same
+                // buffer: the request moves to the top first, so the reply can grow up
+                // from the bottom without catching it.  the host keeps request + reply
+                // within EP5OUT_BUFFER_SIZE
+                {
+                    __xdata u8* __xdata src;
+                    __xdata u8* __xdata dst;
+                    __xdata u8* __xdata mem;
+                    __xdata u8* __xdata end;
+                    u8 op;
+
+                    end = &ep5.OUTbuf[EP5OUT_BUFFER_SIZE];
+                    src = end - ep5.OUTlen;
+                    for (loop = ep5.OUTlen; loop > 0; loop--)      // top down, the two overlap
+                        src[loop - 1] = ptr[loop - 1];
+
+                    dst = ptr;
+                    while (src + 4 <= end)
+                    {
+                        op = *src++;
+                        loop =  *src++;
+                        loop += *src++ << 8;
+                        mem = (__xdata u8*) loop;
+                        loop = *src++;
+
+                        if (op == MEMOP_WRITE)
+                        {
+                            if (src + loop > end)
+                                break;
+                            for (; loop > 0; loop--)
+                                *mem++ = *src++;
+                        }
+                        else
+                        {
+                            for (; loop > 0; loop--)
+                                *dst++ = *mem++;
+                        }
+                    }
+
+                    txdata(ep5.OUTapp, ep5.OUTcmd, (u16)(dst - ptr), ptr);
+                }
+                break;
+
             case CMD_PING:
                 blink(2,2);
                 txdata(ep5.OUTapp,ep5.OUTcmd,ep5.OUTlen,ptr);
                 break;
 
             case CMD_STATUS:
-                txdata(ep5.OUTapp, ep5.OUTcmd, 13, (__xdata u8*)"UNIMPLEMENTED");
-                // unimplemented
+                // copy the counters out with interrupts off, so no u32 is caught half
+                // updated.  a nonzero first byte clears them (and the max loop time) after
+                {
+                    __xdata u8* __xdata src;
+                    u8 clear;
+
+                    clear = ep5.OUTlen && *ptr;
+                    T1_READ32(now);
+                    __critical {
+                        stats.clock = now;
+                        src = (__xdata u8*)&stats;
+                        for (loop = 0; loop < sizeof(stats_t); loop++)
+                            ptr[loop] = src[loop];
+                        if (clear)
+                            for (loop = 2; loop < sizeof(stats_t); loop++)
+                                src[loop] = 0;
+                    }
+                    txdata(ep5.OUTapp, ep5.OUTcmd, sizeof(stats_t), ptr);
+                }
                 break;
 
             case CMD_GET_CLOCK:
-                txdata(ep5.OUTapp, ep5.OUTcmd, 4, (__xdata u8*)clock);
+                // the full T1_READ32() clock, the same one hunt hits and rf_tLastRecv use,
+                // so the host can line this dongle's timestamps up with its own
+                T1_READ32(now);
+                txdata(ep5.OUTapp, ep5.OUTcmd, 4, (__xdata u8*)&now);
                 break;
 
             case CMD_BUILDTYPE:
@@ -1268,6 +1341,7 @@ void usbProcessEvents(void)
     {
         USBCSIL &= ~(USBCSIL_SEND_STALL | USBCSIL_SENT_STALL);
         lastCode[1] = LCE_USB_EP5_STALL;
+        stats.usbStalls++;
         ep5.INbytesleft = 0;
         ep5.OUTlen = 0;
         ep5.epstatus = EP_STATE_IDLE;          // not sure about this.  perhaps check to see if state us RX or TX?
@@ -1276,6 +1350,7 @@ void usbProcessEvents(void)
     {
         USBCSOL &= ~(USBCSOL_SEND_STALL | USBCSOL_SENT_STALL);
         lastCode[1] = LCE_USB_EP5_STALL;
+        stats.usbStalls++;
         ep5.INbytesleft = 0;
         ep5.OUTlen = 0;
         ep5.epstatus = EP_STATE_IDLE;          // not sure about this.  perhaps check to see if state us RX or TX?
@@ -1357,6 +1432,7 @@ void usbProcessEvents(void)
  ************************************************************************************************/
 void usbIntHandler(void) __interrupt (P2INT_VECTOR)
 {
+    stats.usbIsr++;
 
     while (!IS_XOSC_STABLE());
 
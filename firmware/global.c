@@ -3,10 +3,15 @@
 // used for debugging and tracing execution.  see client's ".getDebugCodes()"
 __xdata u8 lastCode[2];
 __xdata u32 clock;
+__xdata stats_t stats = {STATS_VERSION, sizeof(stats_t)};
+__xdata u16 statsLastLoop;
 
 // ENABLE/DISABLE LED(s)
 __xdata u8 ledMode = 1;
 
+// T1 channel 1 compare callback (eg. the FHSS hop scheduler)
+__xdata void (*cb_t1ch1)(void);
+
 void sleepMillis(int ms) 
 {
     int j;
@@ -211,8 +216,29 @@ void io_init(void)
 }
 
 
-void t1IntHandler(void) __interrupt (T1_VECTOR)  // interrupt handler should trigger on T1 overflow
+void registerCb_t1ch1(void (*callback)(void))
+{
+    cb_t1ch1 = callback;
+}
+
+void t1IntHandler(void) __interrupt (T1_VECTOR)  // interrupt handler should trigger on T1 overflow and channel 1 compare
 {   
-    clock ++;
+    stats.t1Isr++;
+
+    // overflow first, so anything reading T1_READ32() from the compare callback sees a sane clock
+    if (T1CTL & T1CTL_OVFIF)
+    {
+        __critical {
+            clock ++;
+            T1_CLEAR_IF(T1CTL_OVFIF);
+        }
+    }
+
+    if (T1CTL & T1CTL_CH1IF)
+    {
+        T1_CLEAR_IF(T1CTL_CH1IF);
+        if (cb_t1ch1)
+            cb_t1ch1();
+    }
 }
 
@@ -17,6 +17,10 @@
 #define FHSS_START_HOPPING      0x23
 #define FHSS_STOP_HOPPING       0x24
 #define FHSS_SET_MAC_PERIOD     0x25
+#define FHSS_GET_HOP_STATUS     0x26
+#define FHSS_GET_TX_STATS       0x27
+#define FHSS_SET_ACQ_PARAMS     0x28
+#define FHSS_GET_ACQ_STATUS     0x29
 
 #define MAC_STATE_NONHOPPING        0
 #define MAC_STATE_DISCOVERY         1
@@ -43,26 +47,176 @@
 #define MAC_STATE_PREP_SPECAN       0x40
 #define MAC_STATE_SPECAN            0x41
 
+// signal hunting:  sweep CHANNR 0..steps-1 with cached FSCAL values, report only the channels
+// where carrier-sense (or RSSI over threshold) trips.  hits go up on APP_SPECAN/HUNT_QUEUE
+#define HUNT_QUEUE                  0x2
+#define RFCAT_START_HUNT            0x42
+#define RFCAT_STOP_HUNT             0x43
+#define MAC_STATE_PREP_HUNT         0x42
+#define MAC_STATE_HUNT              0x43
+
+#define HUNT_MAX_STEPS              255
+#define HUNT_CS                     0x01    // trip on PKTSTATUS carrier-sense instead of RSSI
+#define HUNT_DEFAULT_SETTLE_US      300
+#define HUNT_HITS_OFFSET            (HUNT_MAX_STEPS * 3 + 3)    // FSCAL table first, then the hit batch (both in rfrxbuf)
+#define HUNT_MAX_HITS               ((BUFFER_AMOUNT * BUFFER_SIZE - HUNT_HITS_OFFSET) / sizeof(HUNT_HIT_t))
+
+typedef struct HUNT_HIT_s
+{
+    u8  chan;
+    u8  rssi;                       // raw RSSI register
+    u8  pktstatus;
+    u32 timestamp;                  // T1_READ32() when the channel was sampled
+} HUNT_HIT_t;
+
+typedef struct HUNT_DATA_s
+{
+    u8  steps;
+    u8  rssiThresh;                 // compared against RSSI ^ 0x80 so it's unsigned:  (dBm + 88) * 2
+    u8  flags;                      // HUNT_*
+    u16 settleTicks;                // RX settle time per step before sampling
+    u32 sweeps;
+    u32 hits;
+    u32 sweepTicks;                 // duration of the last sweep
+} HUNT_DATA_t;
+
+extern __xdata HUNT_DATA_t huntdata;
+
 
 // MAC layer defines
 #define MAX_CHANNELS                880
 #define MAX_TX_MSGS                 2
 #define MAX_TX_MSGLEN               240   // must match RF_MAX_TX_CHUNK in rflib/chipcon_nic.py
                                           // and be divisible by 16 for crypto operations
-#define MAX_SYNC_WAIT               10    //seconds... need to true up with T1/clock
 
-#define MAC_TIMER_STATIC_DIFF   6
 #define FHSS_TX_SLEEP_DELAY     25
 
 #define DEFAULT_NUM_CHANS       83
 #define DEFAULT_NUM_CHANHOPS    83
 
-void begin_hopping(__xdata u8 T2_offset);
+// hop clock.  hops are scheduled on T1 channel 1 compare against the 32-bit T1_READ32() clock
+// one tick is 128/Fref:  5.33us on cc1111, 4.92us on cc1110
+#define HOP_US_TO_TICKS(us)         (((u32)(us) * PLATFORM_CLOCK_FREQ) >> 7)
+#define HOP_US_TO_TICKS_Q8(us)      ((u32)(us) * (PLATFORM_CLOCK_FREQ * 2))     // 8 fractional bits
+
+#define FHSS_DEFAULT_DWELL_US       150000
+#define FHSS_MIN_DWELL_US           2000
+#define FHSS_MAX_DWELL_US           60000000
+
+#define HOP_MIN_LEAD_TICKS          8   // never arm the compare closer than this to "now"
+#define HOP_PLL_KP_SHIFT            1   // phase:  remove 1/2 of each measured error immediately
+#define HOP_PLL_KI_SHIFT            4   // freq:   fold 1/16 of each error into the dwell length
+#define HOP_PLL_MAX_DRIFT_SHIFT     10  // limit the dwell correction to ~1000ppm of nominal
+
+typedef struct HOP_DATA_s
+{
+    u32 dwellUs;                    // dwell as requested by the host
+    u32 nominalQ8;                  // dwell in T1 ticks (8 fractional bits) as requested
+    u32 dwellQ8;                    // dwell actually used:  nominalQ8 + driftQ8
+    s32 driftQ8;                    // integrated frequency correction
+    u32 syncOffset;                 // fixed ticks between the SFD time a beacon implies and the one we see
+    u32 tLastHop;                   // hop clock time the current dwell began
+    u32 tNextHop;                   // hop clock time the next dwell begins (T1CC1 holds the low word)
+    u32 tLastSync;                  // SFD time of the last beacon used for correction
+    u32 hopCount;
+    s16 phaseErr;                   // last measured phase error, in ticks (+ means we hop early)
+    u16 maxPhaseErr;                // worst |phaseErr| since the last (re)sync
+    u16 syncCount;                  // beacons used for correction since the last (re)sync
+    u16 lateHops;                   // slots skipped because the hop interrupt was held off
+    u8  frac;                       // fractional tick carried between dwells
+} HOP_DATA_t;
+
+extern __xdata HOP_DATA_t hopdata;
+
+// TX slot scheduler.  queued frames go out from the main loop, packed into each dwell between
+// a lead-in (give listeners time to retune) and a tail guard before the next hop
+#define FHSS_TX_TAIL_US             500
+#define FHSS_TX_OVERHEAD_BYTES      12  // preamble + sync + length + crc, before we've measured anything
+#define FHSS_TX_SETTLE_US           800 // IDLE->TX calibration and turnaround
+#define TX_SLOT_HIST                4   // slots carrying 0, 1, 2, 3+ frames
+
+typedef struct TX_SCHED_s
+{
+    u32 slots;                      // dwells seen by the scheduler
+    u32 framesSent;
+    u32 deferred;                   // dwells that ended with a frame still waiting because it didn't fit
+    u32 oversize;                   // frames longer than a whole dwell (sent at the top of a dwell anyway)
+    u32 busyTicks;                  // total measured on-air time
+    u32 byteTicksQ4;                // estimated on-air ticks per byte (4 fractional bits), from the data rate
+    u16 frameTicks;                 // per-frame overhead, learned from measured transmits
+    u16 leadTicks;
+    u16 tailTicks;
+    u16 lastSlotBusy;               // on-air ticks in the previous dwell
+    u16 maxSlotBusy;
+    u8  slotFrames;                 // frames sent in the current dwell
+    u8  maxSlotFrames;
+    u16 slotHist[TX_SLOT_HIST];
+    // private
+    u32 curSlot;                    // hopCount of the dwell slotFrames/slotBusy belong to
+    u16 slotBusy;
+    u8  slotFlags;
+} TX_SCHED_t;
+
+#define TXS_BEACONED                0x01
+#define TXS_DEFERRED                0x02
+
+extern __xdata TX_SCHED_t txsched;
+
+// acquisition.  a SYNCHING node sniffs one candidate channel at a time for a beacon from the cell
+// it's looking for, walking the hop pattern backwards so it closes on the master two hops per dwell
+#define HOP_MS_TO_TICKS(ms)         (((u32)(ms) * (PLATFORM_CLOCK_FREQ * 125)) >> 4)
+#define FHSS_ACQ_DEFAULT_SNIFF_MS   150
+#define FHSS_ACQ_DEFAULT_TIMEOUT_MS 30000
+#define FHSS_ACQ_MAX_MS             1000000     // keeps HOP_MS_TO_TICKS() inside 32 bits
+
+#define ACQ_IDLE                    0
+#define ACQ_SEARCHING               1
+#define ACQ_LOCKED                  2
+#define ACQ_TIMEOUT                 3
+
+typedef struct ACQ_DATA_s
+{
+    u32 sniffMs;                    // how long to listen on each candidate channel
+    u32 timeoutMs;                  // give up and go back to NONHOPPING after this long
+    u32 tStart;
+    u32 tWindow;                    // when the current sniff window opened
+    u32 acqTicks;                   // start of the search to the SFD of the beacon we locked on
+    u16 chanIdx;                    // candidate hop index being sniffed
+    u16 channelsTried;
+    u16 framesHeard;                // frames received while searching
+    u16 beaconsRejected;            // beacons from other cells or with a different pattern length
+    u16 cellID;                     // cell we locked on
+    u8  result;                     // ACQ_*
+} ACQ_DATA_t;
+
+extern __xdata ACQ_DATA_t acqdata;
+
+// the SYNCINGMASTER beacon.  chanIdx stays first so older listeners still find the hop index
+#define FHSS_BEACON_MAGIC           "BLAH"
+
+typedef struct FHSS_BEACON_s
+{
+    u16 chanIdx;                    // hop index of the dwell the beacon went out in
+    u8  magic[4];
+    u16 cellID;                     // g_NIC_ID of the master
+    u16 numChanHops;
+    u32 phase;                      // ticks from the start of the master's dwell to the start of this transmit
+} FHSS_BEACON_t;
+
+void begin_hopping(__xdata u32 T1_offset);
 void stop_hopping(void);
+u8 hop_set_dwell(__xdata u32 dwell_us, __xdata u32 sync_offset_us);
+void MAC_sync_correct(__xdata u32 tSFD, __xdata u32 phase);
+void MAC_tx_sched_reset(void);
+void MAC_tx_sched_calibrate(void);
+void MAC_tx_slot(void);
+void MAC_acq_start(void);
+void MAC_acq_poll(void);
 
 void PHY_set_channel(__xdata u16 chan);
 void MAC_initChannels(void);
 void MAC_sync(__xdata u16 netID);
+void MAC_stop_sync(void);
 void MAC_set_chanidx(__xdata u16 chanidx);
 u8 MAC_tx(__xdata u8* __xdata  message, __xdata u8 len);
 void MAC_rx_handle(__xdata u8 len, __xdata u8* __xdata  message);
@@ -71,15 +71,23 @@ extern volatile __xdata u16 rfTxBufferEnd;
 extern volatile __xdata u16 rfTxRepeatLen;
 extern volatile __xdata u16 rfTxRepeatOffset;
 extern volatile __xdata u16 rfTxTotalTXLen;
+extern volatile __xdata u16 rfTxPktLen;
 extern volatile __xdata u8 rfTxInfMode;
 
-extern volatile __xdata u16 rf_MAC_timer;
-extern volatile __xdata u16 rf_tLastRecv;
+extern volatile __xdata u32 rf_tLastRecv;     // T1_READ32() time of the last SFD
 
 // AES
 extern volatile __xdata u8 rfAESMode;
 
 extern volatile __xdata u8 rfAmpMode;
+
+// radio config generation, bumped whenever the firmware changes config registers on its own
+// (hopping, specan, large receive...).  the host keeps a copy of the register block and is
+// told once it goes stale, see NIC_GET_RF_CONFIG and NIC_RF_CONFIG_STALE
+extern volatile __xdata u8 rfConfigGen;
+extern volatile __xdata u8 rfConfigGenSeen;     // generation the host last read
+extern volatile __xdata u8 rfConfigNotified;    // host has been told since then
+#define RF_CONFIG_CHANGED()     rfConfigGen++
 extern __xdata u16 txTotal; // debugger
 
 extern volatile u8 rfif;
@@ -101,22 +109,22 @@ void IdleMode(void);        // set defaults to return to IDLE and calls RFOFF
 #define SET_TX_AMP do { TX_AMP_EN = rfAmpMode; RX_AMP_EN = 0; AMP_BYPASS_EN = rfAmpMode^1; } while (0)
 #define SET_RX_AMP do { TX_AMP_EN = 0; RX_AMP_EN = rfAmpMode; AMP_BYPASS_EN = rfAmpMode^1; } while (0)
 // set RF mode to RX and wait until MARCSTATE shows it's there
-#define RFTX do { SET_TX_AMP; RFST = RFST_STX; while ((MARCSTATE) != MARC_STATE_TX); } while (0)
+#define RFTX do { SET_TX_AMP; RFST = RFST_STX; while ((MARCSTATE) != MARC_STATE_TX) SIM_HW_POLL(); } while (0)
 // set RF mode to TX and wait until MARCSTATE shows it's there
-#define RFRX do { SET_RX_AMP; RFST = RFST_SRX; while ((MARCSTATE) != MARC_STATE_RX); } while (0)
+#define RFRX do { SET_RX_AMP; RFST = RFST_SRX; while ((MARCSTATE) != MARC_STATE_RX) SIM_HW_POLL(); } while (0)
 // set RF mode to CAL and wait until MARCSTATE shows it's done (in IDLE)
-#define RFCAL do { SET_AMP_OFF; RFST=RFST_SCAL; while ((MARCSTATE) != MARC_STATE_IDLE); } while (0)
+#define RFCAL do { SET_AMP_OFF; RFST=RFST_SCAL; while ((MARCSTATE) != MARC_STATE_IDLE) SIM_HW_POLL(); } while (0)
 // set RF mode to IDLE and wait until MARCSTATE shows it's there
-#define RFOFF do { SET_AMP_OFF; RFST=RFST_SIDLE; while ((MARCSTATE) != MARC_STATE_IDLE); } while (0)
+#define RFOFF do { SET_AMP_OFF; RFST=RFST_SIDLE; while ((MARCSTATE) != MARC_STATE_IDLE) SIM_HW_POLL(); } while (0)
 #else
 // set RF mode to RX and wait until MARCSTATE shows it's there
-#define RFTX do { RFST = RFST_STX; while ((MARCSTATE) != MARC_STATE_TX); } while (0)
+#define RFTX do { RFST = RFST_STX; while ((MARCSTATE) != MARC_STATE_TX) SIM_HW_POLL(); } while (0)
 // set RF mode to TX and wait until MARCSTATE shows it's there
-#define RFRX do { RFST = RFST_SRX; while ((MARCSTATE) != MARC_STATE_RX); } while (0)
+#define RFRX do { RFST = RFST_SRX; while ((MARCSTATE) != MARC_STATE_RX) SIM_HW_POLL(); } while (0)
 // set RF mode to CAL and wait until MARCSTATE shows it's done (in IDLE)
-#define RFCAL do { RFST = RFST_SCAL; while ((MARCSTATE) != MARC_STATE_IDLE); } while (0)
+#define RFCAL do { RFST = RFST_SCAL; while ((MARCSTATE) != MARC_STATE_IDLE) SIM_HW_POLL(); } while (0)
 // set RF mode to IDLE and wait until MARCSTATE shows it's there
-#define RFOFF do { RFST = RFST_SIDLE; while ((MARCSTATE) != MARC_STATE_IDLE); } while (0)
+#define RFOFF do { RFST = RFST_SIDLE; while ((MARCSTATE) != MARC_STATE_IDLE) SIM_HW_POLL(); } while (0)
 #endif
 
 
@@ -128,13 +136,21 @@ void init_RF(void);
 void byte_shuffle(__xdata u8* __xdata buf, __xdata u16 len, __xdata u16 offset);
 void startRX(void);
 void resetRFSTATE(void);
+void rfCalibrate(void);
+u8 setRFRegisters(__xdata u8* __xdata regs, __xdata u8 count);
+
+// radio configuration registers that may be written as a batch (SYNC1 0xdf00 .. IOCFG0 0xdf31)
+#define RF_CFG_REG_BASE         0xdf00
+#define RF_CFG_REG_COUNT        0x32
+// the whole block the host reads: config registers, then the status registers up to VCO_VC_DAC
+#define RF_CFG_BLOCK_LEN        0x3e
 
 typedef struct MAC_DATA_s 
 {
     u8 mac_state;
     // MAC parameters (FIXME: make this all cc1111fhssmac.c/h?)
-    u16 MAC_threshold;              // when the T2 clock as overflowed this many times, change channel
-    u16 MAC_timer;                  // this tracks how many times it's overflowed (really?  32-bits for these two?!?)
+    u16 MAC_threshold;              // unused since hopping moved to the T1 hop clock (see HOP_DATA_t in FHSS.h)
+    u16 MAC_timer;                  // low 16 bits of the hop count
     u16 NumChannels;                // in case of multiple paths through the available channels 
     u16 NumChannelHops;             // total number of channels in pattern (>= g_MaxChannels)
     u16 curChanIdx;                 // indicates current channel index of the hopping pattern
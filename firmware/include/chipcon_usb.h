@@ -411,8 +411,13 @@ void appReturn(__xdata u8 len, __xdata u8* __xdata  response);
 #define     CMD_RESET       0x8f
 #define     CMD_CLEAR_CODES 0x90
 #define     CMD_DEVICE_SERIAL_NUMBER 0x91
+#define     CMD_MEMOP       0x92
 #define     CMD_LEDMODE	    0x93
 
+// CMD_MEMOP ops:  u8 op, u16 addr, u8 len (then len bytes, for a write)
+#define     MEMOP_READ      0x00
+#define     MEMOP_WRITE     0x01
+
 #define     EP0_CMD_GET_DEBUG_CODES         0x00
 #define     EP0_CMD_GET_ADDRESS             0x01
 #define     EP0_CMD_POKEX                   0x01
@@ -20,6 +20,59 @@
 extern __xdata u8 lastCode[2];
 extern __xdata u32 clock;
 
+// performance counters.  bumped where things happen (ISRs included), and copied out whole
+// with interrupts off by CMD_STATUS, see the client's ".getStats()".  the layout is
+// STATS_FMT in rflib/const.py: only ever add fields at the end, and bump STATS_VERSION
+#define STATS_VERSION                   1
+typedef struct {
+    u8  version;
+    u8  size;               // sizeof(stats_t), so older clients can read newer blocks
+    u32 clock;              // T1_READ32() when CMD_STATUS copied the block
+    u32 rxPackets;          // packets the radio finished receiving
+    u32 rxDelivered;        // ...and handed to the host
+    u32 rxDropped;          // ...lost because the last one wasn't processed yet
+    u32 rxBytes;            // added up per packet, when the radio's done with it
+    u32 txPackets;
+    u32 txBytes;            // ditto
+    u16 rxOverflows;        // RXOVF
+    u16 txUnderflows;       // TXUNF
+    u16 txStarved;          // infinite-mode TX found the next buffer empty
+    u32 usbInMsgs;          // txdata() messages
+    u32 usbInBytes;
+    u32 usbInWaits;         // spins waiting for the host to take the last IN packet
+    u32 usbOutMsgs;
+    u16 usbOutBusy;         // OUT data arrived while the last command was still pending
+    u16 usbStalls;
+    u32 rfIsr;
+    u32 usbIsr;
+    u32 t1Isr;
+    u32 loops;              // main loop iterations
+    u16 maxLoopTicks;       // longest main loop iteration since reset, T1 ticks
+} stats_t;
+
+extern __xdata stats_t stats;
+extern __xdata u16 statsLastLoop;
+
+// once per main loop iteration
+#define STATS_LOOP_MARK()                                               \
+    do {                                                                \
+        u16 _now = T1CNTL;                                              \
+        _now |= (u16)T1CNTH << 8;                                       \
+        if ((u16)(_now - statsLastLoop) > stats.maxLoopTicks)           \
+            stats.maxLoopTicks = _now - statsLastLoop;                  \
+        statsLastLoop = _now;                                           \
+        stats.loops++;                                                  \
+    } while (0)
+
+// "make bench" runs the firmware under ucsim's s51, which has no radio, usb or aes core.  busy-waits
+// on those call SIM_HW_POLL() so bench.c can play the hardware's part.  it's nothing otherwise.
+#ifdef BENCHMARK
+void sim_hw_poll(void);
+#define SIM_HW_POLL()   sim_hw_poll()
+#else
+#define SIM_HW_POLL()
+#endif
+
 extern __xdata u8 ledMode;
 
 //////////////  DEBUG   //////////////
@@ -71,6 +124,7 @@ extern __xdata u8 ledMode;
 #define RC_TX_ERROR                             0xed
 #define RC_RF_BLOCKSIZE_INCOMPAT                0xee
 #define RC_RF_MODE_INCOMPAT                     0xef
+#define RC_ERR_BAD_ARG                          0xfd
 #define RC_ERR_BUFFER_NOT_AVAILABLE             0xfe
 #define RC_ERR_BUFFER_SIZE_EXCEEDED             0xff
 
@@ -195,10 +249,32 @@ void p0IntHandler(void) __interrupt (P0INT_VECTOR);
 #define QUOTE(x) XQUOTE(x)
 #define XQUOTE(x) #x
 
+// T1CTL's interrupt flags are R/W0 and hardware may raise any of them at any moment, so a read-modify-write
+// '&= ~flag' can write back a 0 over one raised in between (and lose a clock wrap).  write 1s to the others.
+#define T1CTL_IF_ALL    (T1CTL_CH2IF | T1CTL_CH1IF | T1CTL_CH0IF | T1CTL_OVFIF)
+#define T1_CLEAR_IF(flag)   (T1CTL = (T1CTL | T1CTL_IF_ALL) & ~(flag))
+
+// 32-bit virtual timer built from T1:  overflow count (clock) in the high word, T1CNT in the low.
+// T1 runs at Fref/128 (187.5kHz on cc1111, 203.125kHz on cc1110) so this wraps every ~6 hours.
+// reading T1CNTL latches T1CNTH.  an overflow not yet counted by t1IntHandler is accounted for.
+#define T1_READ32(dst)                                                  \
+    do {                                                                \
+        u8 _t1l, _t1h;                                                  \
+        __critical {                                                    \
+            _t1l = T1CNTL;                                              \
+            _t1h = T1CNTH;                                              \
+            (dst) = clock;                                              \
+            if ((T1CTL & T1CTL_OVFIF) && !(_t1h & 0x80))                \
+                (dst)++;                                                \
+        }                                                               \
+        (dst) = ((dst) << 16) | ((u16)_t1h << 8) | _t1l;                \
+    } while (0)
+
 /* function declarations */
 void sleepMillis(int ms);
 void sleepMicros(int us);
-void t1IntHandler(void) __interrupt (T1_VECTOR);  // interrupt handler should trigger on T1 overflow
+void t1IntHandler(void) __interrupt (T1_VECTOR);  // interrupt handler should trigger on T1 overflow and channel 1 compare
+void registerCb_t1ch1(void (*callback)(void));    // called from t1IntHandler on T1 channel 1 compare
 void clock_init(void);
 void io_init(void);
 //void blink(u16 on_cycles, u16 off_cycles);
@@ -17,5 +17,10 @@
 
 #define NIC_LONG_XMIT           0xc
 #define NIC_LONG_XMIT_MORE      0xd
+#define NIC_SET_RF_REGS         0xe
+#define NIC_GET_RF_CONFIG       0xf
+
+// sent unsolicited by the dongle
+#define NIC_RF_CONFIG_STALE     0x30
 #endif
 
@@ -6,5 +6,7 @@
 #define uint8 unsigned char
 #define uint16 unsigned int
 #define u32 unsigned long
+#define s16 signed int
+#define s32 signed long
 
 #endif
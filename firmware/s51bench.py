@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+'''
+run the firmware microbenchmarks (bench.c, "make bench") under ucsim's s51 and print cycles
+per operation, next to a saved baseline if there is one.
+
+    s51bench.py bench.ihx [baseline]            compare, exit 1 on a regression
+    s51bench.py --save baseline bench.ihx       run and write a new baseline
+
+S51 and S51FLAGS in the environment pick the simulator and its options.
+'''
+from __future__ import print_function
+import os
+import sys
+import time
+import shlex
+import tempfile
+import argparse
+import subprocess
+
+S51 = os.environ.get('S51', 's51')
+S51FLAGS = os.environ.get('S51FLAGS', '-t 8052')
+
+
+def run(ihx, timeout=300):
+    '''
+    run bench.ihx to "bench done" and return {name: (ops, cycles, min, max, overflow)} in the
+    order the firmware ran them
+    '''
+    out = tempfile.NamedTemporaryFile(prefix='s51bench', delete=False)
+    out.close()
+    cmd = [S51] + shlex.split(S51FLAGS) + ['-g', '-S', 'in=/dev/null,out=%s' % out.name, ihx]
+    sim = subprocess.Popen(cmd, stdin=subprocess.PIPE, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+    # the firmware spins forever when it's done, so watch the serial output rather than wait
+    start = time.time()
+    text = ''
+    try:
+        while 'bench done' not in text:
+            if sim.poll() is not None:
+                raise Exception("%s exited (%d) before the benchmarks finished" % (S51, sim.returncode))
+            if time.time() - start > timeout:
+                raise Exception("benchmarks didn't finish in %ds" % timeout)
+            time.sleep(.2)
+            with open(out.name) as f:
+                text = f.read()
+    finally:
+        if sim.poll() is None:
+            sim.kill()
+            sim.wait()
+        os.unlink(out.name)
+
+    return parse(text)
+
+
+def parse(text):
+    results = {}
+    order = []
+    for line in text.splitlines():
+        parts = line.split()
+        if len(parts) != 7 or parts[0] != 'bench':
+            continue
+        results[parts[1]] = tuple(int(x, 16) for x in parts[2:])
+        order.append(parts[1])
+    results['__order__'] = order
+    return results
+
+
+def perOp(result):
+    ops, cycles = result[:2]
+    if not ops:
+        return 0
+    return cycles / float(ops)
+
+
+def report(results, baseline=None, threshold=5.0):
+    '''
+    print the table.  returns the names that got more than threshold percent slower
+    '''
+    regressed = []
+    print("%-20s %6s %12s %8s %8s %12s %8s" % ('benchmark', 'ops', 'cycles/op', 'min', 'max', 'baseline', 'change'))
+    for name in results['__order__']:
+        ops, cycles, lo, hi, overflow = results[name]
+        line = "%-20s %6d %12.1f %8d %8d" % (name, ops, perOp(results[name]), lo, hi)
+
+        if baseline and name in baseline:
+            old = perOp(baseline[name])
+            change = (perOp(results[name]) - old) * 100 / old if old else 0
+            flag = ''
+            if change > threshold:
+                regressed.append(name)
+                flag = '  <--'
+            line += " %12.1f %+7.1f%%%s" % (old, change, flag)
+
+        if overflow:
+            line += '  (timer 0 overflowed, numbers are low)'
+        print(line)
+    return regressed
+
+
+def main():
+    parser = argparse.ArgumentParser(description='run the firmware benchmarks under s51')
+    parser.add_argument('ihx')
+    parser.add_argument('baseline', nargs='?')
+    parser.add_argument('--save', metavar='BASELINE', help='write the results out as a new baseline')
+    parser.add_argument('--threshold', type=float, default=5.0, help='percent slower that counts as a regression')
+    parser.add_argument('--timeout', type=int, default=300)
+    args = parser.parse_args()
+
+    results = run(args.ihx, args.timeout)
+
+    if args.save:
+        with open(args.save, 'w') as f:
+            for name in results['__order__']:
+                f.write("bench %s %s\n" % (name, ' '.join('%x' % x for x in results[name])))
+        report(results)
+        print("baseline saved to %s" % args.save)
+        return 0
+
+    baseline = None
+    if args.baseline and os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            baseline = parse(f.read())
+
+    regressed = report(results, baseline, args.threshold)
+    if regressed:
+        print("\nslower than the baseline: %s" % ', '.join(regressed))
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
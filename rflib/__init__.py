@@ -10,10 +10,34 @@ import rflib.bits as rfbits
 
 RFCAT_START_SPECAN  = 0x40
 RFCAT_STOP_SPECAN   = 0x41
+RFCAT_START_HUNT    = 0x42
+RFCAT_STOP_HUNT     = 0x43
+HUNT_QUEUE          = 0x2
+HUNT_CS             = 0x1
+
+HUNT_HIT_FMT        = "<BBBI"
+HUNT_HIT_LEN        = struct.calcsize(HUNT_HIT_FMT)
+
+def parseHuntHits(data, basefreq, chanspc, mhz=24):
+    '''
+    decode a batch of hunt hits from the dongle into (freq, rssi_dBm, timestamp_secs, carriersense)
+    tuples.  the timestamp is the dongle's T1-based clock.
+    '''
+    hits = []
+    for off in range(0, len(data) - HUNT_HIT_LEN + 1, HUNT_HIT_LEN):
+        chan, rssi, pktstatus, ts = struct.unpack(HUNT_HIT_FMT, data[off:off+HUNT_HIT_LEN])
+        freq = basefreq + (chan * chanspc)
+        dbm = ((rssi ^ 0x80) / 2.0) - 88
+        hits.append((freq, dbm, ts * 128.0 / (mhz * 1e6), bool(pktstatus & 0x40)))
+    return hits
 
 MAX_FREQ = 936e6
 
 class RfCat(FHSSNIC):
+    # specan and hunt retune the radio from the firmware
+    _rfcfg_changing = FHSSNIC._rfcfg_changing | frozenset((RFCAT_START_SPECAN, RFCAT_STOP_SPECAN,
+                                                           RFCAT_START_HUNT, RFCAT_STOP_HUNT))
+
     def RFdump(self, msg="Receiving", maxnum=100, timeoutms=1000):
         try:
             for x in range(maxnum):
@@ -25,6 +49,7 @@ class RfCat(FHSSNIC):
     def scan(self, basefreq=902e6, inc=250e3, count=104, delaysec=2, drate=38400, lowball=1):
         '''
         scan for signal over a range of frequencies
+        (to split a range across several dongles, see rflib.donglepool.DonglePool.bandScan())
         '''
         self.RFdump("Clearing")
         self.lowball(lowball)
@@ -45,6 +70,73 @@ class RfCat(FHSSNIC):
         sys.stdin.read(1)
         self.lowballRestore()
 
+    def hunt(self, basefreq=902e6, inc=250e3, count=104, rssi=-80, settle_us=300, carriersense=False, duration=None):
+        '''
+        hunt for transmitters across count channels starting at basefreq.
+        unlike scan(), the sweep runs on the dongle with cached calibration, so a full pass
+        takes about count * settle_us.  only channels with RSSI >= rssi (dBm) are reported, or
+        with carriersense=True, channels where the radio's carrier-sense trips.
+
+        runs until Enter is pressed, or for duration seconds.  returns the list of hits as
+        (freq, rssi_dBm, dongle_time, carriersense) tuples
+        '''
+        basefreq, chanspc = self._doHunt(basefreq, inc, count, rssi, settle_us, carriersense)
+        allhits = []
+        starttime = time.time()
+        try:
+            while not keystop():
+                if duration is not None and (time.time() - starttime) > duration:
+                    break
+                try:
+                    data, ts = self.recv(APP_SPECAN, HUNT_QUEUE, 100)
+                except ChipconUsbTimeoutException:
+                    continue
+
+                for hit in parseHuntHits(data, basefreq, chanspc):
+                    allhits.append(hit)
+                    if duration is None:
+                        print("(%10.6f) %3.6f MHz:  %4.1f dBm%s" % (hit[2], hit[0]/1e6, hit[1], ('',' (CS)')[hit[3]]))
+        except KeyboardInterrupt:
+            print("Please press <enter> to stop")
+
+        self._stopHunt()
+        return allhits
+
+    def _doHunt(self, basefreq, inc, count, rssi=-80, settle_us=300, carriersense=False):
+        '''
+        store radio config and start the on-dongle hunt sweep
+        '''
+        if count > 255:
+            raise Exception("sorry, only 255 steps per sweep... (count)")
+        if count < 1:
+            raise Exception("sorry, need at least one step per sweep... (count)")
+        if (count * inc) + basefreq > MAX_FREQ:
+            raise Exception("Sorry, %1.3f + (%1.3f * %1.3f) is higher than %1.3f" %
+                    (basefreq, count, inc, MAX_FREQ))
+
+        self.getRadioConfig()
+        self._hunt_backup_radiocfg = self.radiocfg
+
+        self.setFreq(basefreq)
+        self.setMdmChanSpc(inc)
+        self.setChannel(0)
+
+        freq, fbytes = self.getFreq()
+        delta = self.getMdmChanSpc()
+
+        thresh = min(max(int((rssi + 88) * 2), 0), 255)
+        flags = (0, HUNT_CS)[bool(carriersense)]
+        self.send(APP_NIC, RFCAT_START_HUNT, struct.pack("<BBBH", count, thresh, flags, settle_us))
+        return freq, delta
+
+    def _stopHunt(self):
+        '''
+        stop the hunt sweep and return radio to original config
+        '''
+        self.send(APP_NIC, RFCAT_STOP_HUNT, b'')
+        self.radiocfg = self._hunt_backup_radiocfg
+        self.setRadioConfig()
+
     def specan(self, centfreq=915e6, inc=250e3, count=104):
         '''
         Enter Spectrum Analyzer mode.
@@ -0,0 +1,724 @@
+/*
+ * _bitkern.c - native versions of the kernels in rflib/bitkern.py
+ *
+ * rflib.bitkern imports these over its pure-Python versions when this
+ * extension is built.  results must match the Python code bit for bit, so
+ * any change here needs the same change there (tests/test_bits.py checks).
+ *
+ * all functions accept anything supporting the buffer protocol and return
+ * bytes.  bits are MSB-first.
+ */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdint.h>
+#include <string.h>
+
+static uint8_t  manch_dec[2][256];      // 4 data bits per symbol byte
+static uint16_t manch_enc[2][256];
+static uint8_t  bmc_dec[256];
+static uint16_t bmc_enc[2][256];        // indexed by line level going in
+static uint8_t  bmc_level[2][256];      // line level coming out
+static uint8_t  popcnt8[256];
+static uint16_t pn9_next[512];          // register after 8 steps
+static uint8_t  lfsr7_key[128];
+static uint8_t  lfsr7_next[128];
+
+// TI DN504: output pair for (3 previous input bits << 1 | input bit)
+static const uint8_t fec_table[16] = {0, 3, 1, 2, 3, 0, 2, 1, 3, 0, 2, 1, 0, 3, 1, 2};
+#define FEC_INF (1 << 20)
+
+static void init_tables(void)
+{
+    int b, y, level;
+
+    for (b = 0; b < 256; b++)
+    {
+        uint8_t d0 = 0, d1 = 0, bd = 0, ones = 0;
+        uint16_t e0 = 0, e1 = 0;
+
+        for (y = 6; y >= 0; y -= 2)
+        {
+            int pair = (b >> y) & 3;
+            d0 = (d0 << 1) | (pair == 1);
+            d1 = (d1 << 1) | (pair == 2);
+            bd = (bd << 1) | (pair == 1 || pair == 2);
+        }
+        manch_dec[0][b] = d0;
+        manch_dec[1][b] = d1;
+        bmc_dec[b] = bd;
+
+        for (y = 7; y >= 0; y--)
+        {
+            int bit = (b >> y) & 1;
+            ones += bit;
+            e0 = (e0 << 2) | (bit ? 1 : 2);
+            e1 = (e1 << 2) | (bit ? 2 : 1);
+        }
+        popcnt8[b] = ones;
+        manch_enc[0][b] = e0;
+        manch_enc[1][b] = e1;
+
+        for (level = 0; level < 2; level++)
+        {
+            uint16_t out = 0;
+            int l = level;
+            for (y = 7; y >= 0; y--)
+            {
+                l ^= 1;
+                out = (out << 1) | l;
+                if ((b >> y) & 1)
+                    l ^= 1;
+                out = (out << 1) | l;
+            }
+            bmc_enc[level][b] = out;
+            bmc_level[level][b] = l;
+        }
+    }
+
+    // TI DN509 PN9: x^9 + x^5 + 1
+    for (b = 0; b < 512; b++)
+    {
+        uint16_t s = b;
+        for (y = 0; y < 8; y++)
+            s = (s >> 1) | ((((s >> 5) ^ s) & 1) << 8);
+        pn9_next[b] = s & 0x1ff;
+    }
+
+    // bits.getNextByte_feedbackRegister7bitsMSB()
+    for (b = 0; b < 128; b++)
+    {
+        uint8_t s = b, key = 0;
+        for (y = 0; y < 8; y++)
+        {
+            key = (key << 1) | (s >> 6);
+            s = ((s << 1) | (((s >> 3) ^ (s >> 6)) & 1)) & 0x7f;
+        }
+        lfsr7_key[b] = key;
+        lfsr7_next[b] = s;
+    }
+}
+
+static inline uint64_t load_be64(const uint8_t *p)
+{
+    return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) |
+           ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+           ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) |
+           ((uint64_t)p[6] << 8)  |  (uint64_t)p[7];
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define popcount64(x)   __builtin_popcountll(x)
+#else
+static inline int popcount64(uint64_t x)
+{
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (int)((x * 0x0101010101010101ULL) >> 56);
+}
+#endif
+
+static inline void store_be64(uint8_t *p, uint64_t v)
+{
+    int i;
+    for (i = 7; i >= 0; i--)
+    {
+        p[i] = v & 0xff;
+        v >>= 8;
+    }
+}
+
+// new, uninitialized bytes object of 'len' bytes
+static PyObject *alloc_bytes(Py_ssize_t len, uint8_t **out)
+{
+    PyObject *res = PyBytes_FromStringAndSize(NULL, len);
+    if (res != NULL)
+        *out = (uint8_t *)PyBytes_AS_STRING(res);
+    return res;
+}
+
+
+static PyObject *bk_shift(PyObject *self, PyObject *args)
+{
+    Py_buffer buf;
+    Py_ssize_t bits, q, i, n;
+    int r;
+    const uint8_t *in;
+    uint8_t *out;
+    PyObject *res;
+
+    if (!PyArg_ParseTuple(args, "y*n:shift", &buf, &bits))
+        return NULL;
+    if (bits < 0)
+    {
+        PyBuffer_Release(&buf);
+        PyErr_SetString(PyExc_ValueError, "bits must be positive");
+        return NULL;
+    }
+
+    n = buf.len;
+    in = buf.buf;
+    q = bits >> 3;
+    r = bits & 7;
+    res = alloc_bytes(n, &out);
+    if (res == NULL)
+    {
+        PyBuffer_Release(&buf);
+        return NULL;
+    }
+
+    i = 0;
+    // eight bytes at a time while a whole word plus the carry byte is in range
+    for (; q < n && i + q + 8 < n; i += 8)
+    {
+        uint64_t w = load_be64(in + i + q);
+        if (r)
+            w = (w << r) | (in[i + q + 8] >> (8 - r));
+        store_be64(out + i, w);
+    }
+    for (; i < n; i++)
+    {
+        uint8_t hi = (i + q < n) ? in[i + q] : 0;
+        uint8_t lo = (i + q + 1 < n) ? in[i + q + 1] : 0;
+        out[i] = (uint8_t)((hi << r) | (lo >> (8 - r)));
+    }
+
+    PyBuffer_Release(&buf);
+    return res;
+}
+
+static PyObject *bk_extract(PyObject *self, PyObject *args)
+{
+    Py_buffer buf;
+    Py_ssize_t start, end, nbytes, k, n;
+    long ones = 0;
+    const uint8_t *in;
+    uint8_t *out;
+    PyObject *res;
+
+    if (!PyArg_ParseTuple(args, "y*nn:extract", &buf, &start, &end))
+        return NULL;
+    if (start < 0)
+    {
+        PyBuffer_Release(&buf);
+        PyErr_SetString(PyExc_ValueError, "start must be positive");
+        return NULL;
+    }
+
+    nbytes = (end > start) ? (end - start + 7) / 8 : 0;
+    n = buf.len;
+    in = buf.buf;
+    res = alloc_bytes(nbytes, &out);
+    if (res == NULL)
+    {
+        PyBuffer_Release(&buf);
+        return NULL;
+    }
+
+    for (k = 0; k < nbytes; k++)
+    {
+        Py_ssize_t bit = start + 8 * k;
+        Py_ssize_t B = bit >> 3;
+        int r = bit & 7;
+        uint8_t b1 = (B < n) ? in[B] : 0;
+        uint8_t b2 = (B + 1 < n) ? in[B + 1] : 0;
+        uint8_t byte = (uint8_t)((b1 << r) | (b2 >> (8 - r)));
+
+        ones += popcnt8[byte];
+        if (bit + 8 > end)
+            byte &= (uint8_t)(0xff << (bit + 8 - end));
+        out[k] = byte;
+    }
+
+    PyBuffer_Release(&buf);
+    return Py_BuildValue("(Nl)", res, ones);
+}
+
+static PyObject *bk_unpack_bits(PyObject *self, PyObject *args)
+{
+    Py_buffer buf;
+    Py_ssize_t i;
+    int y;
+    const uint8_t *in;
+    PyObject *res, *bitobj[2];
+
+    if (!PyArg_ParseTuple(args, "y*:unpack_bits", &buf))
+        return NULL;
+
+    res = PyList_New(buf.len * 8);
+    if (res == NULL)
+    {
+        PyBuffer_Release(&buf);
+        return NULL;
+    }
+    bitobj[0] = PyLong_FromLong(0);
+    bitobj[1] = PyLong_FromLong(1);
+
+    in = buf.buf;
+    for (i = 0; i < buf.len; i++)
+    {
+        for (y = 0; y < 8; y++)
+        {
+            PyObject *o = bitobj[(in[i] >> (7 - y)) & 1];
+            Py_INCREF(o);
+            PyList_SET_ITEM(res, i * 8 + y, o);
+        }
+    }
+
+    Py_DECREF(bitobj[0]);
+    Py_DECREF(bitobj[1]);
+    PyBuffer_Release(&buf);
+    return res;
+}
+
+static PyObject *bk_invert(PyObject *self, PyObject *args)
+{
+    Py_buffer buf;
+    Py_ssize_t i, n;
+    const uint8_t *in;
+    uint8_t *out;
+    PyObject *res;
+
+    if (!PyArg_ParseTuple(args, "y*:invert", &buf))
+        return NULL;
+
+    n = buf.len;
+    in = buf.buf;
+    res = alloc_bytes(n, &out);
+    if (res == NULL)
+    {
+        PyBuffer_Release(&buf);
+        return NULL;
+    }
+
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        uint64_t w;
+        memcpy(&w, in + i, 8);
+        w = ~w;
+        memcpy(out + i, &w, 8);
+    }
+    for (; i < n; i++)
+        out[i] = ~in[i];
+
+    PyBuffer_Release(&buf);
+    return res;
+}
+
+// two symbol bytes -> one data byte; an odd trailing byte fills the high nibble
+static PyObject *pairs_to_bytes(Py_buffer *buf, const uint8_t *table)
+{
+    Py_ssize_t i, n = buf->len;
+    const uint8_t *in = buf->buf;
+    uint8_t *out;
+    PyObject *res = alloc_bytes((n + 1) / 2, &out);
+
+    if (res != NULL)
+    {
+        for (i = 0; i + 1 < n; i += 2)
+            out[i / 2] = (table[in[i]] << 4) | table[in[i + 1]];
+        if (n & 1)
+            out[n / 2] = table[in[n - 1]] << 4;
+    }
+    PyBuffer_Release(buf);
+    return res;
+}
+
+static PyObject *bk_manchester_decode(PyObject *self, PyObject *args)
+{
+    Py_buffer buf;
+    int hilo = 1;
+
+    if (!PyArg_ParseTuple(args, "y*|p:manchester_decode", &buf, &hilo))
+        return NULL;
+    return pairs_to_bytes(&buf, manch_dec[hilo ? 1 : 0]);
+}
+
+static PyObject *bk_biphase_decode(PyObject *self, PyObject *args)
+{
+    Py_buffer buf;
+
+    if (!PyArg_ParseTuple(args, "y*:biphase_decode", &buf))
+        return NULL;
+    return pairs_to_bytes(&buf, bmc_dec);
+}
+
+static PyObject *bk_manchester_encode(PyObject *self, PyObject *args)
+{
+    Py_buffer buf;
+    int hilo = 1;
+    Py_ssize_t i;
+    const uint8_t *in;
+    const uint16_t *table;
+    uint8_t *out;
+    PyObject *res;
+
+    if (!PyArg_ParseTuple(args, "y*|p:manchester_encode", &buf, &hilo))
+        return NULL;
+
+    in = buf.buf;
+    table = manch_enc[hilo ? 1 : 0];
+    res = alloc_bytes(buf.len * 2, &out);
+    if (res != NULL)
+    {
+        for (i = 0; i < buf.len; i++)
+        {
+            out[2 * i] = table[in[i]] >> 8;
+            out[2 * i + 1] = table[in[i]] & 0xff;
+        }
+    }
+    PyBuffer_Release(&buf);
+    return res;
+}
+
+static PyObject *bk_biphase_encode(PyObject *self, PyObject *args)
+{
+    Py_buffer buf;
+    int level = 0;
+    Py_ssize_t i;
+    const uint8_t *in;
+    uint8_t *out;
+    PyObject *res;
+
+    if (!PyArg_ParseTuple(args, "y*|i:biphase_encode", &buf, &level))
+        return NULL;
+
+    level &= 1;
+    in = buf.buf;
+    res = alloc_bytes(buf.len * 2, &out);
+    if (res != NULL)
+    {
+        for (i = 0; i < buf.len; i++)
+        {
+            uint16_t sym = bmc_enc[level][in[i]];
+            level = bmc_level[level][in[i]];
+            out[2 * i] = sym >> 8;
+            out[2 * i + 1] = sym & 0xff;
+        }
+    }
+    PyBuffer_Release(&buf);
+    if (res == NULL)
+        return NULL;
+    return Py_BuildValue("(Ni)", res, level);
+}
+
+static PyObject *bk_pn9(PyObject *self, PyObject *args)
+{
+    Py_buffer buf;
+    unsigned int seed = 0x1ff;
+    uint16_t state;
+    Py_ssize_t i;
+    const uint8_t *in;
+    uint8_t *out;
+    PyObject *res;
+
+    if (!PyArg_ParseTuple(args, "y*|I:pn9", &buf, &seed))
+        return NULL;
+
+    state = seed & 0x1ff;
+    in = buf.buf;
+    res = alloc_bytes(buf.len, &out);
+    if (res != NULL)
+    {
+        for (i = 0; i < buf.len; i++)
+        {
+            out[i] = in[i] ^ (state & 0xff);
+            state = pn9_next[state];
+        }
+    }
+    PyBuffer_Release(&buf);
+    return res;
+}
+
+static PyObject *bk_lfsr7(PyObject *self, PyObject *args)
+{
+    Py_buffer buf;
+    unsigned long long seed = 0x7f;
+    uint8_t state;
+    Py_ssize_t i;
+    const uint8_t *in;
+    uint8_t *out;
+    PyObject *res;
+
+    if (!PyArg_ParseTuple(args, "y*|K:lfsr7", &buf, &seed))
+        return NULL;
+
+    // only the low 7 bits of the seed ever reach the output
+    state = seed & 0x7f;
+    in = buf.buf;
+    res = alloc_bytes(buf.len, &out);
+    if (res != NULL)
+    {
+        for (i = 0; i < buf.len; i++)
+        {
+            out[i] = in[i] ^ lfsr7_key[state];
+            state = lfsr7_next[state];
+        }
+    }
+    PyBuffer_Release(&buf);
+    if (res == NULL)
+        return NULL;
+    return Py_BuildValue("(Ni)", res, state);
+}
+
+static PyObject *bk_autocorr(PyObject *self, PyObject *args)
+{
+    Py_buffer buf;
+    Py_ssize_t minlag, maxlag, lag, nbits, nwords, i;
+    const uint8_t *in;
+    uint64_t *words;
+    PyObject *res;
+
+    if (!PyArg_ParseTuple(args, "y*nn:autocorr", &buf, &minlag, &maxlag))
+        return NULL;
+    if (minlag < 0)
+    {
+        PyBuffer_Release(&buf);
+        PyErr_SetString(PyExc_ValueError, "need 0 <= minlag");
+        return NULL;
+    }
+    // an empty lag range, like range(minlag, maxlag + 1) in the Python kernel
+    if (maxlag < minlag)
+    {
+        PyBuffer_Release(&buf);
+        return PyList_New(0);
+    }
+
+    // big-endian words, zero padded, so stream bit j is bit 63-(j%64) of word j/64
+    in = buf.buf;
+    nbits = buf.len * 8;
+    nwords = (buf.len + 7) / 8;
+    words = PyMem_Calloc(nwords + 1, sizeof(uint64_t));
+    if (words == NULL)
+    {
+        PyBuffer_Release(&buf);
+        return PyErr_NoMemory();
+    }
+    for (i = 0; i < buf.len; i++)
+        words[i >> 3] |= (uint64_t)in[i] << (56 - 8 * (i & 7));
+    PyBuffer_Release(&buf);
+
+    res = PyList_New(maxlag - minlag + 1);
+    if (res == NULL)
+    {
+        PyMem_Free(words);
+        return NULL;
+    }
+
+    for (lag = minlag; lag <= maxlag; lag++)
+    {
+        Py_ssize_t q = lag >> 6, count = 0;
+        int r = lag & 63;
+        PyObject *o;
+
+        // positions [lag, nbits): word i against the stream 'lag' bits earlier
+        for (i = q; lag < nbits && i < nwords; i++)
+        {
+            uint64_t prev = words[i - q] >> r;
+            uint64_t diff;
+
+            if (r && i - q > 0)
+                prev |= words[i - q - 1] << (64 - r);
+            diff = words[i] ^ prev;
+            if (i == q)
+                diff &= ~(uint64_t)0 >> r;          // bits before 'lag'
+            if (i == nwords - 1 && (nbits & 63))
+                diff &= ~(uint64_t)0 << (64 - (nbits & 63));
+            count += popcount64(diff);
+        }
+
+        o = PyLong_FromSsize_t(count);
+        if (o == NULL)
+        {
+            Py_DECREF(res);
+            PyMem_Free(words);
+            return NULL;
+        }
+        PyList_SET_ITEM(res, lag - minlag, o);
+    }
+
+    PyMem_Free(words);
+    return res;
+}
+
+static PyObject *bk_fec_encode(PyObject *self, PyObject *args)
+{
+    Py_buffer buf;
+    Py_ssize_t i, nfec, outlen;
+    const uint8_t *in;
+    uint8_t *fec, *out;
+    unsigned int state = 0;
+    PyObject *res;
+
+    if (!PyArg_ParseTuple(args, "y*:fec_encode", &buf))
+        return NULL;
+
+    in = buf.buf;
+    nfec = 2 * buf.len;
+    outlen = (nfec + 3) & ~(Py_ssize_t)3;
+    fec = PyMem_Calloc(outlen + 1, 1);
+    if (fec == NULL)
+    {
+        PyBuffer_Release(&buf);
+        return PyErr_NoMemory();
+    }
+
+    for (i = 0; i < buf.len; i++)
+    {
+        uint16_t word = 0;
+        int bitx;
+        for (bitx = 7; bitx >= 0; bitx--)
+        {
+            unsigned int idx = (state << 1) | ((in[i] >> bitx) & 1);
+            word = (word << 2) | fec_table[idx];
+            state = idx & 7;
+        }
+        fec[2 * i] = word >> 8;
+        fec[2 * i + 1] = word & 0xff;
+    }
+    PyBuffer_Release(&buf);
+
+    res = alloc_bytes(outlen, &out);
+    if (res != NULL)
+    {
+        for (i = 0; i < outlen; i += 4)
+        {
+            uint32_t word = 0;
+            int j;
+            for (j = 0; j < 16; j++)
+                word = (word << 2) | ((fec[i + 3 - (j & 3)] >> (2 * (j >> 2))) & 3);
+            out[i] = word >> 24;
+            out[i + 1] = (word >> 16) & 0xff;
+            out[i + 2] = (word >> 8) & 0xff;
+            out[i + 3] = word & 0xff;
+        }
+    }
+    PyMem_Free(fec);
+    return res;
+}
+
+static PyObject *bk_fec_decode(PyObject *self, PyObject *args)
+{
+    Py_buffer buf;
+    Py_ssize_t nblocks, nsyms, i, t;
+    const uint8_t *in;
+    uint8_t *paths, *out;
+    uint32_t metric[8], next[8], errors;
+    int cost[4][16];
+    int state, s, j;
+    PyObject *res;
+
+    if (!PyArg_ParseTuple(args, "y*:fec_decode", &buf))
+        return NULL;
+
+    in = buf.buf;
+    nblocks = buf.len / 4;
+    nsyms = nblocks * 16;
+    paths = PyMem_Malloc(nsyms + 1);
+    if (paths == NULL)
+    {
+        PyBuffer_Release(&buf);
+        return PyErr_NoMemory();
+    }
+
+    for (s = 0; s < 4; s++)
+        for (j = 0; j < 16; j++)
+            cost[s][j] = popcnt8[s ^ fec_table[j]];
+
+    metric[0] = 0;
+    for (s = 1; s < 8; s++)
+        metric[s] = FEC_INF;
+
+    t = 0;
+    for (i = 0; i < nblocks; i++)
+    {
+        uint32_t word = ((uint32_t)in[4 * i] << 24) | ((uint32_t)in[4 * i + 1] << 16) |
+                        ((uint32_t)in[4 * i + 2] << 8) | in[4 * i + 3];
+        uint8_t fec[4] = {0, 0, 0, 0};
+        int b, y;
+
+        // undo the interleaver, then one trellis step per 2-bit symbol
+        for (j = 0; j < 16; j++)
+            fec[3 - (j & 3)] |= ((word >> (30 - 2 * j)) & 3) << (2 * (j >> 2));
+
+        for (b = 0; b < 4; b++)
+        {
+            for (y = 6; y >= 0; y -= 2)
+            {
+                const int *csym = cost[(fec[b] >> y) & 3];
+                uint8_t choice = 0;
+                int ns;
+                for (ns = 0; ns < 8; ns++)
+                {
+                    int u = ns & 1, p0 = ns >> 1, p1 = p0 | 4;
+                    uint32_t c0 = metric[p0] + csym[(p0 << 1) | u];
+                    uint32_t c1 = metric[p1] + csym[(p1 << 1) | u];
+                    if (c0 <= c1)
+                        next[ns] = c0;
+                    else
+                    {
+                        next[ns] = c1;
+                        choice |= 1 << ns;
+                    }
+                }
+                memcpy(metric, next, sizeof(metric));
+                paths[t++] = choice;
+            }
+        }
+    }
+    PyBuffer_Release(&buf);
+
+    state = 0;
+    for (s = 1; s < 8; s++)
+        if (metric[s] < metric[state])
+            state = s;
+    errors = nsyms ? metric[state] : 0;
+
+    res = alloc_bytes(nsyms / 8, &out);
+    if (res != NULL)
+    {
+        memset(out, 0, nsyms / 8);
+        for (t = nsyms - 1; t >= 0; t--)
+        {
+            if (state & 1)
+                out[t >> 3] |= 0x80 >> (t & 7);
+            state = (state >> 1) | (((paths[t] >> state) & 1) << 2);
+        }
+    }
+    PyMem_Free(paths);
+    if (res == NULL)
+        return NULL;
+    return Py_BuildValue("(NI)", res, (unsigned int)errors);
+}
+
+
+static PyMethodDef bitkern_methods[] = {
+    {"shift",             bk_shift,             METH_VARARGS, "shift(data, bits) -> bytes shifted left by 'bits'"},
+    {"extract",           bk_extract,           METH_VARARGS, "extract(data, start, end) -> (bytes, ones)"},
+    {"unpack_bits",       bk_unpack_bits,       METH_VARARGS, "unpack_bits(data) -> list of 0/1, MSB first"},
+    {"invert",            bk_invert,            METH_VARARGS, "invert(data) -> bytes with every bit flipped"},
+    {"manchester_decode", bk_manchester_decode, METH_VARARGS, "manchester_decode(data, hilo=1) -> bytes"},
+    {"manchester_encode", bk_manchester_encode, METH_VARARGS, "manchester_encode(data, hilo=1) -> bytes"},
+    {"biphase_decode",    bk_biphase_decode,    METH_VARARGS, "biphase_decode(data) -> bytes"},
+    {"biphase_encode",    bk_biphase_encode,    METH_VARARGS, "biphase_encode(data, level=0) -> (bytes, level)"},
+    {"pn9",               bk_pn9,               METH_VARARGS, "pn9(data, seed=0x1ff) -> whitened bytes"},
+    {"lfsr7",             bk_lfsr7,             METH_VARARGS, "lfsr7(data, seed=0x7f) -> (whitened bytes, register)"},
+    {"autocorr",          bk_autocorr,          METH_VARARGS, "autocorr(data, minlag, maxlag) -> [mismatched bits per lag]"},
+    {"fec_encode",        bk_fec_encode,        METH_VARARGS, "fec_encode(data) -> convolutionally coded, interleaved bytes"},
+    {"fec_decode",        bk_fec_decode,        METH_VARARGS, "fec_decode(data) -> (bytes, symbol bit errors corrected)"},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef bitkern_module = {
+    PyModuleDef_HEAD_INIT,
+    "_bitkern",
+    "native bit-level kernels for rflib.bitkern",
+    -1,
+    bitkern_methods
+};
+
+PyMODINIT_FUNC PyInit__bitkern(void)
+{
+    init_tables();
+    return PyModule_Create(&bitkern_module);
+}
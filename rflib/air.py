@@ -0,0 +1,435 @@
+'''
+a virtual air for simulated dongles: what one sends, the others hear, the
+way their radio registers say they would
+
+    air = VirtualAir(ChannelModel(latency=.002, loss=.01, ber=1e-4))
+    a = FakeRfCat(air=air)
+    b = SimRfCat('firmware/bins/RfCatChronos-xxxx.hex', air=air)
+    air.link(a._do, b.sim.cc.radio, ChannelModel(rssi=-90))  # a is far from b
+
+anything with settings() (a RadioSettings, what its registers say) and
+deliver(frame) can attach: fwsim's Radio and fakedongle_nic's fakeDongle
+do.  a frame goes to every other radio attached when it's done being sent,
+and each receiver decides from its own settings whether it hears it
+(hears(): frequency within its channel bandwidth, data rate, modulation,
+manchester/FEC/whitening, sync word).
+
+the channel model: each sender->receiver link has a ChannelModel, the
+air's unless link() set one for that pair.  it decides whether the frame
+gets there at all (loss), flips bits in what does (ber), sets the RSSI
+it's heard at and how long after it was sent it arrives (latency).
+
+collisions: a radio keys up when it starts sending (keyup()) and the frame
+is put on the air when it's done (transmit()), so the air knows what was
+on which channel when.  a frame that overlaps another one a receiver could
+hear is garbled where they overlap, unless it's 'capture' dB stronger than
+the other at that receiver; one that lost its preamble or sync word isn't
+heard at all.  the same carriers are what a receiver's RSSI and carrier
+sense (CCA) see while they're up.
+
+time: collisions and carrier sense need everyone on one timeline.  each
+radio's now() is seconds on it: fake dongles use the wall clock, since the
+air was made.  fwsim chips run on simulated time, each in its own thread,
+so with 'quantum' set their SimDongles join() the air and keep in lockstep:
+none gets more than 'quantum' simulated seconds ahead of the slowest.
+(fake and simulated dongles can share an air, and frames get across, but
+the wall clock and simulated time have nothing to do with each other, so
+don't trust collisions or timing between the two kinds.)
+'''
+import math
+import time
+import random
+import threading
+import collections
+
+from .const import *
+from .pktengine import crc16
+
+FXOSC = 24000000                # what the cc1111's frequency and rate registers count in
+
+
+######## what a radio's registers say ########
+RadioSettings = collections.namedtuple('RadioSettings', 'freq chanbw drate mod syncmode syncword preamble '
+                                                        'manchester fec white crc lengthconfig pktlen appendstatus')
+
+def radioSettings(regs):
+    '''
+    what a block of radio registers (from 0xdf00, as rflib's getRadioConfig()
+    or the simulated chip has them) sets the radio to: frequencies in Hz,
+    data rate in bits/s, preamble in bytes
+    '''
+    reg = lambda addr: regs[addr - SYNC1]
+    mdmcfg4, mdmcfg3, mdmcfg2, mdmcfg1, mdmcfg0 = [reg(MDMCFG4 + x) for x in range(5)]
+    freq = ((reg(FREQ2) << 16) | (reg(FREQ1) << 8) | reg(FREQ0)) * FXOSC / 2.0**16
+    spacing = FXOSC / 2.0**18 * (256 + mdmcfg0) * 2**(mdmcfg1 & 3)
+    freq += spacing * reg(CHANNR)
+    chanbw = FXOSC / (8.0 * (4 + ((mdmcfg4 >> 4) & 3)) * 2**(mdmcfg4 >> 6))
+    drate = (256 + mdmcfg3) * 2**(mdmcfg4 & 0xf) * FXOSC / 2.0**28
+    preamble = NUM_PREAMBLE[(mdmcfg1 & MFMCFG1_NUM_PREAMBLE) >> 4]
+    syncmode = mdmcfg2 & MDMCFG2_SYNC_MODE & 3
+    pktctrl0 = reg(PKTCTRL0)
+    return RadioSettings(freq, chanbw, drate, (mdmcfg2 >> 4) & 7, syncmode, (reg(SYNC1) << 8) | reg(SYNC0),
+                         preamble, bool(mdmcfg2 & MDMCFG2_MANCHESTER_EN), bool(mdmcfg1 & MFMCFG1_FEC_EN),
+                         bool(pktctrl0 & PKTCTRL0_WHITE_DATA), bool(pktctrl0 & PKTCTRL0_CRC_EN),
+                         pktctrl0 & PKTCTRL0_LENGTH_CONFIG, reg(PKTLEN), bool(reg(PKTCTRL1) & PKTCTRL1_APPEND_STATUS))
+
+def syncBytes(settings):
+    '''
+    the sync word as it goes out: none, once, or twice for 30/32 bit sync
+    '''
+    word = bytes([settings.syncword >> 8, settings.syncword & 0xff])
+    return (b'', word, word, word * 2)[settings.syncmode]
+
+def byteCycles(settings):
+    '''
+    clocks (FXOSC) one byte of packet takes on the air
+    '''
+    bits = 8 * (2 if settings.manchester else 1) * (2 if settings.fec else 1)
+    return max(1, int(bits * FXOSC / settings.drate))
+
+def byteTime(settings):
+    '''
+    ...and in seconds
+    '''
+    return byteCycles(settings) / float(FXOSC)
+
+def airBytes(settings, payload):
+    '''
+    what follows the sync word when a radio set up like 'settings' sends
+    'payload': the length byte for variable length packets, then the CRC
+    '''
+    data = bytes(payload)
+    if settings.lengthconfig == PKTCTRL0_LENGTH_CONFIG_VAR:
+        data = bytes([len(data)]) + data
+    if settings.crc:
+        crc = crc16(data)
+        data += bytes([crc >> 8, crc & 0xff])
+    return data
+
+def sameChannel(s, f):
+    '''
+    is something sent on f.freq inside the channel a radio set up like 's'
+    listens to?
+    '''
+    return abs(f.freq - s.freq) <= s.chanbw / 2
+
+def hears(s, frame):
+    '''
+    the bytes a radio set up like 's' would demodulate out of 'frame', or
+    None if it wouldn't pick it up at all
+    '''
+    f = frame.settings
+    if not sameChannel(s, f):
+        return None
+    if abs(f.drate - s.drate) > s.drate * .02:
+        return None
+    if (f.mod, f.manchester, f.fec, f.white) != (s.mod, s.manchester, s.fec, s.white):
+        return None
+    if not s.syncmode:
+        # no sync word: everything from the preamble on is data
+        return b'\xaa' * f.preamble + syncBytes(f) + frame.data
+    if not f.syncmode or f.syncword != s.syncword or (s.syncmode == 3 and f.syncmode != 3):
+        return None
+    if f.syncmode == 3 and s.syncmode != 3:
+        # we sync on the first copy of a 32 bit sync word, so the second is data
+        return syncBytes(s) + frame.data
+    return frame.data
+
+
+class AirFrame(object):
+    '''
+    one packet on the air: 'data' is what followed the sync word, as sent
+    (length byte, payload and CRC), and 'settings' how the sender's radio was
+    set up (RadioSettings), which is what a receiver goes by to hear it.
+    rssi is in dBm at the receiver; start and end are when it was sent, on
+    the air's timeline (None for frames that came from nowhere in
+    particular, which don't collide with anything).  'delay' is how long
+    after it was sent a receiver gets it, which the channel model sets
+    '''
+    def __init__(self, data, settings, rssi=-40, start=None, end=None, source=None, delay=0.0):
+        self.data = bytes(data)
+        self.settings = settings
+        self.rssi = rssi
+        self.start = start
+        self.end = end
+        self.source = source
+        self.delay = delay
+
+    def copy(self, **kwargs):
+        frame = AirFrame(self.data, self.settings, self.rssi, self.start, self.end, self.source, self.delay)
+        frame.__dict__.update(kwargs)
+        return frame
+
+    def header(self):
+        '''
+        seconds of preamble and sync word before 'data' starts
+        '''
+        s = self.settings
+        return (s.preamble + len(syncBytes(s))) * byteTime(s)
+
+    def __repr__(self):
+        return "<AirFrame %.3fMHz %dbps %d bytes %r>" % (self.settings.freq / 1e6, self.settings.drate,
+                                                        len(self.data), self.data[:16])
+
+
+class ChannelModel(object):
+    '''
+    what happens to a frame between a sender and a receiver:
+
+        latency     seconds after the sender's done that the receiver gets it
+        loss        chance (0-1) it doesn't get there at all
+        ber         chance each bit comes out flipped
+        rssi        dBm it's heard at (None keeps what the sender said, -40)
+        capture     dB stronger than something it collides with it has to
+                    be to come through anyway
+
+    'seed' makes the losses and bit errors repeatable
+    '''
+    def __init__(self, latency=0.0, loss=0.0, ber=0.0, rssi=None, capture=6.0, seed=None):
+        self.latency = latency
+        self.loss = loss
+        self.ber = ber
+        self.rssi = rssi
+        self.capture = capture
+        self.rng = random.Random(seed)
+        self.lock = threading.Lock()
+
+    def level(self, frame):
+        if self.rssi is None:
+            return frame.rssi
+        return self.rssi
+
+    def apply(self, frame):
+        '''
+        the frame as the receiver at the other end of this link gets it, or
+        None if it's lost
+        '''
+        with self.lock:
+            if self.loss and self.rng.random() < self.loss:
+                return None
+            data = self.flip(frame.data, self.ber)
+        return frame.copy(data=data, rssi=self.level(frame), delay=frame.delay + self.latency)
+
+    def flip(self, data, ber, start=0, end=None):
+        '''
+        'data' with each bit from byte 'start' to 'end' flipped with
+        probability 'ber'.  skips from one error to the next rather than
+        rolling for every bit
+        '''
+        if end is None:
+            end = len(data)
+        if ber <= 0 or end <= start:
+            return data
+        out = bytearray(data)
+        bits = (end - start) * 8
+        pos = -1
+        while True:
+            if ber < 1:
+                pos += 1 + int(math.log(1.0 - self.rng.random()) / math.log(1.0 - ber))
+            else:
+                pos += 1
+            if pos >= bits:
+                return bytes(out)
+            out[start + pos // 8] ^= 0x80 >> (pos % 8)
+
+
+class VirtualAir(object):
+    '''
+    the medium a set of simulated radios share.  every frame an attached
+    radio sends goes, through the link's ChannelModel, to every other
+    attached radio, and each decides for itself whether it hears it.  the
+    last 'history' frames are kept in .frames; inject() puts one on the air
+    from nowhere in particular.  .stats counts frames sent, delivered, lost
+    to the channel model and garbled or lost in collisions
+    '''
+    def __init__(self, model=None, history=1000, quantum=None):
+        self.model = model or ChannelModel()
+        self.links = {}
+        self.radios = []
+        self.frames = collections.deque(maxlen=history)
+        self.carriers = {}
+        self.epoch = time.time()
+        self.stats = dict(sent=0, delivered=0, lost=0, collided=0)
+        self.lock = threading.Lock()
+
+        self.quantum = quantum
+        self.members = []
+        self.cond = threading.Condition()
+
+    def attach(self, radio):
+        with self.lock:
+            if radio not in self.radios:
+                self.radios.append(radio)
+        radio.air = self
+
+    def detach(self, radio):
+        with self.lock:
+            if radio in self.radios:
+                self.radios.remove(radio)
+            self.carriers.pop(radio, None)
+        radio.air = None
+
+    def now(self):
+        '''
+        wall clock seconds since the air was made, for radios that don't
+        keep simulated time
+        '''
+        return time.time() - self.epoch
+
+    def link(self, sender, receiver, model, both=True):
+        '''
+        use 'model' (a ChannelModel, or None to go back to the air's) for
+        what 'sender' sends 'receiver', and the other way around too unless
+        both=False
+        '''
+        pairs = [(sender, receiver)] + ([(receiver, sender)] if both else [])
+        with self.lock:
+            for pair in pairs:
+                if model is None:
+                    self.links.pop(pair, None)
+                else:
+                    self.links[pair] = model
+
+    def linkModel(self, sender, receiver):
+        return self.links.get((sender, receiver), self.model)
+
+    ######## carriers ########
+    def keyup(self, radio, settings, start):
+        '''
+        'radio' started sending at 'start', set up like 'settings'
+        '''
+        with self.lock:
+            self.carriers[radio] = (settings, start)
+
+    def keydown(self, radio):
+        '''
+        ...and stopped without putting a frame on the air (an underflow, or
+        it was strobed out of TX)
+        '''
+        with self.lock:
+            self.carriers.pop(radio, None)
+
+    def carrier(self, radio, settings, now=None):
+        '''
+        the strongest carrier 'radio' (set up like 'settings') picks up on
+        its channel right now, in dBm, or None if there isn't one
+        '''
+        with self.lock:
+            levels = [self.linkModel(r, radio).level(AirFrame(b'', s)) for r, (s, start) in self.carriers.items()
+                      if r is not radio and sameChannel(settings, s) and (now is None or start <= now)]
+        if not levels:
+            return None
+        return max(levels)
+
+    def _rivals(self, frame):
+        # whatever else was on the air while 'frame' was: frames sent (most recent
+        # first, so we can stop once they're too old) and carriers still up.  call with
+        # the lock held
+        rivals = []
+        for other in reversed(self.frames):
+            if other.end is not None and other.end <= frame.start - 1.0:
+                break
+            if other.source is not frame.source and other.start is not None and \
+                    other.start < frame.end and other.end > frame.start:
+                rivals.append(other)
+        for radio, (s, start) in self.carriers.items():
+            if radio is not frame.source and start < frame.end:
+                rivals.append(AirFrame(b'', s, start=start, end=frame.end, source=radio))
+        return rivals
+
+    def _collide(self, frame, rivals, receiver, model):
+        '''
+        'frame' as 'receiver' gets it, after 'rivals' it could also hear had
+        their say: None if one took out its sync word
+        '''
+        s = receiver.settings()
+        bt = byteTime(frame.settings)
+        header = frame.header()
+        for rival in rivals:
+            if not sameChannel(s, rival.settings):
+                continue
+            if frame.rssi - self.linkModel(rival.source, receiver).level(rival) >= model.capture:
+                continue
+            # what part of the frame's air time the rival was on for, in bytes of data
+            lo = (max(frame.start, rival.start) - frame.start - header) / bt
+            hi = (min(frame.end, rival.end) - frame.start - header) / bt
+            if lo < 0:
+                return None
+            with model.lock:
+                frame.data = model.flip(frame.data, .5, int(lo), min(len(frame.data), int(math.ceil(hi))))
+        return frame
+
+    ######## frames ########
+    def transmit(self, radio, frame):
+        '''
+        'radio' is done sending 'frame': hand it to everyone else
+        '''
+        with self.lock:
+            self.carriers.pop(radio, None)
+            rivals = []
+            if frame.start is not None:
+                rivals = self._rivals(frame)
+            self.frames.append(frame)
+            others = [r for r in self.radios if r is not radio]
+            self.stats['sent'] += 1
+
+        for r in others:
+            model = self.linkModel(radio, r)
+            got = model.apply(frame)
+            if got is None:
+                self.stats['lost'] += 1
+                continue
+            if rivals:
+                clean = got.data
+                got = self._collide(got, rivals, r, model)
+                if got is None or got.data != clean:
+                    self.stats['collided'] += 1
+                if got is None:
+                    continue
+            self.stats['delivered'] += 1
+            r.deliver(got)
+
+    def inject(self, payload, settings, rssi=-40):
+        '''
+        send 'payload' as a radio set up like 'settings' (a RadioSettings)
+        would
+        '''
+        frame = AirFrame(airBytes(settings, payload), settings, rssi)
+        self.transmit(None, frame)
+        return frame
+
+    ######## lockstep ########
+    def join(self, member):
+        '''
+        keep 'member' (anything with now(), in seconds of simulated time) in
+        step with the others that have joined
+        '''
+        with self.cond:
+            if member not in self.members:
+                self.members.append(member)
+            self.cond.notify_all()
+
+    def leave(self, member):
+        with self.cond:
+            if member in self.members:
+                self.members.remove(member)
+            self.cond.notify_all()
+
+    def sync(self, member, timeout=None):
+        '''
+        called by each member between steps: waits while it's more than
+        'quantum' ahead of the slowest of the others.  the slowest never
+        waits, so someone's always moving.  True if it can go on
+        '''
+        if not self.quantum:
+            return True
+        deadline = None if timeout is None else time.time() + timeout
+        with self.cond:
+            self.cond.notify_all()
+            while True:
+                others = [m.now() for m in self.members if m is not member]
+                if member not in self.members or not others or member.now() - min(others) <= self.quantum:
+                    return True
+                if deadline is not None and time.time() >= deadline:
+                    return False
+                self.cond.wait(.01)
@@ -0,0 +1,342 @@
+'''
+bit-level kernels used by rflib.bits
+
+every kernel is implemented twice: in pure Python here (table-driven, and
+word-at-a-time using Python's big ints), and in C in rflib/_bitkern.c.  if
+the C extension was built (setup.py builds it when a compiler is around),
+its functions replace the Python ones when this module is imported.  both
+return exactly the same results; tests/test_bits.py holds them to that.
+
+all kernels take bytes, bytearray or memoryview and return bytes.  bits are
+MSB-first, the way the radio clocks them out.
+
+    shift(data, bits)               shift the whole buffer left by 'bits'
+    extract(data, start, end)       bits [start, end) -> (bytes, ones)
+    unpack_bits(data)               list of 0/1, MSB first
+    invert(data)                    flip every bit
+    manchester_decode(data, hilo)   2 symbols -> 1 bit (10 == 1 when hilo)
+    manchester_encode(data, hilo)
+    biphase_decode(data)            biphase-mark: 1 when the pair differs
+    biphase_encode(data, level)     -> (bytes, level)
+    pn9(data, seed)                 CC1111 PN9 data whitening (self-inverse)
+    lfsr7(data, seed)               7-bit feedback register whitening
+                                    (bits.whitenData()) -> (bytes, register)
+    autocorr(data, minlag, maxlag)  for each lag, how many bits differ from
+                                    the bit 'lag' earlier (list)
+    fec_encode(data)                CC1111 FEC: rate 1/2, K=4 convolutional
+                                    code, then the 4x4 symbol interleaver
+    fec_decode(data)                de-interleave and hard-decision Viterbi
+                                    -> (bytes, symbol bit errors corrected)
+'''
+
+NATIVE = False
+
+
+def _tobytes(data):
+    if isinstance(data, bytes):
+        return data
+    return bytes(data)
+
+
+##### shifting / extraction #####
+def shift(data, bits):
+    data = _tobytes(data)
+    if bits < 0:
+        raise ValueError("bits must be positive")
+    size = len(data)
+    num = int.from_bytes(data, 'big') << bits
+    return (num & ((1 << (8 * size)) - 1)).to_bytes(size, 'big')
+
+
+def extract(data, start, end):
+    '''
+    chop bits [start, end) out of data.  data is treated as zero-padded past
+    its end.  'ones' is counted over every whole output byte *before* the
+    trailing bits are masked off, which is what bitSectString() has always
+    used for its entropy estimate.
+    '''
+    if start < 0:
+        raise ValueError("start must be positive")
+    if end <= start:
+        return b'', 0
+
+    nbytes = (end - start + 7) // 8
+    data = _tobytes(data)
+    first = start // 8
+    last = (start + 8 * nbytes + 7) // 8
+    window = data[first:last]
+    window += b'\0' * (last - first - len(window))
+
+    num = int.from_bytes(window, 'big')
+    num >>= (8 * len(window)) - (start % 8) - (8 * nbytes)
+    num &= (1 << (8 * nbytes)) - 1
+    ones = bin(num).count('1')
+
+    tail = start + 8 * nbytes - end
+    num &= ~((1 << tail) - 1)
+    return num.to_bytes(nbytes, 'big'), ones
+
+
+_BITS = [tuple((byte >> bitx) & 1 for bitx in range(7, -1, -1)) for byte in range(256)]
+
+def unpack_bits(data):
+    out = []
+    for byte in _tobytes(data):
+        out.extend(_BITS[byte])
+    return out
+
+
+_INVERT = bytes(range(255, -1, -1))
+
+def invert(data):
+    return _tobytes(data).translate(_INVERT)
+
+
+##### line codes #####
+def _pairs(byte):
+    return [(byte >> y) & 3 for y in range(6, -1, -2)]
+
+def _nibble(byte, match):
+    out = 0
+    for pair in _pairs(byte):
+        out = (out << 1) | (pair in match)
+    return out
+
+_MANCH_DEC = (
+        [_nibble(byte, (1,)) for byte in range(256)],      # hilo=0: 01 -> 1
+        [_nibble(byte, (2,)) for byte in range(256)],      # hilo=1: 10 -> 1
+        )
+_BMC_DEC = [_nibble(byte, (1, 2)) for byte in range(256)]
+
+def _manch_enc(byte, sym0, sym1):
+    out = 0
+    for bitx in range(7, -1, -1):
+        out = (out << 2) | (sym0, sym1)[(byte >> bitx) & 1]
+    return bytes(((out >> 8), out & 0xff))
+
+_MANCH_ENC = (
+        [_manch_enc(byte, 2, 1) for byte in range(256)],
+        [_manch_enc(byte, 1, 2) for byte in range(256)],
+        )
+
+def _pairs_to_bytes(data, table):
+    data = _tobytes(data)
+    out = bytearray(len(data) // 2)
+    for idx in range(len(out)):
+        out[idx] = (table[data[2*idx]] << 4) | table[data[2*idx+1]]
+    if len(data) & 1:
+        out.append(table[data[-1]] << 4)
+    return bytes(out)
+
+def manchester_decode(data, hilo=1):
+    return _pairs_to_bytes(data, _MANCH_DEC[bool(hilo)])
+
+def manchester_encode(data, hilo=1):
+    table = _MANCH_ENC[bool(hilo)]
+    return b''.join([table[byte] for byte in _tobytes(data)])
+
+def biphase_decode(data):
+    return _pairs_to_bytes(data, _BMC_DEC)
+
+def _bmc_enc(byte, level):
+    out = 0
+    for bitx in range(7, -1, -1):
+        level ^= 1                      # transition at every bit boundary
+        out = (out << 1) | level
+        if (byte >> bitx) & 1:
+            level ^= 1                  # and mid-bit for a 1
+        out = (out << 1) | level
+    return bytes(((out >> 8), out & 0xff)), level
+
+_BMC_ENC = (
+        [_bmc_enc(byte, 0) for byte in range(256)],
+        [_bmc_enc(byte, 1) for byte in range(256)],
+        )
+
+def biphase_encode(data, level=0):
+    out = []
+    level &= 1
+    for byte in _tobytes(data):
+        symbols, level = _BMC_ENC[level][byte]
+        out.append(symbols)
+    return b''.join(out), level
+
+
+##### whitening #####
+def _pn9_step(state):
+    # TI DN509: x^9 + x^5 + 1, key byte is the low 8 bits of the register
+    for x in range(8):
+        state = (state >> 1) | ((((state >> 5) ^ state) & 1) << 8)
+    return state & 0x1ff
+
+def _lfsr7_step(state):
+    key = 0
+    for x in range(8):
+        key = (key << 1) | (state >> 6)
+        state = ((state << 1) | (((state >> 3) ^ (state >> 6)) & 1)) & 0x7f
+    return key, state
+
+_keystreams = {}
+
+def _keystream(kind, seed, length):
+    '''
+    the registers have short periods (127 and 511 bytes), so walk one cycle
+    per seed, cache it, and tile it out to the requested length.
+    returns (keystream, register state after 'length' bytes)
+    '''
+    ks = _keystreams.get((kind, seed))
+    if ks is None:
+        keys = bytearray()
+        states = [seed]
+        seen = {seed: 0}
+        state = seed
+        while True:
+            if kind == 'pn9':
+                key, state = state & 0xff, _pn9_step(state)
+            else:
+                key, state = _lfsr7_step(state)
+            keys.append(key)
+            if state in seen:
+                break
+            seen[state] = len(states)
+            states.append(state)
+        ks = _keystreams[(kind, seed)] = (bytes(keys[:seen[state]]), bytes(keys[seen[state]:]), states, seen[state])
+
+    prefix, cycle, states, cstart = ks
+    if length <= len(prefix):
+        return prefix[:length], states[length]
+    reps = (length - len(prefix)) // len(cycle) + 1
+    keys = (prefix + cycle * reps)[:length]
+    return keys, states[cstart + (length - len(prefix)) % len(cycle)]
+
+def _xor(data, keys):
+    data = _tobytes(data)
+    num = int.from_bytes(data, 'big') ^ int.from_bytes(keys, 'big')
+    return num.to_bytes(len(data), 'big')
+
+def pn9(data, seed=0x1ff):
+    keys, state = _keystream('pn9', seed & 0x1ff, len(data))
+    return _xor(data, keys)
+
+def lfsr7(data, seed=0x7f):
+    # only the low 7 bits of the seed ever reach the output
+    keys, state = _keystream('lfsr7', seed & 0x7f, len(data))
+    return _xor(data, keys), state
+
+
+##### analysis #####
+# int.bit_count() is python 3.10+
+popcount = getattr(int, 'bit_count', None) or (lambda num: bin(num).count('1'))
+
+def autocorr(data, minlag, maxlag):
+    '''
+    returns [mismatches at minlag, ... at maxlag]: the number of bits j in
+    [lag, nbits) where bit j != bit j-lag.  one xor and popcount per lag.
+    '''
+    data = _tobytes(data)
+    nbits = 8 * len(data)
+    num = int.from_bytes(data, 'big')
+    out = []
+    for lag in range(minlag, maxlag + 1):
+        if lag >= nbits:
+            out.append(0)
+            continue
+        out.append(popcount((num ^ (num >> lag)) & ((1 << (nbits - lag)) - 1)))
+    return out
+
+
+##### forward error correction #####
+# TI DN504: output pair for (3 previous input bits << 1 | input bit);
+# G0 = 1 + D^2 + D^3 (high bit), G1 = 1 + D + D^2 + D^3 (low bit)
+FEC_TABLE = (0, 3, 1, 2, 3, 0, 2, 1, 3, 0, 2, 1, 0, 3, 1, 2)
+_FEC_INF = 1 << 20
+
+def _fec_conv(data):
+    out = bytearray()
+    state = 0
+    for byte in data:
+        word = 0
+        for bitx in range(7, -1, -1):
+            idx = (state << 1) | ((byte >> bitx) & 1)
+            word = (word << 2) | FEC_TABLE[idx]
+            state = idx & 7
+        out += bytes(((word >> 8), word & 0xff))
+    return out
+
+def fec_encode(data):
+    '''
+    every input byte becomes two coded bytes, zero padded to whole 4-byte
+    interleaver blocks.  the caller appends the trellis terminator (0x0b).
+    '''
+    fec = _fec_conv(_tobytes(data))
+    fec += b'\0' * (-len(fec) % 4)
+    out = bytearray()
+    for idx in range(0, len(fec), 4):
+        word = 0
+        for j in range(16):
+            word = (word << 2) | ((fec[idx + 3 - (j & 3)] >> (2 * (j >> 2))) & 3)
+        out += word.to_bytes(4, 'big')
+    return bytes(out)
+
+def fec_decode(data):
+    '''
+    whole 4-byte blocks only; two data bytes come out of each.  the decoder
+    starts in state 0 and traces back from the best final state (lowest
+    state number on ties, and the 0 predecessor when two paths tie).
+    '''
+    data = _tobytes(data)
+    syms = []
+    for idx in range(0, len(data) - 3, 4):
+        word = int.from_bytes(data[idx:idx + 4], 'big')
+        fec = [0, 0, 0, 0]
+        for j in range(16):
+            fec[3 - (j & 3)] |= ((word >> (30 - 2 * j)) & 3) << (2 * (j >> 2))
+        for byte in fec:
+            syms.extend(((byte >> 6) & 3, (byte >> 4) & 3, (byte >> 2) & 3, byte & 3))
+
+    cost = [[bin(out ^ sym).count('1') for out in FEC_TABLE] for sym in range(4)]
+    metric = [0] + [_FEC_INF] * 7
+    paths = []
+    for sym in syms:
+        csym = cost[sym]
+        new = [0] * 8
+        choice = 0
+        for nstate in range(8):
+            u = nstate & 1
+            p0 = nstate >> 1
+            p1 = p0 | 4
+            c0 = metric[p0] + csym[(p0 << 1) | u]
+            c1 = metric[p1] + csym[(p1 << 1) | u]
+            if c0 <= c1:
+                new[nstate] = c0
+            else:
+                new[nstate] = c1
+                choice |= 1 << nstate
+        metric = new
+        paths.append(choice)
+
+    state = metric.index(min(metric))
+    errors = metric[state] if syms else 0
+    num = 0
+    for step in range(len(paths) - 1, -1, -1):
+        num |= (state & 1) << (len(paths) - 1 - step)
+        state = (state >> 1) | (((paths[step] >> state) & 1) << 2)
+    return num.to_bytes(len(paths) // 8, 'big'), errors
+
+
+KERNELS = ('shift', 'extract', 'unpack_bits', 'invert',
+           'manchester_decode', 'manchester_encode',
+           'biphase_decode', 'biphase_encode', 'pn9', 'lfsr7', 'autocorr',
+           'fec_encode', 'fec_decode')
+
+# the pure-Python versions stay reachable for testing and benchmarking
+PY_KERNELS = dict([(name, globals()[name]) for name in KERNELS])
+
+try:
+    from ._bitkern import (shift, extract, unpack_bits, invert,
+            manchester_decode, manchester_encode,
+            biphase_decode, biphase_encode, pn9, lfsr7, autocorr,
+            fec_encode, fec_decode)
+    NATIVE = True
+except ImportError:
+    pass
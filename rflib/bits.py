@@ -1,6 +1,10 @@
 from binascii import hexlify
 import sys
 import struct
+import bisect
+import re
+
+from . import bitkern
 
 fmtsLSB = [None, b"B", b"<H", b"<I", b"<I", b"<Q", b"<Q", b"<Q", b"<Q"]
 fmtsMSB = [None, b"B", b">H", b">I", b">I", b">Q", b">Q", b">Q", b">Q"]
@@ -91,16 +95,10 @@ def bitReverse(num, bitcnt):
 
 def shiftString(string, bits):
     '''
+    shift the whole string left by 'bits', zero-filling the end.
     In Python3, use bytes instead of a str
     '''
-    carry = 0
-    news = []
-    for x in range(len(string)-1):
-        newc = ((string[x] << bits) + (string[x+1] >> (8-bits))) & 0xff
-        news.append(b"%c"%newc)
-    newc = (ord23(string[-1])<<bits) & 0xff
-    news.append(b"%c"%newc)
-    return b"".join(news)
+    return bitkern.shift(string, bits)
 
 def getNextByte_feedbackRegister7bitsMSB():
     '''
@@ -142,6 +140,10 @@ def whitenData(data, seed=0xffff, getNextByte=getNextByte_feedbackRegister7bitsM
     global fbRegister
     fbRegister = seed
 
+    if getNextByte is getNextByte_feedbackRegister7bitsMSB:
+        out, fbRegister = bitkern.lfsr7(data[:-1], seed)
+        return out
+
     carry = 0
     news = []
     for x in range(len(data)-1):
@@ -149,6 +151,14 @@ def whitenData(data, seed=0xffff, getNextByte=getNextByte_feedbackRegister7bitsM
         news.append(b"%c" % newc)
     return b"".join(news)
 
+def pn9Whiten(data, seed=0x1ff):
+    '''
+    CC1111 data whitening (PKTCTRL0.WHITE_DATA): XOR with the PN9 sequence
+    (x^9 + x^5 + 1, register seeded all ones).  whitening is its own
+    inverse, so this also de-whitens captured data.
+    '''
+    return bitkern.pn9(data, seed)
+
 def findSyncWord(byts, sensitivity=4, minpreamble=2): 
         '''
         seek SyncWords from a raw bitstream.  
@@ -305,6 +315,109 @@ def findSyncWordDoubled(byts, sensitivity=4, minpreamble=2):
         return possDwords
 
 
+class BitMatcher(object):
+    '''
+    find several bit patterns at every bit offset of a batch of packets at once,
+    allowing up to 'maxerrors' flipped bits (eg. maxerrors=1 behaves like the
+    radio's SYNCM_15_of_16 for a 16-bit sync word).
+
+    patterns may be:
+        bytes               - 8 bits per byte
+        (value, nbits)      - an arbitrary width pattern
+        int                 - a sync word: 16 bits, or 32 if it doesn't fit
+
+    this is bit-parallel shift-and (bitap with mismatches) where the "word" is
+    a Python int holding every bit of every packet in the batch: each pattern
+    bit costs a handful of big-int operations no matter how many packets or
+    alignments there are, so no shifted copies of the data are ever made.
+
+        bm = BitMatcher([0xd391, b'\x12\x34\x56'], maxerrors=1)
+        for pktidx, pattern, bitoff, errors in bm.searchBatch(packets):
+            ...
+    '''
+    def __init__(self, patterns, maxerrors=0):
+        self.maxerrors = maxerrors
+        self.patterns = []
+        for pattern in patterns:
+            if isinstance(pattern, tuple):
+                value, nbits = pattern
+            elif isinstance(pattern, int):
+                value, nbits = pattern, (16, 32)[pattern > 0xffff]
+            else:
+                value, nbits = int.from_bytes(pattern, 'big'), 8 * len(pattern)
+
+            if nbits <= maxerrors:
+                raise Exception("pattern %r is too short to allow %d errors" % (pattern, maxerrors))
+            self.patterns.append((pattern, value & ((1 << nbits) - 1), nbits))
+
+        self.maxbits = max([nbits for pattern, value, nbits in self.patterns] + [0])
+
+    def search(self, data):
+        '''
+        returns a list of (pattern, bit offset, errors) sorted by bit offset
+        '''
+        return [hit[1:] for hit in self.searchBatch([data])]
+
+    def searchBatch(self, packets):
+        '''
+        returns a list of (packet index, pattern, bit offset, errors), sorted by
+        packet and bit offset.  matches never span two packets.
+        '''
+        packets = [bytes(pkt) for pkt in packets]
+        data = b''.join(packets)
+        nbits = 8 * len(data)
+        if not nbits or not self.patterns:
+            return []
+
+        full = (1 << nbits) - 1
+        text = int.from_bytes(data, 'big')
+
+        # bit (nbits-1-i) of shifted[j] is bit i+j of the stream, so ANDing
+        # these lines up pattern bit j against every starting offset i at once
+        shifted = [(text << j) & full for j in range(self.maxbits)]
+
+        starts = [0]
+        for pkt in packets:
+            starts.append(starts[-1] + 8 * len(pkt))
+
+        valid = {}
+        hits = []
+        for pattern, value, plen in self.patterns:
+            # offsets where the whole pattern still fits inside its packet
+            mask = valid.get(plen)
+            if mask is None:
+                chunks = []
+                for pkt in packets:
+                    fit = max(0, 8 * len(pkt) - plen + 1)
+                    chunks.append((((1 << fit) - 1) << (8 * len(pkt) - fit)).to_bytes(len(pkt), 'big'))
+                mask = valid[plen] = int.from_bytes(b''.join(chunks), 'big')
+
+            # match[d]: offsets where the pattern bits so far differ in <= d places
+            match = [mask] * (self.maxerrors + 1)
+            for j in range(plen):
+                if (value >> (plen - 1 - j)) & 1:
+                    agree = shifted[j]
+                else:
+                    agree = full ^ shifted[j]
+                for d in range(self.maxerrors, 0, -1):
+                    match[d] = (match[d] & agree) | match[d-1]
+                match[0] &= agree
+
+            found = 0
+            for errors in range(self.maxerrors + 1):
+                vec = match[errors] & ~found
+                found |= vec
+                while vec:
+                    top = vec.bit_length() - 1
+                    vec ^= (1 << top)
+                    bitoff = nbits - 1 - top
+                    pktidx = bisect.bisect_right(starts, bitoff) - 1
+                    hits.append((pktidx, pattern, bitoff - starts[pktidx], errors))
+
+        hits.sort(key=lambda hit: (hit[0], hit[2], hit[3]))
+        return hits
+
+
 def getBit(data, bit):
     idx = bit // 8
     bidx = bit % 8
@@ -313,74 +426,129 @@ def getBit(data, bit):
 
 
 
-def detectRepeatPatterns(data:bytes, size=64, minEntropy=.07):
-    #FIXME: convert bytes to bit arrays before comparing.
-    patterns = []
-    c1 = 0
-    c2 = 0
-    d1 = 0
-    p1 = 0
-    mask = (1<<size) - 1
-    bitlen = 8*len(data)
-
-    while p1 < (bitlen-size-8):
-        d1 <<= 1
-        d1 |= getBit(data, p1)
-        d1 &= mask
-        #print(bin(d1))
-
-        if c1 < (size):
-            p1 += 1
-            c1 += 1
+def _zeroRuns(diff, nbits, minrun):
+    '''
+    yield (start, end) bit ranges of at least minrun zero bits in the nbits-wide
+    int diff.  the bulk of the search is a regex over whole zero bytes; only
+    the edges are looked at bit by bit.
+    '''
+    byts = diff.to_bytes((nbits + 7) // 8, 'big')
+    minbytes = max(1, (minrun - 14) // 8)
+    for match in re.finditer(rb'\x00{%d,}' % minbytes, byts):
+        start = 8 * match.start()
+        end = 8 * match.end()
+        if match.start() > 0:
+            low = byts[match.start() - 1]
+            start -= (low & -low).bit_length() - 1      # its trailing zeros
+        if match.end() < len(byts):
+            high = byts[match.end()]
+            end += 8 - high.bit_length()                # its leading zeros
+        end = min(end, nbits)
+        if end - start >= minrun:
+            yield start, end
+
+def findPeriodicity(data, minperiod=8, maxperiod=2048, minrun=64, maxbits=None, maxcandidates=5):
+    '''
+    look for repetition in a raw bitstream (eg. a lowball capture of a remote
+    that repeats its frame a few times).
+
+    the bit autocorrelation (of the first 'maxbits' bits, if given) is
+    computed for every lag in [minperiod, maxperiod] with bitkern.autocorr(),
+    which is linear in the data per lag.  the strongest peaks which aren't
+    multiples of a shorter peak are then checked against the whole capture
+    for runs of at least 'minrun' bits that repeat exactly.
+
+    returns a list (best first) of dicts:
+        period      - candidate frame length in bits
+        score       - normalized autocorrelation at that lag (1.0 == perfect)
+        repeats     - [(s1, s2, length, entropy), ...]: bits [s1, s1+length)
+                      equal bits [s2, s2+length), s2 = s1 + period.  entropy
+                      is the 0:1 ratio bitSectString() reports for that run.
+    '''
+    data = bytes(data)
+    nbits = 8 * len(data)
+    maxperiod = min(maxperiod, nbits - minrun)
+    if maxperiod < minperiod:
+        return []
+
+    est = data
+    if maxbits is not None:
+        est = data[:(maxbits + maxperiod + 7) // 8]
+    ebits = 8 * len(est)
+
+    # agreement expected by chance given the ratio of ones to zeros
+    dens = bitkern.popcount(int.from_bytes(est, 'big')) / float(ebits)
+    chance = dens * dens + (1 - dens) * (1 - dens)
+    if chance >= 1.0:
+        return []
+
+    scores = {}
+    mismatches = bitkern.autocorr(est, minperiod, maxperiod)
+    for lag, count in zip(range(minperiod, maxperiod + 1), mismatches):
+        agree = 1.0 - (count / float(ebits - lag))
+        scores[lag] = (agree - chance) / (1.0 - chance)
+
+    # median/MAD so the peaks themselves don't raise the noise floor, and
+    # never below what a coin-flip stream of this length could produce
+    vals = sorted(scores.values())
+    med = vals[len(vals) // 2]
+    mad = sorted([abs(v - med) for v in vals])[len(vals) // 2]
+    thresh = med + max(5 * 1.4826 * mad, 4.0 / (ebits ** .5))
+
+    # local maxima, widening the neighborhood with the lag so a comb of
+    # preamble peaks doesn't drown the frame period
+    peaks = []
+    for lag in range(minperiod, maxperiod + 1):
+        score = scores[lag]
+        if score < thresh:
             continue
-
-        d2 = 0
-        p2 = p1+size
-        while p2 < (bitlen):
-            d2 <<= 1
-            d2 |= getBit(data, p2)
-            d2 &= mask
-            #print(bin(d2))
-
-            if c2 < (size):
-                p2 += 1
-                c2 += 1
+        width = max(2, lag // 16)
+        left = [scores.get(x, -1) for x in range(lag - width, lag)]
+        right = [scores.get(x, -1) for x in range(lag + 1, lag + width + 1)]
+        if score > max(left) and score >= max(right):
+            peaks.append(lag)
+
+    # a multiple of a shorter period is only its harmonic unless it
+    # correlates clearly better (eg. byte structure at 8 vs. a frame at 232)
+    periods = []
+    for lag in peaks:
+        if any([min(lag % p, p - lag % p) <= 1 and scores[lag] <= scores[p] + (thresh - med)
+                for p in periods]):
+            continue
+        periods.append(lag)
+
+    periods.sort(key=lambda lag: -scores[lag])
+    num = int.from_bytes(data, 'big')
+    results = []
+    for lag in periods[:maxcandidates]:
+        diff = (num ^ (num >> lag)) & ((1 << (nbits - lag)) - 1)
+        repeats = []
+        for start, end in _zeroRuns(diff, nbits, minrun):
+            start = max(start, lag)     # the first 'lag' bits have nothing to match
+            if end - start < minrun:
                 continue
+            bitSection, ent = bitSectString(data, start, end)
+            repeats.append((start - lag, start, end - start, ent))
+
+        results.append({'period': lag, 'score': scores[lag], 'repeats': repeats})
+
+    return results
+
+def detectRepeatPatterns(data:bytes, size=64, minEntropy=.07):
+    '''
+    find runs of at least 'size' bits which repeat later in data.
+    returns [(s1, s2, length, firstbits), ...]: bits [s1, s1+length) equal bits
+    [s2, s2+length), and firstbits is the first 'size' bits of the run as an int.
+    runs with entropy (see bitSectString) at or below minEntropy are skipped.
 
-            if d1 == d2 and d1 > 0:
-                s1 = p1 - size
-                s2 = p2 - size
-                print("s1: %d\t  p1: %d\t  " % (s1, p1))
-                print("s2: %d\t  p2: %d\t  " % (s2, p2))
-                # complete the pattern until the numbers differ or meet
-                while True:
-                    p1 += 1
-                    p2 += 1
-                    #print("s1: %d\t  p1: %d\t  " % (s1, p1))
-                    #print("s2: %d\t  p2: %d\t  " % (s2, p2))
-                    if p2 >= bitlen:
-                        break
-
-                    b1 = getBit(data,p1)
-                    b2 = getBit(data,p2)
-
-                    if p1 == s2 or b1 != b2:
-                        break
-
-                length = p1 - s1
-                c2 = 0
-                p2 -= size
-
-                bitSection, ent = bitSectString(data, s1, s1+length)
-                if ent > minEntropy:
-                    print("success:")
-                    print("  * bit idx1: %4d (%4d bits) - '%s' %s" % (s1, length, bin(d1), hexlify(bitSection)))
-                    print("  * bit idx2: %4d (%4d bits) - '%s'" % (s2, length, bin(d2)))
-                    patterns.append((s1, s2, length, d1))
-            #else:
-            #    print("  * idx1: %d - '%s'  * idx2: %d - '%s'" % (p1, d1, p2, d2))
-            p2 += 1
-        p1 += 1
+    see findPeriodicity() for the analysis behind this
+    '''
+    patterns = []
+    for cand in findPeriodicity(data, minrun=size):
+        for s1, s2, length, ent in cand['repeats']:
+            if ent > minEntropy:
+                firstbits = int.from_bytes(bitSectString(data, s1, s1 + size)[0], 'big')
+                patterns.append((s1, s2, length, firstbits))
 
     return patterns
 
@@ -390,41 +558,9 @@ def bitSectString(string, startbit, endbit):
     bitsects a string... ie. chops out the bits from the middle of the string
     returns the new string and the entropy (ratio of 0:1)
     '''
-    ones = 0
-    zeros = 0
-    entropy = [zeros, ones]
-
-    s = b''
-    bit = startbit
-
-    Bidx = bit // 8
-    bidx = (bit % 8)
-
-    while bit < endbit:
-
-        byte1 = string[Bidx]
-        try:
-            byte2 = string[Bidx+1]
-        except IndexError:
-            byte2 = 0
+    s, ones = bitkern.extract(string, startbit, endbit)
+    entropy = [(8 * len(s)) - ones, ones]
 
-        byte = (byte1 << bidx) & 0xff
-        byte |= (byte2 >> (8-bidx))
-        #calculate entropy over the byte
-        for bi in range(8):
-            b = (byte>>bi) & 1
-            entropy[b] += 1
-
-        bit += 8
-        Bidx += 1
-
-        if bit > endbit:
-            diff = bit-endbit
-            mask = ~ ( (1<<diff) - 1 )
-            byte &= mask
-
-        s += correctbytes(byte)
-    
     ent = (min(entropy)+1.0) / (max(entropy)+1)
     #print("entropy: %f" % ent)
     return (s, ent)
@@ -438,14 +574,7 @@ def genBitArray(string, startbit, endbit):
     '''
     binStr, ent = bitSectString(string, startbit, endbit)
 
-    s = []
-    for byte in binStr:
-        byte = byte
-        for bitx in range(7, -1, -1):
-            bit = (byte>>bitx) & 1
-            s.append(bit)
-
-    return (s, ent)
+    return (bitkern.unpack_bits(binStr), ent)
 
 
 chars_top = [
@@ -511,83 +640,32 @@ def reprBitArray(bitAry, width=194):
     return b"\n".join([tops, mids, bots])
 
 def invertBits(data):
-    output = []
-    ldata = len(data)
-    off = 0
-
-    if ldata&1:
-        output.append( correctbytes( ord( data[0:1] ) ^ 0xff) )
-        off = 1
-
-    if ldata&2:
-        output.append( struct.pack( "<H", struct.unpack( "<H", data[off:off+2] )[0] ^ 0xffff) )
-        off += 2
+    return bitkern.invert(data)
 
-    #method 1
-    #for idx in xrange( off, ldata, 4):
-    #    output.append( struct.pack( "<I", struct.unpack( "<I", data[idx:idx+4] )[0] & 0xffff) )
 
-    #method2
-    count = ldata // 4
-    #print(ldata, count)
-    numlist = struct.unpack(b"<%dI" % count, data[off:] )
-    modlist = [ struct.pack(b"<L", (x^0xffffffff) ) for x in numlist ]
-    output.extend(modlist)
-
-    return b''.join(output)
-
-
-def diff_manchester_decode(data, align=False):
-    # FIXME: not validated.  must find reference to validate against
+def diff_manchester_decode(data, align=False, polarity=1):
     '''
     differential manchester encoding/decoding uses 2 symbols per data bit.
     there must always be a transition between the first and second symbol of a bit.
-    bit values are determined by the existence/lack of transition between symbol pairs
+    bit values are determined by the existence/lack of transition between symbol pairs:
+    a transition decodes as 'polarity' (IEEE 802.5 uses 0; this has always
+    returned 1), and the line is taken to idle low before the first bit.
 
     set align=True to allow *one* sync of the bits to clock.  ie, either the whole 
     thing lines up with a transition in the middle of every bit, or shift one, and
     try again.  one way *must* have transitions, or failure occurs
-    '''
-    syncd = False
-
-    out = []
-    last = 0
-    obyte = 0
-    for bidx in range(len(data)):
-        byte = ord(data[bidx:bidx+1])
-        for y in range(6, -1, -2):
-            if not syncd:
-                diff = last & 1
-                bit0 = (byte >> (y+1)) & 1
-                bit1 = (byte >> y) & 1
-            else:
-                diff = last >> 1
-                bit0 = last & 1
-                bit1 = (byte >> (y+1)) & 1
-
-            if bit0 == bit1:
-                if syncd or not align:
-                    raise Exception("Differential Manchester Decoder cannot work with this data.  Sync fault at index %d,%d" % (bidx, y))
-
-                syncd = 1
-                # redo the last stuff with new info
-                diff = last >> 1
-                bit0 = last & 1
-                bit1 = (byte >> (y+1)) & 1
-
-            obyte <<= 1
-            if diff != bit0:
-                obyte |= 1
 
-            last = (bit0 << 1) | bit1
-        if (bidx & 1): 
-            out.append(correctbytes(obyte))
-            obyte = 0
+    see rflib.linecode.detect() to find coded runs in noisier data.
+    '''
+    from . import linecode
+    trans = linecode.transitions(bytes(data))
+    for start in range((1, 2)[bool(align)]):
+        mid = trans[start + 1::2]
+        if '0' not in mid:
+            return linecode.diff_manchester_decode(data, polarity, start=start)
 
-    if not (bidx & 1):
-        obyte << 4 # pad 0's on end
-        out.append(correctbytes(obyte))
-    return ''.join(out)
+    fault = mid.index('0')
+    raise Exception("Differential Manchester Decoder cannot work with this data.  Sync fault at index %d,%d" % divmod(2 * fault + start, 8))
 
 
 
@@ -617,102 +695,62 @@ def biphase_mark_coding_encode(data):
 
     return ''.join(out)
 
-def manchester_decode(data, hilo=1):
-    out = []
-    last = 0
-    obyte = 0
-    for bidx in range(len(data)):
-        byte = ord(data[bidx:bidx+1])
-        for y in range(7, -1, -1):
-            bit = (byte >> y) & 1
-
-            if not (y & 1):   # every other bit counts
-                obyte <<= 1
-                if bit and not last:
-                    if not hilo:
-                        obyte |= 1
-                elif last and not bit:
-                    if hilo:
-                        obyte |= 1
+def biphase_mark_decode(data):
+    '''
+    biphase mark (BMC/FM1): every bit starts with a transition, and a 1 has
+    another one mid-bit.  so a symbol pair decodes to 1 when its halves
+    differ, regardless of line polarity.  an odd trailing byte fills the
+    high nibble of the last output byte.
+    '''
+    return bitkern.biphase_decode(data)
 
-            last = bit
-        if (bidx & 1): 
-            out.append(correctbytes(obyte))
-            obyte = 0
+def biphase_mark_encode(data, level=0):
+    '''
+    biphase mark encoder.  'level' is the line level before the first bit;
+    returns (symbols, level after the last bit) so long messages can be
+    encoded in chunks.
+    '''
+    return bitkern.biphase_encode(data, level)
 
-    if not (bidx & 1):
-        obyte << 4 # pad 0's on end
-        out.append(correctbytes(obyte))
-    return ''.join(out)
+def manchester_decode(data, hilo=1):
+    '''
+    every 2 symbols make one bit: with hilo, 10 is a 1 and 01 is a 0
+    (01 is the 1 otherwise).  invalid pairs (00/11) decode as 0.
+    an odd trailing byte fills the high nibble of the last output byte.
+    '''
+    return bitkern.manchester_decode(data, hilo)
 
 def manchester_encode(data, hilo=1):
     '''
     for the sake of testing.
     assumings msb, and 
     '''
-    if hilo:
-        bits = (0b01, 0b10)
-    else:
-        bits = (0b10, 0b01)
-
-    out = []
-    for bidx in range(len(data)):
-        byte = ord(data[bidx:bidx+1])
-        obyte = 0
-        for bitx in range(7,-1,-1):
-            bit = (byte>>bitx) & 1
-            obyte <<= 2
-            obyte |= bits[bit]
-
-        out.append(struct.pack(">H", obyte))
-    return ''.join(out)
+    return bitkern.manchester_encode(data, hilo)
 
 def findManchesterData(data, hilo=1):
-    poss = []
-
-    for x in range(8):
-        try:
-            newdata = shiftString(data, x)
-            thing = manchester_decode(x, newdata)
-            poss.append(thing)
-        except:
-            pass
+    '''
+    manchester_decode() of data shifted by 0-7 bits (only the first two
+    shifts differ in more than the bits dropped off the front)
+    '''
+    return [manchester_decode(shiftString(data, x), hilo) for x in range(8)]
 
 def findManchester(data, minbytes=10):
-    print("DEBUG: DATA=" + repr(data))
-    success = []
-
-    last = 0
-    last2 = 0
-    lastCount = 0
-    minbits = minbytes * 8
-
-    for bidx in range(len(data)):
-        byt = ord(data[bidx:bidx+1])
-        for btidx in range(0, 8, 2):
-            # compare every other bits
-            bit = (byt>>(8-btidx)) & 1
+    '''
+    find runs of valid manchester symbols (a transition in the middle of
+    every bit) at least 'minbytes' decoded bytes long.
 
-            if (bit + last + last2) in (1,2):
-                lastCount += 1
-            else:
-                # we're done, or not started
-                if lastCount >= minbits:
-                    lenbytes = lastCount // 8
-                    lenbits = lastCount % 8
-                    startbyte = bidx - lenbytes
-                    if lenbits > btidx:
-                        startbyte += 1
-                        lenbits -= 8
-                    startbit = btidx - lenbits
-
-                    stopbyte = startbyte + lenbytes + (0,1)[lenbits>0]
-                    bytez = data[startbyte:stopbyte]
-
-                    success.append((bidx, startbyte, startbit, bytez))
-                lastCount = 0
-            # cycle through
-            last2 = last
-            last = bit
+    returns [(endbyte, startbyte, startbit, bytez), ...]: the run starts at
+    bit 'startbit' of byte 'startbyte' and ends in byte 'endbyte'; bytez are
+    the raw bytes it covers.  see rflib.linecode.detect() for the decoding
+    and the other line codes.
+    '''
+    from . import linecode
+    success = []
+    for cand in linecode.detect(data, 8 * minbytes, codes=('manchester',)):
+        if cand.polarity != 1:
+            continue
+        startbyte, startbit = divmod(cand.start, 8)
+        endbyte = (cand.start + 2 * cand.length - 1) // 8
+        success.append((endbyte, startbyte, startbit, data[startbyte:endbyte + 1]))
+    success.sort()
     return success
-
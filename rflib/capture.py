@@ -0,0 +1,534 @@
+'''
+rfcat capture files
+
+an append-only binary log of received packets, cheap to write from a receive
+loop and cheap to read back without loading the whole thing into memory.
+
+    file header     "<8sHHd"    magic, version, header size, creation time
+    records         "<BBHdIBB"  type, flags, payload length, timestamp,
+                                radio-config fingerprint, rssi, lqi
+                                followed by 'payload length' bytes
+    index           "<%dQ"      file offset of every packet record,
+                                then of every config record
+    trailer         "<8sQQQ"    index magic, packet count, config count,
+                                index offset
+
+REC_CONFIG records carry the 0xdf00 radio config block a following run of
+packets was received with; REC_PKT records point back at it by fingerprint
+(crc32 of the config registers).  rssi/lqi are the raw status bytes the
+radio appends with PKTCTRL1.APPEND_STATUS (REC_F_STATUS set when present).
+
+the index and trailer are written by close().  a file without them (the
+writer died, or is still writing) is still readable: the reader just scans
+the records, and CaptureWriter(..., append=True) picks up where it left off.
+
+    with CaptureWriter('fob.rfcap') as cap:
+        cap.setRadioConfig(d.getRadioConfig())
+        cap.append(*d.RFrecv())
+
+    cap = CaptureReader('fob.rfcap')
+    for data, timestamp in cap.packets():
+        ...
+
+for long unattended sniffing, CaptureRecorder drains received packets into a
+rotating set of these files from a background thread.  gzip'd segments it
+leaves behind can be opened with CaptureReader too (read into memory).
+'''
+from __future__ import print_function
+
+import os
+import sys
+import glob
+import gzip
+import mmap
+import zlib
+import time
+import array
+import queue
+import pickle
+import shutil
+import struct
+import threading
+import collections
+
+from .const import RF_CFG_REG_COUNT, APP_NIC, NIC_RECV, PKTCTRL1_APPEND_STATUS
+
+CAP_MAGIC = b'RFCAP\x00\x01\x00'
+IDX_MAGIC = b'RFCAPIDX'
+CAP_VERSION = 1
+
+FILE_HDR = struct.Struct("<8sHHd")
+REC_HDR = struct.Struct("<BBHdIBB")
+TRAILER = struct.Struct("<8sQQQ")
+
+REC_PKT = 1
+REC_CONFIG = 2
+
+REC_F_STATUS = 1        # rssi/lqi are valid
+
+Packet = collections.namedtuple('Packet', 'data timestamp rssi lqi fingerprint')
+
+
+def configFingerprint(bytedef):
+    '''
+    crc32 of the radio config registers (the status registers past
+    RF_CFG_REG_COUNT change on their own, so they're left out)
+    '''
+    return zlib.crc32(bytes(bytedef[:RF_CFG_REG_COUNT])) & 0xffffffff
+
+
+class CaptureWriter(object):
+    '''
+    append packets to a capture file.  each append() is a single write() of
+    header+payload, so the file is always a valid prefix of records.
+    '''
+    def __init__(self, filename, append=False):
+        self.filename = filename
+        self.fingerprint = 0
+        self.offsets = array.array('Q')
+        self.cfgoffsets = array.array('Q')
+        self.configs = {}
+
+        if append and os.path.exists(filename) and os.path.getsize(filename):
+            # reuse the index we have, and write a new one on close
+            reader = CaptureReader(filename)
+            self.offsets.extend(reader._offsets)
+            self.cfgoffsets.extend(reader._cfgoffsets)
+            self.configs.update(reader.configs)
+            end = reader._end
+            reader.close()
+
+            self.fd = open(filename, 'r+b')
+            self.fd.seek(end)
+            self.fd.truncate()
+        else:
+            self.fd = open(filename, 'wb')
+            self.fd.write(FILE_HDR.pack(CAP_MAGIC, CAP_VERSION, FILE_HDR.size, time.time()))
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __len__(self):
+        return len(self.offsets)
+
+    def setRadioConfig(self, bytedef, timestamp=None):
+        '''
+        note the radio config following packets are received with.  the
+        config block is only written when it hasn't been seen in this file.
+        '''
+        fp = configFingerprint(bytedef)
+        if fp not in self.configs:
+            if timestamp is None:
+                timestamp = time.time()
+            self.configs[fp] = bytes(bytedef)
+            self.cfgoffsets.append(self.fd.tell())
+            self.fd.write(REC_HDR.pack(REC_CONFIG, 0, len(bytedef), timestamp, fp, 0, 0) + bytes(bytedef))
+        self.fingerprint = fp
+
+    def append(self, data, timestamp=None, rssi=None, lqi=None):
+        if timestamp is None:
+            timestamp = time.time()
+        flags = 0
+        if rssi is not None:
+            flags |= REC_F_STATUS
+
+        self.offsets.append(self.fd.tell())
+        self.fd.write(REC_HDR.pack(REC_PKT, flags, len(data), timestamp, self.fingerprint,
+                                   (rssi or 0) & 0xff, (lqi or 0) & 0xff) + bytes(data))
+
+    def flush(self):
+        self.fd.flush()
+
+    def close(self):
+        if self.fd is None:
+            return
+        idxoff = self.fd.tell()
+        self.fd.write(self.offsets.tobytes())
+        self.fd.write(self.cfgoffsets.tobytes())
+        self.fd.write(TRAILER.pack(IDX_MAGIC, len(self.offsets), len(self.cfgoffsets), idxoff))
+        self.fd.close()
+        self.fd = None
+
+
+class CaptureReader(object):
+    '''
+    read a capture file through mmap.  len(), indexing and slicing work off
+    the trailing index (or a scan of the records if the file has none), and
+    only the records actually touched are paged in.
+    '''
+    def __init__(self, filename):
+        self.filename = filename
+        self.configs = {}
+        self.fd = open(filename, 'rb')
+        if self.fd.read(2) == b'\x1f\x8b':
+            # a gzip'd segment from CaptureRecorder: no mmap for these
+            self.fd.seek(0)
+            with gzip.GzipFile(fileobj=self.fd) as gz:
+                self.mm = gz.read()
+            size = len(self.mm)
+        else:
+            size = os.fstat(self.fd.fileno()).st_size
+            self.mm = None
+            if size:
+                self.mm = mmap.mmap(self.fd.fileno(), 0, access=mmap.ACCESS_READ)
+
+        if size >= FILE_HDR.size:
+            magic, version, hdrsize, self.created = FILE_HDR.unpack_from(self.mm, 0)
+        if size < FILE_HDR.size or magic != CAP_MAGIC:
+            self.close()
+            raise Exception("%s: not an rfcat capture file" % filename)
+        self._start = hdrsize
+
+        self._offsets = array.array('Q')
+        self._cfgoffsets = array.array('Q')
+        if size >= self._start + TRAILER.size:
+            magic, count, cfgcount, idxoff = TRAILER.unpack_from(self.mm, size - TRAILER.size)
+            if magic == IDX_MAGIC and idxoff + 8 * (count + cfgcount) + TRAILER.size == size:
+                self._offsets.frombytes(self.mm[idxoff:idxoff + 8 * count])
+                self._cfgoffsets.frombytes(self.mm[idxoff + 8 * count:idxoff + 8 * (count + cfgcount)])
+                self._end = idxoff
+                for off in self._cfgoffsets:
+                    self._loadConfig(off)
+                return
+
+        self._scan(size)
+
+    def _loadConfig(self, off):
+        rtype, flags, length, ts, fp, rssi, lqi = REC_HDR.unpack_from(self.mm, off)
+        self.configs[fp] = self.mm[off + REC_HDR.size:off + REC_HDR.size + length]
+
+    def _scan(self, size):
+        # no index: walk the records, stopping at a torn write at the end
+        off = self._start
+        while off + REC_HDR.size <= size:
+            rtype, flags, length, ts, fp, rssi, lqi = REC_HDR.unpack_from(self.mm, off)
+            if off + REC_HDR.size + length > size or rtype not in (REC_PKT, REC_CONFIG):
+                break
+            if rtype == REC_PKT:
+                self._offsets.append(off)
+            else:
+                self._cfgoffsets.append(off)
+                self._loadConfig(off)
+            off += REC_HDR.size + length
+        self._end = off
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def close(self):
+        if isinstance(self.mm, mmap.mmap):
+            self.mm.close()
+        self.mm = None
+        if self.fd is not None:
+            self.fd.close()
+            self.fd = None
+
+    def __len__(self):
+        return len(self._offsets)
+
+    def _packet(self, off):
+        rtype, flags, length, ts, fp, rssi, lqi = REC_HDR.unpack_from(self.mm, off)
+        data = self.mm[off + REC_HDR.size:off + REC_HDR.size + length]
+        if flags & REC_F_STATUS:
+            return Packet(data, ts, rssi, lqi, fp)
+        return Packet(data, ts, None, None, fp)
+
+    def __getitem__(self, idx):
+        if isinstance(idx, slice):
+            return [self._packet(off) for off in self._offsets[idx]]
+        return self._packet(self._offsets[idx])
+
+    def __iter__(self):
+        for off in self._offsets:
+            yield self._packet(off)
+
+    def packets(self):
+        '''
+        (data, timestamp) tuples, the same shape RFrecv() and RFcapture() give
+        '''
+        for pkt in self:
+            yield pkt.data, pkt.timestamp
+
+    def radioConfig(self, pkt):
+        '''
+        the radio config block a Packet was received with (or None)
+        '''
+        return self.configs.get(pkt.fingerprint)
+
+
+class CaptureRecorder(object):
+    '''
+    record everything the dongle receives into rotating capture files, from
+    background threads, with bounded memory:
+
+        drain thread    moves NIC_RECV messages out of the dongle's mailbox
+                        (swapping the list under rsema, so the USB receive
+                        thread is never held up) into a bounded queue.  if the
+                        disk can't keep up and the queue fills, packets are
+                        counted as dropped rather than piling up in memory.
+        writer thread   writes whatever is queued as one group, then flushes
+                        (and fsync()s, if asked) once per group.  segments
+                        roll over at 'maxbytes', are gzip'd if 'compress',
+                        and only the newest 'maxfiles' are kept (0: keep all).
+
+    files are named <basename>.<NNNN>.rfcap[.gz].  RFrecv() callers compete
+    with the recorder for packets, so don't mix the two.
+
+        rec = d.RFrecord('/data/garage')
+        ...
+        rec.printStats()
+        rec.stop()
+    '''
+    def __init__(self, dongle, basename, maxbytes=64*1024*1024, maxfiles=0, compress=False,
+                 maxqueue=100000, groupsize=1024, fsync=False, poll=.005):
+        self.dongle = dongle
+        self.basename = basename
+        self.maxbytes = maxbytes
+        self.maxfiles = maxfiles
+        self.compress = compress
+        self.groupsize = groupsize
+        self.fsync = fsync
+        self.poll = poll
+
+        self._queue = queue.Queue(maxqueue)
+        self._stopping = threading.Event()
+        self._threads = []
+        self._writer = None
+        self._segment = self._lastSegment()
+
+        self.radiocfg = None
+        self.appendStatus = False
+
+        self.packets = 0
+        self.bytes = 0
+        self.dropped = 0
+        self.groups = 0
+        self.maxdepth = 0
+        self.files = []
+        self.started = None
+        self.stopped = None
+        self._ratemark = (0, 0, 0)      # time, packets, bytes at the last stats()
+
+    def _lastSegment(self):
+        # carry on numbering after any segments already on disk
+        segs = [os.path.basename(fn)[len(os.path.basename(self.basename)) + 1:].split('.')[0]
+                for fn in glob.glob('%s.*.rfcap*' % self.basename)]
+        nums = [int(seg) for seg in segs if seg.isdigit()]
+        return max(nums + [-1]) + 1
+
+    def start(self):
+        self.radiocfg = self.dongle.getRadioConfig()
+        self.appendStatus = bool(self.dongle.radiocfg.pktctrl1 & PKTCTRL1_APPEND_STATUS)
+        self.started = time.time()
+        self._ratemark = (self.started, 0, 0)
+        self._stopping.clear()
+
+        for target in (self._drainloop, self._writeloop):
+            thread = threading.Thread(target=target)
+            thread.daemon = True
+            thread.start()
+            self._threads.append(thread)
+        return self
+
+    def stop(self):
+        '''
+        stop draining, write out what's queued and close the current segment
+        '''
+        self._stopping.set()
+        for thread in self._threads:
+            thread.join()
+        self._threads = []
+        self.stopped = time.time()
+
+    def isRunning(self):
+        return len(self._threads) > 0
+
+    ##### drain thread #####
+    def _drain(self):
+        mbox = self.dongle.recv_mbox.get(APP_NIC)
+        if not mbox or not mbox.get(NIC_RECV):
+            return []
+
+        with self.dongle.rsema:
+            msgs = mbox.get(NIC_RECV)
+            mbox[NIC_RECV] = []
+        return msgs
+
+    def _drainloop(self):
+        while not self._stopping.is_set():
+            msgs = self._drain()
+            for msg, ts in msgs:
+                try:
+                    self._queue.put_nowait((msg[4:], ts))
+                except queue.Full:
+                    self.dropped += 1
+
+            depth = self._queue.qsize()
+            if depth > self.maxdepth:
+                self.maxdepth = depth
+            if not msgs:
+                self._stopping.wait(self.poll)
+
+        self._queue.put(None)           # tell the writer we're done
+
+    ##### writer thread #####
+    def _segmentName(self):
+        return '%s.%.4d.rfcap' % (self.basename, self._segment)
+
+    def _openSegment(self):
+        fn = self._segmentName()
+        self._writer = CaptureWriter(fn)
+        self._writer.setRadioConfig(self.radiocfg)
+        self.files.append(fn)
+
+    def _closeSegment(self):
+        self._writer.close()
+        fn = self._writer.filename
+        self._writer = None
+        self._segment += 1
+
+        if self.compress:
+            with open(fn, 'rb') as src:
+                with gzip.open(fn + '.gz', 'wb') as dst:
+                    shutil.copyfileobj(src, dst)
+            os.unlink(fn)
+            self.files[-1] = fn + '.gz'
+
+        while self.maxfiles and len(self.files) > self.maxfiles:
+            os.unlink(self.files.pop(0))
+
+    def _commit(self):
+        self._writer.flush()
+        if self.fsync:
+            os.fsync(self._writer.fd.fileno())
+
+    def _write(self, group):
+        for data, ts in group:
+            if self._writer is None:
+                self._openSegment()
+
+            if self.appendStatus and len(data) >= 2:
+                self._writer.append(data, ts, data[-2], data[-1])
+            else:
+                self._writer.append(data, ts)
+            self.bytes += len(data)
+            self.packets += 1
+
+            if self._writer.fd.tell() >= self.maxbytes:
+                self._commit()
+                self._closeSegment()
+
+        # group commit: one flush (and fsync) per batch of packets
+        if self._writer is not None:
+            self._commit()
+        self.groups += 1
+
+    def _writeloop(self):
+        done = False
+        while not done:
+            group = [self._queue.get()]
+            while len(group) < self.groupsize:
+                try:
+                    group.append(self._queue.get_nowait())
+                except queue.Empty:
+                    break
+
+            if group[-1] is None:
+                group.pop()
+                done = True
+
+            try:
+                if group:
+                    self._write(group)
+            except Exception:
+                sys.excepthook(*sys.exc_info())
+
+        if self._writer is not None:
+            self._closeSegment()
+
+    ##### stats #####
+    def stats(self):
+        '''
+        returns a dict of counters, and rates both overall and since the last
+        call to stats()
+        '''
+        now = (self.stopped or time.time())
+        elapsed = max(now - (self.started or now), 1e-9)
+        marktime, markpkts, markbytes = self._ratemark
+        interval = max(now - marktime, 1e-9)
+        self._ratemark = (now, self.packets, self.bytes)
+
+        return {
+                'packets':      self.packets,
+                'bytes':        self.bytes,
+                'dropped':      self.dropped,
+                'groups':       self.groups,
+                'queue_depth':  self._queue.qsize(),
+                'queue_max':    self.maxdepth,
+                'files':        list(self.files),
+                'elapsed':      elapsed,
+                'pkts_per_sec': self.packets / elapsed,
+                'bytes_per_sec': self.bytes / elapsed,
+                'recent_pkts_per_sec': (self.packets - markpkts) / interval,
+                'recent_bytes_per_sec': (self.bytes - markbytes) / interval,
+                }
+
+    def reprStats(self):
+        st = self.stats()
+        return '\n'.join([
+            "Recorder:      %s (%s)" % (self.basename, ('stopped', 'running')[self.isRunning()]),
+            "Packets:       %d (%d bytes) in %d groups, %d dropped" % (st['packets'], st['bytes'], st['groups'], st['dropped']),
+            "Rate:          %.1f pkts/s, %.1f bytes/s (recent: %.1f pkts/s)" % (st['pkts_per_sec'], st['bytes_per_sec'], st['recent_pkts_per_sec']),
+            "Queue depth:   %d (max %d)" % (st['queue_depth'], st['queue_max']),
+            "Files:         %d (current: %s)" % (len(st['files']), (st['files'] or ['-'])[-1]),
+            ])
+
+    def printStats(self):
+        print(self.reprStats())
+
+
+##### pickle lists (savePkts/RFcapture) <-> capture files #####
+def loadPickledPkts(filename):
+    '''
+    savePkts() appends one pickled list per call; return them all as one list
+    '''
+    pkts = []
+    with open(filename, 'rb') as fd:
+        while True:
+            try:
+                pkts.extend(pickle.load(fd))
+            except EOFError:
+                break
+    return pkts
+
+def pickleToCapture(pklfile, capfile, radiocfg=None):
+    '''
+    convert a savePkts() file (lists of (data, timestamp), or plain data)
+    into a capture file.  returns the number of packets written.
+    '''
+    with CaptureWriter(capfile) as cap:
+        if radiocfg is not None:
+            cap.setRadioConfig(radiocfg)
+        for pkt in loadPickledPkts(pklfile):
+            if isinstance(pkt, tuple):
+                cap.append(pkt[0], pkt[1])
+            else:
+                cap.append(pkt, 0.0)
+        return len(cap)
+
+def captureToPickle(capfile, pklfile):
+    '''
+    write a capture file out as a single savePkts()-style list of
+    (data, timestamp).  returns the number of packets written.
+    '''
+    with CaptureReader(capfile) as cap:
+        pkts = list(cap.packets())
+    with open(pklfile, 'wb') as fd:
+        pickle.dump(pkts, fd)
+    return len(pkts)
@@ -17,7 +17,12 @@ import time
 import struct
 import pickle
 import threading
+import contextlib
+import collections
+import concurrent.futures
 from .chipcon_usb import *
+from . import capture as rfcapture
+from . import linecode
 from .bits import correctbytes, ord23
 from .const import *
 from binascii import hexlify
@@ -77,10 +82,240 @@ class EnDeCode(object):
         raise Exception("EnDeCode.encode() not implemented.  Each subclass must implement their own")
 
 
+_pipeline_decoder = None
+
+def _pipelineInit(decoder):
+    # runs once in each worker process: keep our own copy of the decoder
+    global _pipeline_decoder
+    _pipeline_decoder = decoder
+
+def _pipelineDecode(batch, decoder=None):
+    '''
+    decode a batch of (msg, ts).  returns ([(decoded, ts), ...], errors);
+    packets the decoder raises on (or returns None for) are dropped.
+    '''
+    decoder = decoder or _pipeline_decoder
+    out = []
+    errors = 0
+    for msg, ts in batch:
+        try:
+            msg = decoder.decode(msg)
+        except Exception:
+            errors += 1
+            continue
+        if msg is not None:
+            out.append((msg, ts))
+    return out, errors
+
+class DecodePipeline(object):
+    '''
+    fan received packets out to a pool of worker processes running an
+    EnDeCode's decode(), and hand the results back in the order the packets
+    were received (ie. by timestamp).  this keeps a CPU-heavy decoder off
+    the thread pulling packets from the dongle, and spreads it over cores.
+
+    the decoder is pickled into each worker once, so it must be picklable
+    (a module-level class, not one defined inside a function).  workers=0
+    decodes on the feeder thread instead, which is handy for debugging.
+
+    packets are sent to the workers 'batchsize' at a time (a partial batch
+    goes out when the source goes quiet), with at most 'maxpending' batches
+    in flight.  when the consumer falls behind, the feeder stops taking
+    packets and the dongle's mailbox absorbs them: stats() reports how often
+    and how long that happened.
+
+        pipe = d.RFpipeline(MyDecoder(), workers=4, batchsize=64)
+        for msg, ts in pipe:
+            ...
+        pipe.stop()
+
+    'source' is any iterable of (msg, ts); a None item means "nothing right
+    now" and flushes the partial batch.  NICxx11.RFpipeline() supplies one
+    that reads the radio (and sets 'stopevent' to end it).
+    '''
+    def __init__(self, source, decoder, workers=None, batchsize=64, maxpending=None, ordered=True, stopevent=None):
+        self.decoder = decoder
+        self.workers = workers
+        self.batchsize = max(1, batchsize)
+        self.ordered = ordered
+        if workers is None:
+            import multiprocessing
+            self.workers = multiprocessing.cpu_count()
+        self.maxpending = maxpending or 2 * max(1, self.workers)
+
+        self._source = source
+        self._pending = collections.deque()
+        self._cond = threading.Condition()
+        self._done = False
+        self._stop = stopevent or threading.Event()
+
+        self.packets_in = 0
+        self.packets_out = 0
+        self.errors = 0
+        self.batches = 0
+        self.maxdepth = 0
+        self.stalls = 0
+        self.stalltime = 0.0
+        self.waittime = 0.0
+        self._starttime = time.time()
+
+        self._pool = None
+        if self.workers:
+            self._pool = concurrent.futures.ProcessPoolExecutor(self.workers,
+                    initializer=_pipelineInit, initargs=(decoder,))
+
+        self._thread = threading.Thread(target=self._feedloop)
+        self._thread.daemon = True
+        self._thread.start()
+
+    def _wake(self, future=None):
+        with self._cond:
+            self._cond.notify_all()
+
+    def _submit(self, batch):
+        with self._cond:
+            if len(self._pending) >= self.maxpending:
+                self.stalls += 1
+                start = time.time()
+                while len(self._pending) >= self.maxpending and not self._stop.is_set():
+                    self._cond.wait(.1)
+                self.stalltime += time.time() - start
+
+            # stop() sets _stop under this lock before shutting the pool down, so a batch that
+            # gets here after that is dropped rather than handed to a dead pool
+            if self._stop.is_set():
+                return
+
+            if self._pool is None:
+                future = concurrent.futures.Future()
+                future.set_result(_pipelineDecode(batch, self.decoder))
+            else:
+                future = self._pool.submit(_pipelineDecode, batch)
+            self._pending.append(future)
+            self.batches += 1
+            self.maxdepth = max(self.maxdepth, len(self._pending))
+
+        future.add_done_callback(self._wake)
+
+    def _feedloop(self):
+        batch = []
+        try:
+            for pkt in self._source:
+                if self._stop.is_set():
+                    break
+                if pkt is not None:
+                    batch.append(pkt)
+                    self.packets_in += 1
+                    if len(batch) < self.batchsize:
+                        continue
+                if batch:
+                    self._submit(batch)
+                    batch = []
+            if batch and not self._stop.is_set():
+                self._submit(batch)
+        except:
+            sys.excepthook(*sys.exc_info())
+        finally:
+            with self._cond:
+                self._done = True
+                self._cond.notify_all()
+
+    def results(self, timeout=None):
+        '''
+        the next finished batch, as a list of (decoded, ts).  returns None
+        once the source is exhausted (or the pipeline stopped) and every
+        batch has been handed out.  raises ChipconUsbTimeoutException if
+        nothing arrives within 'timeout' seconds.
+        '''
+        start = time.time()
+        with self._cond:
+            while True:
+                if self._pending:
+                    if self.ordered:
+                        future = self._pending[0]
+                        break
+                    ready = [fut for fut in self._pending if fut.done()]
+                    if ready:
+                        future = ready[0]
+                        break
+                elif self._done:
+                    return None
+                if timeout is not None and time.time() - start >= timeout:
+                    raise ChipconUsbTimeoutException()
+                self._cond.wait(.1)
+
+        # wait outside the lock so the feeder can keep submitting
+        remaining = None
+        if timeout is not None:
+            remaining = max(0, timeout - (time.time() - start))
+        try:
+            out, errors = future.result(remaining)
+        except concurrent.futures.TimeoutError:
+            raise ChipconUsbTimeoutException()
+        self.waittime += time.time() - start
+        with self._cond:
+            self._pending.remove(future)
+            self.packets_out += len(out)
+            self.errors += errors
+            self._cond.notify_all()
+        return out
+
+    def __iter__(self):
+        while True:
+            out = self.results()
+            if out is None:
+                return
+            for pkt in out:
+                yield pkt
+
+    def stop(self):
+        with self._cond:
+            self._stop.set()
+            self._cond.notify_all()
+        self._thread.join(3)
+        if self._pool is not None:
+            for future in list(self._pending):
+                future.cancel()
+            self._pool.shutdown(wait=True)
+
+    def isRunning(self):
+        return not self._done
+
+    def stats(self):
+        elapsed = time.time() - self._starttime
+        return {
+            'workers': self.workers,
+            'batchsize': self.batchsize,
+            'packets_in': self.packets_in,
+            'packets_out': self.packets_out,
+            'errors': self.errors,
+            'batches': self.batches,
+            'depth': len(self._pending),
+            'maxdepth': self.maxdepth,
+            'maxpending': self.maxpending,
+            'stalls': self.stalls,
+            'stalltime': self.stalltime,
+            'waittime': self.waittime,
+            'elapsed': elapsed,
+            'rate': self.packets_out / max(elapsed, 1e-9),
+            }
+
+    def reprStats(self):
+        st = self.stats()
+        return ("%(packets_in)d in, %(packets_out)d out (%(rate).1f pkts/sec), %(errors)d errors, "
+                "%(workers)d workers x %(batchsize)d/batch, in flight %(depth)d/%(maxpending)d (max %(maxdepth)d), "
+                "feeder stalled %(stalls)d times for %(stalltime).3fs" % st)
+
+
 def savePkts(pkts, filename):
-    pickle.dump(pkts, file(filename, 'a'))
+    with open(filename, 'ab') as fd:
+        pickle.dump(pkts, fd)
 def loadPkts(filename):
-    return pickle.load( file(filename, 'r'))
+    '''
+    returns every list savePkts() appended to filename, as one list.
+    see rflib.capture for a format that doesn't need loading all at once.
+    '''
+    return rfcapture.loadPickledPkts(filename)
 
 def printSyncWords(syncworddict):
     print("SyncWords seen:")
@@ -99,8 +334,23 @@ class NICxx11(USBDongle):
     the same radio concepts (frequency, channels, etc) and functionality
     (AES, Manchester Encoding, etc).
     '''
-    def __init__(self, idx=0, debug=False, copyDongle=None, RfMode=RFST_SRX, safemode=False):
-        USBDongle.__init__(self, idx, debug, copyDongle, RfMode, safemode=safemode)
+    _rfreg_batch = None     # {offset: value} while inside rfRegisterBatch()
+
+    # host-side shadow of the 0xdf00 register block, see getRadioConfig()
+    _rfcfg = None           # the block as last fetched, plus our own writes since
+    _rfcfg_gen = None       # firmware config generation of the last fetch
+    _rfcfg_stale = True
+    _rfcfg_cache = True     # False for firmware without NIC_GET_RF_CONFIG
+    _rfcfg_hits = 0
+    _rfcfg_fetches = 0
+    _rfcfg_notices = 0
+
+    # commands after which the firmware may have rewritten config registers itself
+    _rfcfg_changing = frozenset((NIC_SET_RECV_LARGE, FHSS_NEXT_CHANNEL, FHSS_CHANGE_CHANNEL,
+                                 FHSS_SET_STATE, FHSS_START_SYNC, FHSS_START_HOPPING, FHSS_STOP_HOPPING))
+
+    def __init__(self, idx=0, debug=False, copyDongle=None, RfMode=RFST_SRX, safemode=False, transport=None):
+        USBDongle.__init__(self, idx, debug, copyDongle, RfMode, safemode=safemode, transport=transport)
         self.max_packet_size = RF_MAX_RX_BLOCK
         self.endec = None
         if hasattr(self, "chipnum"):
@@ -110,6 +360,23 @@ class NICxx11(USBDongle):
 
         self.freq_offset_accumulator = 0
 
+    def send(self, app, cmd, buf, wait=USB_TX_WAIT):
+        if app == APP_NIC and cmd in self._rfcfg_changing:
+            self._rfcfg_stale = True
+        return USBDongle.send(self, app, cmd, buf, wait)
+
+    def poke(self, addr, data):
+        r = USBDongle.poke(self, addr, data)
+        self._rfcfgWrite(addr - 0xdf00, data)
+        return r
+
+    def memops(self, ops):
+        r = USBDongle.memops(self, ops)
+        for addr, arg in ops:
+            if not isinstance(arg, int):
+                self._rfcfgWrite(addr - 0xdf00, arg)
+        return r
+
     ######## RADIO METHODS #########
     def setRfMode(self, rfmode, parms=b''):
         '''
@@ -187,31 +454,215 @@ class NICxx11(USBDongle):
 
 
     #### radio config #####
-    def getRadioConfig(self):
-        bytedef = self.peek(0xdf00, 0x3e)
+    def getRadioConfig(self, force=False):
+        '''
+        read the 0xdf00 radio register block into self.radiocfg (and return it)
+
+        reads are served from a host-side shadow of the registers, which
+        follows every write made through this object.  the firmware counts
+        the changes it makes on its own (hopping, specan...) and says once
+        when the shadow goes stale (NIC_RF_CONFIG_STALE); only then, or after
+        a command known to change registers, is the block read again.
+        calibration results (FSCAL*) and status registers (MARCSTATE, RSSI,
+        FREQEST...) are as of the last read: 'force' reads everything now.
+        '''
+        if force or not self._radioConfigFresh():
+            self._fetchRadioConfig()
+        else:
+            self._rfcfg_hits += 1
+
+        bytedef = self._rfcfg
+        if self._rfreg_batch:
+            # show what the radio will look like once the batch is committed
+            cfg = bytearray(bytedef)
+            for off, val in self._rfreg_batch.items():
+                cfg[off] = val
+            bytedef = bytes(cfg)
+
         self.radiocfg.vsParse(bytedef)
         return bytedef
 
+    def _fetchRadioConfig(self):
+        # whatever was stale so far is answered by this read
+        self._rfcfgNotices()
+        self._rfcfg_stale = False
+        self._rfcfg_fetches += 1
+
+        if self._rfcfg_cache:
+            try:
+                r, t = self.send(APP_NIC, NIC_GET_RF_CONFIG, b'', wait=USB_RX_WAIT)
+            except ChipconUsbTimeoutException:
+                r = b''
+            if len(r) == RF_CFG_BLOCK_LEN + 1:
+                self._rfcfg_gen = ord23(r[0])
+                self._rfcfg = r[1:]
+                return
+
+            # older firmware has no config generation: read it every time
+            self._rfcfg_cache = False
+
+        self._rfcfg = self.peek(0xdf00, RF_CFG_BLOCK_LEN)
+
+    def _radioConfigFresh(self):
+        if not self._rfcfg_cache or self._rfcfg is None or self._rfcfg_stale:
+            return False
+        # a notice carrying the generation we already have was sent before our read
+        return all([gen == self._rfcfg_gen for gen in self._rfcfgNotices()])
+
+    def _rfcfgNotices(self):
+        '''
+        take any NIC_RF_CONFIG_STALE notices out of the mailbox, returns
+        their config generations
+        '''
+        msgs = self.recvPending(APP_NIC, NIC_RF_CONFIG_STALE)
+        self._rfcfg_notices += len(msgs)
+        return [ord23(data[0]) for data, t in msgs]
+
+    def _rfcfgWrite(self, off, data):
+        '''
+        keep the shadow in step with a write of 'data' at 0xdf00 + 'off'
+        '''
+        if self._rfcfg is None or off >= RF_CFG_BLOCK_LEN or off + len(data) <= 0:
+            return
+
+        if off < 0:
+            data = data[-off:]
+            off = 0
+
+        if off + len(data) > RF_CFG_REG_COUNT:
+            # status registers: the radio decides what they read back as
+            self._rfcfg_stale = True
+            data = data[:max(0, RF_CFG_REG_COUNT - off)]
+
+        self._rfcfg = self._rfcfg[:off] + bytes(data) + self._rfcfg[off + len(data):]
+
+    def invalidateRadioConfig(self):
+        '''
+        drop the shadow radio config; the next getRadioConfig() reads the
+        registers from the dongle
+        '''
+        self._rfcfg_stale = True
+
+    def setRadioConfigCache(self, enable=True):
+        '''
+        turn the shadow radio config on or off.  off, every getRadioConfig()
+        reads the registers from the dongle (as older firmware always does)
+        '''
+        self._rfcfg_cache = enable
+        self._rfcfg_stale = True
+
+    def radioConfigStats(self):
+        '''
+        shadow radio config counters: reads served locally, reads from the
+        dongle, stale notices received
+        '''
+        return {
+            'cached':       self._rfcfg_cache,
+            'generation':   self._rfcfg_gen,
+            'hits':         self._rfcfg_hits,
+            'fetches':      self._rfcfg_fetches,
+            'notices':      self._rfcfg_notices,
+        }
+
     def setRadioConfig(self, bytedef = None):
+        '''
+        write a full radio config (default: self.radiocfg) to the dongle.
+        only registers which differ from what's currently in the radio are
+        sent, as one NIC_SET_RF_REGS batch (one IDLE/calibrate cycle)
+        '''
         if bytedef is None:
             bytedef = self.radiocfg.vsEmit()
 
-        statestr, marcstate = self.getMARCSTATE()
-        if marcstate != MARC_STATE_IDLE:
-            self.strobeModeIDLE()
+        if not self._radioConfigFresh():
+            self._fetchRadioConfig()
+        current = self._rfcfg
+        changed = [(off, ord23(bytedef[off])) for off in range(len(bytedef))
+                        if bytedef[off] != current[off]]
 
-        self.poke(0xdf00, bytedef)
+        self.setRFRegisters([x for x in changed if x[0] < RF_CFG_REG_COUNT])
 
-        self.strobeModeReturn(marcstate)
-        #if (marcstate == MARC_STATE_RX):
-            #self.strobeModeRX()
-        #elif (marcstate == MARC_STATE_TX):
-            #self.strobeModeTX()
+        # anything past the config block (status regs) is written as before
+        for off, val in changed:
+            if off >= RF_CFG_REG_COUNT:
+                self.poke(0xdf00 + off, correctbytes(val))
 
         self.getRadioConfig()
 
         return bytedef
 
+    def setRFRegisters(self, regs):
+        '''
+        write several radio config registers at once.  'regs' is a dict or a
+        list of (regaddr, value); regaddr is either the XDATA address
+        (eg. FREQ2) or the offset into the 0xdf00 config block.
+
+        the firmware idles the radio once, writes every register, recalibrates
+        (unless MCSM0 autocal will do it for us) and returns to the configured
+        RfMode.  returns the resulting MARCSTATE.
+
+        inside an rfRegisterBatch() the writes are queued until the batch exits
+        '''
+        if hasattr(regs, 'items'):
+            regs = regs.items()
+
+        pairs = []
+        for regaddr, value in regs:
+            off = regaddr - 0xdf00 if regaddr >= 0xdf00 else regaddr
+            if not 0 <= off < RF_CFG_REG_COUNT:
+                raise Exception("Register 0x%x is not a radio config register" % regaddr)
+            pairs.append((off, value & 0xff))
+
+        if not pairs:
+            return None
+
+        if self._rfreg_batch is not None:
+            for off, val in pairs:
+                self._rfreg_batch[off] = val
+            return None
+
+        data = b''.join([struct.pack("BB", off, val) for off, val in pairs])
+        r, t = self.send(APP_NIC, NIC_SET_RF_REGS, data)
+        if len(r) == 2:
+            for off, val in pairs:
+                self._rfcfgWrite(off, b'%c' % val)
+            return ord23(r[0])
+
+        # older firmware doesn't know NIC_SET_RF_REGS: write them with memops instead
+        ops = []
+        if self.radiocfg.marcstate != MARC_STATE_IDLE:
+            ops.append((X_RFST, b"%c" % RFST_SIDLE))
+        ops += [(0xdf00 + off, correctbytes(val)) for off, val in pairs]
+        ops.append((X_RFST, b"%c" % self._rfmode))
+        self.memops(ops)
+        return None
+
+    @contextlib.contextmanager
+    def rfRegisterBatch(self):
+        '''
+        queue up setRFRegister()/setRFRegisters() calls and send them as one
+        NIC_SET_RF_REGS command when the block exits cleanly:
+
+            with d.rfRegisterBatch():
+                d.setFreq(433920000)
+                d.setMdmDRate(4800)
+
+        if the block raises, nothing is written.
+        '''
+        if self._rfreg_batch is not None:
+            # nested: the outermost batch commits
+            yield
+            return
+
+        self._rfreg_batch = {}
+        try:
+            yield
+            batch = self._rfreg_batch
+        finally:
+            self._rfreg_batch = None
+
+        self.setRFRegisters(sorted(batch.items()))
+        self.getRadioConfig()
+
 
     ##### GETTER/SETTERS for Radio Config/Status #####
     ### radio state
@@ -224,7 +675,8 @@ class NICxx11(USBDongle):
 
     def getMARCSTATE(self, radiocfg=None):
         if radiocfg is None:
-            self.getRadioConfig()
+            # a status register, so not worth the whole block
+            self.radiocfg.marcstate = ord(self.peek(MARCSTATE))
             radiocfg=self.radiocfg
 
         mode = radiocfg.marcstate
@@ -240,13 +692,18 @@ class NICxx11(USBDongle):
             self.poke(regaddr, correctbytes(value))
             return
 
+        if self._rfreg_batch is not None and 0 <= regaddr - 0xdf00 < RF_CFG_REG_COUNT:
+            self._rfreg_batch[regaddr - 0xdf00] = value & 0xff
+            return
+
+        # idle the radio, write, and strobe it back, all in one round trip
+        ops = []
         marcstate = self.radiocfg.marcstate
         if marcstate != MARC_STATE_IDLE:
-            self.strobeModeIDLE()
-
-        self.poke(regaddr, correctbytes(value))
-
-        self.strobeModeReturn(marcstate)
+            ops.append((X_RFST, b"%c" % RFST_SIDLE))
+        ops.append((regaddr, correctbytes(value)))
+        ops.append((X_RFST, b"%c" % self._rfmode))
+        self.memops(ops)
         #if (marcstate == MARC_STATE_RX):
             #self.strobeModeRX()
         #elif (marcstate == MARC_STATE_TX):
@@ -258,7 +715,10 @@ class NICxx11(USBDongle):
         mask = ((1<<bitsz) - 1) << bitnum
         rmask = ~mask
 
-        temp = ord(self.peek(addr)) & rmask
+        if 0 <= addr - 0xdf00 < RF_CFG_REG_COUNT:
+            temp = ord23(self.getRadioConfig()[addr - 0xdf00]) & rmask
+        else:
+            temp = ord(self.peek(addr)) & rmask
         temp |= ((val << bitnum) & mask)
 
         self.setRFRegister(addr, temp, suppress=suppress)
@@ -311,17 +771,10 @@ class NICxx11(USBDongle):
             radiocfg.fscal2 = 0x2A
 
         if applyConfig:
-            marcstate = radiocfg.marcstate
-            if marcstate != MARC_STATE_IDLE:
-                self.strobeModeIDLE()
-            self.poke(FREQ2, struct.pack("3B", self.radiocfg.freq2, self.radiocfg.freq1, self.radiocfg.freq0))
-            self.poke(FSCAL2, struct.pack("B", self.radiocfg.fscal2))
-
-            self.strobeModeReturn(marcstate)
-            #if (radiocfg.marcstate == MARC_STATE_RX):
-                #self.strobeModeRX()
-            #elif (radiocfg.marcstate == MARC_STATE_TX):
-                #self.strobeModeTX()
+            self.setRFRegisters(((FREQ2, radiocfg.freq2),
+                                 (FREQ1, radiocfg.freq1),
+                                 (FREQ0, radiocfg.freq0),
+                                 (FSCAL2, radiocfg.fscal2)))
 
     def getFreq(self, mhz=24, radiocfg=None):
         freqmult = old_div((0x10000 / 1000000.0), mhz)
@@ -335,7 +788,7 @@ class NICxx11(USBDongle):
 
     def getFreqEst(self, radiocfg=None):
         if radiocfg==None:
-            self.getRadioConfig()
+            self.radiocfg.freqest = ord(self.peek(FREQEST))
             radiocfg = self.radiocfg
 
         return radiocfg.freqest
@@ -346,7 +799,7 @@ class NICxx11(USBDongle):
     # http://e2e.ti.com/cfs-file/__key/telligent-evolution-components-attachments/00-155-01-00-00-73-46-38/DN015_5F00_Permanent_5F00_Frequency_5F00_Offset_5F00_Compensation.pdf
     def adjustFreqOffset(self, mhz=24, radiocfg=None):
         if radiocfg==None:
-            self.getRadioConfig()
+            self.getRadioConfig(force=True)
             radiocfg = self.radiocfg
 
         self.freq_offset_accumulator += self.getFreqEst(radiocfg)
@@ -1219,30 +1672,93 @@ class NICxx11(USBDongle):
 
         sys.stdin.read(1)
 
-    def RFcapture(self):
+    def RFcapture(self, capfile=None):
         '''
         dump packets as they come in, but return a list of packets when you exit capture mode.
         kinda like discover() but without changing any of the communications settings
+
+        if capfile is given, packets are appended to that rflib.capture file
+        (with the radio config and RSSI/LQI, if APPEND_STATUS is on) instead of
+        being kept in memory, and the number of packets written is returned.
         '''
         capture = []
-        print("Entering RFlisten mode...  packets arriving will be displayed on the screen (and returned in a list)")
-        print("(press Enter to stop)")
-        while not keystop():
+        writer = None
+        if capfile is not None:
+            writer = rfcapture.CaptureWriter(capfile, append=True)
 
-            try:
-                y, t = self.RFrecv()
-                print("(%5.3f) Received:  %s  | %s" % (t, hexlify(y).decode(), makeFriendlyAscii(y)))
-                capture.append((y,t))
+        # whatever stops us (^C included), the writer's header and index get written out
+        try:
+            if writer is not None:
+                writer.setRadioConfig(self.getRadioConfig())
+                appendStatus = self.radiocfg.pktctrl1 & PKTCTRL1_APPEND_STATUS
+
+            print("Entering RFlisten mode...  packets arriving will be displayed on the screen (and returned in a list)")
+            print("(press Enter to stop)")
+            while not keystop():
+
+                try:
+                    y, t = self.RFrecv()
+                    print("(%5.3f) Received:  %s  | %s" % (t, hexlify(y).decode(), makeFriendlyAscii(y)))
+                    if writer is None:
+                        capture.append((y,t))
+                    elif appendStatus and len(y) >= 2:
+                        writer.append(y, t, ord23(y[-2]), ord23(y[-1]))
+                    else:
+                        writer.append(y, t)
+
+                except ChipconUsbTimeoutException:
+                    pass
+                except KeyboardInterrupt:
+                    print("Please press <enter> to stop")
+
+            sys.stdin.read(1)
+        finally:
+            if writer is not None:
+                writer.close()
+
+        if writer is not None:
+            return len(writer)
+        return capture
+
+    def RFrecord(self, basename, **kwargs):
+        '''
+        start recording every received packet to rotating capture files in
+        the background.  returns the running rflib.capture.CaptureRecorder
+        (see there for options); call .stop() on it when done.
+        '''
+        return rfcapture.CaptureRecorder(self, basename, **kwargs).start()
 
+    def _rawPackets(self, stop, wait):
+        '''
+        received packets, undecoded, until 'stop' is set.  yields None each
+        time nothing arrives within 'wait' ms.
+        '''
+        while not stop.is_set():
+            try:
+                yield self.recv(APP_NIC, NIC_RECV, wait)
             except ChipconUsbTimeoutException:
-                pass
-            except KeyboardInterrupt:
-                print("Please press <enter> to stop")
+                yield None
 
-        sys.stdin.read(1)
-        return capture
+    def RFpipeline(self, decoder=None, workers=None, batchsize=64, maxpending=None, ordered=True, flushwait=50):
+        '''
+        start decoding received packets on a pool of worker processes (see
+        DecodePipeline).  iterate the returned pipeline for (decoded, ts) in
+        receive order; call .stop() on it when done.  'decoder' defaults to
+        the one given to setEnDeCoder().  a partial batch is sent off after
+        'flushwait' ms without a new packet.
 
-    def discover(self, lowball=1, debug=None, length=30, IdentSyncWord=False, ISWsensitivity=4, ISWminpreamble=2, SyncWordMatchList=None, Search=None, RegExpSearch=None):
+        don't call RFrecv() while a pipeline is running: they'd split the
+        packets between them.
+        '''
+        if decoder is None:
+            decoder = self.endec
+        if decoder is None:
+            raise Exception("RFpipeline() needs a decoder: pass one or use setEnDeCoder()")
+
+        stop = threading.Event()
+        return DecodePipeline(self._rawPackets(stop, flushwait), decoder, workers, batchsize, maxpending, ordered, stop)
+
+    def discover(self, lowball=1, debug=None, length=30, IdentSyncWord=False, ISWsensitivity=4, ISWminpreamble=2, SyncWordMatchList=None, Search=None, RegExpSearch=None, MaxBitErrors=0, IdentFrameLen=False, IdentLineCode=False):
         '''
         discover() sets lowball mode to the mode requested (length too), and begins to dump packets to the screen.
                 press <enter> to quit, and your radio config will be set back to its original configuration.
@@ -1251,13 +1767,18 @@ class NICxx11(USBDongle):
             debug               - sets _debug to this setting if not None.
             length              - arbitrary length of bytes we want to see per pseudopacket. (should be enough to identify interesting packets, but not too long)
             IdentSyncWord       - look for preamble in each packet and determine possible sync-words in use
-            SyncWordMatchList   - attempt to find *these* sync words (provide a list)
+            SyncWordMatchList   - attempt to find *these* sync words (provide a list) at any bit offset
             Search              - byte string to search through each received packet for (real bytes, not hex repr)
             RegExpSearch        - regular expression to search through received bytes (not the hex repr that is printed)
+            MaxBitErrors        - number of flipped bits allowed in SyncWordMatchList/Search matches (1 ~= SYNCM_15_of_16)
+            IdentFrameLen       - look for repeating frames in each packet and suggest a FLEN on exit (use a length long enough to hold a few frames)
+            IdentLineCode       - look for Manchester/differential Manchester/biphase-mark coded runs in each packet and show them decoded
 
         if IdentSyncWord == True (or SyncWordMatchList != None), returns a dict of unique possible SyncWords identified along with the number of times seen.
         '''
         retval = {}
+        framelens = {}
+        linecodes = {}
         oldebug = self._debug
 
         if SyncWordMatchList != None:
@@ -1278,6 +1799,13 @@ class NICxx11(USBDongle):
         if debug is not None:
             self._debug = debug
 
+        matcher = None
+        if Search is not None or SyncWordMatchList is not None:
+            matchlist = list(SyncWordMatchList or [])
+            if Search is not None:
+                matchlist.append(Search)
+            matcher = bits.BitMatcher(matchlist, MaxBitErrors)
+
         if Search is not None:
             print("Search:",repr(Search))
 
@@ -1288,40 +1816,68 @@ class NICxx11(USBDongle):
         while not keystop():
 
             try:
-                y, t = self.RFrecv()
-                yhex = hexlify(y).decode()
-
-                print("(%5.3f) Received:  %s" % (t, yhex))
-                if RegExpSearch is not None:
-                    ynext = y
-                    for loop in range(8):
-                        if (re.search(RegExpSearch, ynext) is not None):
-                            print("    REG EXP SEARCH SUCCESS:",RegExpSearch)
-                        ynext = bits.shiftString(ynext, 1)
-
-                if Search is not None:
-                    ynext = y
-                    for loop in range(8):
-                        if (Search in ynext):
-                            print("    SEARCH SUCCESS:",Search)
-                        ynext = bits.shiftString(ynext, 1)
-
-                if IdentSyncWord:
-                    #if lowball == 1:
-                    #    y = b'\xaa\xaa' + y
-
-                    poss = bits.findSyncWord(y, ISWsensitivity, ISWminpreamble)
-                    if len(poss):
-                        print("  possible Sync Dwords: %s" % repr([hex(x) for x in poss]))
-                        for dw in poss:
+                # wait for one packet, then take whatever else has already come in, so the
+                # matcher searches them all in one pass
+                batch = [self.RFrecv()]
+                for y, t in self.recvPending(APP_NIC, NIC_RECV):
+                    if self.endec is not None:
+                        y = self.endec.decode(y)
+                    batch.append((y, t))
+
+                hits = [[] for pkt in batch]
+                if matcher is not None:
+                    for pktidx, pattern, bitoff, errors in matcher.searchBatch([y for y, t in batch]):
+                        hits[pktidx].append((pattern, bitoff, errors))
+
+                for (y, t), pkthits in zip(batch, hits):
+                    yhex = hexlify(y).decode()
+
+                    print("(%5.3f) Received:  %s" % (t, yhex))
+                    if RegExpSearch is not None:
+                        ynext = y
+                        for loop in range(8):
+                            if (re.search(RegExpSearch, ynext) is not None):
+                                print("    REG EXP SEARCH SUCCESS:",RegExpSearch)
+                            ynext = bits.shiftString(ynext, 1)
+
+                    matched = []
+                    for pattern, bitoff, errors in pkthits:
+                        if pattern is Search:
+                            print("    SEARCH SUCCESS: %r (bit %d, %d bit errors)" % (Search, bitoff, errors))
+                        elif pattern not in matched:
+                            matched.append(pattern)
+                            print("MATCH WITH KNOWN SYNC WORD: %s (bit %d, %d bit errors)" % (hex(pattern), bitoff, errors))
+
+                    if IdentSyncWord:
+                        #if lowball == 1:
+                        #    y = b'\xaa\xaa' + y
+
+                        poss = bits.findSyncWord(y, ISWsensitivity, ISWminpreamble)
+                        if len(poss):
+                            print("  possible Sync Dwords: %s" % repr([hex(x) for x in poss]))
+
+                        for dw in poss + [x for x in matched if x not in poss]:
                             lst = retval.get(dw, 0)
                             lst += 1
                             retval[dw] = lst
 
-                    if SyncWordMatchList is not None:
-                        for x in poss:
-                            if x in SyncWordMatchList:
-                                print("MATCH WITH KNOWN SYNC WORD:" + hex(x))
+                    if IdentFrameLen:
+                        cands = bits.findPeriodicity(y, minrun=32)
+                        if len(cands) and len(cands[0]['repeats']):
+                            period = cands[0]['period']
+                            print("  possible frame length: %d bits (repeats at: %s)" % (period,
+                                    repr([rep[:2] for rep in cands[0]['repeats']])))
+                            framelens[period] = framelens.get(period, 0) + 1
+
+                    if IdentLineCode:
+                        cands = linecode.detect(y, syncwords=SyncWordMatchList, maxerrors=MaxBitErrors)
+                        if len(cands):
+                            best = cands[0]
+                            print("  possible %s (polarity %d): %d bits at bit %d%s: %s" % (best.code, best.polarity,
+                                    best.length, best.start, ('', ' (sync word at bit %s)' % best.sync)[best.sync is not None],
+                                    hexlify(best.data).decode()))
+                            key = (best.code, best.polarity)
+                            linecodes[key] = linecodes.get(key, 0) + 1
 
             except ChipconUsbTimeoutException:
                 pass
@@ -1333,6 +1889,15 @@ class NICxx11(USBDongle):
         self.lowballRestore()
         print("Exiting Discover mode...")
 
+        if len(framelens):
+            period = max(framelens, key=framelens.get)
+            print("Suggested FLEN: %d bytes (frames repeat every %d bits, seen %d times; includes preamble/sync/gap)" % \
+                    ((period + 7) // 8, period, framelens[period]))
+
+        if len(linecodes):
+            code, polarity = max(linecodes, key=linecodes.get)
+            print("Most likely line code: %s, polarity %d (best match in %d packets)" % (code, polarity, linecodes[(code, polarity)]))
+
         if len(retval) == 0:
             return
 
@@ -1381,7 +1946,8 @@ class NICxx11(USBDongle):
         print(self.reprRadioConfig(mhz, radiocfg))
 
     def reprRadioConfig(self, mhz=24, radiocfg=None):
-        if radiocfg == None:
+        live = radiocfg is None
+        if live:
             self.getRadioConfig()
             radiocfg = self.radiocfg
         output = []
@@ -1401,7 +1967,7 @@ class NICxx11(USBDongle):
         output.append( "\n== Radio Test Signal Configuration ==")
         output.append( self.reprRadioTestSignalConfig(radiocfg))
         output.append( "\n== Radio State ==")
-        output.append( self.reprRadioState(radiocfg))
+        output.append( self.reprRadioState(None if live else radiocfg))
         output.append("\n== Client State ==")
         output.append( self.reprClientState())
         return "\n".join(output)
@@ -1507,10 +2073,6 @@ class NICxx11(USBDongle):
     def reprRadioState(self, radiocfg=None):
         output = []
         try:
-            if radiocfg==None:
-                self.getRadioConfig()
-                radiocfg = self.radiocfg
-
             output.append("     MARCSTATE:      %s (%x)" % (self.getMARCSTATE(radiocfg)))
             output.append("     DONGLE RESPONDING:  mode :%x, last error# %d"%(self.getDebugCodes()))
         except:
@@ -1825,19 +2387,108 @@ class FHSSNIC(NICxx11):
         return self.send(APP_NIC, FHSS_STOP_HOPPING, b'')
 
     def setMACperiod(self, dwell_ms, mhz=24):
-        macdata = self.getMACdata()
-        cycles_per_channel = macdata[1]
-        ticks_per_cycle = 256
-        tick_ms = old_div(dwell_ms, (ticks_per_cycle * cycles_per_channel))
-        val = calculateT2(tick_ms, mhz)
-        T, tickidx, tipidx, PR = val
-        print("Setting MAC period to %f secs (%x %x %x)" % (val))
-        t2ctl = (ord(self.peek(X_T2CTL)) & 0xfc)   | (tipidx)
-        clkcon = (ord(self.peek(X_CLKCON)) & 0xc7) | (tickidx<<3)
-
-        self.poke(X_T2PR, correctbytes(PR))
-        self.poke(X_T2CTL, correctbytes(t2ctl))
-        self.poke(X_CLKCON, correctbytes(clkcon))
+        '''
+        set the dwell time per channel, in milliseconds.  kept for compatibility, see setDwellTime()
+        '''
+        return self.setDwellTime(int(dwell_ms * 1000))
+
+    def setDwellTime(self, dwell_us, sync_offset_us=0):
+        '''
+        set the hop clock dwell time per channel, in microseconds.
+        while SYNCHED the hop clock is corrected from the master's beacons, which carry how far
+        into its dwell each was sent; sync_offset_us trims any fixed lag (radio, interrupt
+        latency) on top of that.  returns the dwell time the firmware accepted (it clamps).
+        an offset past the end of the (clamped) dwell is refused.
+        '''
+        retval, ts = self.send(APP_NIC, FHSS_SET_MAC_PERIOD, struct.pack("<II", dwell_us, sync_offset_us))
+        if len(retval) < 4:
+            raise Exception("sync offset %dus doesn't fit in the dwell" % sync_offset_us)
+        dwell_us, = struct.unpack("<I", retval[:4])
+        return dwell_us
+
+    def getHopStatus(self, mhz=24):
+        '''
+        returns a dict describing the firmware hop clock.  times are in microseconds, based on
+        the T1 tick (128 / mhz us)
+        '''
+        datastr, timestamp = self.send(APP_NIC, FHSS_GET_HOP_STATUS, b'')
+        (dwellUs, nominalQ8, dwellQ8, driftQ8, syncOffset, tLastHop, tNextHop, tLastSync,
+                hopCount, phaseErr, maxPhaseErr, syncCount, lateHops, frac) = \
+                struct.unpack("<IIIiIIIIIhHHHB", datastr[:45])
+
+        tick_us = 128.0 / mhz
+        return {
+                'dwell_us':         dwellUs,
+                'dwell_actual_us':  dwellQ8 * tick_us / 256,
+                'drift_ppm':        1e6 * driftQ8 / nominalQ8 if nominalQ8 else 0.0,
+                'sync_offset_us':   syncOffset * tick_us,
+                'last_hop':         tLastHop,
+                'next_hop':         tNextHop,
+                'last_sync':        tLastSync,
+                'hop_count':        hopCount,
+                'phase_err_us':     phaseErr * tick_us,
+                'max_phase_err_us': maxPhaseErr * tick_us,
+                'sync_count':       syncCount,
+                'late_hops':        lateHops,
+                }
+
+    def reprHopStatus(self, mhz=24):
+        hs = self.getHopStatus(mhz)
+        return """\
+Dwell:              %(dwell_us)d us (actual %(dwell_actual_us).1f us)
+Drift Correction:   %(drift_ppm).1f ppm
+Sync Offset:        %(sync_offset_us).1f us
+Hop Count:          %(hop_count)d (late: %(late_hops)d)
+Phase Error:        %(phase_err_us).1f us (max: %(max_phase_err_us).1f us)
+Sync Beacons:       %(sync_count)d
+""" % hs
+
+    def getTxStats(self, reset=False, mhz=24):
+        '''
+        returns a dict of the firmware FHSS transmit scheduler counters.  queued FHSSxmit()
+        messages are packed into each dwell from the main loop; anything that doesn't fit in
+        what's left of a dwell is deferred to the next one.
+        slot_hist counts dwells that carried 0, 1, 2, and 3+ frames.
+        if reset is True, the counters are cleared after they're read.
+        '''
+        datastr, timestamp = self.send(APP_NIC, FHSS_GET_TX_STATS, struct.pack("<B", bool(reset)))
+        (slots, framesSent, deferred, oversize, busyTicks, byteTicksQ4, frameTicks, leadTicks,
+                tailTicks, lastSlotBusy, maxSlotBusy, slotFrames, maxSlotFrames,
+                h0, h1, h2, h3) = struct.unpack("<IIIIIIHHHHHBB4H", datastr[:44])
+
+        tick_us = 128.0 / mhz
+        dwell_us = self.getHopStatus(mhz)['dwell_us'] if slots else 0
+        return {
+                'slots':            slots,
+                'frames_sent':      framesSent,
+                'deferred':         deferred,
+                'oversize':         oversize,
+                'busy_us':          busyTicks * tick_us,
+                'utilization':      (busyTicks * tick_us) / (slots * dwell_us) if dwell_us else 0.0,
+                'byte_us':          byteTicksQ4 * tick_us / 16,
+                'frame_overhead_us':    frameTicks * tick_us,
+                'lead_us':          leadTicks * tick_us,
+                'tail_us':          tailTicks * tick_us,
+                'last_slot_busy_us':    lastSlotBusy * tick_us,
+                'max_slot_busy_us': maxSlotBusy * tick_us,
+                'max_slot_frames':  maxSlotFrames,
+                'slot_hist':        (h0, h1, h2, h3),
+                }
+
+    def reprTxStats(self, mhz=24):
+        ts = self.getTxStats(mhz=mhz)
+        ts['utilization'] *= 100
+        ts['hist'] = "%d / %d / %d / %d" % ts['slot_hist']
+        return """\
+Dwells:             %(slots)d (0 / 1 / 2 / 3+ frames: %(hist)s)
+Frames Sent:        %(frames_sent)d (max per dwell: %(max_slot_frames)d)
+Deferred Dwells:    %(deferred)d
+Oversize Frames:    %(oversize)d
+Air Time:           %(busy_us).0f us (%(utilization).1f%% of dwell time)
+Per-Dwell Air Time: %(last_slot_busy_us).0f us last, %(max_slot_busy_us).0f us max
+Frame Estimate:     %(frame_overhead_us).0f us + %(byte_us).1f us/byte
+Guards:             %(lead_us).0f us lead, %(tail_us).0f us tail
+""" % ts
 
     def _setMACmode(self, _mode):
         '''
@@ -1910,8 +2561,38 @@ u16 synched_chans           %x
         return FHSS_STATES[state], state
 
     def mac_SyncCell(self, CellID=0x0000):
+        '''
+        start acquiring the cell CellID (0 takes any cell).  the dongle sniffs one channel of the
+        hop pattern at a time for a SYNCINGMASTER beacon, then locks its hop clock to it.
+        poll getAcqStatus() to see how it went.
+        '''
         return self.send(APP_NIC, FHSS_START_SYNC, struct.pack("<H",CellID))
 
+    def setAcqParams(self, sniff_ms=150, timeout_ms=30000):
+        '''
+        sniff_ms:   how long to listen on each candidate channel.  about one dwell works well.
+        timeout_ms: give up and drop back to NONHOPPING after this long (0 searches forever)
+        '''
+        retval, ts = self.send(APP_NIC, FHSS_SET_ACQ_PARAMS, struct.pack("<II", sniff_ms, timeout_ms))
+        return struct.unpack("<II", retval[:8])
+
+    def getAcqStatus(self, mhz=24):
+        datastr, timestamp = self.send(APP_NIC, FHSS_GET_ACQ_STATUS, b'')
+        (sniffMs, timeoutMs, tStart, tWindow, acqTicks, chanIdx, channelsTried, framesHeard,
+                beaconsRejected, cellID, result) = struct.unpack("<IIIIIHHHHHB", datastr[:31])
+
+        return {
+                'result':           FHSS_ACQ_RESULTS.get(result, result),
+                'sniff_ms':         sniffMs,
+                'timeout_ms':       timeoutMs,
+                'acq_time_ms':      acqTicks * 0.128 / mhz,
+                'chan_idx':         chanIdx,
+                'channels_tried':   channelsTried,
+                'frames_heard':     framesHeard,
+                'beacons_rejected': beaconsRejected,
+                'cell_id':          cellID,
+                }
+
 def unittest(dongle):
     from . import chipcon_usb
     chipcon_usb.unittest(dongle)
@@ -20,6 +20,7 @@ import threading
 from binascii import hexlify
 
 from . import bits
+from . import usbtransport
 from .bits import correctbytes, ord23
 from .const import *
 
@@ -32,23 +33,19 @@ def keystop(delay=0):
     else:
         return msvcrt.kbhit()
 
-def getRfCatDevices():
+def getRfCatDevices(transport=None):
     '''
-    returns a list of USB device objects for any rfcats that are plugged in
+    returns a list of USB device objects for any rfcats that are plugged in,
+    as 'transport' (see rflib.usbtransport) sees them
     NOTE: if any rfcats are in bootloader mode, this will cause python to Exit
     '''
-    rfcats = []
-    for bus in usb.busses():
-        for dev in bus.devices:
-            # OpenMoko assigned or Legacy TI
-            if (dev.idVendor == 0x0451 and dev.idProduct == 0x4715) or (dev.idVendor == 0x1d50 and (dev.idProduct == 0x6047 or dev.idProduct == 0x6048 or dev.idProduct == 0x605b or dev.idProduct == 0xecc1)):
-                rfcats.append(dev)
+    return usbtransport.getTransport(transport).devices()
 
-            elif (dev.idVendor == 0x1d50 and (dev.idProduct == 0x6049 or dev.idProduct == 0x604a or dev.idProduct == 0xecc0)):
-                print("Already in Bootloader Mode... exiting")
-                exit(0)
-
-    return rfcats
+INTERRUPT_REGISTERS = (
+        ('IEN0', IEN0), ('IEN1', IEN1), ('IEN2', IEN2), ('TCON', TCON),
+        ('S0CON', S0CON), ('IRCON', IRCON), ('IRCON2', IRCON2), ('S1CON', S1CON),
+        ('RFIF', RFIF), ('DMAIE', DMAIE), ('DMAIF', DMAIF), ('DMAIRQ', DMAIRQ),
+        )
 
 class ChipconUsbTimeoutException(Exception):
     def __str__(self):
@@ -58,8 +55,9 @@ direct=False
 
 class USBDongle(object):
     ######## INITIALIZATION ########
-    def __init__(self, idx=0, debug=False, copyDongle=None, RfMode=RFST_SRX, safemode=False):
+    def __init__(self, idx=0, debug=False, copyDongle=None, RfMode=RFST_SRX, safemode=False, transport=None):
         self._safemode = safemode
+        self._transport = transport
         self.chipnum = None
         self.chipstr = "uninitialized"
         self.rsema = None
@@ -76,6 +74,9 @@ class USBDongle(object):
         self.radiocfg = RadioConfig()
         self._rfmode = RfMode
         self._radio_configured = False
+        self._recv_listeners = []
+        self._memops = None
+        self._stats_prev = None
 
         self.ctrl_thread = threading.Thread(target=self.run_ctrl)
         self.ctrl_thread.setDaemon(True)
@@ -148,38 +149,10 @@ class USBDongle(object):
         '''
         self.ep5timeout = EP_TIMEOUT_ACTIVE
 
-        dongles = []
-        for dev in getRfCatDevices():
-            if self._debug: print((dev), file=sys.stderr)
-            do = dev.open()
-            iSN = do.getDescriptor(1,0,50)[16]
-            devnum = dev.devnum
-            dongles.append((devnum, dev, do))
-
-        dongles.sort()
-        if len(dongles) == 0:
-            raise Exception("No Dongle Found.  Please insert a RFCAT dongle.")
-
-        # claim that interface!
-        do = dongles[self.idx][2]
-        
-        try:
-            do.claimInterface(0)
-        except Exception as e:
-            if console or self._debug: print(("Error claiming usb interface:" + repr(e)), file=sys.stderr)
-
-
-
-        self.devnum, self._d, self._do = dongles[self.idx]
-
-        self._usbcfg = self._d.configurations[0]
-        self._usbintf = self._usbcfg.interfaces[0][0]
-        self._usbeps = self._usbintf.endpoints
-        for ep in self._usbeps:
-            if ep.address & 0x80:
-                self._usbmaxi = ep.maxPacketSize
-            else:
-                self._usbmaxo = ep.maxPacketSize
+        t = usbtransport.openTransport(self._transport, self.idx, console or self._debug)
+        self.devnum, self._d, self._do = t.devnum, t.device, t
+        self._usbcfg, self._usbintf, self._usbeps = t.cfg, t.intf, t.eps
+        self._usbmaxi, self._usbmaxo = t.maxi, t.maxo
 
     def finish_setup(self):
         '''
@@ -187,6 +160,7 @@ class USBDongle(object):
         '''
         self.rsema = threading.Lock()
         self.xsema = threading.Lock()
+        self._memops = None             # the firmware may have changed
 
         self._usbmaxi, self._usbmaxo = (EP5IN_MAX_PACKET_SIZE, EP5OUT_MAX_PACKET_SIZE)
         self._threadGo.set()
@@ -194,7 +168,7 @@ class USBDongle(object):
         if self._safemode:
             return
 
-        self.getRadioConfig()
+        self.getRadioConfig(force=True)
         chip = self.getPartNum()
         chipstr = CHIPS.get(chip)
 
@@ -215,6 +189,11 @@ class USBDongle(object):
                 self._radio_configured = True
 
     def resetup(self, console=True, copyDongle=None):
+        if isinstance(self._do, usbtransport.Transport) and copyDongle is None:
+            try:
+                self._do.close()
+            except Exception as e:
+                if self._debug: print(("Error closing usb transport:" + repr(e)), file=sys.stderr)
         self._do=None
         if self._bootloader: 
             return
@@ -501,6 +480,12 @@ class USBDongle(object):
                                         sys.excepthook(*sys.exc_info())
                                     finally:
                                         self.rsema.release()                            # THREAD SAFETY DANCE COMPLETE
+
+                                for listener in self._recv_listeners:
+                                    try:
+                                        listener(app, cmd)
+                                    except:
+                                        sys.excepthook(*sys.exc_info())
                                
                             else:            
                                 if self._debug>1:     sys.stderr.write('=')
@@ -578,6 +563,32 @@ class USBDongle(object):
 
         raise ChipconUsbTimeoutException
 
+    def recvPending(self, app, cmd):
+        '''
+        take every message already waiting in the mbox for app/cmd, without
+        waiting.  returns a (possibly empty) list of (data, timestamp)
+        '''
+        q = self.recv_mbox.get(app, {}).get(cmd)
+        if not q:
+            return []
+
+        # empty the list in place, the recv thread may be about to append to it
+        with self.rsema:
+            msgs = q[:]
+            del q[:]
+
+        return [(msg[4:], t) for msg, t in msgs]
+
+    def addRecvListener(self, callback):
+        '''
+        call callback(app, cmd) from the recv thread each time a message
+        lands in the mbox.  it must not block: wake something up and return
+        '''
+        self._recv_listeners = self._recv_listeners + [callback]
+
+    def removeRecvListener(self, callback):
+        self._recv_listeners = [x for x in self._recv_listeners if x != callback]
+
     def recvAll(self, app, cmd=None):
         retval = self.recv_mbox.get(app,None)
         if retval is not None:
@@ -771,6 +782,131 @@ class USBDongle(object):
         r, t = self.send(APP_SYSTEM, SYS_CMD_POKE_REG, struct.pack("<H", addr) + data)
         return r
 
+    def memops(self, ops):
+        '''
+        scatter-gather memory access: ops is a list of (addr, length) reads
+        and (addr, data) writes, run in order on the dongle.  returns a list
+        with the data of each read.
+
+        it all goes in one SYS_CMD_MEMOP round trip, or as few as it fits
+        in (request and reply share EP5OUT_BUFFER_SIZE on the dongle).
+        firmware without SYS_CMD_MEMOP gets the same ops as peeks and pokes
+        '''
+        if self._memops is None:
+            self._memops = self._probeMemops()
+
+        if not self._memops:
+            results = []
+            for addr, arg in ops:
+                if isinstance(arg, int):
+                    results.append(USBDongle.peek(self, addr, arg) if arg else b'')
+                else:
+                    USBDongle.poke(self, addr, arg)
+            return results
+
+        # split into ops of up to MEMOP_MAX_LEN bytes: (op, addr, data or length, read index)
+        pieces = []
+        results = []
+        for addr, arg in ops:
+            if isinstance(arg, int):
+                for off in range(0, arg, MEMOP_MAX_LEN):
+                    pieces.append((MEMOP_READ, addr + off, min(MEMOP_MAX_LEN, arg - off), len(results)))
+                results.append(b'')
+            else:
+                for off in range(0, len(arg), MEMOP_MAX_LEN):
+                    pieces.append((MEMOP_WRITE, addr + off, arg[off:off + MEMOP_MAX_LEN], None))
+
+        while pieces:
+            req = []
+            reads = []
+            size = 0
+            while pieces:
+                op, addr, arg, idx = pieces[0]
+                if op == MEMOP_READ:
+                    need = 4 + arg
+                else:
+                    need = 4 + len(arg)
+                if req and size + need > EP5OUT_BUFFER_SIZE:
+                    break
+                pieces.pop(0)
+                size += need
+
+                if op == MEMOP_READ:
+                    req.append(struct.pack("<BHB", op, addr, arg))
+                    reads.append((idx, arg))
+                else:
+                    req.append(struct.pack("<BHB", op, addr, len(arg)) + arg)
+
+            r, t = self.send(APP_SYSTEM, SYS_CMD_MEMOP, b''.join(req))
+            off = 0
+            for idx, length in reads:
+                results[idx] += r[off:off + length]
+                off += length
+
+        return results
+
+    def getStats(self, clear=False, mhz=24):
+        '''
+        the dongle's performance counters (SYS_CMD_STATUS), as a dict of
+        STATS_FIELDS.  'rates' has each counter's change per second since
+        the last getStats(), timed by the dongle's own clock.  'maxLoopTime'
+        is the longest main loop iteration (seconds) since the counters were
+        last cleared; clear zeroes them all after this read.
+
+        returns None for older firmware, which has no counters
+        '''
+        r, t = self.send(APP_SYSTEM, SYS_CMD_STATUS, b'%c' % bool(clear))
+        if len(r) < STATS_LEN or r[1] != len(r):
+            return None
+
+        stats = dict(zip(STATS_FIELDS, struct.unpack(STATS_FMT, r[:STATS_LEN])))
+        stats['maxLoopTime'] = stats['maxLoopTicks'] * 128.0 / (mhz * 1e6)
+
+        prev = self._stats_prev
+        stats['interval'] = None
+        stats['rates'] = {}
+        if prev is not None:
+            ticks = (stats['clock'] - prev['clock']) & 0xffffffff
+            if ticks:
+                secs = ticks * 128.0 / (mhz * 1e6)
+                stats['interval'] = secs
+                for name, fmt in zip(STATS_FIELDS[3:-1], STATS_FMT[4:-1]):
+                    wrap = (0xffffffff, 0xffff)[fmt == 'H']
+                    stats['rates'][name] = ((stats[name] - prev[name]) & wrap) / secs
+
+        if clear:
+            # the next rates count up from zero
+            prev = dict(stats)
+            for name in STATS_FIELDS[3:]:
+                prev[name] = 0
+            self._stats_prev = prev
+        else:
+            self._stats_prev = stats
+        return stats
+
+    def reprStats(self, clear=False):
+        stats = self.getStats(clear)
+        if stats is None:
+            return "No counters: older firmware, consider upgrading."
+
+        rates = stats['rates']
+        output = ["Dongle counters (%s):" % ('totals', 'per second over %.3fs' % (stats['interval'] or 0))[bool(rates)]]
+        for name in STATS_FIELDS[3:-1]:
+            if rates:
+                output.append("    %-14s %12d  %12.1f/s" % (name, stats[name], rates[name]))
+            else:
+                output.append("    %-14s %12d" % (name, stats[name]))
+        output.append("    %-14s %12.6fs" % ('maxLoopTime', stats['maxLoopTime']))
+        return "\n".join(output)
+
+    def _probeMemops(self):
+        # older firmware echoes commands it doesn't know: 4 bytes back instead of 8
+        try:
+            r, t = self.send(APP_SYSTEM, SYS_CMD_MEMOP, struct.pack("<BHB", MEMOP_READ, 0xdf00, 8))
+        except ChipconUsbTimeoutException:
+            return False
+        return len(r) == 8
+
     def getBuildInfo(self):
         r, t = self.send(APP_SYSTEM, SYS_CMD_BUILDTYPE, b'')
         return r
@@ -782,32 +918,18 @@ class USBDongle(object):
     def getDeviceSerialNumber(self):
         r, t = self.send(APP_SYSTEM, SYS_CMD_DEVICE_SERIAL_NUMBER, b'')
         return r
+
+    def getClock(self):
+        '''
+        the dongle's 32-bit T1 clock, in Fref/128 ticks (wraps every ~6 hours).
+        hunt hits are stamped with the same clock
+        '''
+        r, t = self.send(APP_SYSTEM, SYS_CMD_GET_CLOCK, b'')
+        return struct.unpack("<I", r[:4])[0]
             
     def getInterruptRegisters(self):
-        regs = {}
-        # IEN0,1,2
-        regs['IEN0'] = self.peek(IEN0,1)
-        regs['IEN1'] = self.peek(IEN1,1)
-        regs['IEN2'] = self.peek(IEN2,1)
-        # TCON
-        regs['TCON'] = self.peek(TCON,1)
-        # S0CON
-        regs['S0CON'] = self.peek(S0CON,1)
-        # IRCON
-        regs['IRCON'] = self.peek(IRCON,1)
-        # IRCON2
-        regs['IRCON2'] = self.peek(IRCON2,1)
-        # S1CON
-        regs['S1CON'] = self.peek(S1CON,1)
-        # RFIF
-        regs['RFIF'] = self.peek(RFIF,1)
-        # DMAIE
-        regs['DMAIE'] = self.peek(DMAIE,1)
-        # DMAIF
-        regs['DMAIF'] = self.peek(DMAIF,1)
-        # DMAIRQ
-        regs['DMAIRQ'] = self.peek(DMAIRQ,1)
-        return regs
+        regs = self.memops([(addr, 1) for name, addr in INTERRUPT_REGISTERS])
+        return dict([(name, regs[x]) for x, (name, addr) in enumerate(INTERRUPT_REGISTERS)])
 
     def reprHardwareConfig(self):
         output= []
@@ -825,7 +947,7 @@ class USBDongle(object):
             output.append("Compiler:            Not found! Update needed!")
         # see if we have a bootloader by loooking for it's recognition semaphores
         # in SFR I2SCLKF0 & I2SCLKF1
-        if(self.peek(0xDF46,1) == b'\xF0' and self.peek(0xDF47,1) == b'\x0D'):
+        if(self.peek(0xDF46,2) == b'\xF0\x0D'):
             output.append("Bootloader:          CC-Bootloader")
         else:
             output.append("Bootloader:          Not installed")
@@ -886,6 +1008,12 @@ def unittest(self, mhz=24):
     else:
         print("  passed  '%s'" % (hexlify(ndata)))
 
+    print("\nTesting USB memops (scatter-gather)")
+    ndata = self.memops([(where, b'\xa5' * 300), (where + 8, 4), (where + 1, b'\x5a'), (where, 300)])
+    if ndata != [b'\xa5' * 4, b'\xa5' + b'\x5a' + b'\xa5' * 298]:
+        raise Exception(" *FAILED*\n %r" % ndata)
+    print("  passed")
+
 
 if __name__ == "__main__":
     idx = 0
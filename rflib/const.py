@@ -1,3 +1,5 @@
+import struct
+
 from .rflib_defs import *
 from .chipcondefs import *
 from .rflib_version import *
@@ -58,8 +60,25 @@ SYS_CMD_PARTNUM                 = 0x8e
 SYS_CMD_RESET                   = 0x8f
 SYS_CMD_CLEAR_CODES             = 0x90
 SYS_CMD_DEVICE_SERIAL_NUMBER    = 0x91
+SYS_CMD_MEMOP                   = 0x92
 SYS_CMD_LED_MODE                = 0x93
 
+# SYS_CMD_MEMOP ops: u8 op, u16 addr, u8 len (then len bytes, for a write)
+MEMOP_READ                      = 0x00
+MEMOP_WRITE                     = 0x01
+MEMOP_MAX_LEN                   = 0xff
+
+# SYS_CMD_STATUS: the firmware's stats_t (firmware/include/global.h).  newer firmware
+# may append fields, so only the first STATS_LEN bytes are ours to read
+STATS_VERSION                   = 1
+STATS_FMT                       = "<BBIIIIIIIHHHIIIIHHIIIIH"     # one letter per field
+STATS_LEN                       = struct.calcsize(STATS_FMT)
+STATS_FIELDS                    = ('version', 'size', 'clock', 'rxPackets', 'rxDelivered', 'rxDropped',
+                                   'rxBytes', 'txPackets', 'txBytes', 'rxOverflows', 'txUnderflows',
+                                   'txStarved', 'usbInMsgs', 'usbInBytes', 'usbInWaits', 'usbOutMsgs',
+                                   'usbOutBusy', 'usbStalls', 'rfIsr', 'usbIsr', 't1Isr', 'loops',
+                                   'maxLoopTicks')
+
 EP0_CMD_GET_DEBUG_CODES         = 0x00
 EP0_CMD_GET_ADDRESS             = 0x01
 EP0_CMD_POKEX                   = 0x01
@@ -156,6 +175,8 @@ RF_MAX_TX_CHUNK                 = 240 # must match MAX_TX_MSGLEN in firmware/inc
                                       # and be divisible by 16 for crypto operations
 RF_MAX_TX_LONG                  = 65535
 RF_MAX_RX_BLOCK                 = 512 # must match BUFFER_SIZE definition in firmware/include/cc1111rf.h
+RF_CFG_REG_COUNT                = 0x32 # must match RF_CFG_REG_COUNT in firmware/include/cc1111rf.h
+RF_CFG_BLOCK_LEN                = 0x3e # config and status registers, must match firmware/include/cc1111rf.h
 
 APP_NIC =                       0x42
 APP_SPECAN =                    0x43
@@ -172,6 +193,9 @@ NIC_SET_AMP_MODE =              0xa
 NIC_GET_AMP_MODE =              0xb
 NIC_LONG_XMIT =                 0xc
 NIC_LONG_XMIT_MORE =            0xd
+NIC_SET_RF_REGS =               0xe
+NIC_GET_RF_CONFIG =             0xf
+NIC_RF_CONFIG_STALE =           0x30   # unsolicited, from the dongle
 
 FHSS_SET_CHANNELS =             0x10
 FHSS_NEXT_CHANNEL =             0x11
@@ -188,6 +212,11 @@ FHSS_GET_STATE =                0x21
 FHSS_START_SYNC =               0x22
 FHSS_START_HOPPING =            0x23
 FHSS_STOP_HOPPING =             0x24
+FHSS_SET_MAC_PERIOD =           0x25
+FHSS_GET_HOP_STATUS =           0x26
+FHSS_GET_TX_STATS =             0x27
+FHSS_SET_ACQ_PARAMS =           0x28
+FHSS_GET_ACQ_STATUS =           0x29
 
 FHSS_STATE_NONHOPPING =         0
 FHSS_STATE_DISCOVERY =          1
@@ -198,6 +227,7 @@ FHSS_STATE_SYNCHED =            3
 FHSS_STATE_SYNC_MASTER =        4
 FHSS_STATE_SYNCINGMASTER =      5
 FHSS_LAST_STATE =               5       # used for testing
+FHSS_STATE_LONG_XMIT =          6       # RFxmitLong() in progress
 
 
 FHSS_STATES = {}
@@ -205,6 +235,16 @@ for key,val in list(globals().items()):
     if key.startswith("FHSS_STATE_"):
         FHSS_STATES[key] = val
         FHSS_STATES[val] = key
+
+FHSS_ACQ_IDLE =                 0
+FHSS_ACQ_SEARCHING =            1
+FHSS_ACQ_LOCKED =               2
+FHSS_ACQ_TIMEOUT =              3
+
+FHSS_ACQ_RESULTS = {}
+for key,val in list(globals().items()):
+    if key.startswith("FHSS_ACQ_") and isinstance(val, int):
+        FHSS_ACQ_RESULTS[val] = key
                 
 """  MODULATIONS
 Note that MSK is only supported for data rates above 26 kBaud and GFSK,
@@ -0,0 +1,641 @@
+'''
+one process driving every rfcat plugged in
+
+    pool = DonglePool().start()         # every dongle getRfCatDevices() finds
+    hits = pool.scan(902e6, 250e3, 104, dwell=.02)
+    pool.capture([315e6, 433.92e6], 30)
+    pool.transmit(433.92e6, b'...', device=1).wait()
+    while True:
+        data, ts, idx = pool.recv()
+    pool.stop()
+
+RX: the pool never polls.  each dongle's recv thread calls back
+(USBDongle.addRecvListener) when a packet lands in its mailbox, which wakes
+the pool's one RX loop.  that loop takes the packets from every dongle that
+has any, puts them on one timeline and merges them into a single feed in
+time order.  packets are held 'reorder' seconds before they go out, so one
+that comes in late from a slower dongle still goes out in order.
+
+time: packets are stamped on the host when the dongle's recv thread sorts
+them, which is later than the air by that dongle's USB latency.  every
+'syncinterval' seconds the pool reads each dongle's T1 clock (getClock())
+and ClockSync fits ticks to host time, trusting the samples with the
+shortest round trip.  half the best round trip comes off that dongle's
+packet stamps, and anything the dongle stamps itself (hunt hits,
+rf_tLastRecv) lands on the same timeline through hostTime().
+
+tasks: every radio command waits for its answer, so each dongle gets one
+worker running PoolTasks one at a time.  a task submitted for a device
+waits for that device; anything else goes to whichever dongle frees up
+first.
+
+band scans: bandScan() cuts a range into chunks of channels and deals them
+out to the dongles.  a dongle that runs out steals from the back of the
+busiest one, so covering 300-928MHz takes about 1/N as long with N
+dongles, even when some of them are slower or dwelling on live channels.
+'''
+import time
+import heapq
+import threading
+import collections
+
+from .const import *
+from .chipcondefs import RSSI, PKTSTATUS
+from .chipcon_usb import ChipconUsbTimeoutException, getRfCatDevices
+
+T1_RATE = 24e6 / 128            # T1 ticks per second, Fref/128
+T1_WRAP = 1 << 32
+
+
+ScanStep = collections.namedtuple('ScanStep', 'freq rssi timestamp carriersense samples dwell device')
+
+
+def rssiToDbm(rssi):
+    return ((rssi ^ 0x80) / 2.0) - 88
+
+def sampleChannel(nic):
+    '''
+    one look at the radio: (rssi_dBm, carriersense).  RSSI, MARCSTATE and
+    PKTSTATUS are adjacent, so it's one peek
+    '''
+    regs = nic.peek(RSSI, PKTSTATUS - RSSI + 1)
+    return rssiToDbm(regs[0]), bool(regs[PKTSTATUS - RSSI] & 0x40)
+
+
+class ClockSync(object):
+    '''
+    maps one dongle's T1 clock onto host time.  add() takes samples of
+    (ticks, host time at the middle of the request, round trip); the rate
+    and offset are a least squares fit over the samples whose round trip is
+    close to the best one, since a slow round trip says little about when
+    the dongle actually read its clock
+    '''
+    def __init__(self, rate=T1_RATE, keep=16):
+        self.nominal = rate
+        self.rate = rate
+        self.keep = keep
+        self.samples = []           # (unwrapped ticks, host time, round trip)
+        self.offset = None          # host time at tick 0
+        self.latency = 0.0          # best one-way USB latency seen
+        self._wraps = 0
+        self._last = None
+
+    def _unwrap(self, ticks):
+        ticks += self._wraps * T1_WRAP
+        if self._last is not None:
+            if ticks < self._last - T1_WRAP // 2:
+                ticks += T1_WRAP
+            elif ticks > self._last + T1_WRAP // 2:
+                ticks -= T1_WRAP
+        return ticks
+
+    def add(self, ticks, hostts, rtt):
+        ticks = self._unwrap(ticks)
+        self._wraps = ticks // T1_WRAP
+        self._last = ticks
+        self.samples.append((ticks, hostts, rtt))
+        del self.samples[:-self.keep]
+        self._fit()
+
+    def _fit(self):
+        best = min([rtt for ticks, hostts, rtt in self.samples])
+        good = [(ticks, hostts) for ticks, hostts, rtt in self.samples if rtt <= best * 2 + .0005]
+        self.latency = best / 2
+
+        n = len(good)
+        mt = sum([ticks for ticks, hostts in good]) / float(n)
+        mh = sum([hostts for ticks, hostts in good]) / float(n)
+
+        self.rate = self.nominal
+        # it takes a few seconds of spread before the rate is worth more than the crystal's spec
+        if good[-1][0] - good[0][0] > 5 * self.nominal:
+            num = sum([(ticks - mt) * (hostts - mh) for ticks, hostts in good])
+            den = sum([(ticks - mt) ** 2 for ticks, hostts in good])
+            if num > 0:
+                rate = den / num
+                # older firmware answers SYS_CMD_GET_CLOCK with junk: don't believe a wild rate
+                # (a cc1110's 26MHz crystal is still within reach)
+                if abs(rate / self.nominal - 1) < .1:
+                    self.rate = rate
+
+        self.offset = mh - mt / self.rate
+
+    def synced(self):
+        return self.offset is not None
+
+    def hostTime(self, ticks):
+        '''
+        host time (time.time()) when the dongle's T1 clock read 'ticks'
+        '''
+        if self.offset is None:
+            raise Exception("no clock samples yet")
+        return self.offset + self._unwrap(ticks) / self.rate
+
+    def ppm(self):
+        return (self.rate / self.nominal - 1) * 1e6
+
+
+class PoolTask(object):
+    '''
+    one job for one dongle.  subclasses implement run(pool, idx, nic) and
+    return the result; wait() hands it back, or raises whatever run() raised
+    '''
+    def __init__(self):
+        self.device = None
+        self.result = None
+        self.error = None
+        self.started = None
+        self.finished = None
+        self._done = threading.Event()
+
+    def run(self, pool, idx, nic):
+        raise NotImplementedError()
+
+    def _run(self, pool, idx):
+        self.device = idx
+        self.started = time.time()
+        try:
+            self.result = self.run(pool, idx, pool.nics[idx])
+        except Exception as e:
+            self.error = e
+        self.finished = time.time()
+        self._done.set()
+
+    def done(self):
+        return self._done.is_set()
+
+    def wait(self, timeout=None):
+        if not self._done.wait(timeout):
+            raise Exception("timeout waiting for %r" % self)
+        if self.error is not None:
+            raise self.error
+        return self.result
+
+class CaptureTask(PoolTask):
+    '''
+    listen on freq for duration seconds.  packets go to the pool's feed
+    '''
+    def __init__(self, freq, duration):
+        PoolTask.__init__(self)
+        self.freq = freq
+        self.duration = duration
+
+    def run(self, pool, idx, nic):
+        nic.setFreq(self.freq)
+        nic.setModeRX()
+        time.sleep(self.duration)
+
+    def __repr__(self):
+        return "CaptureTask(%.3f MHz, %ss)" % (self.freq / 1e6, self.duration)
+
+class TransmitTask(PoolTask):
+    def __init__(self, freq, data, repeat=0):
+        PoolTask.__init__(self)
+        self.freq = freq
+        self.data = data
+        self.repeat = repeat
+
+    def run(self, pool, idx, nic):
+        nic.setFreq(self.freq)
+        nic.RFxmit(self.data, self.repeat)
+
+    def __repr__(self):
+        return "TransmitTask(%.3f MHz, %d bytes)" % (self.freq / 1e6, len(self.data))
+
+class ScanTask(PoolTask):
+    '''
+    step through count channels from basefreq, dwell seconds on each.
+    returns a (freq, rssi_dBm, timestamp, carriersense, device) tuple per step
+    '''
+    def __init__(self, basefreq, inc, count, dwell):
+        PoolTask.__init__(self)
+        self.basefreq = basefreq
+        self.inc = inc
+        self.count = count
+        self.dwell = dwell
+
+    def run(self, pool, idx, nic):
+        hits = []
+        for step in range(self.count):
+            freq = self.basefreq + step * self.inc
+            nic.setFreq(freq)
+            time.sleep(self.dwell)
+            rssi, cs = sampleChannel(nic)
+            hits.append((freq, rssi, time.time(), cs, idx))
+        return hits
+
+    def __repr__(self):
+        return "ScanTask(%.3f MHz + %d x %.3f kHz)" % (self.basefreq / 1e6, self.count, self.inc / 1e3)
+
+class BandScan(object):
+    '''
+    one scan of count channels from basefreq, shared by every dongle in a
+    pool (see DonglePool.bandScan()).
+
+    the channels are cut into chunks of 'chunk' and dealt out in contiguous
+    runs, one run per dongle.  each dongle works through its own run from
+    the front; once it runs dry it steals a chunk from the back of whichever
+    dongle has the most left.
+
+    every channel gets 'dwell' seconds.  while carrier sense fires or RSSI
+    is at least 'rssi' dBm, it's looked at again every 'dwell' seconds, for
+    up to 'maxdwell' seconds in all.  each channel ends up as one ScanStep
+    with the peak RSSI, how many looks saw carrier sense, and how many looks
+    there were.
+    '''
+    def __init__(self, pool, basefreq, inc, count, dwell=.01, maxdwell=.25, rssi=-70, chunk=8, lowball=None):
+        self.pool = pool
+        self.basefreq = basefreq
+        self.inc = inc
+        self.count = count
+        self.dwell = dwell
+        self.maxdwell = max(dwell, maxdwell)
+        self.rssi = rssi
+        self.lowball = lowball
+
+        self._lock = threading.Lock()
+        chunks = [(start, min(chunk, count - start)) for start in range(0, count, chunk)]
+        self._work = []
+        for base, n in pool.splitRange(0, 1, len(chunks)):
+            self._work.append(collections.deque(chunks[int(base):int(base) + n]))
+        self._work += [collections.deque() for x in range(len(pool) - len(self._work))]
+
+        self.steps = []
+        self.steals = 0
+        self.stepsby = [0] * len(pool)
+        self.started = None
+        self.elapsed = None
+        self.tasks = []
+
+    def start(self):
+        self.started = time.time()
+        self.tasks = [self.pool.submit(BandScanTask(self), idx) for idx in range(len(self.pool))]
+        return self
+
+    def wait(self, timeout=None):
+        # timeout covers the whole scan, not each dongle's share of it
+        deadline = None
+        if timeout is not None:
+            deadline = time.time() + timeout
+        for task in self.tasks:
+            if deadline is not None:
+                timeout = max(0, deadline - time.time())
+            task.wait(timeout)
+        self.steps.sort()
+        self.elapsed = max([task.finished for task in self.tasks]) - self.started
+        return self
+
+    def _next(self, idx):
+        with self._lock:
+            if self._work[idx]:
+                return self._work[idx].popleft()
+
+            victim = max(self._work, key=len)
+            if victim:
+                self.steals += 1
+                return victim.pop()
+        return None
+
+    def _step(self, nic, idx, step):
+        freq = self.basefreq + step * self.inc
+        nic.setFreq(freq)
+
+        start = time.time()
+        due = start
+        peak = None
+        carrier = 0
+        samples = 0
+        while True:
+            due += self.dwell
+            time.sleep(max(0, due - time.time()))
+            rssi, cs = sampleChannel(nic)
+            samples += 1
+            carrier += cs
+            if peak is None or rssi > peak:
+                peak = rssi
+            if not (cs or rssi >= self.rssi) or due - start >= self.maxdwell:
+                break
+
+        return ScanStep(freq, peak, start, carrier, samples, time.time() - start, idx)
+
+    def hits(self):
+        '''
+        the channels that had carrier sense or reached the RSSI threshold
+        '''
+        return [step for step in self.steps if step.carriersense or step.rssi >= self.rssi]
+
+    def reprHits(self):
+        output = ["%d channels, %.3f - %.3f MHz, %.2fs on %d dongles (%d steals)  steps per dongle: %r" % (
+                self.count, self.basefreq / 1e6, (self.basefreq + (self.count - 1) * self.inc) / 1e6,
+                self.elapsed or 0, len(self.pool), self.steals, self.stepsby)]
+        for step in self.hits():
+            output.append("    %3.6f MHz:  %5.1f dBm  cs: %2d/%-2d  %.3fs  (dongle %d)" % (
+                    step.freq / 1e6, step.rssi, step.carriersense, step.samples, step.dwell, step.device))
+        return "\n".join(output)
+
+class BandScanTask(PoolTask):
+    '''
+    one dongle's share of a BandScan: take chunks until there are none left
+    '''
+    def __init__(self, scan):
+        PoolTask.__init__(self)
+        self.scan = scan
+
+    def run(self, pool, idx, nic):
+        scan = self.scan
+        if scan.lowball is not None:
+            nic.lowball(scan.lowball)
+        try:
+            while True:
+                chunk = scan._next(idx)
+                if chunk is None:
+                    break
+                start, n = chunk
+                steps = [scan._step(nic, idx, step) for step in range(start, start + n)]
+                with scan._lock:
+                    scan.steps.extend(steps)
+                    scan.stepsby[idx] += n
+        finally:
+            if scan.lowball is not None:
+                nic.lowballRestore()
+
+    def __repr__(self):
+        return "BandScanTask(%.3f MHz + %d)" % (self.scan.basefreq / 1e6, self.scan.count)
+
+
+class DonglePool(object):
+    '''
+    N dongles, one RX feed and one task scheduler.  nics defaults to an
+    RfCat for every dongle plugged in; any USBDongle subclass will do
+    '''
+    def __init__(self, nics=None, reorder=.05, syncinterval=10, maxfeed=100000):
+        if nics is None:
+            from . import RfCat
+            nics = [RfCat(idx=x) for x in range(len(getRfCatDevices()))]
+        if not len(nics):
+            raise Exception("No Dongle Found.  Please insert a RFCAT dongle.")
+
+        self.nics = list(nics)
+        self.reorder = reorder
+        self.syncinterval = syncinterval
+        self.clocks = [ClockSync() for nic in self.nics]
+        self._synced = [0] * len(self.nics)
+
+        # RX: recv threads mark their dongle ready, the RX loop merges
+        self._listeners = [self._makeListener(idx) for idx in range(len(self.nics))]
+        self._ready = set()
+        self._readylock = threading.Lock()
+        self._rxevent = threading.Event()
+        self._heap = []
+        self._seq = 0
+        self._released = 0
+        self.feed = collections.deque()
+        self.maxfeed = maxfeed
+        self._feedcv = threading.Condition()
+
+        # tasks: per-device queues for pinned tasks, one shared queue for the rest
+        self._tasks = collections.deque()
+        self._pinned = [collections.deque() for nic in self.nics]
+        self._taskcv = threading.Condition()
+        self.busy = [None] * len(self.nics)
+
+        self._threads = []
+        self._go = False
+
+        self.packets = [0] * len(self.nics)
+        self.late = 0
+        self.dropped = 0
+        self.decodeerrors = 0
+
+    def __len__(self):
+        return len(self.nics)
+
+    def __enter__(self):
+        return self.start()
+
+    def __exit__(self, *exc):
+        self.stop()
+
+    def start(self):
+        self._go = True
+        for idx, nic in enumerate(self.nics):
+            nic.addRecvListener(self._listeners[idx])
+            self._ready.add(idx)        # whatever came in before we were listening
+
+        self._threads = [threading.Thread(target=self._rxRun)]
+        self._threads += [threading.Thread(target=self._workRun, args=(idx,)) for idx in range(len(self.nics))]
+        for thread in self._threads:
+            thread.daemon = True
+            thread.start()
+        return self
+
+    def stop(self):
+        self._go = False
+        for idx, nic in enumerate(self.nics):
+            nic.removeRecvListener(self._listeners[idx])
+        self._rxevent.set()
+        with self._taskcv:
+            self._taskcv.notify_all()
+        for thread in self._threads:
+            if thread is not threading.current_thread():
+                thread.join()
+        self._threads = []
+        self._release(True)
+
+    ##### clocks #####
+    def sync(self, idx):
+        '''
+        take a clock sample from dongle idx
+        '''
+        nic = self.nics[idx]
+        start = time.time()
+        ticks = nic.getClock()
+        stop = time.time()
+        self.clocks[idx].add(ticks, (start + stop) / 2, stop - start)
+        self._synced[idx] = stop
+
+    def hostTime(self, idx, ticks):
+        '''
+        host time of a T1 clock reading from dongle idx (eg. a raw hunt hit timestamp)
+        '''
+        return self.clocks[idx].hostTime(ticks)
+
+    ##### RX #####
+    def _makeListener(self, idx):
+        def onRecv(app, cmd):
+            # runs on the dongle's recv thread
+            if app == APP_NIC and cmd == NIC_RECV:
+                with self._readylock:
+                    self._ready.add(idx)
+                self._rxevent.set()
+        return onRecv
+
+    def _rxRun(self):
+        while self._go:
+            timeout = None
+            if self._heap:
+                timeout = max(0, self._heap[0][0] + self.reorder - time.time())
+            self._rxevent.wait(timeout)
+            self._rxevent.clear()
+
+            with self._readylock:
+                ready = self._ready
+                self._ready = set()
+            for idx in ready:
+                self._collect(idx)
+            self._release()
+
+    def _collect(self, idx):
+        nic = self.nics[idx]
+        latency = self.clocks[idx].latency
+        for data, ts in nic.recvPending(APP_NIC, NIC_RECV):
+            if nic.endec is not None:
+                try:
+                    data = nic.endec.decode(data)
+                except Exception:
+                    self.decodeerrors += 1
+                    continue
+
+            ts -= latency
+            if ts < self._released:
+                # later than 'reorder' allows for: it goes out of order
+                self.late += 1
+            self.packets[idx] += 1
+            heapq.heappush(self._heap, (ts, self._seq, idx, data))
+            self._seq += 1
+
+    def _release(self, flush=False):
+        horizon = time.time() - self.reorder
+        out = []
+        while self._heap and (flush or self._heap[0][0] <= horizon):
+            ts, seq, idx, data = heapq.heappop(self._heap)
+            self._released = max(self._released, ts)
+            out.append((data, ts, idx))
+
+        if out:
+            with self._feedcv:
+                self.feed.extend(out)
+                while len(self.feed) > self.maxfeed:
+                    self.feed.popleft()
+                    self.dropped += 1
+                self._feedcv.notify_all()
+
+    def recv(self, timeout=1):
+        '''
+        the next packet from any dongle, in time order, as (data, timestamp, device)
+        '''
+        with self._feedcv:
+            if not self.feed:
+                self._feedcv.wait_for(lambda: self.feed, timeout)
+            if not self.feed:
+                raise ChipconUsbTimeoutException()
+            return self.feed.popleft()
+
+    ##### tasks #####
+    def submit(self, task, device=None):
+        '''
+        queue a PoolTask, for a particular dongle or for the first one free
+        '''
+        with self._taskcv:
+            if device is None:
+                self._tasks.append(task)
+            else:
+                self._pinned[device].append(task)
+            self._taskcv.notify_all()
+        return task
+
+    def _take(self, idx):
+        if self._pinned[idx]:
+            return self._pinned[idx].popleft()
+        if self._tasks:
+            return self._tasks.popleft()
+        return None
+
+    def _workRun(self, idx):
+        while self._go:
+            if time.time() - self._synced[idx] >= self.syncinterval:
+                try:
+                    self.sync(idx)
+                except ChipconUsbTimeoutException:
+                    self._synced[idx] = time.time()
+
+            with self._taskcv:
+                task = self._take(idx)
+                if task is None:
+                    self._taskcv.wait(self.syncinterval)
+                    continue
+                self.busy[idx] = task
+
+            task._run(self, idx)
+            self.busy[idx] = None
+
+    def splitRange(self, basefreq, inc, count, parts=None):
+        '''
+        split count channels from basefreq into 'parts' (default: one per
+        dongle) contiguous (basefreq, count) ranges, as even as they go
+        '''
+        if parts is None:
+            parts = len(self.nics)
+        ranges = []
+        start = 0
+        for part in range(parts):
+            n = (count - start) // (parts - part)
+            if n:
+                ranges.append((basefreq + start * inc, n))
+            start += n
+        return ranges
+
+    def scan(self, basefreq=902e6, inc=250e3, count=104, dwell=.05, timeout=None):
+        '''
+        split the channels across the dongles and scan them all at once: a
+        bandScan() with one look per channel.  returns every step's
+        (freq, rssi_dBm, timestamp, carriersense, device), sorted by frequency
+        '''
+        scan = self.bandScan(basefreq, inc, count, dwell, dwell, chunk=1, timeout=timeout)
+        return [(step.freq, step.rssi, step.timestamp, step.carriersense, step.device) for step in scan.steps]
+
+    def bandScan(self, basefreq=300e6, inc=250e3, count=2513, dwell=.01, maxdwell=.25, rssi=-70, chunk=8,
+                 lowball=None, timeout=None):
+        '''
+        scan count channels from basefreq on every dongle, with work stealing
+        and adaptive dwell (see BandScan).  returns the finished BandScan:
+        .steps has every channel by frequency, .hits() the live ones.
+        lowball sets each dongle to that lowball() level for the scan
+        '''
+        return BandScan(self, basefreq, inc, count, dwell, maxdwell, rssi, chunk, lowball).start().wait(timeout)
+
+    def capture(self, freqs, duration):
+        '''
+        listen on each of freqs for duration seconds, as many at once as
+        there are dongles.  returns the CaptureTasks
+        '''
+        return [self.submit(CaptureTask(freq, duration)) for freq in freqs]
+
+    def transmit(self, freq, data, device=None, repeat=0):
+        return self.submit(TransmitTask(freq, data, repeat), device)
+
+    ##### stats #####
+    def stats(self):
+        return {
+            'devices': [{
+                    'packets':  self.packets[idx],
+                    'latency':  self.clocks[idx].latency,
+                    'ppm':      self.clocks[idx].ppm(),
+                    'busy':     self.busy[idx],
+                    'pinned':   len(self._pinned[idx]),
+                } for idx in range(len(self.nics))],
+            'queued':       len(self._tasks),
+            'feed':         len(self.feed),
+            'late':         self.late,
+            'dropped':      self.dropped,
+            'decodeerrors': self.decodeerrors,
+        }
+
+    def reprStats(self):
+        st = self.stats()
+        output = ["tasks queued: %(queued)d  feed: %(feed)d  late: %(late)d  dropped: %(dropped)d  "
+                  "decode errors: %(decodeerrors)d" % st]
+        for idx, dst in enumerate(st['devices']):
+            output.append("    dongle %d:  packets: %7d  usb latency: %6.3fms  clock: %+7.1fppm  pinned: %d  %r" % (
+                    idx, dst['packets'], dst['latency'] * 1000, dst['ppm'], dst['pinned'], dst['busy']))
+        return "\n".join(output)
@@ -10,6 +10,9 @@ import traceback
 
 from rflib.const import *
 from rflib.bits import ord23
+from rflib.chipcon_usb import ChipconUsbTimeoutException
+import rflib.capture as rfcapture
+import rflib.air as rfair
 
 logging.basicConfig(level=logging.INFO, format='%(asctime)s:%(levelname)s:%(name)s: %(message)s')
 logger = logging.getLogger(__name__)
@@ -131,8 +134,12 @@ class MAC_Data:
 class fakeDongle:
     '''
     This class emulates a real RfCat dongle (the physical device), as well as LibUSB.
+
+    With an 'air' (rflib.air.VirtualAir), what it's told to transmit goes out on it,
+    taking as long as it would on a real radio, and what it hears there while it's
+    in RX comes back up as NIC_RECV, like the firmware would send it.
     '''
-    def __init__(self):
+    def __init__(self, air=None):
         self._recvbuf = b''
         self.bulk5 = queue.Queue()
         self.bulk0 = [0 for x in range(EP0BUFSIZE)]
@@ -143,6 +150,10 @@ class fakeDongle:
         self.ampMode = 0
         self.macdata = MAC_Data()
         self.NIC_ID = 0
+        self.cfgGen = 0
+        self.cfgGenSeen = 0
+        self.cfgNotified = False
+        self.stats = dict([(name, 0) for name in STATS_FIELDS])
         self.g_txMsgQueue = ['\0'*(MAX_TX_MSGLEN+1) for x in range(MAX_TX_MSGS)]
         self.g_Channels = b''
 
@@ -152,9 +163,66 @@ class fakeDongle:
             logger.info('setting interrupt register: %r = %r', intreg, intval)
             self.memory.writeMemory(eval(intreg), intval)
 
+        self.air = None
+        if air is not None:
+            air.attach(self)
+
     def clock(self):
         return time.time() - self.start_ts
 
+    ######## the virtual air ########
+    def settings(self):
+        return rfair.radioSettings(self.memory.readMemory(0xdf00, 0x30))
+
+    def now(self):
+        return self.air.now()
+
+    def transmit(self, payload, infinite=False):
+        '''
+        send 'payload' on the air, the way the radio's set up (or as it is, for
+        an infinite mode transmit), and take as long as that takes
+        '''
+        s = self.settings()
+        data = payload if infinite else rfair.airBytes(s, payload)
+        self.stats['txPackets'] += 1
+        self.stats['txBytes'] += len(payload)
+        if self.air is None:
+            return
+
+        start = self.now()
+        self.air.keyup(self, s, start)
+        airtime = (s.preamble + len(rfair.syncBytes(s)) + len(data)) * rfair.byteTime(s)
+        time.sleep(airtime)
+        self.air.transmit(self, rfair.AirFrame(data, s, start=start, end=start + airtime, source=self))
+
+    def deliver(self, frame):
+        '''
+        a frame from the air (any thread).  if we're listening and it's for us,
+        up it goes
+        '''
+        if self.memory.readMemory(X_RFST, 1) != b'%c' % RFST_SRX:
+            return
+        if frame.delay > 0:
+            threading.Timer(frame.delay, self.hear, (frame,)).start()
+        else:
+            self.hear(frame)
+
+    def hear(self, frame):
+        s = self.settings()
+        stream = rfair.hears(s, frame)
+        if stream is None:
+            return
+        # what the firmware hands up: the length byte's dropped for variable length
+        # packets, fixed length ones are PKTLEN however much was sent
+        if s.lengthconfig == PKTCTRL0_LENGTH_CONFIG_VAR:
+            if not stream or ord23(stream[0]) > s.pktlen:
+                self.stats['rxDropped'] += 1
+                return
+            payload = stream[1:1 + ord23(stream[0])]
+        else:
+            payload = stream[:s.pktlen]
+        self.txdata(APP_NIC, NIC_RECV, payload)
+
     def controlMsg(self, flags, request, buf, value, index, timeout):
         logger.info("controlMsg: 0x%x %r %r 0x%x %r %r", flags, request, buf, value, index, timeout)
         try:
@@ -174,9 +242,25 @@ class fakeDongle:
         except:
             logger.error(traceback.format_exc())
 
+    def rfConfigChanged(self):
+        '''
+        the "firmware" changed radio config registers on its own: bump the
+        config generation and tell the host, once until it reads them again
+        '''
+        self.cfgGen = (self.cfgGen + 1) & 0xff
+        if not self.cfgNotified:
+            self.cfgNotified = True
+            self.txdata(APP_NIC, NIC_RF_CONFIG_STALE, self.cfgGen)
+
     def txdata(self, app, cmd, data):
         if type(data) == int and data < 0x100:
             data = b'%c' % data
+        self.stats['usbInMsgs'] += 1
+        self.stats['usbInBytes'] += len(data)
+        if app == APP_NIC and cmd == NIC_RECV:
+            self.stats['rxPackets'] += 1
+            self.stats['rxDelivered'] += 1
+            self.stats['rxBytes'] += len(data)
         self.bulk5.put(struct.pack('<BBH', app, cmd, len(data)) + data)
 
     def bulkWrite(self, chan, buf, timeout=1):
@@ -192,8 +276,8 @@ class fakeDongle:
 
             app, cmd, mlen = struct.unpack("<BBH", self._recvbuf[:4])
 
-            if curbuflen < mlen+2:
-                logger.info("bulkWrite: returning because buffer isn't big enough: len: %x  need: %x", curbuflen, mlen+2)
+            if curbuflen < mlen+4:
+                logger.info("bulkWrite: returning because buffer isn't big enough: len: %x  need: %x", curbuflen, mlen+4)
                 return buflen
 
             # now handle a packet
@@ -202,6 +286,7 @@ class fakeDongle:
             data = pkt[4:]
             #print("_recvbuf:%r\t\tpkt:%r\t\tapp:%x\tcmd:%x\tdata:%r\t\tmlen:%r\t" % (self._recvbuf, pkt, app, cmd, data, hex(mlen)))
             self._recvbuf = self._recvbuf[mlen+4:]
+            self.stats['usbOutMsgs'] += 1
 
             # handle commands for the SYSTEM app
             if app == APP_SYSTEM:
@@ -231,6 +316,36 @@ class fakeDongle:
                 elif cmd == SYS_CMD_DEVICE_SERIAL_NUMBER:
                     self.txdata(app, cmd, FAKE_DONGLE_SERIALNUM)
 
+                elif cmd == SYS_CMD_PARTNUM:
+                    self.txdata(app, cmd, bytes([FAKE_PARTNUM]))
+
+                elif cmd == SYS_CMD_MEMOP:
+                    retmsg = b''
+                    off = 0
+                    while off + 4 <= len(data):
+                        op, addr, size = struct.unpack("<BHB", data[off:off+4])
+                        off += 4
+                        if op == MEMOP_WRITE:
+                            self.memory.writeMemory(addr, data[off:off+size])
+                            off += size
+                        else:
+                            retmsg += self.memory.readMemory(addr, size)
+                    self.txdata(app, cmd, retmsg)
+
+                elif cmd == SYS_CMD_STATUS:
+                    stats = self.stats
+                    stats['version'] = STATS_VERSION
+                    stats['size'] = STATS_LEN
+                    stats['clock'] = int(self.clock() * 24e6 / 128) & 0xffffffff
+                    retmsg = struct.pack(STATS_FMT, *[stats[name] for name in STATS_FIELDS])
+                    if data[:1] not in (b'', b'\0'):
+                        self.stats = dict([(name, 0) for name in STATS_FIELDS])
+                    self.txdata(app, cmd, retmsg)
+
+                elif cmd == SYS_CMD_GET_CLOCK:
+                    ticks = int(self.clock() * 24e6 / 128) & 0xffffffff
+                    self.txdata(app, cmd, struct.pack("<I", ticks))
+
                 elif cmd == SYS_CMD_RFMODE:
                     if len(data) > 1:
                         logger.warning("ummm. what's this extra data in your SYS_CMD_RFMODE command?")
@@ -268,76 +383,69 @@ class fakeDongle:
                     self.setAES(data, ENCCS_CMD_LDKEY, (self.aesMode & AES_CRYPTO_MODE))
                     self.txdata(app, cmd, data[:16])
 
+                elif cmd == NIC_SET_RF_REGS:
+                    # packed (offset, value) pairs into the 0xdf00 config block
+                    count = 0
+                    for x in range(0, len(data) - 1, 2):
+                        off = ord23(data[x])
+                        if off < RF_CFG_REG_COUNT:
+                            self.memory.writeMemory(0xdf00 + off, data[x+1:x+2])
+                            count += 1
+                    marcstate = self.memory.readMemory(0xdf3b, 1)
+                    self.txdata(app, cmd, marcstate + b'%c' % count)
+
+                elif cmd == NIC_GET_RF_CONFIG:
+                    self.cfgGenSeen = self.cfgGen
+                    self.cfgNotified = False
+                    self.txdata(app, cmd, b'%c' % self.cfgGen + self.memory.readMemory(0xdf00, RF_CFG_BLOCK_LEN))
+
+                elif cmd == NIC_XMIT:
+                    length, repeat, offset = struct.unpack("<HHH", data[:6])
+                    payload = data[6:6+length]
+                    if repeat and repeat != 0xffff:
+                        payload += payload[offset:] * repeat
+                    self.transmit(payload)
+                    self.txdata(app, cmd, b'\0')
+
                 elif cmd == NIC_SET_ID:
                     # fixme: sending 8 bit to 16 bit function???
                     self.NIC_ID = ord23(data[0])
                     self.txdata(app, cmd, data[0])
 
                 elif cmd == NIC_LONG_XMIT:
-                    # load up macdata queues, follow-on with 
-                    #
-                    #
-                    # this is duplicating our work in transmit_long().  pick one.
-                    if (macdata.mac_state != FHSS_STATE_NONHOPPING):
-                        data[0] = RC_RF_MODE_INCOMPAT
-                        self.txdata(app, cmd, data[0])
-                   
+                    # the first blocks of a long (infinite mode) transmit.  the real thing starts
+                    # sending as they come in; we collect them all and send at the end
+                    if (self.macdata.mac_state != FHSS_STATE_NONHOPPING):
+                        self.txdata(app, cmd, b'%c' % RC_RF_MODE_INCOMPAT)
+
                     else:
-                        length, blocks = struct.unpack("<HB", data[:2])
-                        txTotal= 0
-                        data[0] = transmit_long(data[3:], length, blocks)
-                        self.txdata(app, cmd, data[0])
+                        length, blocks = struct.unpack("<HB", data[:3])
+                        self.longTotal = length
+                        self.longBuf = data[3:3+length]
+                        self.macdata.mac_state = FHSS_STATE_LONG_XMIT
+                        self.txdata(app, cmd, b'%c' % LCE_NO_ERROR)
 
                 elif cmd == NIC_LONG_XMIT_MORE:
                     length = ord23(data[0])
-                    if (length == 0):
-                        if(rfTxTotalTXLen):
-                            self.debug("dropout final wait!")
-                            #debughex16(rfTxTotalTXLen)
-                            #debughex(g_txMsgQueue[0][0])
-                            #debughex(g_txMsgQueue[1][0])
-                            self.lastCode[1] = LCE_DROPPED_PACKET
-                            data[0] = RC_TX_DROPPED_PACKET
-                            #LED = 0
-                            #resetRFSTATE()
-                            self.macdata.mac_state = FHSS_STATE_NONHOPPING
-                            self.txdata(app, cmd, b'%c' % RC_TX_DROPPED_PACKET)
-                            return
-                        
-                        #LED = 0
-                        self.macdata.mac_state = FHSS_STATE_NONHOPPING
-                        self.debug("total bytes tx:")
-                        #debughex16(txTotal)
-                        self.txdata(app, cmd, b'%c' % LCE_NO_ERROR)
-                        return
-                    
-                    # catch if we've been called out of sequence, or we've had an underrun
                     if (self.macdata.mac_state != FHSS_STATE_LONG_XMIT):
-                        self.debug("underrun")
-                        # TX underrun
-                        if(self.lastCode[1] == LCE_DROPPED_PACKET):
+                        # called out of sequence
+                        self.debug(b"underrun")
+                        self.macdata.mac_state = FHSS_STATE_NONHOPPING
+                        self.txdata(app, cmd, b'%c' % RC_RF_MODE_INCOMPAT)
+
+                    elif (length == 0):
+                        # that was the last of it
+                        self.macdata.mac_state = FHSS_STATE_NONHOPPING
+                        if len(self.longBuf) < self.longTotal:
+                            self.debug(b"dropout final wait!")
                             self.txdata(app, cmd, b'%c' % RC_TX_DROPPED_PACKET)
-                            
                         else:
-                            self.lastCode[1] = LCE_RF_MULTI_BUFFER_NOT_INIT
-                            self.txdata(app, cmd, b'%c' % RC_RF_MODE_INCOMPAT)
-                        
-                        #LED = 0
-                        #resetRFSTATE()
-                        self.macdata.mac_state = FHSS_STATE_NONHOPPING
+                            self.transmit(self.longBuf, infinite=True)
+                            self.txdata(app, cmd, b'%c' % LCE_NO_ERROR)
+
                     else:
-                        # add data to rolling datafer
-                        #data[0] = MAC_tx(&data[1], (__xdata u8) len)
-                        # check for any other error return
-                        #if(data[0] && data[0] != RC_ERR_BUFFER_NOT_AVAILABLE)
-                        #{
-                        #    debug("datafer error");
-                        #    debughex(data[0]);
-                        #    LED = 0;
-                        #    resetRFSTATE();
-                        #    self.macdata.mac_state = FHSS_STATE_NONHOPPING;
-                        #}
-                        self.txdata(app, cmd, data[0]);
+                        self.longBuf += data[1:1+length]
+                        self.txdata(app, cmd, b'%c' % LCE_NO_ERROR)
 
                 elif cmd == FHSS_XMIT:
                     length = ord23(data[0])
@@ -389,7 +497,8 @@ class fakeDongle:
 
                 elif cmd == FHSS_CHANGE_CHANNEL:
                     #PHY_set_channel(data[0]);
-                    self.memory.writeMemory(CHANNR, data[0])
+                    self.memory.writeMemory(CHANNR, data[0:1])
+                    self.rfConfigChanged()
                     self.txdata(app, cmd, data[0]);
 
                 elif cmd == FHSS_START_HOPPING:
@@ -454,7 +563,7 @@ class fakeDongle:
         except:
             logger.error(traceback.format_exc())
 
-    def bulkRead(self, chan, length, timeout=1):
+    def bulkRead(self, chan, length, timeout=1000):
         '''
         In standard USB fashion, bulkRead() handles the "IN" communication, whereby the "host" 
         pulls information back from the "device".  ie. our responses to commands.
@@ -463,21 +572,17 @@ class fakeDongle:
         communication, when in fact USB (pre-v3) is completely host-driven.  If a USB device
         gets to talk, it's because the host asked for information.
 
-        For our purposes, bulkRead() simply pops data out of the EP5 Bulk "queue" and returns.
+        For our purposes, bulkRead() simply pops data out of the EP5 Bulk "queue" and returns,
+        waiting up to 'timeout' milliseconds (as libusb counts it) for something to show up.
 
         This has *nothing* to do with "reading" from the memory.  bulkRead() gives the dongle
         the "talking stick"
         '''
-        starttime = time.time()
-
-        while time.time() - starttime < timeout:
-            try:
-                out = self.bulk5.get_nowait()
-                logger.debug('<= fakeDoer.bulkRead(5, %r) == %r', length, out)
-                return b"@" + out
-            except queue.Empty:
-                time.sleep(.05)
-
+        try:
+            out = self.bulk5.get(timeout=timeout / 1000.0)
+            logger.debug('<= fakeDoer.bulkRead(5, %r) == %r', length, out)
+            return b"@" + out
+        except queue.Empty:
             logger.debug('<= fakeDoer.bulkRead(5, %r) == <EmptyQueue>', length)
             raise usb.USBError('Operation timed out (FakeDongle)')
 
@@ -498,11 +603,13 @@ class fakeDongle:
 
     def setFHSSchanByIdx(self, chanidx):
         chan = self.g_Channels[chanidx]
-        self.memory.writeMemory(CHANNR, chan)
+        self.memory.writeMemory(CHANNR, b'%c' % chan)
+        self.rfConfigChanged()
         return chan
 
     def begin_hopping(self, startchan):
         self.memory.writeMemory(CHANNR, b'%c' % startchan)
+        self.rfConfigChanged()
         return
     def stop_hopping(self):
         return
@@ -511,15 +618,126 @@ class fakeDongle:
         return int((self.clock() * 20) % self.macdata.MAC_threshold)
 
 class FakeRfCat(rflib.RfCat):
-    def __init__(self, idx=0, debug=False, copyDongle=None, RfMode=RFST_SRX):
+    '''
+    an RfCat on a fakeDongle.  fake dongles that share an 'air'
+    (rflib.air.VirtualAir) hear each other's RFxmit()s
+    '''
+    def __init__(self, idx=0, debug=False, copyDongle=None, RfMode=RFST_SRX, air=None):
+        self._air = air
         # instantiate ourself as an official RfCat dongle
         rflib.RfCat.__init__(self, idx, debug, copyDongle, RfMode)
 
     def _internal_select_dongle(self, console=False):
+        old = getattr(self, '_do', None)
+        if old is not None and getattr(old, 'air', None) is not None:
+            old.air.detach(old)
         self._d = fakeDon()
-        self._do = fakeDongle()
+        self._do = fakeDongle(self._air)
         self.console = console
 
     def getPartNum(self):
         return FAKE_PARTNUM
 
+
+
+class ReplayFinished(ChipconUsbTimeoutException):
+    def __str__(self):
+        return "Replay capture exhausted."
+
+class ReplayRfCat(FakeRfCat):
+    '''
+    a FakeRfCat whose receiver plays back a recorded capture, so anything
+    built on RFrecv() (an EnDeCode subclass, rflib.bits analysis, discover()'s
+    statistics) can be re-run offline.
+
+    'capture' is an rflib.capture file name, a CaptureReader, or any list of
+    (data, timestamp) tuples (eg. loadPkts() output).  packets come back with
+    their recorded timestamps, and when a packet was recorded with a
+    different radio config than the last one, that config is loaded into
+    the fake radio's registers first, so getRadioConfig() matches it.
+
+    speed=None replays as fast as RFrecv() is called; otherwise the recorded
+    packet spacing is kept, scaled by 1/speed.  once the capture runs out
+    RFrecv() raises ReplayFinished (a ChipconUsbTimeoutException, so listen
+    loops just see a quiet radio), or starts over if loop is set.
+
+        d = ReplayRfCat('fob.rfcap')
+        d.setEnDeCoder(MyDecoder())
+        while True:
+            try:
+                pkt, ts = d.RFrecv()
+            except ReplayFinished:
+                break
+    '''
+    def __init__(self, capture, speed=None, loop=False, idx=0, debug=False, RfMode=RFST_SRX):
+        if isinstance(capture, str):
+            capture = rfcapture.CaptureReader(capture)
+        self._capture = capture
+        self._speed = speed
+        self._loop = loop
+        FakeRfCat.__init__(self, idx, debug, None, RfMode)
+        self.replayRewind()
+
+    def replayRewind(self):
+        '''
+        start the capture over, and reset the replay statistics
+        '''
+        self._replay = iter(self._capture)
+        self._replayfp = None
+        self.replayed = 0
+        self._replaystart = None
+        self._replayts0 = None
+
+    def _replayNext(self):
+        try:
+            pkt = next(self._replay)
+        except StopIteration:
+            if not self._loop or not self.replayed:
+                raise ReplayFinished()
+            self._replay = iter(self._capture)
+            pkt = next(self._replay)
+
+        if isinstance(pkt, rfcapture.Packet):
+            if pkt.fingerprint != self._replayfp:
+                cfg = self._capture.radioConfig(pkt)
+                if cfg is not None:
+                    self._do.memory.writeMemory(0xdf00, cfg[:RF_CFG_REG_COUNT])
+                    self.invalidateRadioConfig()
+                self._replayfp = pkt.fingerprint
+            data, ts = pkt.data, pkt.timestamp
+        else:
+            data, ts = pkt[:2]
+
+        now = time.time()
+        if self._replaystart is None:
+            self._replaystart = now
+            self._replayts0 = ts
+        elif self._speed:
+            delay = (ts - self._replayts0) / self._speed - (now - self._replaystart)
+            if delay > 0:
+                time.sleep(delay)
+
+        self.replayed += 1
+        return data, ts
+
+    def recv(self, app, cmd=None, wait=USB_RX_WAIT):
+        if app == APP_NIC and cmd == NIC_RECV:
+            return self._replayNext()
+        return FakeRfCat.recv(self, app, cmd, wait)
+
+    def _rawPackets(self, stop, wait):
+        # RFpipeline() source: ends with the capture instead of idling
+        while not stop.is_set():
+            try:
+                yield self._replayNext()
+            except ReplayFinished:
+                return
+
+    def replayStats(self):
+        '''
+        (packets replayed, seconds since the first one, packets/sec)
+        '''
+        if self._replaystart is None:
+            return 0, 0.0, 0.0
+        elapsed = time.time() - self._replaystart
+        return self.replayed, elapsed, self.replayed / max(elapsed, 1e-9)
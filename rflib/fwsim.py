@@ -0,0 +1,2262 @@
+'''
+firmware in the loop: the real firmware build, running on a simulated cc1111
+
+    d = SimRfCat('firmware/bins/RfCatChronos-xxxx.hex')    # an rflib.RfCat like any other
+    d.setFreq(433.92e6)
+    d.RFxmit(b'hello')
+
+fakedongle_nic answers rflib's commands with Python written to look like the
+firmware.  this runs the firmware itself: the .hex is loaded into an 8051
+(Core8051) with the parts of the cc1111 the firmware talks to modeled around
+it (CC1111), and rflib talks to it over the same control and bulk transfers
+it would use on a real bus (SimDongle, which looks like a pyusb device
+handle).  so what the host sees, including how long things take, comes from
+the firmware's own code paths.
+
+what's modeled:
+
+    cpu         the whole 8051 instruction set, with the cc1111's dual
+                DPTR, MPAGE and interrupt controller (18 vectors, 4 levels).
+                one machine cycle per clock at 24MHz, which is the clock
+                the firmware runs from once clock_init() is done
+    timer 1     free-running and modulo modes, overflow and compare
+                interrupts: the firmware's clock and FHSS hop timer
+    dma         all five channels, single and block, any trigger
+    aes         the coprocessor's DMA and ENCCS handshake.  the cipher
+                itself isn't modeled: blocks come out as they went in
+    usb         endpoint 0 control transfers and endpoint 5 bulk IN/OUT,
+                double buffered, with the controller's interrupt flags
+    radio       MARCSTATE and the strobes, with settling and calibration
+                time; TX and RX a byte at a time through RFD at the
+                configured data rate; RFIF/RFIM; RSSI, LQI and PKTSTATUS
+    watchdog    resets the chip, and the host sees the device go away
+
+frames a radio sends go out on a VirtualAir (rflib.air), which hands them to
+every other radio attached to it, through its channel model; each receiver
+decides from its own registers (frequency, bandwidth, data rate,
+modulation, sync word) whether it hears one.  a frame reaches the others
+when its transmission ends, plus the channel's latency.
+
+time is simulated: each SimDongle's cpu runs in a thread of its own as fast
+as Python can run it, and USB timeouts are counted in simulated
+milliseconds, so a slow host doesn't make the firmware miss deadlines it
+would make on the real chip.  dongles on an air with a 'quantum' keep
+their clocks in lockstep, so collisions and carrier sense between them
+happen when they would.
+'''
+import time
+import heapq
+import random
+import threading
+import collections
+
+import usb
+import rflib
+
+from .const import *
+from . import intelhex
+from .pktengine import crc16
+from .air import FXOSC, RadioSettings, radioSettings, syncBytes, byteCycles, airBytes, hears, AirFrame, \
+        ChannelModel, VirtualAir
+
+NEVER = 1 << 62
+
+PARITY = bytes([bin(x).count('1') & 1 for x in range(256)])
+
+# 8051 registers the core itself needs
+DPL1 = 0x84
+DPH1 = 0x85
+PSW_CY = 0x80
+PSW_AC = 0x40
+PSW_OV = 0x04
+
+# machine cycles per opcode.  everything not listed takes one
+CYCLES = bytearray([1] * 256)
+for _op in list(range(0x01, 0x100, 0x20)) + list(range(0x11, 0x100, 0x20)):   # AJMP/ACALL
+    CYCLES[_op] = 2
+for _op in (0x02, 0x12, 0x22, 0x32,                         # LJMP LCALL RET RETI
+            0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70, 0x80, # JBC JB JNB JC JNC JZ JNZ SJMP
+            0x43, 0x53, 0x63, 0x72, 0x73, 0x75, 0x82, 0x83, 0x85,
+            0x90, 0x92, 0x93, 0xa0, 0xa3, 0xb0, 0xc0, 0xd0, 0xd5,
+            0xe0, 0xe2, 0xe3, 0xf0, 0xf2, 0xf3):            # MOVX
+    CYCLES[_op] = 2
+for _op in list(range(0x86, 0x90)) + list(range(0xa6, 0xb0)) + list(range(0xb4, 0xc0)) + list(range(0xd8, 0xe0)):
+    CYCLES[_op] = 2
+CYCLES[0x84] = CYCLES[0xa4] = 4                             # DIV MUL
+
+# taking an interrupt: the LCALL the core makes, plus latching the request
+IRQ_CYCLES = 7
+
+# the interrupt sources, by vector:
+# (vector, flag sfr, flag mask, enable sfr, enable mask, priority group, flag cleared on entry)
+IRQ_SOURCES = (
+    (0,  TCON,   0x02, IEN0, 0x01, 0, True),     # RFTXRX
+    (1,  TCON,   0x20, IEN0, 0x02, 1, True),     # ADC
+    (2,  TCON,   0x08, IEN0, 0x04, 2, True),     # URX0
+    (3,  TCON,   0x80, IEN0, 0x08, 3, True),     # URX1
+    (4,  S0CON,  0x03, IEN0, 0x10, 4, False),    # ENC
+    (5,  IRCON,  0x80, IEN0, 0x20, 5, False),    # ST
+    (6,  IRCON2, 0x01, IEN2, 0x02, 1, False),    # P2INT (usb)
+    (7,  IRCON2, 0x02, IEN2, 0x04, 2, False),    # UTX0
+    (8,  IRCON,  0x01, IEN1, 0x01, 0, False),    # DMA
+    (9,  IRCON,  0x02, IEN1, 0x02, 1, True),     # T1
+    (10, IRCON,  0x04, IEN1, 0x04, 2, True),     # T2
+    (11, IRCON,  0x08, IEN1, 0x08, 3, True),     # T3
+    (12, IRCON,  0x10, IEN1, 0x10, 4, True),     # T4
+    (13, IRCON,  0x20, IEN1, 0x20, 5, False),    # P0INT
+    (14, IRCON2, 0x04, IEN2, 0x08, 3, False),    # UTX1
+    (15, IRCON2, 0x08, IEN2, 0x10, 4, False),    # P1INT
+    (16, S1CON,  0x03, IEN2, 0x01, 0, False),    # RF
+    (17, IRCON2, 0x10, IEN2, 0x20, 5, False),    # WDT
+)
+# writing any of these may let an interrupt in
+IRQ_SFRS = frozenset([TCON, S0CON, S1CON, IRCON, IRCON2, IEN0, IEN1, IEN2, IP0, IP1])
+
+# register values after a reset, where they aren't 0
+SFR_RESET = {0x80: 0xff, 0x90: 0xff, 0xa0: 0xff,            # P0 P1 P2
+             SP: 0x07, CLKCON: 0xc9, TIMIF: 0x40, ENCCS: ENCCS_RDY, SLEEP: 0x00}
+
+# 0xdf00-0xdf37: the radio's configuration registers, then PARTNUM and VERSION
+RF_RESET = bytes((
+    0xd3, 0x91, 0xff, 0x04, 0x45, 0x00, 0x00, 0x0f,   # SYNC1 SYNC0 PKTLEN PKTCTRL1 PKTCTRL0 ADDR CHANNR FSCTRL1
+    0x00, 0x1e, 0xc4, 0xec, 0x8c, 0x22, 0x02, 0x22,   # FSCTRL0 FREQ2 FREQ1 FREQ0 MDMCFG4..MDMCFG1
+    0xf8, 0x47, 0x07, 0x30, 0x04, 0x36, 0x6c, 0x03,   # MDMCFG0 DEVIATN MCSM2 MCSM1 MCSM0 FOCCFG BSCFG AGCCTRL2
+    0x40, 0x91, 0x56, 0x10, 0xa9, 0x0a, 0x20, 0x0d,   # AGCCTRL1 AGCCTRL0 FREND1 FREND0 FSCAL3..FSCAL0
+    0x00, 0x00, 0x00, 0x88, 0x31, 0x09, 0x00, 0x00,   # - - - TEST2 TEST1 TEST0 - PA_TABLE7
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,   # PA_TABLE6..PA_TABLE0 IOCFG2
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x11, 0x03,   # IOCFG1 IOCFG0 - - - - PARTNUM VERSION
+))
+
+T1_DIV = (1, 8, 32, 128)
+
+# the aes core takes about this long per block
+AES_CYCLES = 40
+
+# radio timing, in clocks: calibration, and the synthesizer settling on the way into RX/TX
+RF_CAL_CYCLES = 17280           # 720us
+RF_SETTLE_CYCLES = 2100         # from IDLE, ~88us
+RF_TURNAROUND_CYCLES = 720      # RX<->TX, 30us
+RF_FSTXON_CYCLES = 24           # FSTXON to TX
+
+RSSI_NOISE = -100               # dBm when nothing's on the air
+
+# usb controller bits (firmware/include/chipcon_usb.h)
+USBCS0_OUTPKT_RDY       = 0x01
+USBCS0_INPKT_RDY        = 0x02
+USBCS0_SENT_STALL       = 0x04
+USBCS0_DATA_END         = 0x08
+USBCS0_SETUP_END        = 0x10
+USBCS0_SEND_STALL       = 0x20
+USBCS0_CLR_OUTPKT_RDY   = 0x40
+USBCS0_CLR_SETUP_END    = 0x80
+
+USBCSIL_INPKT_RDY       = 0x01
+USBCSIL_PKT_PRESENT     = 0x02
+USBCSIL_FLUSH_PACKET    = 0x08
+USBCSIL_SEND_STALL      = 0x10
+USBCSIL_SENT_STALL      = 0x20
+USBCSIH_IN_DBL_BUF      = 0x01
+
+USBCSOL_OUTPKT_RDY      = 0x01
+USBCSOL_FLUSH_PACKET    = 0x10
+USBCSOL_SEND_STALL      = 0x20
+USBCSOL_SENT_STALL      = 0x40
+USBCSOH_OUT_DBL_BUF     = 0x01
+
+USBIIF_EP0IF            = 0x01
+USBIIF_INEP5IF          = 0x20
+USBOIF_OUTEP5IF         = 0x20
+USBCIF_RSTIF            = 0x04
+
+USBADDR                 = 0xDE00
+USBPOW                  = 0xDE01
+USBIIF                  = 0xDE02
+USBOIF                  = 0xDE04
+USBCIF                  = 0xDE06
+USBIIE                  = 0xDE07
+USBOIE                  = 0xDE09
+USBCIE                  = 0xDE0B
+USBFRML                 = 0xDE0C
+USBFRMH                 = 0xDE0D
+USBINDEX                = 0xDE0E
+USBF0                   = 0xDE20
+USBF5                   = 0xDE2A
+
+EP0_MAX_PACKET = 32
+EP5_MAX_PACKET = 64
+
+# SimDongle: how many clocks the cpu thread runs between looks at the host
+SIM_BATCH = 2400
+SIM_BOOT_TIMEOUT = 2000         # simulated ms for the firmware to turn its usb on
+
+
+class Core8051(object):
+    '''
+    an 8051: code, internal ram, sfr and xdata spaces, and a cycle counter.
+
+    peripherals hook the registers they own (sfrread/sfrwrite by sfr address,
+    xread/xwrite by xdata address); registers nobody hooks are plain memory.
+    they do their work either when they're touched or at a time they ask for
+    with at(), which run() calls when the cycle counter gets there, between
+    instructions.  interrupts are looked for only after something that could
+    change the answer (irqcheck): a write to a flag, enable or priority
+    register, a peripheral raising a flag (flag()), or a RETI.
+    '''
+    sources = IRQ_SOURCES
+    irqsfrs = IRQ_SFRS
+
+    def __init__(self):
+        self.code = bytearray(b'\xff' * 0x10000)
+        self.iram = bytearray(0x100)
+        self.sfr = bytearray(0x100)
+        self.xram = bytearray(0x10000)
+        self.sfrread = {PSW: self._rdpsw}
+        self.sfrwrite = {}
+        self.xread = {}
+        self.xwrite = {}
+        self.cycles = 0
+        self.vectorbase = 0
+        self.events = []
+        self.deadline = NEVER
+        self.eventseq = 0
+        self.ops = [getattr(self, '_op_%.2x' % op, None) or self._opFor(op) for op in range(256)]
+        self.reset()
+
+    def reset(self):
+        '''
+        a power-on reset.  the cycle counter keeps going, so anything timed
+        against it stays monotonic
+        '''
+        self.iram[:] = bytes(0x100)
+        self.sfr[:] = bytes(0x100)
+        for addr, val in SFR_RESET.items():
+            self.sfr[addr] = val
+        self.pc = self.vectorbase
+        self.events = []
+        self.deadline = NEVER
+        self.active = []
+        self.irqcheck = False
+        self.irqhold = False
+        self.idle = False
+
+    def load(self, image):
+        '''
+        load a firmware image: an IntelHex, the name of a .hex file, or raw
+        bytes to go at 0.  the image's lowest address is where it starts and
+        where its interrupt vectors are (0 for a standalone build, 0x1400
+        behind the bootloader)
+        '''
+        if isinstance(image, (bytes, bytearray)):
+            self.loadBytes(image)
+            self.vectorbase = 0
+            self.reset()
+            return
+        if not isinstance(image, intelhex.IntelHex):
+            image = intelhex.IntelHex(image)
+        start = image.minaddr()
+        data = image.tobinarray(start=start)
+        self.code[start:start + len(data)] = bytes(data)
+        self.vectorbase = start
+        self.reset()
+
+    def loadBytes(self, data, addr=0):
+        self.code[addr:addr + len(data)] = bytes(data)
+
+    ######## time ########
+    def at(self, cycle, fn):
+        '''
+        call fn() once the cycle counter reaches 'cycle'
+        '''
+        self.eventseq += 1
+        heapq.heappush(self.events, (cycle, self.eventseq, fn))
+        if cycle < self.deadline:
+            self.deadline = cycle
+
+    def tick(self):
+        # an event can reset the chip, which replaces the list
+        while self.events and self.events[0][0] <= self.cycles:
+            heapq.heappop(self.events)[2]()
+        self.deadline = self.events[0][0] if self.events else NEVER
+
+    def run(self, cycles):
+        '''
+        run for (at least) 'cycles' clocks
+        '''
+        end = self.cycles + cycles
+        code = self.code
+        ops = self.ops
+        cyc = CYCLES
+        while self.cycles < end:
+            if self.irqcheck:
+                self._interrupt()
+            if self.idle:
+                # nothing happens until something wakes us: skip ahead to it
+                self.cycles = max(self.cycles, min(self.deadline, end))
+                if self.cycles >= self.deadline:
+                    self.tick()
+                continue
+
+            op = code[self.pc]
+            self.pc = (self.pc + 1) & 0xffff
+            ops[op](op)
+            self.cycles += cyc[op]
+            if self.cycles >= self.deadline:
+                self.tick()
+
+    def runUntil(self, cond, limit, chunk=64):
+        '''
+        run until cond() is true, checking every 'chunk' clocks.  False if
+        'limit' clocks went by first
+        '''
+        end = self.cycles + limit
+        while not cond():
+            if self.cycles >= end:
+                return False
+            self.run(chunk)
+        return True
+
+    ######## interrupts ########
+    def flag(self, addr, mask):
+        '''
+        a peripheral sets an interrupt flag
+        '''
+        self.sfr[addr] |= mask
+        self.irqcheck = True
+
+    def _interrupt(self):
+        self.irqcheck = False
+        if self.irqhold:
+            # the instruction after a RETI always runs
+            self.irqhold = False
+            self.irqcheck = True
+            return
+
+        sfr = self.sfr
+        if not sfr[IEN0] & 0x80:
+            return
+
+        current = self.active[-1] if self.active else -1
+        best = None
+        bestlevel = current
+        for source in self.sources:
+            vector, flagreg, flagmask, enreg, enmask, group, autoclear = source
+            if sfr[flagreg] & flagmask and sfr[enreg] & enmask:
+                bit = 1 << group
+                level = (2 if sfr[IP1] & bit else 0) | (1 if sfr[IP0] & bit else 0)
+                if level > bestlevel:
+                    best, bestlevel = source, level
+        if best is None:
+            return
+
+        vector, flagreg, flagmask, enreg, enmask, group, autoclear = best
+        if autoclear:
+            sfr[flagreg] &= ~flagmask & 0xff
+        self.idle = False
+        self._pushpc()
+        self.pc = self.vectorbase + 3 + 8 * vector
+        self.active.append(bestlevel)
+        self.cycles += IRQ_CYCLES
+
+    ######## memory ########
+    def _rdpsw(self):
+        return (self.sfr[PSW] & 0xfe) | PARITY[self.sfr[ACC]]
+
+    def rd(self, addr):
+        '''
+        direct addressing: internal ram below 0x80, sfrs above
+        '''
+        if addr < 0x80:
+            return self.iram[addr]
+        hook = self.sfrread.get(addr)
+        if hook is not None:
+            return hook()
+        return self.sfr[addr]
+
+    def wr(self, addr, val):
+        if addr < 0x80:
+            self.iram[addr] = val
+            return
+        hook = self.sfrwrite.get(addr)
+        if hook is not None:
+            hook(val)
+        else:
+            self.sfr[addr] = val
+        if addr in self.irqsfrs:
+            self.irqcheck = True
+
+    def rdx(self, addr):
+        '''
+        xdata: flash below 0x8000 (read only), the radio and usb registers,
+        the sfrs again at 0xdf80, ram at 0xf000 with internal ram at 0xff00
+        '''
+        if addr >= 0xf000:
+            if addr >= 0xff00:
+                return self.iram[addr & 0xff]
+            return self.xram[addr]
+        hook = self.xread.get(addr)
+        if hook is not None:
+            return hook()
+        if addr < 0x8000:
+            return self.code[addr]
+        if 0xdf80 <= addr < 0xe000:
+            return self.rd(addr & 0xff)
+        return self.xram[addr]
+
+    def wrx(self, addr, val):
+        if addr >= 0xf000:
+            if addr >= 0xff00:
+                self.iram[addr & 0xff] = val
+            else:
+                self.xram[addr] = val
+            return
+        hook = self.xwrite.get(addr)
+        if hook is not None:
+            hook(val)
+            return
+        if addr < 0x8000:
+            return
+        if 0xdf80 <= addr < 0xe000:
+            self.wr(addr & 0xff, val)
+            return
+        self.xram[addr] = val
+
+    def rdbit(self, bit):
+        if bit < 0x80:
+            return (self.iram[0x20 + (bit >> 3)] >> (bit & 7)) & 1
+        return (self.rd(bit & 0xf8) >> (bit & 7)) & 1
+
+    def wrbit(self, bit, val):
+        mask = 1 << (bit & 7)
+        if bit < 0x80:
+            idx = 0x20 + (bit >> 3)
+            if val:
+                self.iram[idx] |= mask
+            else:
+                self.iram[idx] &= ~mask & 0xff
+            return
+        addr = bit & 0xf8
+        old = self.sfr[addr]
+        self.wr(addr, (old | mask) if val else (old & ~mask & 0xff))
+
+    @property
+    def dptr(self):
+        sfr = self.sfr
+        if sfr[DPS] & 1:
+            return (sfr[DPH1] << 8) | sfr[DPL1]
+        return (sfr[DPH0] << 8) | sfr[DPL0]
+
+    @dptr.setter
+    def dptr(self, val):
+        sfr = self.sfr
+        if sfr[DPS] & 1:
+            sfr[DPH1], sfr[DPL1] = (val >> 8) & 0xff, val & 0xff
+        else:
+            sfr[DPH0], sfr[DPL0] = (val >> 8) & 0xff, val & 0xff
+
+    def reg(self, n):
+        '''
+        R0-R7 in the current bank
+        '''
+        return self.iram[(self.sfr[PSW] & 0x18) | n]
+
+    ######## instruction helpers ########
+    def _fetch(self):
+        pc = self.pc
+        self.pc = (pc + 1) & 0xffff
+        return self.code[pc]
+
+    def _fetch16(self):
+        hi = self._fetch()
+        return (hi << 8) | self._fetch()
+
+    def _rel(self):
+        # relative offsets are always the instruction's last byte
+        off = self._fetch()
+        return (self.pc + off - (0x100 if off & 0x80 else 0)) & 0xffff
+
+    def _push(self, val):
+        sp = (self.sfr[SP] + 1) & 0xff
+        self.sfr[SP] = sp
+        self.iram[sp] = val
+
+    def _pop(self):
+        sp = self.sfr[SP]
+        self.sfr[SP] = (sp - 1) & 0xff
+        return self.iram[sp]
+
+    def _pushpc(self):
+        self._push(self.pc & 0xff)
+        self._push(self.pc >> 8)
+
+    def _ea(self, op):
+        '''
+        the operand the low bits of 'op' pick: direct (x5, 0x100|addr), @Ri
+        (x6-x7) or Rn (x8-xf), the last two as internal ram addresses
+        '''
+        lo = op & 0x0f
+        if lo >= 8:
+            return (self.sfr[PSW] & 0x18) | (lo - 8)
+        if lo >= 6:
+            return self.iram[(self.sfr[PSW] & 0x18) | (lo - 6)]
+        return 0x100 | self._fetch()
+
+    def _ld(self, ea):
+        if ea & 0x100:
+            return self.rd(ea & 0xff)
+        return self.iram[ea]
+
+    def _st(self, ea, val):
+        if ea & 0x100:
+            self.wr(ea & 0xff, val)
+        else:
+            self.iram[ea] = val
+
+    def _src(self, op):
+        # x4 is #data, the rest as _ea()
+        if op & 0x0f == 4:
+            return self._fetch()
+        return self._ld(self._ea(op))
+
+    def _setcy(self, cy):
+        if cy:
+            self.sfr[PSW] |= PSW_CY
+        else:
+            self.sfr[PSW] &= ~PSW_CY & 0xff
+
+    def _add(self, val, carry):
+        sfr = self.sfr
+        a = sfr[ACC]
+        res = a + val + carry
+        psw = sfr[PSW] & ~(PSW_CY | PSW_AC | PSW_OV) & 0xff
+        if res > 0xff:
+            psw |= PSW_CY
+        if (a & 0xf) + (val & 0xf) + carry > 0xf:
+            psw |= PSW_AC
+        if (~(a ^ val) & (a ^ res)) & 0x80:
+            psw |= PSW_OV
+        sfr[PSW] = psw
+        sfr[ACC] = res & 0xff
+
+    def _subb(self, val):
+        sfr = self.sfr
+        a = sfr[ACC]
+        carry = 1 if sfr[PSW] & PSW_CY else 0
+        res = a - val - carry
+        psw = sfr[PSW] & ~(PSW_CY | PSW_AC | PSW_OV) & 0xff
+        if res < 0:
+            psw |= PSW_CY
+        if (a & 0xf) - (val & 0xf) - carry < 0:
+            psw |= PSW_AC
+        if ((a ^ val) & (a ^ res)) & 0x80:
+            psw |= PSW_OV
+        sfr[PSW] = psw
+        sfr[ACC] = res & 0xff
+
+    def _cjne(self, a, b, target):
+        self._setcy(a < b)
+        if a != b:
+            self.pc = target
+
+    def _opFor(self, op):
+        '''
+        the handler for the opcodes that come in families (by their high
+        nibble, operand in the low bits)
+        '''
+        if op & 0x0f == 1:
+            return self._acall if op & 0x10 else self._ajmp
+        if op in (0xd6, 0xd7):
+            return self._xchd
+        return {
+            0x0: self._inc, 0x1: self._dec, 0x2: self._addop, 0x3: self._addcop,
+            0x4: self._orlop, 0x5: self._anlop, 0x6: self._xrlop, 0x7: self._movimm,
+            0x8: self._movtodirect, 0x9: self._subbop, 0xa: self._movfromdirect,
+            0xb: self._cjneop, 0xc: self._xchop, 0xd: self._djnzop, 0xe: self._movtoa,
+            0xf: self._movfroma,
+        }[op >> 4]
+
+    def _undefined(self, op):
+        raise Exception("undefined opcode %.2x at %.4x" % (op, (self.pc - 1) & 0xffff))
+
+    ######## the instruction families ########
+    def _ajmp(self, op):
+        lo = self._fetch()
+        self.pc = (self.pc & 0xf800) | ((op & 0xe0) << 3) | lo
+
+    def _acall(self, op):
+        lo = self._fetch()
+        self._pushpc()
+        self.pc = (self.pc & 0xf800) | ((op & 0xe0) << 3) | lo
+
+    def _inc(self, op):
+        ea = self._ea(op)
+        self._st(ea, (self._ld(ea) + 1) & 0xff)
+
+    def _dec(self, op):
+        ea = self._ea(op)
+        self._st(ea, (self._ld(ea) - 1) & 0xff)
+
+    def _addop(self, op):
+        self._add(self._src(op), 0)
+
+    def _addcop(self, op):
+        self._add(self._src(op), 1 if self.sfr[PSW] & PSW_CY else 0)
+
+    def _subbop(self, op):
+        self._subb(self._src(op))
+
+    def _orlop(self, op):
+        self.sfr[ACC] |= self._src(op)
+
+    def _anlop(self, op):
+        self.sfr[ACC] &= self._src(op)
+
+    def _xrlop(self, op):
+        self.sfr[ACC] ^= self._src(op)
+
+    def _movimm(self, op):
+        # MOV @Ri/Rn,#data
+        ea = self._ea(op)
+        self.iram[ea] = self._fetch()
+
+    def _movtodirect(self, op):
+        # MOV direct,@Ri/Rn
+        ea = self._ea(op)
+        self.wr(self._fetch(), self.iram[ea])
+
+    def _movfromdirect(self, op):
+        # MOV @Ri/Rn,direct
+        ea = self._ea(op)
+        self.iram[ea] = self.rd(self._fetch())
+
+    def _cjneop(self, op):
+        # CJNE A,direct,rel / CJNE @Ri/Rn,#data,rel
+        if op == 0xb5:
+            val = self.rd(self._fetch())
+            self._cjne(self.sfr[ACC], val, self._rel())
+        else:
+            val = self.iram[self._ea(op)]
+            imm = self._fetch()
+            self._cjne(val, imm, self._rel())
+
+    def _xchop(self, op):
+        ea = self._ea(op)
+        val = self._ld(ea)
+        self._st(ea, self.sfr[ACC])
+        self.sfr[ACC] = val
+
+    def _xchd(self, op):
+        ea = self._ea(op)
+        a = self.sfr[ACC]
+        val = self.iram[ea]
+        self.iram[ea] = (val & 0xf0) | (a & 0x0f)
+        self.sfr[ACC] = (a & 0xf0) | (val & 0x0f)
+
+    def _djnzop(self, op):
+        if op == 0xd5:
+            addr = self._fetch()
+            target = self._rel()
+            val = (self.rd(addr) - 1) & 0xff
+            self.wr(addr, val)
+        else:
+            ea = self._ea(op)
+            target = self._rel()
+            val = (self.iram[ea] - 1) & 0xff
+            self.iram[ea] = val
+        if val:
+            self.pc = target
+
+    def _movtoa(self, op):
+        self.sfr[ACC] = self._ld(self._ea(op))
+
+    def _movfroma(self, op):
+        self._st(self._ea(op), self.sfr[ACC])
+
+    ######## the one-offs ########
+    def _op_00(self, op):       # NOP
+        pass
+
+    def _op_02(self, op):       # LJMP
+        self.pc = self._fetch16()
+
+    def _op_12(self, op):       # LCALL
+        addr = self._fetch16()
+        self._pushpc()
+        self.pc = addr
+
+    def _op_22(self, op):       # RET
+        hi = self._pop()
+        self.pc = (hi << 8) | self._pop()
+
+    def _op_32(self, op):       # RETI
+        self._op_22(op)
+        if self.active:
+            self.active.pop()
+        self.irqcheck = True
+        self.irqhold = True
+
+    def _op_03(self, op):       # RR A
+        a = self.sfr[ACC]
+        self.sfr[ACC] = ((a >> 1) | (a << 7)) & 0xff
+
+    def _op_13(self, op):       # RRC A
+        sfr = self.sfr
+        a = sfr[ACC]
+        cy = sfr[PSW] & PSW_CY
+        self._setcy(a & 1)
+        sfr[ACC] = (a >> 1) | cy
+
+    def _op_23(self, op):       # RL A
+        a = self.sfr[ACC]
+        self.sfr[ACC] = ((a << 1) | (a >> 7)) & 0xff
+
+    def _op_33(self, op):       # RLC A
+        sfr = self.sfr
+        a = sfr[ACC]
+        cy = 1 if sfr[PSW] & PSW_CY else 0
+        self._setcy(a & 0x80)
+        sfr[ACC] = ((a << 1) | cy) & 0xff
+
+    def _op_04(self, op):       # INC A
+        self.sfr[ACC] = (self.sfr[ACC] + 1) & 0xff
+
+    def _op_14(self, op):       # DEC A
+        self.sfr[ACC] = (self.sfr[ACC] - 1) & 0xff
+
+    def _op_10(self, op):       # JBC bit,rel
+        bit = self._fetch()
+        target = self._rel()
+        if self.rdbit(bit):
+            self.wrbit(bit, 0)
+            self.pc = target
+
+    def _op_20(self, op):       # JB bit,rel
+        bit = self._fetch()
+        target = self._rel()
+        if self.rdbit(bit):
+            self.pc = target
+
+    def _op_30(self, op):       # JNB bit,rel
+        bit = self._fetch()
+        target = self._rel()
+        if not self.rdbit(bit):
+            self.pc = target
+
+    def _op_40(self, op):       # JC rel
+        target = self._rel()
+        if self.sfr[PSW] & PSW_CY:
+            self.pc = target
+
+    def _op_50(self, op):       # JNC rel
+        target = self._rel()
+        if not self.sfr[PSW] & PSW_CY:
+            self.pc = target
+
+    def _op_60(self, op):       # JZ rel
+        target = self._rel()
+        if not self.sfr[ACC]:
+            self.pc = target
+
+    def _op_70(self, op):       # JNZ rel
+        target = self._rel()
+        if self.sfr[ACC]:
+            self.pc = target
+
+    def _op_80(self, op):       # SJMP rel
+        self.pc = self._rel()
+
+    def _op_42(self, op):       # ORL direct,A
+        addr = self._fetch()
+        self.wr(addr, self.rd(addr) | self.sfr[ACC])
+
+    def _op_43(self, op):       # ORL direct,#data
+        addr = self._fetch()
+        self.wr(addr, self.rd(addr) | self._fetch())
+
+    def _op_52(self, op):       # ANL direct,A
+        addr = self._fetch()
+        self.wr(addr, self.rd(addr) & self.sfr[ACC])
+
+    def _op_53(self, op):       # ANL direct,#data
+        addr = self._fetch()
+        self.wr(addr, self.rd(addr) & self._fetch())
+
+    def _op_62(self, op):       # XRL direct,A
+        addr = self._fetch()
+        self.wr(addr, self.rd(addr) ^ self.sfr[ACC])
+
+    def _op_63(self, op):       # XRL direct,#data
+        addr = self._fetch()
+        self.wr(addr, self.rd(addr) ^ self._fetch())
+
+    def _op_72(self, op):       # ORL C,bit
+        if self.rdbit(self._fetch()):
+            self._setcy(1)
+
+    def _op_a0(self, op):       # ORL C,/bit
+        if not self.rdbit(self._fetch()):
+            self._setcy(1)
+
+    def _op_82(self, op):       # ANL C,bit
+        if not self.rdbit(self._fetch()):
+            self._setcy(0)
+
+    def _op_b0(self, op):       # ANL C,/bit
+        if self.rdbit(self._fetch()):
+            self._setcy(0)
+
+    def _op_73(self, op):       # JMP @A+DPTR
+        self.pc = (self.sfr[ACC] + self.dptr) & 0xffff
+
+    def _op_74(self, op):       # MOV A,#data
+        self.sfr[ACC] = self._fetch()
+
+    def _op_75(self, op):       # MOV direct,#data
+        addr = self._fetch()
+        self.wr(addr, self._fetch())
+
+    def _op_83(self, op):       # MOVC A,@A+PC
+        self.sfr[ACC] = self.code[(self.sfr[ACC] + self.pc) & 0xffff]
+
+    def _op_93(self, op):       # MOVC A,@A+DPTR
+        self.sfr[ACC] = self.code[(self.sfr[ACC] + self.dptr) & 0xffff]
+
+    def _op_84(self, op):       # DIV AB
+        sfr = self.sfr
+        a, b = sfr[ACC], sfr[B]
+        psw = sfr[PSW] & ~(PSW_CY | PSW_OV) & 0xff
+        if b:
+            sfr[ACC], sfr[B] = a // b, a % b
+        else:
+            psw |= PSW_OV
+        sfr[PSW] = psw
+
+    def _op_a4(self, op):       # MUL AB
+        sfr = self.sfr
+        res = sfr[ACC] * sfr[B]
+        psw = sfr[PSW] & ~(PSW_CY | PSW_OV) & 0xff
+        if res > 0xff:
+            psw |= PSW_OV
+        sfr[PSW] = psw
+        sfr[ACC], sfr[B] = res & 0xff, res >> 8
+
+    def _op_85(self, op):       # MOV direct,direct (source first)
+        src = self._fetch()
+        self.wr(self._fetch(), self.rd(src))
+
+    def _op_90(self, op):       # MOV DPTR,#data16
+        self.dptr = self._fetch16()
+
+    def _op_92(self, op):       # MOV bit,C
+        self.wrbit(self._fetch(), self.sfr[PSW] & PSW_CY)
+
+    def _op_a2(self, op):       # MOV C,bit
+        self._setcy(self.rdbit(self._fetch()))
+
+    def _op_a3(self, op):       # INC DPTR
+        self.dptr = (self.dptr + 1) & 0xffff
+
+    def _op_b2(self, op):       # CPL bit
+        bit = self._fetch()
+        self.wrbit(bit, not self.rdbit(bit))
+
+    def _op_b3(self, op):       # CPL C
+        self.sfr[PSW] ^= PSW_CY
+
+    def _op_b4(self, op):       # CJNE A,#data,rel
+        imm = self._fetch()
+        self._cjne(self.sfr[ACC], imm, self._rel())
+
+    def _op_c0(self, op):       # PUSH direct
+        self._push(self.rd(self._fetch()))
+
+    def _op_d0(self, op):       # POP direct
+        addr = self._fetch()
+        self.wr(addr, self._pop())
+
+    def _op_c2(self, op):       # CLR bit
+        self.wrbit(self._fetch(), 0)
+
+    def _op_c3(self, op):       # CLR C
+        self._setcy(0)
+
+    def _op_d2(self, op):       # SETB bit
+        self.wrbit(self._fetch(), 1)
+
+    def _op_d3(self, op):       # SETB C
+        self._setcy(1)
+
+    def _op_c4(self, op):       # SWAP A
+        a = self.sfr[ACC]
+        self.sfr[ACC] = ((a << 4) | (a >> 4)) & 0xff
+
+    def _op_d4(self, op):       # DA A
+        sfr = self.sfr
+        a = sfr[ACC]
+        psw = sfr[PSW]
+        if (a & 0x0f) > 9 or psw & PSW_AC:
+            a += 6
+        if (a >> 4) > 9 or psw & PSW_CY or a > 0xff:
+            a += 0x60
+        if a > 0xff:
+            psw |= PSW_CY
+        sfr[PSW] = psw
+        sfr[ACC] = a & 0xff
+
+    def _op_e4(self, op):       # CLR A
+        self.sfr[ACC] = 0
+
+    def _op_f4(self, op):       # CPL A
+        self.sfr[ACC] ^= 0xff
+
+    def _op_e0(self, op):       # MOVX A,@DPTR
+        self.sfr[ACC] = self.rdx(self.dptr)
+
+    def _op_f0(self, op):       # MOVX @DPTR,A
+        self.wrx(self.dptr, self.sfr[ACC])
+
+    def _op_e2(self, op):       # MOVX A,@Ri (MPAGE is the high byte)
+        self.sfr[ACC] = self.rdx((self.sfr[MPAGE] << 8) | self.reg(op & 1))
+
+    _op_e3 = _op_e2
+
+    def _op_f2(self, op):       # MOVX @Ri,A
+        self.wrx((self.sfr[MPAGE] << 8) | self.reg(op & 1), self.sfr[ACC])
+
+    _op_f3 = _op_f2
+
+    def _op_a5(self, op):
+        self._undefined(op)
+
+
+class Timer1(object):
+    '''
+    timer 1 in free-running or modulo mode: the overflow and channel 0-2
+    compare flags in T1CTL, and the T1 interrupt when they're unmasked.
+    the count isn't stepped, it's worked out from the cycle counter when
+    it's read, and the next overflow or compare is scheduled, so the timer
+    costs nothing in between.  up/down mode and capture aren't modeled.
+    '''
+    def __init__(self, cc):
+        self.cc = cc
+        self.gen = 0
+        cc.sfrread[T1CNTL] = self._rdcntl
+        cc.sfrread[T1CNTH] = lambda: self.latch
+        cc.sfrwrite[T1CNTL] = self._wrcntl
+        cc.sfrwrite[T1CNTH] = lambda val: None
+        cc.sfrwrite[T1CTL] = self._wrctl
+        for reg in (T1CC0L, T1CC0H, T1CC1L, T1CC1H, T1CC2L, T1CC2H, T1CCTL0, T1CCTL1, T1CCTL2):
+            cc.sfrwrite[reg] = self._wrreg(reg)
+        self.reset()
+
+    def reset(self):
+        self.value = 0
+        self.base = self.cc.cycles
+        self.latch = 0
+        self.gen += 1
+
+    def period(self):
+        '''
+        clocks per timer tick
+        '''
+        sfr = self.cc.sfr
+        return (1 << ((sfr[CLKCON] >> 3) & 7)) * T1_DIV[(sfr[T1CTL] >> 2) & 3]
+
+    def top(self):
+        sfr = self.cc.sfr
+        if sfr[T1CTL] & 3 == T1CTL_MODE_MODULO:
+            return (sfr[T1CC0H] << 8) | sfr[T1CC0L]
+        return 0xffff
+
+    def compare(self, ch):
+        sfr = self.cc.sfr
+        return (sfr[T1CC0H + 2 * ch] << 8) | sfr[T1CC0L + 2 * ch]
+
+    def count(self, when=None):
+        if when is None:
+            when = self.cc.cycles
+        if not self.cc.sfr[T1CTL] & 3:
+            return self.value
+        ticks = (when - self.base) // self.period()
+        return (self.value + ticks) % (self.top() + 1)
+
+    def rebase(self, when=None):
+        '''
+        fold the ticks so far into .value, before something changes how the
+        timer counts
+        '''
+        if when is None:
+            when = self.cc.cycles
+        if self.cc.sfr[T1CTL] & 3:
+            period = self.period()
+            ticks = (when - self.base) // period
+            self.value = (self.value + ticks) % (self.top() + 1)
+            self.base += ticks * period
+        else:
+            self.base = when
+
+    def schedule(self):
+        '''
+        queue up the next overflow or compare match
+        '''
+        self.gen += 1
+        sfr = self.cc.sfr
+        if not sfr[T1CTL] & 3:
+            return
+        wrap = self.top() + 1
+        ticks = wrap - self.value
+        for ch in range(3):
+            if sfr[T1CCTL0 + ch] & 0x04:
+                d = (self.compare(ch) - self.value) % wrap
+                if d and d < ticks:
+                    ticks = d
+        gen = self.gen
+        when = self.base + ticks * self.period()
+        self.cc.at(when, lambda: self._event(gen, when))
+
+    def _event(self, gen, when):
+        if gen != self.gen:
+            return
+        self.rebase(when)
+        sfr = self.cc.sfr
+        flags = 0
+        irq = False
+        if self.value == 0:
+            flags |= T1CTL_OVFIF
+            irq = bool(sfr[TIMIF] & 0x40)
+        for ch in range(3):
+            if sfr[T1CCTL0 + ch] & 0x04 and self.value == self.compare(ch):
+                flags |= T1CTL_CH0IF << ch
+                irq = irq or bool(sfr[T1CCTL0 + ch] & 0x40)
+        sfr[T1CTL] |= flags
+        if irq:
+            self.cc.flag(IRCON, 0x02)
+        self.schedule()
+
+    def _rdcntl(self):
+        val = self.count()
+        self.latch = val >> 8
+        return val & 0xff
+
+    def _wrcntl(self, val):
+        # any write clears the count
+        self.rebase()
+        self.value = 0
+        self.base = self.cc.cycles
+        self.schedule()
+
+    def _wrctl(self, val):
+        sfr = self.cc.sfr
+        self.rebase()
+        wasrunning = sfr[T1CTL] & 3
+        # the flags can only be cleared
+        sfr[T1CTL] = (val & 0x0f) | (sfr[T1CTL] & val & 0xf0)
+        if not wasrunning:
+            self.base = self.cc.cycles
+        self.schedule()
+
+    def _wrreg(self, reg):
+        def write(val):
+            self.rebase()
+            self.cc.sfr[reg] = val
+            self.schedule()
+        return write
+
+
+class DMAController(object):
+    '''
+    the five dma channels.  a channel's descriptor is read through
+    DMA0CFG/DMA1CFG the first time it's triggered after being armed, by a
+    DMAREQ write or a peripheral's trigger().  single modes move one unit
+    per trigger, block modes the whole lot at once, through the same memory
+    map the cpu sees.  when it's done the channel sets its DMAIRQ bit (and
+    DMAIF, if IRQMASK is set) and disarms unless it's a repeated mode.
+    transfers take no time.
+    '''
+    INC = (0, 1, 2, -1)
+
+    def __init__(self, cc):
+        self.cc = cc
+        cc.sfrwrite[DMAARM] = self._wrarm
+        cc.sfrwrite[DMAREQ] = self._wrreq
+        self.reset()
+
+    def reset(self):
+        self.progress = [None] * 5
+
+    def descriptor(self, ch):
+        sfr = self.cc.sfr
+        if ch == 0:
+            addr = (sfr[DMA0CFGH] << 8) | sfr[DMA0CFGL]
+        else:
+            addr = ((sfr[DMA1CFGH] << 8) | sfr[DMA1CFGL]) + 8 * (ch - 1)
+        return [self.cc.rdx((addr + x) & 0xffff) for x in range(8)]
+
+    def _wrarm(self, val):
+        sfr = self.cc.sfr
+        chans = val & 0x1f
+        if val & DMAARM_ABORT:
+            sfr[DMAARM] &= ~chans & 0xff
+        else:
+            sfr[DMAARM] = chans
+        for ch in range(5):
+            if chans & (1 << ch):
+                self.progress[ch] = None
+
+    def _wrreq(self, val):
+        for ch in range(5):
+            if val & (1 << ch) and self.cc.sfr[DMAARM] & (1 << ch):
+                self._transfer(ch)
+
+    def trigger(self, trig):
+        '''
+        a peripheral's DMA trigger fired
+        '''
+        armed = self.cc.sfr[DMAARM]
+        for ch in range(5):
+            if armed & (1 << ch) and (self.progress[ch] or self._start(ch))[6] == trig:
+                self._transfer(ch)
+
+    def _start(self, ch):
+        d = self.descriptor(ch)
+        src = (d[0] << 8) | d[1]
+        dst = (d[2] << 8) | d[3]
+        vlen = d[4] >> 5
+        count = ((d[4] & 0x1f) << 8) | d[5]
+        if vlen in (1, 2, 3, 4):
+            first = self.cc.rdx(src)
+            count = min(count, first + (0, 1, 0, 2, 3)[vlen])
+        # done, src, dst, count, word, tmode, trig, srcinc, dstinc, irqmask
+        state = [0, src, dst, count, d[6] >> 7, (d[6] >> 5) & 3, d[6] & 0x1f,
+                 self.INC[d[7] >> 6], self.INC[(d[7] >> 4) & 3], d[7] & 0x08]
+        self.progress[ch] = state
+        return state
+
+    def _transfer(self, ch):
+        cc = self.cc
+        state = self.progress[ch] or self._start(ch)
+        done, src, dst, count, word, tmode, trig, srcinc, dstinc, irqmask = state
+        size = 2 if word else 1
+        units = count - done if tmode & 1 else 1
+        for x in range(units):
+            for b in range(size):
+                cc.wrx((dst + b) & 0xffff, cc.rdx((src + b) & 0xffff))
+            src = (src + srcinc * size) & 0xffff
+            dst = (dst + dstinc * size) & 0xffff
+            done += 1
+        state[:3] = [done, src, dst]
+
+        if done >= count:
+            self.progress[ch] = None
+            if not tmode & 2:
+                cc.sfr[DMAARM] &= ~(1 << ch) & 0xff
+            cc.sfr[DMAIRQ] |= 1 << ch
+            if irqmask:
+                cc.flag(IRCON, 0x01)
+
+
+class AESCore(object):
+    '''
+    the aes coprocessor as the firmware drives it: a command in ENCCS with ST
+    set pulls 16 bytes in over dma (trigger 29, into ENCDI), and a little
+    later ENC/DEC push 16 back out (trigger 30, from ENCDO) and ENCCS.RDY
+    comes back.  the cipher itself isn't modeled: blocks come out as they
+    went in, so encrypted traffic is plaintext on the virtual air.
+    '''
+    TRIG_DW = 29
+    TRIG_UP = 30
+
+    def __init__(self, cc):
+        self.cc = cc
+        self.gen = 0
+        cc.sfrwrite[ENCCS] = self._wrcs
+        cc.sfrwrite[ENCDI] = self._wrdi
+        cc.sfrread[ENCDO] = self._rddo
+        self.reset()
+
+    def reset(self):
+        self.gen += 1
+        self.inbuf = bytearray()
+        self.outbuf = bytearray()
+        self.key = self.iv = bytes(16)
+
+    def _wrdi(self, val):
+        self.inbuf.append(val)
+
+    def _rddo(self):
+        if self.outbuf:
+            return self.outbuf.pop(0)
+        return 0
+
+    def _wrcs(self, val):
+        cc = self.cc
+        sfr = cc.sfr
+        sfr[ENCCS] = (val & ~ENCCS_ST & ~ENCCS_RDY & 0xff) | (sfr[ENCCS] & ENCCS_RDY)
+        if not val & ENCCS_ST:
+            return
+
+        sfr[ENCCS] &= ~ENCCS_RDY & 0xff
+        self.inbuf = bytearray()
+        for x in range(16):
+            cc.dma.trigger(self.TRIG_DW)
+        block = bytes(self.inbuf[:16]).ljust(16, b'\0')
+
+        cmd = val & ENCCS_CMD
+        out = None
+        if cmd == ENCCS_CMD_LDKEY:
+            self.key = block
+        elif cmd == ENCCS_CMD_LDIV:
+            self.iv = block
+        else:
+            out = block
+
+        gen = self.gen
+        cc.at(cc.cycles + AES_CYCLES, lambda: gen == self.gen and self._done(out))
+
+    def _done(self, out):
+        cc = self.cc
+        if out is not None:
+            self.outbuf = bytearray(out)
+            for x in range(16):
+                cc.dma.trigger(self.TRIG_UP)
+        cc.sfr[ENCCS] |= ENCCS_RDY
+        cc.flag(S0CON, 0x01)
+
+
+######## the host's side of the usb ########
+class UsbRequest(object):
+    '''
+    a transfer the host has asked for.  the cpu thread completes it (finish())
+    and the host waits on .done; a host that gives up cancel()s it, and
+    whichever of the two gets the lock first decides how it ended
+    '''
+    def __init__(self):
+        self.done = threading.Event()
+        self.lock = threading.Lock()
+        self.cancelled = False
+        self.result = None
+        self.error = None
+
+    def finish(self, result=None, error=None):
+        with self.lock:
+            return self._finish(result, error)
+
+    def _finish(self, result=None, error=None):
+        if self.cancelled or self.done.is_set():
+            return False
+        self.result = result
+        self.error = error
+        self.done.set()
+        return True
+
+    def cancel(self):
+        with self.lock:
+            if self.done.is_set():
+                return False
+            self.cancelled = True
+            return True
+
+
+class ControlRequest(UsbRequest):
+    def __init__(self, reqtype, request, value=0, index=0, length=0, data=b''):
+        UsbRequest.__init__(self)
+        self.reqtype = reqtype
+        self.dirin = bool(reqtype & USB_BM_REQTYPE_DIR_IN)
+        self.length = length
+        self.setup = bytes([reqtype, request, value & 0xff, value >> 8, index & 0xff, index >> 8,
+                            length & 0xff, length >> 8])
+        self.data = bytes(data)
+        self.indata = bytearray()
+        self.sent = 0
+        self.stage = None
+
+
+class BulkOutRequest(UsbRequest):
+    def __init__(self, packets):
+        UsbRequest.__init__(self)
+        self.packets = packets
+        self.next = 0
+
+
+class BulkInRequest(UsbRequest):
+    def __init__(self, maxlen):
+        UsbRequest.__init__(self)
+        self.maxlen = maxlen
+        self.data = bytearray()
+        self.first = None           # when the firmware committed the first packet, in clocks
+
+
+class BusReset(UsbRequest):
+    pass
+
+
+class USBController(object):
+    '''
+    the cc1111's usb controller, registers at 0xde00.  endpoint 0 does control
+    transfers through USBCS0/USBF0 a packet at a time; endpoint 5 is bulk
+    both ways through USBF5, double buffered when USBCSIH/USBCSOH ask for it.
+    everything the host wants comes in through submit() (ControlRequest,
+    BulkOutRequest, BulkInRequest, BusReset) and is finished the way it
+    would be on the wire: a control transfer once its status stage is done,
+    a bulk read when a short packet comes or the buffer fills.  the interrupt
+    flags (USBIIF/USBOIF/USBCIF, clear on read) raise P2INT when enabled.
+    other endpoints aren't modeled.
+    '''
+    def __init__(self, cc):
+        self.cc = cc
+        for addr in range(0xde00, 0xde2c):
+            cc.xread[addr] = self._reader(addr)
+            cc.xwrite[addr] = self._writer(addr)
+        self.ctrlq = collections.deque()
+        self.outreqs = collections.deque()
+        self.inreqs = collections.deque()
+        self.reset()
+
+    def reset(self, error='No such device'):
+        self.regs = bytearray(0x10)
+        self.banks = [bytearray(8) for x in range(6)]
+        self.index = 0
+        self.iif = self.oif = self.cif = 0
+        self.cs0 = 0
+        self.fifo0 = bytearray()
+        self.in0 = bytearray()
+        self.ctrl = None
+        self.csil = self.csol = 0
+        self.in5 = bytearray()
+        self.inslots = collections.deque()
+        self.inpending = None
+        self.out5 = bytearray()
+        self.out5next = None
+        for q in (self.ctrlq, self.outreqs, self.inreqs):
+            while q:
+                q.popleft().finish(error=error)
+
+    def maxPacket0(self):
+        return self.banks[0][0] * 8 or EP0_MAX_PACKET
+
+    def maxPacket5(self, out):
+        return self.banks[5][3 if out else 0] * 8 or EP5_MAX_PACKET
+
+    ######## interrupts ########
+    def _irq(self, which, mask):
+        if which == 'i':
+            self.iif |= mask
+        elif which == 'o':
+            self.oif |= mask
+        else:
+            self.cif |= mask
+        self.recheck()
+
+    def recheck(self):
+        '''
+        P2INT stays up while any enabled flag is unread
+        '''
+        regs = self.regs
+        if (self.iif & regs[0x07]) or (self.oif & regs[0x09]) or (self.cif & regs[0x0b]):
+            self.cc.flag(IRCON2, 0x01)
+
+    ######## registers ########
+    def _reader(self, addr):
+        off = addr - 0xde00
+        if off == 0x02:
+            return self._rdflags('iif')
+        if off == 0x04:
+            return self._rdflags('oif')
+        if off == 0x06:
+            return self._rdflags('cif')
+        if off == 0x0c:
+            return lambda: (self.cc.cycles // (FXOSC // 1000)) & 0xff
+        if off == 0x0d:
+            return lambda: ((self.cc.cycles // (FXOSC // 1000)) >> 8) & 0x07
+        if off == 0x0e:
+            return lambda: self.index
+        if 0x10 <= off < 0x18:
+            return lambda: self._rdbank(off - 0x10)
+        if off == 0x20:
+            return lambda: self._pop(self.fifo0)
+        if off == 0x2a:
+            return lambda: self._pop(self.out5)
+        if off < 0x10:
+            return lambda: self.regs[off]
+        return lambda: 0
+
+    def _writer(self, addr):
+        off = addr - 0xde00
+        if off in (0x02, 0x04, 0x06, 0x0c, 0x0d):
+            return lambda val: None
+        if off == 0x0e:
+            return self._wrindex
+        if 0x10 <= off < 0x18:
+            return lambda val: self._wrbank(off - 0x10, val)
+        if off == 0x20:
+            return lambda val: self.in0.append(val)
+        if off == 0x2a:
+            return lambda val: self.in5.append(val)
+        if off < 0x10:
+            def write(val):
+                self.regs[off] = val
+                self.recheck()
+            return write
+        return lambda val: None
+
+    def _rdflags(self, name):
+        def read():
+            val = getattr(self, name)
+            setattr(self, name, 0)
+            return val
+        return read
+
+    def _pop(self, fifo):
+        if fifo:
+            return fifo.pop(0)
+        return 0
+
+    def _wrindex(self, val):
+        self.index = val & 0x0f
+
+    def _rdbank(self, off):
+        ep = self.index
+        if ep == 0:
+            if off == 1:
+                return self.cs0
+            if off == 6:
+                return len(self.fifo0)
+        elif ep == 5:
+            if off == 1:
+                return self.csil | (USBCSIL_PKT_PRESENT if self.inslots else 0)
+            if off == 4:
+                return self.csol
+            if off == 6:
+                return len(self.out5) & 0xff
+            if off == 7:
+                return len(self.out5) >> 8
+        if ep < 6:
+            return self.banks[ep][off]
+        return 0
+
+    def _wrbank(self, off, val):
+        ep = self.index
+        if ep == 0 and off == 1:
+            self._wrcs0(val)
+        elif ep == 5 and off == 1:
+            self._wrcsil(val)
+        elif ep == 5 and off == 4:
+            self._wrcsol(val)
+        elif ep < 6:
+            self.banks[ep][off] = val
+            if ep == 5 and off == 5:
+                self._outfeed()
+
+    ######## the host ########
+    def submit(self, req):
+        if isinstance(req, ControlRequest):
+            self.ctrlq.append(req)
+            self._ep0next()
+        elif isinstance(req, BulkOutRequest):
+            self.outreqs.append(req)
+            self._outfeed()
+        elif isinstance(req, BulkInRequest):
+            self.inreqs.append(req)
+            self._infeed()
+        elif isinstance(req, BusReset):
+            self.busReset()
+            req.finish()
+
+    def busReset(self):
+        '''
+        the host resets the bus: the address goes back to 0, the endpoints
+        are emptied, and the firmware hears RSTIF
+        '''
+        self.regs[0x00] = 0
+        if self.ctrl is not None:
+            self.ctrl.finish(error='Pipe error')
+            self.ctrl = None
+        self.cs0 = 0
+        self.fifo0 = bytearray()
+        self.in0 = bytearray()
+        self.csil = self.csol = 0
+        self.in5 = bytearray()
+        self.inslots.clear()
+        self.inpending = None
+        self.out5 = bytearray()
+        self.out5next = None
+        self._irq('c', USBCIF_RSTIF)
+
+    ######## endpoint 0 ########
+    def _ep0next(self):
+        if self.ctrl is not None and self.ctrl.cancelled and self.ctrlq:
+            # the host gave up on that one and has moved on
+            self.ctrl = None
+            self.cs0 = (self.cs0 | USBCS0_SETUP_END) & ~USBCS0_DATA_END
+            self.in0 = bytearray()
+        while self.ctrl is None and self.ctrlq:
+            req = self.ctrlq.popleft()
+            if req.cancelled:
+                continue
+            self.ctrl = req
+            req.stage = 'setup'
+            self.fifo0 = bytearray(req.setup)
+            self.cs0 |= USBCS0_OUTPKT_RDY
+            self._irq('i', USBIIF_EP0IF)
+
+    def _ctrlDone(self, result=None, error=None):
+        req = self.ctrl
+        self.ctrl = None
+        self.cs0 &= ~(USBCS0_DATA_END | USBCS0_OUTPKT_RDY) & 0xff
+        self.fifo0 = bytearray()
+        req.finish(result, error)
+        self._irq('i', USBIIF_EP0IF)
+        self._ep0next()
+
+    def _wrcs0(self, val):
+        req = self.ctrl
+        if not val & USBCS0_SENT_STALL:
+            self.cs0 &= ~USBCS0_SENT_STALL & 0xff
+        if val & USBCS0_CLR_SETUP_END:
+            self.cs0 &= ~USBCS0_SETUP_END & 0xff
+        if val & USBCS0_SEND_STALL:
+            self.cs0 |= USBCS0_SENT_STALL
+            self.in0 = bytearray()
+            if req is not None:
+                self._ctrlDone(error='Pipe error')
+            return
+        if val & USBCS0_DATA_END:
+            self.cs0 |= USBCS0_DATA_END
+
+        if val & USBCS0_CLR_OUTPKT_RDY and self.cs0 & USBCS0_OUTPKT_RDY:
+            self.cs0 &= ~USBCS0_OUTPKT_RDY & 0xff
+            self.fifo0 = bytearray()
+            if req is not None:
+                if req.stage == 'setup':
+                    req.stage = 'data' if req.length else 'status'
+                elif req.stage == 'data' and not req.dirin and req.sent >= len(req.data):
+                    req.stage = 'status'
+
+                if req.stage == 'data' and not req.dirin and req.sent < len(req.data):
+                    # the next packet of the OUT data stage
+                    pkt = req.data[req.sent:req.sent + self.maxPacket0()]
+                    req.sent += len(pkt)
+                    self.fifo0 = bytearray(pkt)
+                    self.cs0 |= USBCS0_OUTPKT_RDY
+                    self._irq('i', USBIIF_EP0IF)
+
+        if val & USBCS0_INPKT_RDY and req is not None and req.dirin and req.stage == 'data':
+            pkt = self.in0
+            self.in0 = bytearray()
+            req.indata += pkt
+            if self.cs0 & USBCS0_DATA_END or len(pkt) < self.maxPacket0() or len(req.indata) >= req.length:
+                self._ctrlDone(bytes(req.indata[:req.length]))
+            else:
+                self._irq('i', USBIIF_EP0IF)
+            return
+
+        req = self.ctrl
+        if req is not None and req.stage == 'status' and self.cs0 & USBCS0_DATA_END:
+            self._ctrlDone(len(req.data))
+
+    ######## endpoint 5 OUT ########
+    def _outfeed(self):
+        dbl = self.banks[5][5] & USBCSOH_OUT_DBL_BUF
+        while self.outreqs:
+            req = self.outreqs[0]
+            if req.cancelled:
+                self.outreqs.popleft()
+                continue
+            if req.next >= len(req.packets):
+                req.finish(sum([len(pkt) for pkt in req.packets]))
+                self.outreqs.popleft()
+                continue
+            pkt = req.packets[req.next]
+            if not self.csol & USBCSOL_OUTPKT_RDY:
+                self._outload(pkt)
+            elif dbl and self.out5next is None:
+                self.out5next = pkt
+            else:
+                break
+            req.next += 1
+
+    def _outload(self, pkt):
+        self.out5 = bytearray(pkt)
+        self.csol |= USBCSOL_OUTPKT_RDY
+        self._irq('o', USBOIF_OUTEP5IF)
+
+    def _wrcsol(self, val):
+        if val & USBCSOL_FLUSH_PACKET or (self.csol & USBCSOL_OUTPKT_RDY and not val & USBCSOL_OUTPKT_RDY):
+            # the firmware's done with this packet: on to the next
+            self.csol &= ~USBCSOL_OUTPKT_RDY & 0xff
+            self.out5 = bytearray()
+            if self.out5next is not None:
+                pkt, self.out5next = self.out5next, None
+                self._outload(pkt)
+            self._outfeed()
+        self.csol = (self.csol & USBCSOL_OUTPKT_RDY) | (val & USBCSOL_SEND_STALL) | \
+                    (self.csol & val & USBCSOL_SENT_STALL)
+
+    ######## endpoint 5 IN ########
+    def _wrcsil(self, val):
+        if val & USBCSIL_FLUSH_PACKET:
+            self.in5 = bytearray()
+        if val & USBCSIL_INPKT_RDY and not self.csil & USBCSIL_INPKT_RDY:
+            pkt = bytes(self.in5)
+            self.in5 = bytearray()
+            slots = 2 if self.banks[5][2] & USBCSIH_IN_DBL_BUF else 1
+            if len(self.inslots) < slots:
+                self.inslots.append((self.cc.cycles, pkt))
+            else:
+                self.inpending = pkt
+                self.csil |= USBCSIL_INPKT_RDY
+        self.csil = (self.csil & USBCSIL_INPKT_RDY) | (val & USBCSIL_SEND_STALL) | \
+                    (self.csil & val & USBCSIL_SENT_STALL)
+        self._infeed()
+
+    def _infeed(self):
+        maxi = self.maxPacket5(False)
+        while self.inreqs and self.inslots:
+            req = self.inreqs[0]
+            with req.lock:
+                if req.cancelled or req.done.is_set():
+                    self.inreqs.popleft()
+                    continue
+                ts, pkt = self.inslots[0]
+                if req.data and len(req.data) + len(pkt) > req.maxlen:
+                    req._finish(bytes(req.data))
+                    self.inreqs.popleft()
+                    continue
+
+                self.inslots.popleft()
+                req.data += pkt[:req.maxlen]
+                if req.first is None:
+                    req.first = ts
+                if len(pkt) < maxi or len(req.data) + maxi > req.maxlen:
+                    req._finish(bytes(req.data))
+                    self.inreqs.popleft()
+
+            # the host has it: the buffer's free for the next one
+            if self.inpending is not None:
+                self.inslots.append((self.cc.cycles, self.inpending))
+                self.inpending = None
+                self.csil &= ~USBCSIL_INPKT_RDY & 0xff
+            self._irq('i', USBIIF_INEP5IF)
+
+
+######## the radio ########
+class Radio(object):
+    '''
+    the cc1111 radio as the firmware sees it: RFST strobes move MARCSTATE,
+    through calibration and synthesizer settling where the chip would; TX and
+    RX go a byte at a time through RFD at the configured data rate, asking
+    for each with RFTXRXIF; RFIF/RFIM flag SFD, DONE, RX overflow and TX
+    underflow onto the RF interrupt.  RSSI, LQI and PKTSTATUS follow what's
+    on the air.  whitening and FEC aren't applied to the bytes, they just
+    have to match between sender and receiver (and FEC doubles the air time)
+    '''
+    def __init__(self, cc, air=None):
+        self.cc = cc
+        self.air = None
+        self.gen = 0
+        self.inbox = collections.deque()
+        self.rng = random.Random(0)
+        self.txframes = 0
+        self.rxframes = 0
+        cc.sfrwrite[RFST] = self.strobe
+        cc.sfrread[RFD] = self._rdrfd
+        cc.sfrwrite[RFD] = self._wrrfd
+        cc.xread[MARCSTATE] = lambda: self.marc
+        cc.xread[RSSI] = self._rdrssi
+        cc.xread[PKTSTATUS] = self._rdpktstatus
+        for addr in range(PARTNUM, VCO_VC_DAC + 1):
+            cc.xwrite[addr] = lambda val: None
+        if air is not None:
+            air.attach(self)
+        self.reset()
+
+    def reset(self):
+        cc = self.cc
+        cc.xram[SYNC1:SYNC1 + len(RF_RESET)] = RF_RESET
+        self.gen += 1
+        self._keydown()
+        self.marc = MARC_STATE_IDLE
+        self.txreg = None
+        self.rxreg = None
+        self.rxframe = None
+        self.carrier = None
+        self.carrierend = 0
+        self.crcok = False
+        self.sfd = False
+
+    def settings(self):
+        return radioSettings(self.cc.xram[SYNC1:SYNC1 + 0x30])
+
+    def seconds(self, cycles=None):
+        if cycles is None:
+            cycles = self.cc.cycles
+        return cycles / float(FXOSC)
+
+    # where we are on the air's timeline
+    now = seconds
+
+    def _after(self, cycles, fn):
+        '''
+        fn() in 'cycles' clocks, unless the radio's state changes first
+        '''
+        gen = self.gen
+        self.cc.at(self.cc.cycles + cycles, lambda: gen == self.gen and fn())
+
+    def _flag(self, mask):
+        cc = self.cc
+        cc.sfr[RFIF] |= mask
+        if cc.sfr[RFIM] & mask:
+            cc.flag(S1CON, 0x03)
+
+    def _rfd(self):
+        cc = self.cc
+        cc.flag(TCON, 0x02)
+
+    ######## state ########
+    def strobe(self, val):
+        self.cc.sfr[RFST] = val
+        marc = self.marc
+        if val == RFST_SIDLE:
+            self._enter(MARC_STATE_IDLE)
+        elif val == RFST_SCAL:
+            if marc == MARC_STATE_IDLE:
+                self._enter(MARC_STATE_MANCAL)
+                self._after(RF_CAL_CYCLES, lambda: self._enter(MARC_STATE_IDLE))
+        elif val == RFST_SFSTXON:
+            if marc in (MARC_STATE_IDLE, MARC_STATE_RX):
+                self._settle(MARC_STATE_FSTXON)
+        elif val == RFST_SRX:
+            if marc in (MARC_STATE_IDLE, MARC_STATE_FSTXON, MARC_STATE_TX):
+                self._settle(MARC_STATE_RX)
+        elif val == RFST_STX:
+            if marc in (MARC_STATE_IDLE, MARC_STATE_FSTXON):
+                self._settle(MARC_STATE_TX)
+            elif marc == MARC_STATE_RX:
+                # with a CCA mode set, a busy channel keeps us listening
+                if self.cc.xram[MCSM1] & MCSM1_CCA_MODE and self.busy():
+                    return
+                self._settle(MARC_STATE_TX)
+
+    def _settle(self, state):
+        marc = self.marc
+        if marc == MARC_STATE_IDLE:
+            cycles = RF_SETTLE_CYCLES
+            if self.cc.xram[MCSM0] & MCSM0_FS_AUTOCAL == 0x10:
+                cycles += RF_CAL_CYCLES
+        elif marc == MARC_STATE_FSTXON and state == MARC_STATE_TX:
+            cycles = RF_FSTXON_CYCLES
+        else:
+            cycles = RF_TURNAROUND_CYCLES
+        self._enter(MARC_STATE_FS_LOCK)
+        self._after(cycles, lambda: self._enter(state))
+
+    def _enter(self, state):
+        if self.marc == MARC_STATE_TX:
+            self._keydown()
+        self.gen += 1
+        self.marc = state
+        self.txreg = None
+        self.rxframe = None
+        self.sfd = False
+        if state == MARC_STATE_TX:
+            self._txstart()
+
+    def busy(self):
+        return self.cc.cycles < self.carrierend or self._onair() is not None
+
+    def _onair(self):
+        # someone else's carrier on our channel, that hasn't finished yet
+        if self.air is None or not self.air.carriers:
+            return None
+        return self.air.carrier(self, self.settings(), self.seconds())
+
+    def _keydown(self):
+        if self.air is not None:
+            self.air.keydown(self)
+
+    ######## TX ########
+    def _txstart(self):
+        s = self.settings()
+        self.txs = s
+        self.txbuf = bytearray()
+        self.txstarted = self.cc.cycles
+        self.txbc = byteCycles(s)
+        if self.air is not None:
+            self.air.keyup(self, s, self.seconds())
+        self._rfd()
+        self._after((s.preamble + len(syncBytes(s))) * self.txbc, self._txbyte)
+
+    def _wrrfd(self, val):
+        self.cc.sfr[RFD] = val
+        if self.marc == MARC_STATE_TX:
+            self.txreg = val
+
+    def _packetDone(self, count, first):
+        '''
+        has a packet 'count' bytes in, starting with 'first', ended?  PKTCTRL0
+        and PKTLEN are looked at as it goes, the way the chip does, so the
+        firmware can switch an infinite packet to fixed length to end it
+        '''
+        xram = self.cc.xram
+        lengthconfig = xram[PKTCTRL0] & PKTCTRL0_LENGTH_CONFIG
+        if lengthconfig == PKTCTRL0_LENGTH_CONFIG_VAR:
+            return count == first + 1
+        if lengthconfig == PKTCTRL0_LENGTH_CONFIG_FIX:
+            return count and (count & 0xff) == xram[PKTLEN]
+        return False
+
+    def _txbyte(self):
+        if self.txreg is None:
+            self.gen += 1
+            self.marc = MARC_STATE_TX_UNDERFLOW
+            self._keydown()
+            self._flag(RFIF_IRQ_TXUNF)
+            return
+
+        self.txbuf.append(self.txreg)
+        self.txreg = None
+        if self._packetDone(len(self.txbuf), self.txbuf[0]):
+            # this byte, then the CRC, go out before it's over
+            crcbytes = 2 if self.cc.xram[PKTCTRL0] & PKTCTRL0_CRC_EN else 0
+            self._after((1 + crcbytes) * self.txbc, self._txdone)
+        else:
+            self._rfd()
+            self._after(self.txbc, self._txbyte)
+
+    def _txdone(self):
+        cc = self.cc
+        data = bytes(self.txbuf)
+        if cc.xram[PKTCTRL0] & PKTCTRL0_CRC_EN:
+            crc = crc16(data)
+            data += bytes([crc >> 8, crc & 0xff])
+        self.txframes += 1
+        frame = AirFrame(data, self.txs, start=self.seconds(self.txstarted), end=self.seconds(), source=self)
+        if self.air is not None:
+            self.air.transmit(self, frame)
+
+        self._flag(RFIF_IRQ_DONE)
+        txoff = cc.xram[MCSM1] & MCSM1_TXOFF_MODE
+        if txoff == MCSM1_TXOFF_MODE_RX:
+            self._settle(MARC_STATE_RX)
+        else:
+            self._enter((MARC_STATE_IDLE, MARC_STATE_FSTXON, MARC_STATE_TX)[txoff])
+
+    ######## RX ########
+    def deliver(self, frame):
+        '''
+        a frame from the air.  any thread: it's heard in the cpu's, at its next
+        poll(), or the channel's latency after that
+        '''
+        self.inbox.append(frame)
+
+    def poll(self):
+        while self.inbox:
+            frame = self.inbox.popleft()
+            if frame.delay > 0:
+                self.cc.at(self.cc.cycles + int(frame.delay * FXOSC), lambda frame=frame: self.hear(frame))
+            else:
+                self.hear(frame)
+
+    def hears(self, frame):
+        '''
+        the bytes we'd demodulate out of 'frame', or None if we wouldn't pick
+        it up at all
+        '''
+        return hears(self.settings(), frame)
+
+    def hear(self, frame):
+        s = self.settings()
+        if abs(frame.settings.freq - s.freq) <= s.chanbw / 2:
+            self.carrier = frame
+            self.carrierend = max(self.carrierend, self.cc.cycles + len(frame.data) * byteCycles(frame.settings))
+
+        if self.marc != MARC_STATE_RX or self.rxframe is not None:
+            return
+        stream = self.hears(frame)
+        if stream is None:
+            return
+
+        self.rxframe = frame
+        self.rxstream = stream
+        self.rxbuf = bytearray()
+        self.rxpos = 0
+        self.rxreg = None
+        self.rxbc = byteCycles(s)
+        self.rxphase = 'data'
+        self.rxs = s
+        skip = 0 if not s.syncmode else frame.settings.preamble + len(syncBytes(frame.settings))
+        self._after(skip * self.rxbc, self._rxsfd)
+
+    def _rxsfd(self):
+        self.sfd = True
+        self._flag(RFIF_IRQ_SFD)
+        self._after(self.rxbc, self._rxbyte)
+
+    def _rxnext(self):
+        # past the end of what was sent, the demodulator makes up noise
+        if self.rxpos < len(self.rxstream):
+            val = self.rxstream[self.rxpos]
+        else:
+            val = self.rng.randrange(256)
+        self.rxpos += 1
+        return val
+
+    def _rxput(self, val):
+        if self.rxreg is not None:
+            # the firmware didn't read the last one in time
+            self.gen += 1
+            self.marc = MARC_STATE_RX_OVERFLOW
+            self.rxframe = None
+            self._flag(RFIF_IRQ_RXOVF)
+            return False
+        self.rxreg = val
+        self.cc.sfr[RFD] = val
+        self._rfd()
+        return True
+
+    def _rxbyte(self):
+        xram = self.cc.xram
+        if self.rxphase == 'data':
+            val = self._rxnext()
+            if not self.rxbuf and xram[PKTCTRL0] & PKTCTRL0_LENGTH_CONFIG == PKTCTRL0_LENGTH_CONFIG_VAR \
+                    and val > xram[PKTLEN]:
+                # length filtering: too long, so it's dropped and we go back to looking for sync
+                self.rxframe = None
+                self.sfd = False
+                return
+            self.rxbuf.append(val)
+            if not self._rxput(val):
+                return
+            if self._packetDone(len(self.rxbuf), self.rxbuf[0]):
+                self.rxphase = 'crc'
+                if xram[PKTCTRL0] & PKTCTRL0_CRC_EN:
+                    crc = (self._rxnext() << 8) | self._rxnext()
+                    self.crcok = crc == crc16(bytes(self.rxbuf))
+                    self._after(2 * self.rxbc, self._rxbyte)
+                    return
+                self.crcok = True
+            self._after(self.rxbc, self._rxbyte)
+            return
+
+        if self.rxphase == 'crc':
+            if xram[PKTCTRL1] & PKTCTRL1_APPEND_STATUS:
+                self.rxphase = 'rssi'
+                if self._rxput(self._rssibyte(self.rxframe.rssi)):
+                    self._after(self.rxbc, self._rxbyte)
+                return
+            self._rxdone()
+            return
+
+        if self.rxphase == 'rssi':
+            self.rxphase = 'lqi'
+            if self._rxput((0x80 if self.crcok else 0) | self.lqi()):
+                self._after(self.rxbc, self._rxbyte)
+            return
+
+        self._rxdone()
+
+    def _rxdone(self):
+        self.rxframes += 1
+        self.rxframe = None
+        self.sfd = False
+        self._flag(RFIF_IRQ_DONE)
+        rxoff = self.cc.xram[MCSM1] & MCSM1_RXOFF_MODE
+        if rxoff == MCSM1_RXOFF_MODE_TX:
+            self._settle(MARC_STATE_TX)
+        elif rxoff == MCSM1_RXOFF_MODE_RX:
+            self.gen += 1
+        else:
+            self._enter((MARC_STATE_IDLE, MARC_STATE_FSTXON)[rxoff >> 2])
+
+    def _rdrfd(self):
+        self.rxreg = None
+        return self.cc.sfr[RFD]
+
+    def lqi(self):
+        return 0x7f - min(0x7f, max(0, int(self.rssi() - RSSI_NOISE)))
+
+    def rssi(self):
+        levels = [self._onair()]
+        if self.cc.cycles < self.carrierend:
+            levels.append(self.carrier.rssi)
+        return max([RSSI_NOISE] + [level for level in levels if level is not None])
+
+    def _rssibyte(self, dbm):
+        # the inverse of what rflib does with it
+        return (int(round((dbm + 88) * 2)) & 0xff) ^ 0x80
+
+    def _rdrssi(self):
+        return self._rssibyte(self.rssi())
+
+    def _rdpktstatus(self):
+        busy = self.busy()
+        return (0x80 if self.crcok else 0) | (0x40 if busy else 0) | (0 if busy else 0x10) | (0x08 if self.sfd else 0)
+
+
+class CC1111(Core8051):
+    '''
+    a cc1111: the 8051 with the peripherals the firmware uses (Timer1,
+    DMAController, AESCore, USBController, Radio), the clock and sleep
+    registers, and the watchdog
+    '''
+    WDT_CYCLES = (FXOSC, FXOSC // 4, FXOSC // 64, FXOSC // 512)
+
+    def __init__(self, image=None, air=None):
+        self.resets = 0
+        self.wdtgen = 0
+        Core8051.__init__(self)
+        self.timer1 = Timer1(self)
+        self.dma = DMAController(self)
+        self.aes = AESCore(self)
+        self.usb = USBController(self)
+        self.radio = Radio(self, air)
+        self.sfrread[SLEEP] = lambda: self.sfr[SLEEP] | SLEEP_XOSC_S | SLEEP_HFRC_S
+        self.sfrwrite[CLKCON] = self._wrclkcon
+        self.sfrwrite[WDCTL] = self._wrwdctl
+        self.sfrwrite[PCON] = self._wrpcon
+        self.sfrwrite[IRCON2] = self._wrircon2
+        if image is not None:
+            self.load(image)
+
+    def reset(self):
+        Core8051.reset(self)
+        self.wdtgen += 1
+        self.wdtclr = 0
+        for part in ('timer1', 'dma', 'aes', 'usb', 'radio'):
+            if hasattr(self, part):
+                getattr(self, part).reset()
+
+    def run(self, cycles):
+        self.radio.poll()
+        Core8051.run(self, cycles)
+
+    def seconds(self):
+        return self.cycles / float(FXOSC)
+
+    def _wrclkcon(self, val):
+        # the oscillator's always stable, so the switch happens right away
+        self.timer1.rebase()
+        self.sfr[CLKCON] = val
+        self.timer1.schedule()
+
+    def _wrpcon(self, val):
+        if val & PCON_IDLE:
+            self.idle = True
+
+    def _wrircon2(self, val):
+        self.sfr[IRCON2] = val
+        self.usb.recheck()
+
+    def _wrwdctl(self, val):
+        old = self.sfr[WDCTL]
+        self.sfr[WDCTL] = val & 0x0f
+        if not val & WDCTL_EN or val & WDCTL_MODE:
+            return
+        # 0xa then 0x5 in CLR feeds it
+        clr = val >> 4
+        if not old & WDCTL_EN or (self.wdtclr == 0xa and clr == 0x5):
+            self.wdtgen += 1
+            gen = self.wdtgen
+            self.at(self.cycles + self.WDT_CYCLES[val & WDCTL_INT], lambda: gen == self.wdtgen and self.watchdog())
+        self.wdtclr = clr
+
+    def watchdog(self):
+        '''
+        the watchdog ran out: the chip resets and falls off the bus
+        '''
+        self.resets += 1
+        self.reset()
+        self.sfr[SLEEP] = SLEEP_RST_WDT
+
+
+class SimDevice(object):
+    '''
+    stands in for the usb.Device rflib keeps in ._d
+    '''
+    def __init__(self, descriptor):
+        self.devnum = 0
+        self.filename = 'fwsim'
+        self.descriptor = descriptor
+        if len(descriptor) >= 18:
+            self.idVendor = descriptor[8] | (descriptor[9] << 8)
+            self.idProduct = descriptor[10] | (descriptor[11] << 8)
+
+
+class SimDongle(object):
+    '''
+    a simulated dongle on a simulated bus, looking like the pyusb device
+    handle rflib keeps in ._do: controlMsg(), bulkWrite(), bulkRead().
+
+    the chip (a CC1111) runs in a thread of its own, 'batch' clocks at a
+    time; in between, it picks up whatever the host has asked for.  timeouts
+    are simulated milliseconds.  with 'enumerate' set we wait for the
+    firmware to bring its usb up and then enumerate it like a host would
+    (reset, GET_DESCRIPTOR, SET_ADDRESS, SET_CONFIGURATION), and again after
+    the watchdog resets it
+    '''
+    def __init__(self, image, air=None, enumerate=True, batch=SIM_BATCH):
+        self.cc = CC1111(image, air)
+        self.batch = batch
+        self.requests = collections.deque()
+        self.descriptor = b''
+        self._stop = False
+        self._pause = threading.Event()
+        self._paused = threading.Event()
+        self._resets = 0
+
+        self.thread = threading.Thread(target=self._run, name='fwsim')
+        self.thread.daemon = True
+        self.thread.start()
+
+        if enumerate:
+            self.enumerate()
+
+    def _run(self):
+        cc = self.cc
+        air = cc.radio.air
+        if air is None:
+            air = VirtualAir()          # on our own: lockstep with nobody
+        air.join(self)
+        try:
+            while not self._stop:
+                if self._pause.is_set():
+                    # nobody waits on us while we're stopped
+                    air.leave(self)
+                    self._paused.set()
+                    while self._pause.is_set() and not self._stop:
+                        time.sleep(.001)
+                    self._paused.clear()
+                    air.join(self)
+                while self.requests:
+                    cc.usb.submit(self.requests.popleft())
+                while not air.sync(self, .1) and not self._stop:
+                    pass
+                cc.run(self.batch)
+        finally:
+            air.leave(self)
+
+    def stop(self):
+        self._stop = True
+        self.thread.join(5)
+        self.cc.usb.reset()
+
+    def now(self):
+        # for VirtualAir's lockstep
+        return self.cc.seconds()
+
+    def clock(self):
+        '''
+        simulated seconds since the chip started
+        '''
+        return self.cc.seconds()
+
+    def paused(self):
+        '''
+        with sim.paused(): look at the chip while it isn't running
+        '''
+        sim = self
+
+        class Paused(object):
+            def __enter__(self):
+                sim._paused.clear()
+                sim._pause.set()
+                while sim.thread.is_alive() and not sim._paused.wait(.01):
+                    pass
+                return sim.cc
+
+            def __exit__(self, *args):
+                sim._pause.clear()
+
+        return Paused()
+
+    ######## transfers ########
+    def _submit(self, req, timeout):
+        '''
+        hand 'req' to the cpu thread and wait up to 'timeout' simulated ms
+        '''
+        if self.cc.resets != self._resets:
+            self._resets = self.cc.resets
+            raise usb.USBError('No such device (fwsim: watchdog reset)')
+
+        deadline = self.cc.cycles + int(timeout * FXOSC / 1000)
+        self.requests.append(req)
+        while not req.done.wait(.005):
+            if not self.thread.is_alive():
+                req.cancel()
+                raise usb.USBError('No such device (fwsim stopped)')
+            if self.cc.cycles >= deadline and req.cancel():
+                return False
+        if req.error:
+            raise usb.USBError(req.error)
+        return True
+
+    def controlMsg(self, requestType, request, buffer, value=0, index=0, timeout=100):
+        if requestType & USB_BM_REQTYPE_DIR_IN:
+            req = ControlRequest(requestType, request, value, index, buffer)
+        else:
+            data = bytes(buffer or b'')
+            req = ControlRequest(requestType, request, value, index, len(data), data)
+        if not self._submit(req, timeout):
+            raise usb.USBError('Operation timed out')
+        return req.result
+
+    def bulkWrite(self, endpoint, buffer, timeout=100):
+        data = bytes(buffer)
+        maxo = EP5_MAX_PACKET
+        packets = [data[x:x + maxo] for x in range(0, len(data), maxo)] or [b'']
+        req = BulkOutRequest(packets)
+        if not self._submit(req, timeout):
+            raise usb.USBError('Operation timed out')
+        return req.result
+
+    def bulkRead(self, endpoint, size, timeout=100):
+        req = BulkInRequest(size)
+        if not self._submit(req, timeout):
+            # whatever came in before the timeout isn't lost
+            if req.data:
+                return bytes(req.data)
+            raise usb.USBError('Operation timed out')
+        return req.result
+
+    def busReset(self):
+        self._submit(BusReset(), 100)
+
+    def enumerate(self, timeout=SIM_BOOT_TIMEOUT):
+        '''
+        wait for the firmware to switch its usb interrupt on, then do what a
+        host does when a device shows up
+        '''
+        cc = self.cc
+        deadline = cc.cycles + int(timeout * FXOSC / 1000)
+        while not (cc.sfr[IEN0] & 0x80 and cc.sfr[IEN2] & IEN2_USBIE):
+            if cc.cycles >= deadline or not self.thread.is_alive():
+                raise usb.USBError('No such device (fwsim: the firmware never enabled usb)')
+            time.sleep(.005)
+        self._resets = cc.resets
+
+        self.busReset()
+        self.descriptor = self.controlMsg(USB_BM_REQTYPE_DIR_IN, USB_GET_DESCRIPTOR, 18, 0x0100, 0, timeout)
+        self.controlMsg(USB_BM_REQTYPE_DIR_OUT, USB_SET_ADDRESS, b'', 1, 0, timeout)
+        self.controlMsg(USB_BM_REQTYPE_DIR_OUT, USB_SET_CONFIGURATION, b'', 1, 0, timeout)
+        return self.descriptor
+
+
+class SimRfCat(rflib.RfCat):
+    '''
+    an RfCat on a simulated dongle running 'image' (a firmware .hex file or
+    IntelHex).  dongles that share an 'air' (VirtualAir) hear each other
+    '''
+    def __init__(self, image, air=None, idx=0, debug=False, copyDongle=None, RfMode=RFST_SRX):
+        self.sim = None
+        self._image = image
+        self._air = air
+        rflib.RfCat.__init__(self, idx, debug, copyDongle, RfMode)
+
+    def _internal_select_dongle(self, console=False):
+        if self.sim is None or not self.sim.thread.is_alive():
+            self.sim = SimDongle(self._image, self._air, enumerate=False)
+        self.sim.enumerate()
+        self.ep5timeout = EP_TIMEOUT_ACTIVE
+        self.devnum = 0
+        self._d = SimDevice(self.sim.descriptor)
+        self._do = self.sim
+        self.console = console
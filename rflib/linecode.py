@@ -0,0 +1,160 @@
+'''
+line code detection: Manchester, differential Manchester and biphase-mark
+
+all three send one data bit as two symbols, with a guaranteed transition
+once per bit: mid-bit for (differential) Manchester, at the bit boundary for
+biphase-mark.  so in a raw (lowball) capture, a coded stretch shows up as a
+run where every other symbol boundary is a transition.  which boundaries
+(the even or odd ones) fixes the symbol alignment; the other set carries
+the data.
+
+detect() finds those runs for both alignments at once: the transitions of
+the whole packet are one xor of the packet with itself shifted by a bit,
+and the two alignments are the even and odd characters of its bit string,
+so the per-bit work all happens inside C (int ops, slicing, re).  every run
+is then decoded each way the alignment allows:
+
+    code            always-transition   data bit           polarity means
+    manchester      mid-bit             first symbol       1: 10 is a 1 (hilo)
+    diffmanchester  mid-bit             boundary toggle    value of a toggle
+    biphase         bit boundary        mid-bit toggle     value of a toggle
+                                                           (1: mark, 0: space)
+
+the transitions alone can't tell these apart (a biphase-mark signal is a
+differential Manchester one shifted half a bit), so every candidate is
+returned.  if sync words are given, candidates whose decoded data contains
+one sort first; that's usually what settles it.
+'''
+import re
+import collections
+
+CODES = ('manchester', 'diffmanchester', 'biphase')
+
+LineCode = collections.namedtuple('LineCode', 'code polarity start length score sync data')
+LineCode.__doc__ = '''
+    code        one of CODES
+    polarity    see the module docstring
+    start       bit offset of the first symbol in the raw packet
+    length      decoded bits
+    score       length / the most bits the packet could hold (0..1)
+    sync        bit offset of the first sync word match in data, or None
+    data        decoded bytes, MSB first, zero padded
+'''
+
+_FLIP = str.maketrans('01', '10')
+
+
+def _bitstr(data):
+    nbits = 8 * len(data)
+    return format(int.from_bytes(data, 'big'), '0%db' % nbits) if nbits else ''
+
+def transitions(data):
+    '''
+    returns a '0'/'1' string, one character per bit of data: character j is
+    '1' when bit j differs from bit j-1 (bit -1 is taken as 0, ie. the line
+    idles low)
+    '''
+    num = int.from_bytes(data, 'big')
+    nbits = 8 * len(data)
+    return format(num ^ (num >> 1), '0%db' % nbits) if nbits else ''
+
+def _pack(bits):
+    if not bits:
+        return b''
+    pad = -len(bits) % 8
+    return (int(bits, 2) << pad).to_bytes((len(bits) + pad) // 8, 'big')
+
+def _runs(trans, minbits):
+    '''
+    (phase, first symbol index of the always-transition, count) for each
+    run of at least minbits transitions on every other boundary
+    '''
+    runs = re.compile('1{%d,}' % max(1, minbits))
+    for phase in (0, 1):
+        lattice = trans[phase::2]
+        if phase == 0:
+            lattice = '0' + lattice[1:]         # bit 0 has no real predecessor
+        for match in runs.finditer(lattice):
+            yield phase, phase + 2 * match.start(), match.end() - match.start()
+
+def detect(data, minbits=16, codes=CODES, syncwords=None, maxerrors=0):
+    '''
+    every line-coded run of at least 'minbits' data bits in a raw packet,
+    decoded both polarities of each code in 'codes'.  returns a list of
+    LineCode, longest (and sync word matches) first.
+    '''
+    return detectBatch([data], minbits, codes, syncwords, maxerrors)[0]
+
+def detectBatch(packets, minbits=16, codes=CODES, syncwords=None, maxerrors=0):
+    '''
+    detect() for a list of packets; returns a list of candidate lists.
+    sync words are searched for in every candidate of every packet in one
+    bits.BitMatcher pass.
+    '''
+    out = []
+    for data in packets:
+        data = bytes(data)
+        raw = _bitstr(data)
+        trans = transitions(data)
+        maxlen = max(1, len(raw) // 2)
+        cands = []
+
+        for phase, first, count in _runs(trans, minbits):
+            if 'manchester' in codes and first >= 1:
+                # the always-transition is mid-bit: the bit starts a symbol earlier
+                start = first - 1
+                bits = raw[start:start + 2 * count:2]
+                cands.append(('manchester', 1, start, bits))
+                cands.append(('manchester', 0, start, bits.translate(_FLIP)))
+
+            if 'diffmanchester' in codes and first >= 1:
+                start = first - 1
+                toggles = trans[start:start + 2 * count:2]
+                cands.append(('diffmanchester', 1, start, toggles))
+                cands.append(('diffmanchester', 0, start, toggles.translate(_FLIP)))
+
+            if 'biphase' in codes:
+                # the always-transition starts the bit; the data is mid-bit
+                start = first
+                toggles = trans[start + 1:start + 2 * count:2]
+                cands.append(('biphase', 1, start, toggles))
+                cands.append(('biphase', 0, start, toggles.translate(_FLIP)))
+
+        out.append([LineCode(code, pol, start, len(bits), len(bits) / maxlen, None, _pack(bits))
+                    for code, pol, start, bits in cands if len(bits) >= minbits])
+
+    if syncwords:
+        from .bits import BitMatcher
+        matcher = BitMatcher(syncwords, maxerrors)
+        flat = [(pidx, cidx) for pidx in range(len(out)) for cidx in range(len(out[pidx]))]
+        hits = matcher.searchBatch([out[pidx][cidx].data for pidx, cidx in flat])
+        for idx, pattern, bitoff, errors in hits:
+            pidx, cidx = flat[idx]
+            cand = out[pidx][cidx]
+            if cand.sync is None or bitoff < cand.sync:
+                out[pidx][cidx] = cand._replace(sync=bitoff)
+
+    for cands in out:
+        cands.sort(key=lambda cand: (cand.sync is None, -cand.length, CODES.index(cand.code), -cand.polarity))
+    return out
+
+
+##### plain decoders #####
+def diff_manchester_decode(data, polarity=0, level=0, start=0):
+    '''
+    differential Manchester with the first bit at symbol 'start': a
+    transition at the start of a bit is a 'polarity' (0 per IEEE 802.5), no
+    transition the other value.  'level' is the line level before the first
+    symbol when start is 0.  mid-bit transitions aren't checked; use
+    detect() for that.
+    '''
+    data = bytes(data)
+    nbits = 8 * len(data)
+    if nbits - start < 2:
+        return b''
+    num = int.from_bytes(data, 'big')
+    num ^= (num >> 1) | (level << (nbits - 1))
+    toggles = format(num, '0%db' % nbits)[start:start + 2 * ((nbits - start) // 2):2]
+    if polarity == 0:
+        toggles = toggles.translate(_FLIP)
+    return _pack(toggles)
@@ -0,0 +1,337 @@
+'''
+a software copy of the CC1111 packet handler
+
+lowball() turns off sync detection, length handling, whitening, FEC and CRC
+so the dongle hands over raw bits.  PacketEngine puts all of that back on
+the host: give it a radio config block (getRadioConfig() output, or a
+RadioConfig) and raw captures, and it returns the packets the radio would
+have received with that config.  since it's just a function of the bits,
+one capture can be run against many candidate configs (see scanConfigs()),
+instead of re-tuning the dongle and waiting for the remote to be pressed.
+
+receive path, per the datasheet's packet handling chapter:
+
+    Manchester decode (MDMCFG2.MANCHESTER_EN; the whole frame is coded, 10 == 1)
+    preamble quality (PKTCTRL1.PQT): the quality counter goes up 1 for each
+        bit that differs from the last and down 8 for each that doesn't;
+        a sync word only counts once it's reached 4 * PQT
+    sync word (MDMCFG2.SYNC_MODE): 15/16, 16/16 or 30/32 bits of SYNC1:SYNC0
+        (twice for 30/32).  the carrier sense modes are treated as their
+        plain versions, and "no sync" starts a packet at bit 0 of a capture
+    FEC (MDMCFG1.FEC_EN): 4x4 de-interleaving and Viterbi decoding
+    PN9 de-whitening (PKTCTRL0.WHITE_DATA)
+    length (PKTCTRL0.LENGTH_CONFIG): fixed PKTLEN, variable (first byte, and
+        packets longer than PKTLEN are dropped), or infinite (to the end of
+        the capture)
+    address check (PKTCTRL1.ADR_CHK): mismatches are dropped
+    CRC-16 (PKTCTRL0.CRC_EN): x^16 + x^15 + x^2 + 1, initialized to 0xffff,
+        over length, address and payload.  the CRC bytes don't reach the host
+    status (PKTCTRL1.APPEND_STATUS): RSSI (0 here) and LQI with CRC_OK in
+        bit 7 are appended
+
+encode() runs the same chain the other way, for building test signals.
+
+    pe = PacketEngine(d.getRadioConfig())
+    for pkt in pe.process(raw):
+        print(pkt.bitoff, pkt.crcok, hexlify(pkt.data))
+'''
+import itertools
+import collections
+import concurrent.futures
+
+from . import bitkern
+from .bits import BitMatcher
+from .chipcondefs import RadioConfig
+from .const import *
+
+RxPacket = collections.namedtuple('RxPacket', 'data crcok bitoff end syncerrors fecerrors')
+RxPacket.__doc__ = '''
+    data        what the radio hands over: length byte (variable length),
+                address, payload, and the status bytes if APPEND_STATUS is set
+    crcok       the CRC checked out (always True with CRC_EN off)
+    bitoff      bit offset of the sync word (the packet's start without one)
+    end         bit offset just past the packet
+    syncerrors  sync word bits that didn't match
+    fecerrors   coded bits the Viterbi decoder corrected
+'''
+
+
+def _crcTable():
+    table = []
+    for byte in range(256):
+        crc = byte << 8
+        for x in range(8):
+            crc = ((crc << 1) ^ 0x8005) if crc & 0x8000 else (crc << 1)
+        table.append(crc & 0xffff)
+    return table
+
+_CRC_TABLE = _crcTable()
+
+def crc16(data, crc=0xffff):
+    '''
+    the packet handler's CRC-16 (0x8005, MSB first, seeded with 0xffff)
+    '''
+    for byte in bytes(data):
+        crc = ((crc << 8) & 0xffff) ^ _CRC_TABLE[(crc >> 8) ^ byte]
+    return crc
+
+
+class PacketEngine(object):
+    def __init__(self, radiocfg):
+        if not isinstance(radiocfg, RadioConfig):
+            cfg = RadioConfig()
+            cfg.vsParse(bytes(radiocfg)[:len(cfg)])
+            radiocfg = cfg
+        self.radiocfg = radiocfg
+
+        pktctrl0 = radiocfg.pktctrl0
+        pktctrl1 = radiocfg.pktctrl1
+        if pktctrl0 & PKTCTRL0_PKT_FORMAT:
+            raise Exception("only the normal packet format (PKT_FORMAT 0) can be emulated")
+
+        self.syncword = (radiocfg.sync1 << 8) | radiocfg.sync0
+        self.syncmode = radiocfg.mdmcfg2 & MDMCFG2_SYNC_MODE & 3
+        self.manchester = bool(radiocfg.mdmcfg2 & MDMCFG2_MANCHESTER_EN)
+        self.fec = bool(radiocfg.mdmcfg1 & MFMCFG1_FEC_EN)
+        self.preamble = NUM_PREAMBLE[(radiocfg.mdmcfg1 & MFMCFG1_NUM_PREAMBLE) >> 4]
+        self.pqt = (pktctrl1 & PKTCTRL1_PQT) >> 5
+        self.appendstatus = bool(pktctrl1 & PKTCTRL1_APPEND_STATUS)
+        self.adrchk = pktctrl1 & PKTCTRL1_ADR_CHK
+        self.addr = radiocfg.addr
+        self.white = bool(pktctrl0 & PKTCTRL0_WHITE_DATA)
+        self.crc = bool(pktctrl0 & PKTCTRL0_CRC_EN)
+        self.lengthconfig = pktctrl0 & PKTCTRL0_LENGTH_CONFIG
+        self.pktlen = radiocfg.pktlen
+
+        # symbols on air per data bit
+        self.spb = (1, 2)[self.manchester]
+
+        self._matcher = None
+        self.syncbits = 0
+        if self.syncmode:
+            value, nbits, errors = ((0, 0, 0),
+                    (self.syncword, 16, 1),
+                    (self.syncword, 16, 0),
+                    ((self.syncword << 16) | self.syncword, 32, 2))[self.syncmode]
+            pattern = value.to_bytes(nbits // 8, 'big')
+            if self.manchester:
+                pattern = bitkern.manchester_encode(pattern, 1)
+                errors *= 2
+            self.syncbits = 8 * len(pattern)
+            self._matcher = BitMatcher([pattern], errors)
+
+    ##### receive #####
+    def _symbols(self, raw, start, nbytes):
+        # nbytes of data starting at symbol bit 'start', or None if the capture ends first
+        end = start + 8 * nbytes * self.spb
+        if end > 8 * len(raw):
+            return None
+        chunk = bitkern.extract(raw, start, end)[0]
+        if self.manchester:
+            chunk = bitkern.manchester_decode(chunk, 1)
+        return chunk
+
+    def _data(self, raw, start, nbytes):
+        '''
+        (nbytes of de-whitened data, symbol bits used, fec errors) or None
+        '''
+        if self.fec:
+            ncoded = ((nbytes // 2) + 1) * 4
+            coded = self._symbols(raw, start, ncoded)
+            if coded is None:
+                return None
+            data, errors = bitkern.fec_decode(coded)
+            data = data[:nbytes]
+        else:
+            ncoded = nbytes
+            errors = 0
+            data = self._symbols(raw, start, nbytes)
+            if data is None:
+                return None
+
+        if self.white:
+            data = bitkern.pn9(data)
+        return data, 8 * ncoded * self.spb, errors
+
+    def _preambleOK(self, raw, syncoff):
+        # run the preamble quality counter up to the sync word
+        need = 4 * self.pqt
+        window = min(syncoff, 32 * need * self.spb)
+        bits = bitkern.unpack_bits(bitkern.extract(raw, syncoff - window, syncoff)[0])[:window]
+        if self.manchester:
+            bits = bits[window % 2::2]
+        pqi = 0
+        last = None
+        for bit in bits:
+            if last is not None:
+                pqi = pqi + 1 if bit != last else max(0, pqi - 8)
+            last = bit
+        return pqi >= need
+
+    def _packet(self, raw, start, bitoff, syncerrors):
+        ncrc = (0, 2)[self.crc]
+        if self.lengthconfig == PKTCTRL0_LENGTH_CONFIG_VAR:
+            first = self._data(raw, start, 1)
+            if first is None:
+                return None
+            length = first[0][0]
+            if length > self.pktlen:
+                return None
+            total = 1 + length + ncrc
+        elif self.lengthconfig == PKTCTRL0_LENGTH_CONFIG_FIX:
+            total = self.pktlen + ncrc
+        else:
+            # infinite: whatever the capture holds, unchecked
+            avail = (8 * len(raw) - start) // (8 * self.spb)
+            total = max(0, (avail // 4 - 1) * 2) if self.fec else avail
+            ncrc = 0
+
+        got = self._data(raw, start, total)
+        if got is None:
+            return None
+        data, used, fecerrors = got
+
+        crcok = True
+        if ncrc:
+            crcok = crc16(data[:-2]) == int.from_bytes(data[-2:], 'big')
+            data = data[:-2]
+
+        if self.adrchk:
+            addr = data[(0, 1)[self.lengthconfig == PKTCTRL0_LENGTH_CONFIG_VAR]:][:1]
+            allowed = (self.addr,) + ((), (), (0,), (0, 0xff))[self.adrchk]
+            if not addr or addr[0] not in allowed:
+                return None
+
+        if self.appendstatus:
+            data += bytes((0, (crcok << 7) | min(fecerrors, 0x7f)))
+        return RxPacket(data, crcok, bitoff, start + used, syncerrors, fecerrors)
+
+    def process(self, raw):
+        '''
+        every packet the radio would pull out of one raw capture, in order
+        '''
+        raw = bytes(raw)
+        if self._matcher is None:
+            pkt = self._packet(raw, 0, 0, 0)
+            return [pkt] if pkt is not None else []
+
+        out = []
+        cursor = 0
+        for pattern, bitoff, errors in self._matcher.search(raw):
+            if bitoff < cursor:
+                continue
+            if self.pqt and not self._preambleOK(raw, bitoff):
+                continue
+            pkt = self._packet(raw, bitoff + self.syncbits, bitoff, errors)
+            if pkt is not None:
+                out.append(pkt)
+                cursor = pkt.end
+        return out
+
+    def processBatch(self, captures):
+        '''
+        [(capture index, RxPacket), ...] for a list of raw captures
+        '''
+        return [(idx, pkt) for idx, raw in enumerate(captures) for pkt in self.process(raw)]
+
+    ##### transmit #####
+    def encode(self, payload, addr=None):
+        '''
+        the symbols a CC1111 with this config sends for 'payload': preamble,
+        sync word, then length/address/payload/CRC, whitened, FEC coded and
+        Manchester coded as configured.  addr defaults to ADDR when address
+        checking is on.
+        '''
+        body = bytes(payload)
+        if self.adrchk:
+            body = bytes((self.addr if addr is None else addr,)) + body
+        if self.lengthconfig == PKTCTRL0_LENGTH_CONFIG_VAR:
+            body = bytes((len(body),)) + body
+        elif self.lengthconfig == PKTCTRL0_LENGTH_CONFIG_FIX and len(body) != self.pktlen:
+            raise Exception("fixed length packets must be PKTLEN (%d) bytes, not %d" % (self.pktlen, len(body)))
+
+        if self.crc:
+            body += crc16(body).to_bytes(2, 'big')
+        if self.white:
+            body = bitkern.pn9(body)
+        if self.fec:
+            body = bitkern.fec_encode(body + b'\x0b' * (2 - len(body) % 2))
+
+        sync = b''
+        if self.syncmode:
+            sync = self.syncword.to_bytes(2, 'big') * (1, 1, 1, 2)[self.syncmode]
+        frame = b'\xaa' * self.preamble + sync + body
+        if self.manchester:
+            frame = bitkern.manchester_encode(frame, 1)
+        return frame
+
+
+##### trying configs against captures #####
+_VARIANTS = {
+    # name: (register, mask, value for each choice)
+    'whitening':    ('pktctrl0', PKTCTRL0_WHITE_DATA, lambda on: (0, PKTCTRL0_WHITE_DATA)[bool(on)]),
+    'crc':          ('pktctrl0', PKTCTRL0_CRC_EN, lambda on: (0, PKTCTRL0_CRC_EN)[bool(on)]),
+    'lengthconfig': ('pktctrl0', PKTCTRL0_LENGTH_CONFIG, lambda val: val & PKTCTRL0_LENGTH_CONFIG),
+    'manchester':   ('mdmcfg2', MDMCFG2_MANCHESTER_EN, lambda on: (0, MDMCFG2_MANCHESTER_EN)[bool(on)]),
+    'syncmode':     ('mdmcfg2', MDMCFG2_SYNC_MODE, lambda val: val & MDMCFG2_SYNC_MODE),
+    'fec':          ('mdmcfg1', MFMCFG1_FEC_EN, lambda on: (0, MFMCFG1_FEC_EN)[bool(on)]),
+    'pqt':          ('pktctrl1', PKTCTRL1_PQT, lambda val: (val << 5) & PKTCTRL1_PQT),
+    'preamble':     ('mdmcfg1', MFMCFG1_NUM_PREAMBLE, lambda nbytes: NUM_PREAMBLE.index(nbytes) << 4),
+    'pktlen':       ('pktlen', 0xff, lambda val: val & 0xff),
+    }
+
+def configVariants(radiocfg, syncwords=None, **choices):
+    '''
+    every combination of the given settings applied to radiocfg.  choices
+    are lists of values for: whitening, crc, fec, manchester (bools),
+    lengthconfig, syncmode, pqt, pktlen, preamble (bytes); plus syncwords
+    (16-bit ints).
+
+    returns [(settings dict, config bytes), ...]
+
+        configVariants(d.getRadioConfig(), syncwords=[0xd391, 0x0f0f],
+                       whitening=[False, True], fec=[False, True])
+    '''
+    base = bytes(radiocfg)
+    names = sorted(choices)
+    if syncwords is not None:
+        names.append('syncword')
+        choices = dict(choices, syncword=syncwords)
+
+    out = []
+    for combo in itertools.product(*[choices[name] for name in names]):
+        cfg = RadioConfig()
+        cfg.vsParse(base[:len(cfg)])
+        for name, val in zip(names, combo):
+            if name == 'syncword':
+                cfg.sync1, cfg.sync0 = (val >> 8) & 0xff, val & 0xff
+                continue
+            reg, mask, conv = _VARIANTS[name]
+            setattr(cfg, reg, (getattr(cfg, reg) & ~mask) | conv(val))
+        out.append((dict(zip(names, combo)), cfg.vsEmit() + base[len(cfg):]))
+    return out
+
+def _scanOne(radiocfg, captures):
+    pkts = PacketEngine(radiocfg).processBatch(captures)
+    return len(pkts), len([pkt for idx, pkt in pkts if pkt.crcok])
+
+def scanConfigs(captures, configs, workers=None):
+    '''
+    run every config in 'configs' (config blocks, or configVariants()
+    output) over the same raw captures, spread across worker processes
+    (workers=0 runs them here).
+
+    returns [(config index, packets, packets with a good CRC), ...], best
+    first.
+    '''
+    configs = [cfg[1] if isinstance(cfg, tuple) else cfg for cfg in configs]
+    captures = [bytes(raw) for raw in captures]
+    if workers == 0:
+        results = [_scanOne(cfg, captures) for cfg in configs]
+    else:
+        with concurrent.futures.ProcessPoolExecutor(workers) as pool:
+            results = list(pool.map(_scanOne, configs, [captures] * len(configs)))
+
+    out = [(idx, npkts, ncrcok) for idx, (npkts, ncrcok) in enumerate(results)]
+    out.sort(key=lambda res: (-res[2], -res[1], res[0]))
+    return out
@@ -0,0 +1,524 @@
+'''
+rfcat_server's data plane: one dongle, any number of TCP clients
+
+everything on the data port, both ways, is a frame:
+
+    u8 type, u16 length (little endian), then 'length' bytes of payload
+
+    FRAME_TX        client -> server    bytes to RFxmit()
+    FRAME_TX_DONE   server -> client    u8 status: 0 sent, 1 failed (one per FRAME_TX, in order)
+    FRAME_RX        server -> client    f64 timestamp, then the (decoded) packet
+    FRAME_SPECAN    server -> client    f64 timestamp, u8 APP_SPECAN cmd, then the dump
+    FRAME_DROPPED   server -> client    u32 frames dropped for this client so far
+
+every client gets every received packet.  the server never polls: the
+dongle's recv thread wakes the select() loop when a packet lands in the
+mailbox (USBDongle.addRecvListener).  each client has its own send queue,
+limited to 'maxqueue' bytes; what happens when a client can't keep up is
+its policy:
+
+    POLICY_DROP_OLDEST  drop the oldest queued frames (a live tail, the default)
+    POLICY_DROP_NEWEST  drop the new frames
+    POLICY_BLOCK        stop sending to anyone until it catches up.  every
+                        client waits for it; meanwhile packets are still taken
+                        from the dongle into a backlog of 'maxbacklog', past
+                        which the oldest are dropped (counted in 'overflows')
+    POLICY_DISCONNECT   hang up on it
+
+transmits run one at a time on a thread of their own.  a client with
+'txdepth' frames waiting to go out isn't read from until one is sent, so
+TCP pushes back on it instead of the server buffering.
+'''
+import time
+import struct
+import select
+import socket
+import threading
+import collections
+
+from .const import *
+
+FRAME_TX        = 1
+FRAME_TX_DONE   = 2
+FRAME_RX        = 3
+FRAME_SPECAN    = 4
+FRAME_DROPPED   = 5
+
+FRAME_HDR = struct.Struct("<BH")
+FRAME_MAX = 0xffff
+
+POLICY_DROP_OLDEST  = 'drop-oldest'
+POLICY_DROP_NEWEST  = 'drop-newest'
+POLICY_BLOCK        = 'block'
+POLICY_DISCONNECT   = 'disconnect'
+POLICIES = (POLICY_DROP_OLDEST, POLICY_DROP_NEWEST, POLICY_BLOCK, POLICY_DISCONNECT)
+
+
+def packFrame(ftype, payload=b''):
+    if len(payload) > FRAME_MAX:
+        raise ValueError("frame payload too long: %d bytes" % len(payload))
+    return FRAME_HDR.pack(ftype, len(payload)) + payload
+
+class FrameReader(object):
+    '''
+    reassembles frames from a byte stream, however it arrives
+    '''
+    def __init__(self):
+        self._buf = b''
+
+    def feed(self, data):
+        '''
+        add received bytes, returns the list of (type, payload) now complete
+        '''
+        self._buf += data
+        frames = []
+        off = 0
+        while len(self._buf) - off >= FRAME_HDR.size:
+            ftype, length = FRAME_HDR.unpack_from(self._buf, off)
+            end = off + FRAME_HDR.size + length
+            if end > len(self._buf):
+                break
+            frames.append((ftype, self._buf[off + FRAME_HDR.size:end]))
+            off = end
+
+        self._buf = self._buf[off:]
+        return frames
+
+
+class ServerClient(object):
+    '''
+    the server's end of one client connection.  received packets queue up
+    in 'queue', subject to the policy; FRAME_TX_DONE and FRAME_DROPPED are
+    never dropped and go out first
+    '''
+    def __init__(self, sock, addr, maxqueue, policy, txdepth):
+        self.sock = sock
+        self.addr = addr
+        self.maxqueue = maxqueue
+        self.policy = policy
+        self.txdepth = txdepth
+
+        self.reader = FrameReader()
+        self.queue = collections.deque()
+        self.queued = 0             # bytes in queue
+        self.control = collections.deque()
+        self.notice = False         # FRAME_DROPPED owed
+        self.out = b''              # what the socket hasn't taken yet
+        self.txpending = 0
+        self.closed = False
+
+        self.frames = 0
+        self.dropped = 0
+        self.maxqueued = 0
+
+    def full(self):
+        return self.queued >= self.maxqueue
+
+    def pending(self):
+        return bool(self.out or self.control or self.notice or self.queue)
+
+    def enqueue(self, frame):
+        '''
+        queue a packet frame, applying the policy if the queue is full.
+        returns False if the frame was dropped
+        '''
+        if self.queued + len(frame) > self.maxqueue and self.queue:
+            if self.policy == POLICY_DISCONNECT:
+                self.closed = True
+                return False
+
+            if self.policy == POLICY_DROP_NEWEST:
+                self.dropped += 1
+                self.notice = True
+                return False
+
+            if self.policy == POLICY_DROP_OLDEST:
+                while self.queue and self.queued + len(frame) > self.maxqueue:
+                    self.queued -= len(self.queue.popleft())
+                    self.dropped += 1
+                self.notice = True
+
+            # POLICY_BLOCK: the server stops feeding us once we're full, and
+            # keeps the frame that got us there
+
+        self.queue.append(frame)
+        self.queued += len(frame)
+        self.maxqueued = max(self.maxqueued, self.queued)
+        return True
+
+    def flush(self):
+        '''
+        write as much as the socket will take without blocking
+        '''
+        while self.pending():
+            if not self.out:
+                # hand the kernel a decent chunk at a time
+                chunk = list(self.control)
+                self.control.clear()
+                if self.notice:
+                    # the count is cumulative, so one notice covers every drop so far
+                    chunk.append(packFrame(FRAME_DROPPED, struct.pack("<I", self.dropped)))
+                    self.notice = False
+
+                size = 0
+                while self.queue and size < 65536:
+                    frame = self.queue.popleft()
+                    chunk.append(frame)
+                    size += len(frame)
+                    self.frames += 1
+                self.queued -= size
+                self.out = b''.join(chunk)
+
+            try:
+                sent = self.sock.send(self.out)
+            except (BlockingIOError, InterruptedError):
+                return
+            except socket.error:
+                self.closed = True
+                return
+
+            self.out = self.out[sent:]
+
+    def stats(self):
+        return {
+            'addr':         self.addr,
+            'policy':       self.policy,
+            'frames':       self.frames,
+            'dropped':      self.dropped,
+            'queued':       self.queued,
+            'maxqueued':    self.maxqueued,
+            'txpending':    self.txpending,
+        }
+
+
+class RfServer(object):
+    '''
+    serve a dongle's RX stream to every client connected to ip:port, and
+    transmit what they send.  run() is the event loop; start() runs it on a
+    thread.  port 0 picks a free port, see self.address.
+    '''
+    def __init__(self, nic, ip='0.0.0.0', port=1900, maxqueue=1024*1024, policy=POLICY_DROP_OLDEST, txdepth=4,
+                 maxbacklog=4096):
+        if policy not in POLICIES:
+            raise ValueError("unknown policy %r, use one of %r" % (policy, POLICIES))
+
+        self.nic = nic
+        self.maxqueue = maxqueue
+        self.policy = policy
+        self.txdepth = txdepth
+        self.maxbacklog = maxbacklog
+
+        self._lsock = socket.socket()
+        self._lsock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self._lsock.bind((ip, port))
+        self._lsock.listen(100)
+        self._lsock.setblocking(False)
+        self.address = self._lsock.getsockname()
+
+        # the recv and tx threads poke this to wake select()
+        self._wakeR, self._wakeW = socket.socketpair()
+        self._wakeR.setblocking(False)
+        self._wakeW.setblocking(False)
+
+        self.clients = {}
+        self._backlog = collections.deque()
+        self._txq = collections.deque()
+        self._txevent = threading.Event()
+        self._txdone = collections.deque()
+        self._txthread = None
+        self._thread = None
+        self._go = False
+
+        self.packets = 0
+        self.specan = 0
+        self.decodeerrors = 0
+        self.transmitted = 0
+        self.txerrors = 0
+        self.badframes = 0
+        self.overflows = 0
+
+    ##### event loop #####
+    def start(self):
+        self._thread = threading.Thread(target=self.run)
+        self._thread.daemon = True
+        self._thread.start()
+        return self
+
+    def stop(self):
+        self._go = False
+        self._wake()
+        if self._thread is not None and self._thread is not threading.current_thread():
+            self._thread.join()
+
+    def run(self):
+        self._go = True
+        self._txthread = threading.Thread(target=self._txRun)
+        self._txthread.daemon = True
+        self._txthread.start()
+
+        self.nic.addRecvListener(self._onRecv)
+        try:
+            self._pump()
+            while self._go:
+                rlist = [self._lsock, self._wakeR]
+                rlist.extend([c.sock for c in self.clients.values() if c.txpending < c.txdepth])
+                wlist = [c.sock for c in self.clients.values() if c.pending()]
+
+                r, w, x = select.select(rlist, wlist, [])
+
+                if self._wakeR in r:
+                    self._drainWake()
+                if self._lsock in r:
+                    self._accept()
+
+                for sock in r:
+                    client = self.clients.get(sock)
+                    if client is not None:
+                        self._read(client)
+
+                for sock in w:
+                    client = self.clients.get(sock)
+                    if client is not None:
+                        client.flush()
+
+                self._pump()
+                self._reap()
+
+        finally:
+            self.nic.removeRecvListener(self._onRecv)
+            self._txq.append(None)
+            self._txevent.set()
+            for client in list(self.clients.values()):
+                client.closed = True
+            self._reap()
+            self._lsock.close()
+            self._wakeR.close()
+            self._wakeW.close()
+
+    def _wake(self):
+        try:
+            self._wakeW.send(b'\0')
+        except (BlockingIOError, socket.error):
+            pass        # a wakeup is already pending (or we're shutting down)
+
+    def _drainWake(self):
+        try:
+            while self._wakeR.recv(4096):
+                pass
+        except (BlockingIOError, socket.error):
+            pass
+
+    def _onRecv(self, app, cmd):
+        # runs on the dongle's recv thread
+        if (app == APP_NIC and cmd == NIC_RECV) or app == APP_SPECAN:
+            self._wake()
+
+    def _accept(self):
+        try:
+            sock, addr = self._lsock.accept()
+        except (BlockingIOError, socket.error):
+            return
+        sock.setblocking(False)
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.clients[sock] = ServerClient(sock, addr, self.maxqueue, self.policy, self.txdepth)
+
+    def _reap(self):
+        for sock, client in list(self.clients.items()):
+            if client.closed:
+                del self.clients[sock]
+                try:
+                    sock.close()
+                except socket.error:
+                    pass
+
+    ##### RX fan-out #####
+    def _blocked(self):
+        return any([c.full() for c in self.clients.values() if c.policy == POLICY_BLOCK])
+
+    def _broadcast(self, frame):
+        for client in self.clients.values():
+            client.enqueue(frame)
+
+    def _pump(self):
+        '''
+        move finished transmits and received packets from the dongle's
+        mailbox to the client queues, and start them on their way
+        '''
+        while self._txdone:
+            client, status = self._txdone.popleft()
+            client.txpending -= 1
+            client.control.append(packFrame(FRAME_TX_DONE, struct.pack("<B", status)))
+
+        # always empty the dongle's mailbox, so a blocked client can't grow it without bound
+        for data, ts in self.nic.recvPending(APP_NIC, NIC_RECV):
+            self._backlog.append((None, data, ts))
+        for cmd in list(self.nic.recv_mbox.get(APP_SPECAN, {}).keys()):
+            for data, ts in self.nic.recvPending(APP_SPECAN, cmd):
+                self._backlog.append((cmd, data, ts))
+        while len(self._backlog) > self.maxbacklog:
+            self._backlog.popleft()
+            self.overflows += 1
+
+        if not self._blocked():
+            while self._backlog:
+                cmd, data, ts = self._backlog.popleft()
+                if cmd is not None:
+                    self.specan += 1
+                    self._broadcast(packFrame(FRAME_SPECAN, struct.pack("<dB", ts, cmd) + data))
+                    continue
+
+                if self.nic.endec is not None:
+                    try:
+                        data = self.nic.endec.decode(data)
+                    except Exception:
+                        self.decodeerrors += 1
+                        continue
+                self.packets += 1
+                self._broadcast(packFrame(FRAME_RX, struct.pack("<d", ts) + data))
+
+        for client in self.clients.values():
+            client.flush()
+
+    ##### TX #####
+    def _read(self, client):
+        try:
+            data = client.sock.recv(65536)
+        except (BlockingIOError, InterruptedError):
+            return
+        except socket.error:
+            data = b''
+
+        if not data:
+            client.closed = True
+            return
+
+        for ftype, payload in client.reader.feed(data):
+            if ftype == FRAME_TX:
+                client.txpending += 1
+                self._txq.append((client, payload))
+                self._txevent.set()
+            else:
+                self.badframes += 1
+
+    def _txRun(self):
+        while True:
+            self._txevent.wait()
+            self._txevent.clear()
+            while self._txq:
+                item = self._txq.popleft()
+                if item is None:
+                    return
+
+                client, data = item
+                status = 0
+                try:
+                    if self.nic.RFxmit(data):
+                        status = 1
+                except Exception:
+                    status = 1
+
+                if status:
+                    self.txerrors += 1
+                else:
+                    self.transmitted += 1
+                self._txdone.append((client, status))
+                self._wake()
+
+    ##### stats #####
+    def stats(self):
+        return {
+            'clients':      [c.stats() for c in self.clients.values()],
+            'packets':      self.packets,
+            'specan':       self.specan,
+            'decodeerrors': self.decodeerrors,
+            'transmitted':  self.transmitted,
+            'txerrors':     self.txerrors,
+            'badframes':    self.badframes,
+            'backlog':      len(self._backlog),
+            'overflows':    self.overflows,
+        }
+
+    def reprStats(self):
+        st = self.stats()
+        output = ["RX packets: %(packets)d  specan: %(specan)d  decode errors: %(decodeerrors)d  "
+                  "TX: %(transmitted)d (%(txerrors)d failed)  bad frames: %(badframes)d  "
+                  "backlog: %(backlog)d (%(overflows)d dropped)" % st]
+        for cst in st['clients']:
+            output.append("    %-22s %-12s frames: %6d  dropped: %6d  queued: %7d (max %d)  tx pending: %d" % (
+                    "%s:%d" % cst['addr'][:2], cst['policy'], cst['frames'], cst['dropped'],
+                    cst['queued'], cst['maxqueued'], cst['txpending']))
+        return "\n".join(output)
+
+
+class RfServerClient(object):
+    '''
+    the client end of the data port:
+
+        c = RfServerClient('localhost')
+        c.xmit(b'hello')
+        status = c.waitTxDone()
+        data, ts = c.recv()
+
+    frames are filed as they arrive: packets in self.rx, FRAME_TX_DONE
+    statuses in self.txdone, (cmd, data, timestamp) specan dumps in
+    self.specan, and the server's dropped count in self.dropped
+    '''
+    def __init__(self, host='localhost', port=1900):
+        self.sock = socket.create_connection((host, port))
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self._reader = FrameReader()
+        self.rx = collections.deque()
+        self.txdone = collections.deque()
+        self.specan = collections.deque()
+        self.dropped = 0
+
+    def close(self):
+        self.sock.close()
+
+    def xmit(self, data):
+        self.sock.sendall(packFrame(FRAME_TX, data))
+
+    def recv(self, timeout=None):
+        '''
+        the next received packet as (data, timestamp), or None on timeout
+        '''
+        if not self._fill(self.rx, timeout):
+            return None
+        return self.rx.popleft()
+
+    def waitTxDone(self, timeout=None):
+        '''
+        the status of the oldest unacknowledged xmit(), or None on timeout
+        '''
+        if not self._fill(self.txdone, timeout):
+            return None
+        return self.txdone.popleft()
+
+    def _fill(self, want, timeout):
+        # read and file frames until 'want' has something in it
+        deadline = None if timeout is None else time.time() + timeout
+        while not want:
+            if deadline is not None:
+                left = deadline - time.time()
+                if left <= 0:
+                    return False
+                self.sock.settimeout(left)
+            try:
+                data = self.sock.recv(65536)
+            except socket.timeout:
+                return False
+            if not data:
+                raise EOFError("server closed the connection")
+
+            for ftype, payload in self._reader.feed(data):
+                if ftype == FRAME_RX:
+                    ts, = struct.unpack_from("<d", payload)
+                    self.rx.append((payload[8:], ts))
+                elif ftype == FRAME_TX_DONE:
+                    self.txdone.append(payload[0])
+                elif ftype == FRAME_SPECAN:
+                    ts, cmd = struct.unpack_from("<dB", payload)
+                    self.specan.append((cmd, payload[9:], ts))
+                elif ftype == FRAME_DROPPED:
+                    self.dropped, = struct.unpack("<I", payload)
+        return True
@@ -0,0 +1,509 @@
+'''
+how rflib gets bytes to and from a dongle over USB, with a choice of ways to
+do it
+
+    d = RfCat(transport='libusb1')      # or RFCAT_TRANSPORT=libusb1 in the environment
+
+USBDongle needs three calls from whatever it keeps in ._do, the ones a
+legacy pyusb device handle has: controlMsg(), bulkWrite() and bulkRead().
+a Transport is those, plus finding and opening a dongle:
+
+    pyusb       the legacy pyusb 0.x API rflib has always used: one
+                synchronous transfer at a time, from the recv and send
+                threads.  the default
+    libusb1     libusb-1.0's asynchronous API, through python-libusb1 (pip
+                install libusb1).  'inflight' IN transfers are kept queued
+                on EP5 at all times, so the dongle never waits on the host to
+                ask for its next packet, and bulkWrite() submits its OUT
+                transfer and returns without waiting for it, 'outflight' of
+                them at most.  a thread of its own runs libusb's events
+    fake        a fakedongle_nic.fakeDongle standing in for the dongle (or
+                anything else with the three calls, eg. an fwsim.SimDongle)
+
+errors come out as usb.USBError with the words pyusb would use for them
+('Operation timed out', 'No such device', 'Input/output error'...), since
+those are what USBDongle's threads go by.
+'''
+from __future__ import print_function
+
+import os
+import sys
+import time
+import threading
+import collections
+
+import usb
+
+from .const import *
+
+# OpenMoko assigned, or legacy TI
+RFCAT_IDS = frozenset([(0x0451, 0x4715), (0x1d50, 0x6047), (0x1d50, 0x6048), (0x1d50, 0x605b), (0x1d50, 0xecc1)])
+BOOTLOADER_IDS = frozenset([(0x1d50, 0x6049), (0x1d50, 0x604a), (0x1d50, 0xecc0)])
+
+EP5_OUT = 0x05
+EP5_IN = 0x85
+
+LIBUSB1_INFLIGHT = 8            # IN transfers kept queued on EP5
+LIBUSB1_OUTFLIGHT = 8           # OUT transfers submitted before bulkWrite() waits
+LIBUSB1_IN_SIZE = 512           # bytes per IN transfer: 8 full packets, ends early on a short one
+
+# RFCAT_TRANSPORT picks the default for the whole process (as does setting this)
+default = os.environ.get('RFCAT_TRANSPORT', 'pyusb')
+
+
+def checkBootloader(vid, pid):
+    if (vid, pid) in BOOTLOADER_IDS:
+        print("Already in Bootloader Mode... exiting")
+        exit(0)
+
+
+class Transport(object):
+    '''
+    one open dongle.  devnum orders them (idx counts through devices() in
+    devnum order); 'device' is what USBDongle keeps in ._d
+    '''
+    name = None
+
+    def __init__(self):
+        self.devnum = 0
+        self.device = None
+        self.maxi = EP5IN_MAX_PACKET_SIZE
+        self.maxo = EP5OUT_MAX_PACKET_SIZE
+        # the pyusb configuration, interface and endpoints, where there are such things
+        self.cfg = None
+        self.intf = None
+        self.eps = None
+
+    @classmethod
+    def devices(cls):
+        '''
+        the rfcats this transport can see
+        '''
+        raise NotImplementedError
+
+    @classmethod
+    def open(cls, idx=0, verbose=False):
+        raise NotImplementedError
+
+    def controlMsg(self, requestType, request, buffer, value=0, index=0, timeout=DEFAULT_USB_TIMEOUT):
+        '''
+        buffer is the data for an OUT request, and how many bytes to read
+        for an IN one
+        '''
+        raise NotImplementedError
+
+    def bulkWrite(self, endpoint, buffer, timeout=DEFAULT_USB_TIMEOUT):
+        raise NotImplementedError
+
+    def bulkRead(self, endpoint, size, timeout=DEFAULT_USB_TIMEOUT):
+        raise NotImplementedError
+
+    def close(self):
+        pass
+
+
+######## pyusb 0.x ########
+class PyUSBTransport(Transport):
+    '''
+    a legacy pyusb device handle, used as it always has been.  anything else
+    the handle does (getString(), reset()...) passes straight through
+    '''
+    name = 'pyusb'
+
+    def __init__(self, dev, handle):
+        Transport.__init__(self)
+        self.device = dev
+        self.handle = handle
+        self.devnum = dev.devnum
+        self.cfg = dev.configurations[0]
+        self.intf = self.cfg.interfaces[0][0]
+        self.eps = self.intf.endpoints
+        for ep in self.eps:
+            if ep.address & 0x80:
+                self.maxi = ep.maxPacketSize
+            else:
+                self.maxo = ep.maxPacketSize
+
+    @classmethod
+    def devices(cls):
+        rfcats = []
+        for bus in usb.busses():
+            for dev in bus.devices:
+                checkBootloader(dev.idVendor, dev.idProduct)
+                if (dev.idVendor, dev.idProduct) in RFCAT_IDS:
+                    rfcats.append(dev)
+        return rfcats
+
+    @classmethod
+    def open(cls, idx=0, verbose=False):
+        dongles = []
+        for dev in cls.devices():
+            if verbose: print((dev), file=sys.stderr)
+            do = dev.open()
+            iSN = do.getDescriptor(1,0,50)[16]
+            dongles.append((dev.devnum, dev, do))
+
+        dongles.sort(key=lambda x: x[0])
+        if len(dongles) == 0:
+            raise Exception("No Dongle Found.  Please insert a RFCAT dongle.")
+
+        # claim that interface!
+        devnum, dev, do = dongles[idx]
+        try:
+            do.claimInterface(0)
+        except Exception as e:
+            if verbose: print(("Error claiming usb interface:" + repr(e)), file=sys.stderr)
+
+        return cls(dev, do)
+
+    def controlMsg(self, requestType, request, buffer, value=0, index=0, timeout=DEFAULT_USB_TIMEOUT):
+        return self.handle.controlMsg(requestType, request, buffer, value, index, timeout)
+
+    def bulkWrite(self, endpoint, buffer, timeout=DEFAULT_USB_TIMEOUT):
+        return self.handle.bulkWrite(endpoint, buffer, timeout)
+
+    def bulkRead(self, endpoint, size, timeout=DEFAULT_USB_TIMEOUT):
+        return self.handle.bulkRead(endpoint, size, timeout)
+
+    def close(self):
+        try:
+            self.handle.releaseInterface()
+        except Exception:
+            pass
+
+    def __getattr__(self, name):
+        if name == 'handle':
+            raise AttributeError(name)
+        return getattr(self.handle, name)
+
+
+######## libusb-1.0, asynchronous ########
+def _usb1():
+    try:
+        import usb1
+    except ImportError:
+        raise ImportError("the libusb1 transport needs python-libusb1:  pip install libusb1")
+    return usb1
+
+# what pyusb would have called each of these
+LIBUSB1_ERRORS = {
+    'USBErrorTimeout': 'Operation timed out',
+    'USBErrorNoDevice': 'No such device (it may have been disconnected)',
+    'USBErrorIO': 'Input/output error',
+    'USBErrorPipe': 'Pipe error',
+    'USBErrorBusy': 'Resource busy',
+    'USBErrorOverflow': 'Overflow',
+    'USBErrorAccess': 'Access denied (insufficient permissions)',
+    'USBErrorInterrupted': 'Interrupted system call',
+    }
+
+def usbError(e):
+    '''
+    a usb1 exception as the usb.USBError pyusb would have raised
+    '''
+    return usb.USBError(LIBUSB1_ERRORS.get(type(e).__name__, str(e)))
+
+
+class LibUSB1Transport(Transport):
+    '''
+    EP5 through libusb-1.0's asynchronous transfers.
+
+    IN: 'inflight' transfers of 'insize' bytes are always submitted.  each
+    one that completes is resubmitted from its callback straight away, and
+    what it brought in is queued for bulkRead(), which hands back whatever
+    has come in (up to 'size' bytes) or waits 'timeout' ms for something
+    to.  libusb completes an endpoint's transfers in the order they were
+    submitted, so the bytes stay in order.
+
+    OUT: bulkWrite() submits a transfer and returns.  it only waits (up to
+    'timeout' ms, then 'Operation timed out', having sent nothing) when
+    'outflight' are already on their way.  OUT transfers don't time out
+    once submitted: the dongle NAKs until it has room.  if one fails, the
+    next bulkWrite() raises the error.
+
+    control transfers are synchronous, as they're rare and USBDongle waits
+    for each anyway.
+    '''
+    name = 'libusb1'
+
+    def __init__(self, context, device, handle, inflight=LIBUSB1_INFLIGHT, outflight=LIBUSB1_OUTFLIGHT,
+                 insize=LIBUSB1_IN_SIZE):
+        Transport.__init__(self)
+        self.usb1 = _usb1()
+        self.context = context
+        self.device = device
+        self.handle = handle
+        self.devnum = device.getDeviceAddress()
+        self.idVendor = device.getVendorID()
+        self.idProduct = device.getProductID()
+        self.outflight = outflight
+
+        self.cond = threading.Condition()
+        self.incoming = collections.deque()
+        self.error = None               # an IN transfer failed: everything after the data fails
+        self.outerror = None            # ...an OUT one: the next bulkWrite() fails
+        self.outfree = []
+        self.outgoing = 0
+        self.closing = False
+        self.stats = dict(inTransfers=0, inBytes=0, outTransfers=0, outBytes=0, outWaits=0)
+
+        self.intransfers = []
+        for x in range(inflight):
+            transfer = handle.getTransfer()
+            transfer.setBulk(EP5_IN, insize, callback=self._inDone, timeout=0)
+            self.intransfers.append(transfer)
+
+        self.thread = threading.Thread(target=self._events, name='libusb1')
+        self.thread.daemon = True
+        self.thread.start()
+        for transfer in self.intransfers:
+            transfer.submit()
+
+    @classmethod
+    def devices(cls, context=None):
+        usb1 = _usb1()
+        if context is None:
+            context = usb1.USBContext()
+        rfcats = []
+        for dev in context.getDeviceList(skip_on_error=True):
+            checkBootloader(dev.getVendorID(), dev.getProductID())
+            if (dev.getVendorID(), dev.getProductID()) in RFCAT_IDS:
+                rfcats.append(dev)
+        return rfcats
+
+    @classmethod
+    def open(cls, idx=0, verbose=False, **kwargs):
+        usb1 = _usb1()
+        context = usb1.USBContext()
+        dongles = sorted(cls.devices(context), key=lambda dev: dev.getDeviceAddress())
+        if len(dongles) == 0:
+            context.close()
+            raise Exception("No Dongle Found.  Please insert a RFCAT dongle.")
+
+        dev = dongles[idx]
+        if verbose: print((dev), file=sys.stderr)
+        try:
+            handle = dev.open()
+        except usb1.USBError as e:
+            context.close()
+            raise usbError(e)
+        try:
+            handle.claimInterface(0)
+        except usb1.USBError as e:
+            if verbose: print(("Error claiming usb interface:" + repr(e)), file=sys.stderr)
+        return cls(context, dev, handle, **kwargs)
+
+    def _events(self):
+        usb1 = self.usb1
+        while not self.closing or any([t.isSubmitted() for t in self.intransfers]) or self.outgoing:
+            try:
+                self.context.handleEventsTimeout(.05)
+            except usb1.USBErrorInterrupted:
+                pass
+            except usb1.USBError as e:
+                self._fail(usbError(e))
+                return
+            if self.closing and self.error is not None:
+                return
+
+    def _fail(self, error):
+        with self.cond:
+            if self.error is None:
+                self.error = error
+            self.cond.notify_all()
+
+    def _status(self, transfer):
+        # a finished transfer's status as a usb.USBError, None for a good one
+        usb1 = self.usb1
+        status = transfer.getStatus()
+        if status == usb1.TRANSFER_COMPLETED:
+            return None
+        return usb.USBError({usb1.TRANSFER_TIMED_OUT: 'Operation timed out',
+                             usb1.TRANSFER_STALL: 'Pipe error',
+                             usb1.TRANSFER_NO_DEVICE: 'No such device (it may have been disconnected)',
+                             usb1.TRANSFER_OVERFLOW: 'Overflow',
+                             usb1.TRANSFER_CANCELLED: 'Operation cancelled',
+                             }.get(status, 'Input/output error'))
+
+    def _inDone(self, transfer):
+        error = self._status(transfer)
+        if error is not None:
+            if not self.closing:
+                self._fail(error)
+            return
+
+        length = transfer.getActualLength()
+        with self.cond:
+            if length:
+                self.incoming.append(bytes(transfer.getBuffer()[:length]))
+                self.stats['inBytes'] += length
+            self.stats['inTransfers'] += 1
+            self.cond.notify_all()
+        if not self.closing:
+            try:
+                transfer.submit()
+            except self.usb1.USBError as e:
+                self._fail(usbError(e))
+
+    def _outDone(self, transfer):
+        error = self._status(transfer)
+        with self.cond:
+            self.outgoing -= 1
+            self.outfree.append(transfer)
+            if error is not None and self.outerror is None:
+                self.outerror = error
+            self.cond.notify_all()
+
+    def _deadline(self, timeout):
+        if not timeout:
+            return None
+        return time.time() + timeout / 1000.0
+
+    def _wait(self, deadline):
+        # with the lock held: False once we've waited long enough
+        left = None if deadline is None else deadline - time.time()
+        if left is not None and left <= 0:
+            return False
+        self.cond.wait(left)
+        return True
+
+    def bulkRead(self, endpoint, size, timeout=DEFAULT_USB_TIMEOUT):
+        deadline = self._deadline(timeout)
+        with self.cond:
+            while not self.incoming:
+                if self.error is not None:
+                    raise self.error
+                if not self._wait(deadline):
+                    raise usb.USBError('Operation timed out')
+
+            data = b''
+            while self.incoming and len(data) < size:
+                data += self.incoming.popleft()
+            if len(data) > size:
+                self.incoming.appendleft(data[size:])
+                data = data[:size]
+            return data
+
+    def bulkWrite(self, endpoint, buffer, timeout=DEFAULT_USB_TIMEOUT):
+        data = bytes(buffer)
+        deadline = self._deadline(timeout)
+        with self.cond:
+            if self.outerror is not None:
+                error, self.outerror = self.outerror, None
+                raise error
+            if self.error is not None:
+                raise self.error
+            if self.outgoing >= self.outflight:
+                self.stats['outWaits'] += 1
+            while self.outgoing >= self.outflight:
+                if not self._wait(deadline):
+                    raise usb.USBError('Operation timed out')
+            transfer = self.outfree.pop() if self.outfree else self.handle.getTransfer()
+            self.outgoing += 1
+            self.stats['outTransfers'] += 1
+            self.stats['outBytes'] += len(data)
+
+        transfer.setBulk(endpoint & 0x7f, data, callback=self._outDone, timeout=0)
+        try:
+            transfer.submit()
+        except self.usb1.USBError as e:
+            with self.cond:
+                self.outgoing -= 1
+                self.outfree.append(transfer)
+            raise usbError(e)
+        return len(data)
+
+    def controlMsg(self, requestType, request, buffer, value=0, index=0, timeout=DEFAULT_USB_TIMEOUT):
+        try:
+            if requestType & USB_BM_REQTYPE_DIR_IN:
+                return self.handle.controlRead(requestType, request, value, index, buffer, timeout)
+            return self.handle.controlWrite(requestType, request, value, index, bytes(buffer), timeout)
+        except self.usb1.USBError as e:
+            raise usbError(e)
+
+    def getString(self, index, length):
+        return self.handle.getASCIIStringDescriptor(index)
+
+    def close(self):
+        '''
+        cancel what's in flight, wait for libusb to hand it all back, and let
+        go of the dongle
+        '''
+        self.closing = True
+        for transfer in self.intransfers:
+            try:
+                transfer.cancel()
+            except self.usb1.USBError:
+                pass
+        self.thread.join(2)
+        try:
+            self.handle.releaseInterface(0)
+            self.handle.close()
+        except self.usb1.USBError:
+            pass
+        self.context.close()
+
+
+######## fake ########
+class FakeTransport(Transport):
+    '''
+    a dongle that isn't there: a fakedongle_nic.fakeDongle, or whatever
+    'dongle' is, as long as it has the three calls
+    '''
+    name = 'fake'
+
+    def __init__(self, dongle=None):
+        Transport.__init__(self)
+        from .fakedongle_nic import fakeDon, fakeDongle
+        if dongle is None:
+            dongle = fakeDongle()
+        self.dongle = dongle
+        self.device = fakeDon()
+
+    @classmethod
+    def devices(cls):
+        return ['fake']
+
+    @classmethod
+    def open(cls, idx=0, verbose=False):
+        return cls()
+
+    def controlMsg(self, requestType, request, buffer, value=0, index=0, timeout=DEFAULT_USB_TIMEOUT):
+        return self.dongle.controlMsg(requestType, request, buffer, value, index, timeout)
+
+    def bulkWrite(self, endpoint, buffer, timeout=DEFAULT_USB_TIMEOUT):
+        return self.dongle.bulkWrite(endpoint, buffer, timeout)
+
+    def bulkRead(self, endpoint, size, timeout=DEFAULT_USB_TIMEOUT):
+        return self.dongle.bulkRead(endpoint, size, timeout)
+
+    def __getattr__(self, name):
+        if name == 'dongle':
+            raise AttributeError(name)
+        return getattr(self.dongle, name)
+
+
+TRANSPORTS = {
+    'pyusb': PyUSBTransport,
+    'libusb1': LibUSB1Transport,
+    'fake': FakeTransport,
+    }
+
+def getTransport(name=None):
+    '''
+    the Transport class called 'name', or the default one
+    '''
+    name = name or default
+    try:
+        return TRANSPORTS[name]
+    except KeyError:
+        raise ValueError("no USB transport %r (there's %s)" % (name, ', '.join(sorted(TRANSPORTS))))
+
+def openTransport(transport=None, idx=0, verbose=False):
+    '''
+    open dongle 'idx' with 'transport' (a name, or a Transport that's
+    already open, which is used as is)
+    '''
+    if isinstance(transport, Transport):
+        return transport
+    return getTransport(transport).open(idx, verbose)
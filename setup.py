@@ -4,7 +4,10 @@ import codecs
 import setuptools
 
 packages = ['rflib', 'vstruct', 'vstruct.defs']
-mods = []
+mods = [
+        # optional: rflib.bitkern falls back to pure Python without a compiler
+        setuptools.Extension('rflib._bitkern', ['rflib/_bitkern.c'], optional=True),
+        ]
 pkgdata = {}
 scripts = ['rfcat',
            'rfcat_server',
@@ -48,7 +51,10 @@ setuptools.setup  (name  = 'rfcat',
         extras_require={
             'specan': [
                 'PySide2==5.12.0',
-            ]
+            ],
+            'libusb1': [
+                'libusb1',
+            ],
         },
         classifiers      = [
                             # How mature is this project? Common values are
@@ -0,0 +1,185 @@
+'''
+benchmark rflib.bits against the bit-at-a-time implementations it replaced.
+
+    python -m tests.bench_bits [size_in_bytes [loops]]
+
+for each function it checks that the legacy code, the pure-Python kernels and
+(if built) the native kernels agree, then prints the time per call of each.
+'''
+import sys
+import time
+import random
+import struct
+
+import rflib.bits as rfbits
+import rflib.bitkern as bitkern
+
+
+##### the original rflib.bits loops, kept here as the reference #####
+def legacy_shiftString(string, bits):
+    news = []
+    for x in range(len(string)-1):
+        newc = ((string[x] << bits) + (string[x+1] >> (8-bits))) & 0xff
+        news.append(b"%c"%newc)
+    newc = (string[-1]<<bits) & 0xff
+    news.append(b"%c"%newc)
+    return b"".join(news)
+
+def legacy_bitSectString(string, startbit, endbit):
+    entropy = [0, 0]
+    s = b''
+    bit = startbit
+    Bidx = bit // 8
+    bidx = (bit % 8)
+    while bit < endbit:
+        byte1 = string[Bidx]
+        try:
+            byte2 = string[Bidx+1]
+        except IndexError:
+            byte2 = 0
+        byte = (byte1 << bidx) & 0xff
+        byte |= (byte2 >> (8-bidx))
+        for bi in range(8):
+            b = (byte>>bi) & 1
+            entropy[b] += 1
+        bit += 8
+        Bidx += 1
+        if bit > endbit:
+            diff = bit-endbit
+            mask = ~ ( (1<<diff) - 1 )
+            byte &= mask
+        s += bytes([byte])
+    ent = (min(entropy)+1.0) / (max(entropy)+1)
+    return (s, ent)
+
+def legacy_genBitArray(string, startbit, endbit):
+    binStr, ent = legacy_bitSectString(string, startbit, endbit)
+    s = []
+    for byte in binStr:
+        for bitx in range(7, -1, -1):
+            s.append((byte>>bitx) & 1)
+    return (s, ent)
+
+def legacy_invertBits(data):
+    output = []
+    ldata = len(data)
+    off = 0
+    if ldata&1:
+        output.append(bytes([data[0] ^ 0xff]))
+        off = 1
+    if ldata&2:
+        output.append( struct.pack( "<H", struct.unpack( "<H", data[off:off+2] )[0] ^ 0xffff) )
+        off += 2
+    count = ldata // 4
+    numlist = struct.unpack(b"<%dI" % count, data[off:] )
+    output.extend([ struct.pack(b"<L", (x^0xffffffff) ) for x in numlist ])
+    return b''.join(output)
+
+def legacy_whitenData(data, seed=0xffff):
+    fbRegister = seed
+    news = []
+    for x in range(len(data)-1):
+        retval = 0
+        for y in range(8):
+            retval <<= 1
+            retval |= (fbRegister >> 6)
+            nb = ( ( fbRegister>>3) ^ (fbRegister>>6)) &1
+            fbRegister = ( ( fbRegister << 1 )   |   nb ) & 0x7f
+        news.append(b"%c" % ((data[x] ^ retval) & 0xff))
+    return b"".join(news)
+
+def legacy_manchester_decode(data, hilo=1):
+    # the original returned ''.join() of bytes (a TypeError on py3) and
+    # didn't shift an odd trailing nibble; both fixed here for comparison
+    out = []
+    last = 0
+    obyte = 0
+    for bidx in range(len(data)):
+        byte = data[bidx]
+        for y in range(7, -1, -1):
+            bit = (byte >> y) & 1
+            if not (y & 1):
+                obyte <<= 1
+                if bit and not last:
+                    if not hilo:
+                        obyte |= 1
+                elif last and not bit:
+                    if hilo:
+                        obyte |= 1
+            last = bit
+        if (bidx & 1):
+            out.append(bytes([obyte]))
+            obyte = 0
+    if not (bidx & 1):
+        out.append(bytes([obyte << 4]))
+    return b''.join(out)
+
+def legacy_manchester_encode(data, hilo=1):
+    bits = ((0b10, 0b01), (0b01, 0b10))[bool(hilo)]
+    out = []
+    for byte in data:
+        obyte = 0
+        for bitx in range(7,-1,-1):
+            obyte <<= 2
+            obyte |= bits[(byte>>bitx) & 1]
+        out.append(struct.pack(">H", obyte))
+    return b''.join(out)
+
+
+def timeit(func, args, loops):
+    start = time.perf_counter()
+    for x in range(loops):
+        func(*args)
+    return (time.perf_counter() - start) / loops
+
+def main(size=4096, loops=20):
+    rand = random.Random(0x1111)
+    data = bytes([rand.randrange(256) for x in range(size)])
+    endbit = 8 * size - 5
+
+    native = dict((name, getattr(bitkern, name)) for name in bitkern.KERNELS) if bitkern.NATIVE else {}
+    py = bitkern.PY_KERNELS
+
+    # (name, legacy call, rflib.bits call, kernel name, kernel args)
+    cases = [
+        ('shiftString',         lambda: legacy_shiftString(data, 3),
+                                lambda: rfbits.shiftString(data, 3),            'shift', (data, 3)),
+        ('bitSectString',       lambda: legacy_bitSectString(data, 5, endbit),
+                                lambda: rfbits.bitSectString(data, 5, endbit),  'extract', (data, 5, endbit)),
+        ('genBitArray',         lambda: legacy_genBitArray(data, 5, endbit),
+                                lambda: rfbits.genBitArray(data, 5, endbit),    'unpack_bits', (data,)),
+        ('invertBits',          lambda: legacy_invertBits(data),
+                                lambda: rfbits.invertBits(data),                'invert', (data,)),
+        ('whitenData',          lambda: legacy_whitenData(data),
+                                lambda: rfbits.whitenData(data),                'lfsr7', (data, 0xffff)),
+        ('manchester_decode',   lambda: legacy_manchester_decode(data),
+                                lambda: rfbits.manchester_decode(data),         'manchester_decode', (data,)),
+        ('manchester_encode',   lambda: legacy_manchester_encode(data),
+                                lambda: rfbits.manchester_encode(data),         'manchester_encode', (data,)),
+        ]
+
+    print("rflib.bits benchmark: %d bytes, %d loops, native kernels: %s" % (size, loops, bitkern.NATIVE))
+    print("%-20s %12s %12s %12s %9s" % ("function", "legacy(us)", "python(us)", "native(us)", "speedup"))
+    ok = True
+    for name, legacy, current, kname, kargs in cases:
+        if legacy() != current():
+            print("%-20s MISMATCH against legacy implementation" % name)
+            ok = False
+            continue
+        if kname in native and native[kname](*kargs) != py[kname](*kargs):
+            print("%-20s MISMATCH between native and python kernels" % name)
+            ok = False
+            continue
+
+        tleg = timeit(legacy, (), loops)
+        tpy = timeit(py[kname], kargs, loops)
+        tnat = timeit(native[kname], kargs, loops) if kname in native else None
+        best = tnat or tpy
+        print("%-20s %12.1f %12.1f %12s %8.0fx" % (name, tleg * 1e6, tpy * 1e6,
+                ('%.1f' % (tnat * 1e6)) if tnat else '-', tleg / best))
+
+    return ok
+
+if __name__ == '__main__':
+    args = [int(x) for x in sys.argv[1:3]]
+    sys.exit(not main(*args))
@@ -0,0 +1,126 @@
+'''
+replay a capture through RFrecv() and report packets/sec for each decoder.
+
+    python -m tests.bench_replay [capfile | num_packets]
+
+with no capture file, a synthetic one is generated: manchester-encoded
+frames behind a 0xaaaa preamble and 0xd391 sync word.  every decoder runs
+the full RFrecv() path of a ReplayRfCat, the same as it would on a dongle,
+then the slowest one runs again through RFpipeline() with 1..ncpu workers.
+'''
+import os
+import sys
+import time
+import random
+import shutil
+import tempfile
+import multiprocessing
+
+import rflib.bits as rfbits
+import rflib.bitkern as bitkern
+import rflib.capture as rfcapture
+import rflib.linecode as linecode
+from rflib.chipcon_nic import EnDeCode
+from rflib.fakedongle_nic import ReplayRfCat, ReplayFinished
+
+
+class Manchester(EnDeCode):
+    def decode(self, msg):
+        return rfbits.manchester_decode(msg)
+
+class BiphaseMark(EnDeCode):
+    def decode(self, msg):
+        return rfbits.biphase_mark_decode(msg)
+
+class PN9(EnDeCode):
+    def decode(self, msg):
+        return rfbits.pn9Whiten(msg)
+
+class SyncSearch(EnDeCode):
+    '''
+    discover()'s sync word statistics: find 0xd391 with up to 2 bit errors
+    '''
+    def __init__(self):
+        self.matcher = rfbits.BitMatcher([0xd391], maxerrors=2)
+        self.counts = {}
+
+    def decode(self, msg):
+        for pattern, bitoff, errors in self.matcher.search(msg):
+            self.counts[pattern] = self.counts.get(pattern, 0) + 1
+        return msg
+
+class LineCode(EnDeCode):
+    '''
+    discover(IdentLineCode=True): find and decode the line-coded run
+    '''
+    def decode(self, msg):
+        cands = linecode.detect(msg, syncwords=[0xd391])
+        return cands[0].data if cands else msg
+
+class Periodicity(EnDeCode):
+    def decode(self, msg):
+        rfbits.findPeriodicity(msg, maxperiod=128, minrun=32)
+        return msg
+
+DECODERS = [
+    ('raw', lambda: None),
+    ('manchester', Manchester),
+    ('biphase-mark', BiphaseMark),
+    ('pn9', PN9),
+    ('syncsearch', SyncSearch),
+    ('linecode', LineCode),
+    ('periodicity', Periodicity),
+    ]
+
+
+def makeCapture(filename, count=20000, length=64):
+    rand = random.Random(0x1111)
+    with rfcapture.CaptureWriter(filename) as cap:
+        cap.setRadioConfig(b'\0' * 0x3e)
+        for x in range(count):
+            payload = bytes([rand.randrange(256) for y in range(length // 2 - 2)])
+            cap.append(b'\xaa\xaa\xd3\x91' + rfbits.manchester_encode(payload), x * .01)
+
+def main(capfile=None, count=20000):
+    tmpdir = None
+    if capfile is None:
+        tmpdir = tempfile.mkdtemp()
+        capfile = os.path.join(tmpdir, 'bench.rfcap')
+        makeCapture(capfile, count)
+
+    try:
+        d = ReplayRfCat(capfile)
+        print("replay benchmark: %s, %d packets, native kernels: %s" % (capfile, len(d._capture), bitkern.NATIVE))
+        print("%-14s %10s %10s %12s" % ("decoder", "packets", "seconds", "packets/sec"))
+        for name, factory in DECODERS:
+            d.setEnDeCoder(factory())
+            d.replayRewind()
+            start = time.perf_counter()
+            while True:
+                try:
+                    d.RFrecv()
+                except ReplayFinished:
+                    break
+            elapsed = time.perf_counter() - start
+            print("%-14s %10d %10.3f %12.0f" % (name, d.replayed, elapsed, d.replayed / elapsed))
+
+        workers = 1
+        while workers <= multiprocessing.cpu_count():
+            d.replayRewind()
+            start = time.perf_counter()
+            pipe = d.RFpipeline(Periodicity(), workers=workers, batchsize=64)
+            count = sum(1 for pkt in pipe)
+            elapsed = time.perf_counter() - start
+            pipe.stop()
+            print("%-14s %10d %10.3f %12.0f   stalls: %d (%.3fs)" % ("periodicity x%d" % workers,
+                    count, elapsed, count / elapsed, pipe.stalls, pipe.stalltime))
+            workers *= 2
+    finally:
+        if tmpdir is not None:
+            shutil.rmtree(tmpdir)
+
+if __name__ == '__main__':
+    if len(sys.argv) > 1 and not sys.argv[1].isdigit():
+        main(sys.argv[1])
+    else:
+        main(None, *[int(x) for x in sys.argv[1:2]])
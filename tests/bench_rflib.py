@@ -0,0 +1,363 @@
+'''
+end-to-end benchmarks for rflib: how fast it gets data to, from and through
+a dongle.
+
+    python -m tests.bench_rflib [--target fake|sim|usb] [--json results.json] [--compare baseline.json]
+
+each benchmark runs a warmup round, then 'rounds' timed ones, and reports
+the time per round (min, median, mean, max, stddev) and its rate, the way
+pytest-benchmark does.  --json writes them out in pytest-benchmark's layout
+(machine_info, benchmarks[].stats, ...) so whatever tracks those files
+over time can track these; --compare prints each one's change against an
+earlier --json file and exits 1 if any got more than --threshold percent
+slower.
+
+    ping            EP5 round trip: a SYS_CMD_PING out and back
+    rfxmit          RFxmit() of a --size byte packet, packets/sec
+    rfxmitlong      RFxmitLong() of 4KB, bytes/sec
+    rfrecv          the peer RFxmit()s a packet until our RFrecv() has it
+    mailbox         the recv thread sorting 200 NIC_RECV messages into the
+                    mailbox and recv() taking them out again.  fake only:
+                    the messages go straight into the fake dongle's EP5 IN
+                    queue
+    radioconfig     getRadioConfig() reading the whole register block
+    radioconfig_shadow  ...and served from the host's shadow of it
+
+targets:
+
+    fake    two FakeRfCats on a VirtualAir (the default: no hardware, but
+            transmits take their real air time)
+    sim     two SimRfCats running --image, in lockstep on a VirtualAir
+    usb     the dongle at --idx, and the one at --peer, tuned the same, for
+            rfrecv.  without --peer, rfrecv is skipped.  --transport picks
+            how rflib talks USB to them (rflib.usbtransport)
+'''
+import sys
+import json
+import time
+import math
+import platform
+import argparse
+import datetime
+
+import rflib
+import rflib.air as rfair
+from rflib import usbtransport
+from rflib.const import *
+from rflib.fakedongle_nic import FakeRfCat
+
+
+def stats(times):
+    '''
+    pytest-benchmark's numbers for a list of round times, in seconds
+    '''
+    data = sorted(times)
+    n = len(data)
+    mean = sum(data) / n
+    stddev = math.sqrt(sum([(x - mean) ** 2 for x in data]) / (n - 1)) if n > 1 else 0.0
+    quartile = lambda q: data[min(n - 1, int(q * n))]
+    median = data[n // 2] if n % 2 else (data[n // 2 - 1] + data[n // 2]) / 2
+    return dict(min=data[0], max=data[-1], mean=mean, stddev=stddev, median=median, q1=quartile(.25),
+                q3=quartile(.75), iqr=quartile(.75) - quartile(.25), rounds=n, total=sum(data),
+                ops=1 / mean if mean else 0.0, data=list(times))
+
+
+class Bench(object):
+    '''
+    one benchmark.  run(d, peer) does one round and returns how many of
+    'unit' it moved (packets, bytes...), or raises Skip
+    '''
+    name = None
+    unit = 'ops'
+    rounds = 20
+
+    def setup(self, d, peer):
+        pass
+
+    def run(self, d, peer):
+        raise NotImplementedError
+
+    def teardown(self, d, peer):
+        pass
+
+
+class Skip(Exception):
+    pass
+
+
+class Ping(Bench):
+    name = 'ping'
+    unit = 'pings'
+    rounds = 200
+
+    def run(self, d, peer):
+        d.send(APP_SYSTEM, SYS_CMD_PING, b'ABCDEFGHIJKLMNOPQRSTUVWXYZ')
+        return 1
+
+
+class RFxmit(Bench):
+    name = 'rfxmit'
+    unit = 'packets'
+    rounds = 50
+
+    def __init__(self, size=32):
+        self.data = bytes(range(size))
+
+    def run(self, d, peer):
+        d.RFxmit(self.data)
+        return 1
+
+
+class RFxmitLong(Bench):
+    name = 'rfxmitlong'
+    unit = 'bytes'
+    rounds = 5
+
+    def __init__(self, size=4096):
+        self.data = bytes([x & 0xff for x in range(size)])
+
+    def run(self, d, peer):
+        err = d.RFxmitLong(self.data)
+        if err:
+            raise Exception("RFxmitLong() failed: 0x%x" % err)
+        return len(self.data)
+
+
+class RFrecv(Bench):
+    name = 'rfrecv'
+    unit = 'packets'
+    rounds = 30
+
+    def __init__(self, size=32):
+        self.size = size
+        self.count = 0
+
+    def setup(self, d, peer):
+        if peer is None:
+            raise Skip("needs a peer to transmit")
+        d.recvPending(APP_NIC, NIC_RECV)
+
+    def run(self, d, peer):
+        self.count += 1
+        data = (b'%.8d' % self.count) * (self.size // 8)
+        peer.RFxmit(data)
+        while True:
+            got, ts = d.RFrecv(timeout=2000)
+            if got[:len(data)] == data:
+                return 1
+
+
+class Mailbox(Bench):
+    name = 'mailbox'
+    unit = 'messages'
+    rounds = 10
+    count = 200
+
+    def setup(self, d, peer):
+        if not hasattr(d._do, 'bulk5'):
+            raise Skip("needs a fake dongle to put messages in its EP5 queue")
+        d.recvPending(APP_NIC, NIC_RECV)
+
+    def run(self, d, peer):
+        for x in range(self.count):
+            d._do.txdata(APP_NIC, NIC_RECV, b'%.8d' % x)
+        for x in range(self.count):
+            d.recv(APP_NIC, NIC_RECV, 2000)
+        return self.count
+
+
+class RadioConfig(Bench):
+    name = 'radioconfig'
+    unit = 'reads'
+    rounds = 50
+    shadow = False
+
+    def setup(self, d, peer):
+        d.setRadioConfigCache(self.shadow)
+        d.getRadioConfig()
+
+    def run(self, d, peer):
+        d.getRadioConfig()
+        return 1
+
+    def teardown(self, d, peer):
+        d.setRadioConfigCache(True)
+
+
+class RadioConfigShadow(RadioConfig):
+    name = 'radioconfig_shadow'
+    rounds = 1000
+    shadow = True
+
+
+def benches(size=32):
+    return [Ping(), RFxmit(size), RFxmitLong(), RFrecv(size), Mailbox(), RadioConfig(), RadioConfigShadow()]
+
+
+def measure(bench, d, peer, rounds=None):
+    '''
+    a warmup round, then 'rounds' timed ones.  returns a pytest-benchmark
+    style entry, or None if it was skipped
+    '''
+    rounds = rounds or bench.rounds
+    try:
+        bench.setup(d, peer)
+    except Skip as e:
+        print("%-20s skipped: %s" % (bench.name, e))
+        return None
+
+    try:
+        bench.run(d, peer)
+        times = []
+        moved = 0
+        for x in range(rounds):
+            start = time.perf_counter()
+            moved += bench.run(d, peer)
+            times.append(time.perf_counter() - start)
+    finally:
+        bench.teardown(d, peer)
+
+    st = stats(times)
+    rate = moved / st['total'] if st['total'] else 0.0
+    return dict(group=None, name=bench.name, fullname='tests/bench_rflib.py::%s' % bench.name, params=None,
+                stats=st, extra_info={'unit': bench.unit, 'per_round': moved / float(rounds),
+                                      'rate': rate})
+
+
+######## targets ########
+def openTarget(args):
+    '''
+    (dongle, peer or None, air or None) for --target
+    '''
+    if args.target == 'fake':
+        air = rfair.VirtualAir()
+        return FakeRfCat(air=air), FakeRfCat(air=air), air
+
+    if args.target == 'sim':
+        import rflib.fwsim as fwsim
+        if not args.image:
+            raise SystemExit("--target sim needs a firmware --image")
+        air = rfair.VirtualAir(quantum=.001)
+        return fwsim.SimRfCat(args.image, air), fwsim.SimRfCat(args.image, air), air
+
+    d = rflib.RfCat(idx=args.idx, transport=args.transport)
+    peer = None
+    if args.peer is not None:
+        peer = rflib.RfCat(idx=args.peer, transport=args.transport)
+    return d, peer, None
+
+
+def prepare(d, peer):
+    # variable length, so what the peer sends comes out the same length it went in
+    for nic in (d, peer):
+        if nic is not None:
+            nic.makePktVLEN(255)
+            nic.setMdmSyncWord(0xd391)
+    if peer is not None:
+        peer.setFreq(d.getFreq()[0])
+
+
+def closeTarget(d, peer):
+    for nic in (d, peer):
+        if nic is None:
+            continue
+        if hasattr(nic, 'sim'):
+            nic.sim.stop()
+        nic.cleanup()
+
+
+######## results ########
+def machineInfo():
+    return dict(node=platform.node(), processor=platform.processor(), machine=platform.machine(),
+                python_implementation=platform.python_implementation(),
+                python_version=platform.python_version(), system=platform.system(),
+                release=platform.release())
+
+
+def report(results, baseline=None, threshold=10.0):
+    '''
+    print the table.  returns the names that got more than threshold percent
+    slower than in 'baseline' (a loaded --json file)
+    '''
+    old = {}
+    if baseline:
+        old = dict([(b['name'], b) for b in baseline['benchmarks']])
+
+    regressed = []
+    print("%-20s %6s %10s %10s %10s %10s %10s %-10s %10s" % ('benchmark', 'rounds', 'min', 'median', 'mean', 'max',
+                                                            'rate', '', 'change'))
+    for b in results:
+        st = b['stats']
+        line = "%-20s %6d %9.3fms %9.3fms %9.3fms %9.3fms %10.0f %-10s" % (b['name'], st['rounds'], st['min'] * 1e3,
+                st['median'] * 1e3, st['mean'] * 1e3, st['max'] * 1e3, b['extra_info']['rate'],
+                b['extra_info']['unit'] + '/s')
+        if b['name'] in old:
+            was = old[b['name']]['stats']['mean']
+            change = (st['mean'] - was) * 100 / was if was else 0
+            flag = ''
+            if change > threshold:
+                regressed.append(b['name'])
+                flag = '  <--'
+            line += " %+9.1f%%%s" % (change, flag)
+        print(line)
+    return regressed
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description='end-to-end rflib benchmarks')
+    parser.add_argument('--target', choices=('fake', 'sim', 'usb'), default='fake')
+    parser.add_argument('--image', help='firmware .hex for --target sim')
+    parser.add_argument('--idx', type=int, default=0, help='dongle index for --target usb')
+    parser.add_argument('--peer', type=int, help='index of a second dongle to transmit for rfrecv (usb)')
+    parser.add_argument('--transport', choices=sorted(usbtransport.TRANSPORTS), help='USB transport for --target usb')
+    parser.add_argument('--only', help='comma separated benchmarks to run')
+    parser.add_argument('--rounds', type=int, help='timed rounds for every benchmark, instead of their own')
+    parser.add_argument('--size', type=int, default=32, help='packet size for rfxmit and rfrecv')
+    parser.add_argument('--json', help='write the results here')
+    parser.add_argument('--compare', help='an earlier --json file to compare against')
+    parser.add_argument('--threshold', type=float, default=10.0, help='percent slower that counts as a regression')
+    args = parser.parse_args(argv)
+
+    todo = benches(args.size)
+    if args.only:
+        names = args.only.split(',')
+        todo = [b for b in todo if b.name in names]
+
+    d, peer, air = openTarget(args)
+    try:
+        prepare(d, peer)
+        build = d.getBuildInfo()
+        print("rflib benchmarks: target %s (%r)\n" % (args.target, build))
+        results = []
+        for bench in todo:
+            entry = measure(bench, d, peer, args.rounds)
+            if entry is not None:
+                entry['group'] = args.target
+                results.append(entry)
+    finally:
+        closeTarget(d, peer)
+
+    baseline = None
+    if args.compare:
+        with open(args.compare) as f:
+            baseline = json.load(f)
+    regressed = report(results, baseline, args.threshold)
+
+    if args.json:
+        out = dict(machine_info=machineInfo(), commit_info=dict(rflib_version=RFLIB_VERSION,
+                   target=args.target, build=build.decode('latin1', 'replace')),
+                   benchmarks=results, datetime=datetime.datetime.utcnow().isoformat(), version='rflib-bench 1')
+        if air is not None:
+            out['commit_info']['air'] = dict(air.stats)
+        with open(args.json, 'w') as f:
+            json.dump(out, f, indent=4)
+        print("\nresults written to %s" % args.json)
+
+    if regressed:
+        print("\nslower than the baseline: %s" % ', '.join(regressed))
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
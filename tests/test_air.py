@@ -0,0 +1,183 @@
+import time
+import unittest
+
+import rflib.air as air
+import rflib.fwsim as fwsim
+from rflib.chipcondefs import *
+from rflib.const import FAKE_MEM_DF00
+from rflib.fakedongle_nic import FakeRfCat
+
+
+class StubRadio(object):
+    '''
+    just enough of a radio to attach to an air
+    '''
+    def __init__(self, settings):
+        self.air = None
+        self.s = settings
+        self.got = []
+
+    def settings(self):
+        return self.s
+
+    def deliver(self, frame):
+        self.got.append(frame)
+
+
+class AirTest(unittest.TestCase):
+    def setUp(self):
+        self.s = air.radioSettings(FAKE_MEM_DF00)
+
+    def test_hears(self):
+        s = self.s
+        frame = air.AirFrame(air.airBytes(s, b'hello'), s)
+        self.assertEqual(air.hears(s, frame), frame.data)
+        self.assertEqual(air.hears(s._replace(freq=s.freq + s.chanbw), frame), None)
+        self.assertEqual(air.hears(s._replace(drate=s.drate * 2), frame), None)
+        self.assertEqual(air.hears(s._replace(syncword=s.syncword ^ 1), frame), None)
+        self.assertEqual(air.hears(s._replace(manchester=not s.manchester), frame), None)
+        # no sync word: the preamble and sync come out as data
+        self.assertTrue(air.hears(s._replace(syncmode=0), frame).endswith(air.syncBytes(s) + frame.data))
+
+    def test_channel(self):
+        s = self.s
+        frame = air.AirFrame(bytes(1000), s)
+        self.assertEqual(air.ChannelModel(loss=1).apply(frame), None)
+
+        got = air.ChannelModel(ber=.01, latency=.5, rssi=-70, seed=1).apply(frame)
+        errors = sum([bin(x).count('1') for x in got.data])
+        self.assertAlmostEqual(errors, 8000 * .01, delta=30)
+        self.assertEqual((got.delay, got.rssi, frame.data), (.5, -70, bytes(1000)))
+
+        # every bit, over a range
+        model = air.ChannelModel()
+        self.assertEqual(model.flip(bytes(4), 1, 1, 3), b'\0\xff\xff\0')
+
+    def test_links(self):
+        s = self.s
+        va = air.VirtualAir(air.ChannelModel(latency=.1))
+        a, b, c = [StubRadio(s) for x in range(3)]
+        for r in (a, b, c):
+            va.attach(r)
+        va.link(a, c, air.ChannelModel(loss=1))
+
+        va.transmit(a, air.AirFrame(air.airBytes(s, b'hi'), s, source=a))
+        self.assertEqual((len(a.got), len(b.got), len(c.got)), (0, 1, 0))
+        self.assertEqual(b.got[0].delay, .1)
+        self.assertEqual(va.stats, dict(sent=1, delivered=1, lost=1, collided=0))
+
+        # both ways, until one's put back
+        va.transmit(c, air.AirFrame(air.airBytes(s, b'hi'), s, source=c))
+        self.assertEqual(len(a.got), 0)
+        va.link(c, a, None, both=False)
+        va.transmit(c, air.AirFrame(air.airBytes(s, b'hi'), s, source=c))
+        va.transmit(a, air.AirFrame(air.airBytes(s, b'hi'), s, source=a))
+        self.assertEqual((len(a.got), len(c.got)), (1, 0))
+
+    def test_collisions(self):
+        s = self.s
+        bt = air.byteTime(s)
+        va = air.VirtualAir()
+        a, b, rx = [StubRadio(s) for x in range(3)]
+        for r in (a, b, rx):
+            va.attach(r)
+
+        def frame(src, start, payload=b'x' * 20, settings=s):
+            data = air.airBytes(settings, payload)
+            f = air.AirFrame(data, settings, start=start, source=src)
+            f.end = start + f.header() + len(data) * bt
+            return f
+
+        # b keys up partway through a's data: the end of a's packet is garbled
+        fa = frame(a, 0.0)
+        va.keyup(b, s, fa.start + fa.header() + 10 * bt)
+        self.assertEqual(va.carrier(rx, s), -40)
+        va.transmit(a, fa)
+        got = rx.got[-1].data
+        self.assertEqual(got[:10], fa.data[:10])
+        self.assertNotEqual(got[10:], fa.data[10:])
+
+        # ...and b lost its sync word under the end of a's
+        fb = frame(b, fa.start + fa.header() + 10 * bt)
+        va.transmit(b, fb)
+        self.assertEqual((len(rx.got), len(a.got)), (1, 0))
+        self.assertEqual(va.carrier(rx, s), None)
+        self.assertEqual(va.stats['collided'], 4)
+
+        # a much stronger frame comes through anyway
+        va.link(a, rx, air.ChannelModel(rssi=-30))
+        va.link(b, rx, air.ChannelModel(rssi=-80))
+        fa = frame(a, 1.0)
+        va.keyup(b, s, 1.0)
+        va.transmit(a, fa)
+        self.assertEqual(rx.got[-1].data, fa.data)
+        va.keydown(b)
+
+        # nor does something on another channel get in the way
+        va.link(a, rx, None)
+        va.link(b, rx, None)
+        other = s._replace(freq=s.freq + 2 * s.chanbw)
+        va.keyup(b, other, 2.0)
+        fa = frame(a, 2.0)
+        va.transmit(a, fa)
+        self.assertEqual(rx.got[-1].data, fa.data)
+
+    def test_fakedongles(self):
+        va = air.VirtualAir()
+        tx, rx = FakeRfCat(air=va), FakeRfCat(air=va)
+        try:
+            for d in (tx, rx):
+                d.makePktVLEN(255)
+            start = time.time()
+            tx.RFxmit(b'hello world')
+            # it takes as long as it would on the air:  preamble, sync word, then the length byte and
+            # payload (plus CRC when it's on; FAKE_MEM_DF00 has it off)
+            s = tx._do.settings()
+            airtime = (s.preamble + len(air.syncBytes(s)) + len(air.airBytes(s, b'hello world'))) * air.byteTime(s)
+            self.assertTrue(time.time() - start >= airtime)
+            data, ts = rx.RFrecv(timeout=1000)
+            self.assertEqual(data, b'hello world')
+            self.assertEqual(va.stats['delivered'], 1)
+
+            # a receiver somewhere else doesn't hear it
+            rx.setFreq(915e6)
+            tx.RFxmit(b'hello again')
+            self.assertRaises(Exception, rx.RFrecv, timeout=200)
+        finally:
+            for d in (tx, rx):
+                d.cleanup()
+
+    def test_lockstep(self):
+        # two chips spinning at different speeds stay within a quantum of each other
+        loop = bytes([0x80, 0xfe])                      # SJMP $
+        va = air.VirtualAir(quantum=.001)
+        fast = fwsim.SimDongle(loop, va, enumerate=False)
+        slow = fwsim.SimDongle(loop, va, enumerate=False, batch=240)
+        try:
+            for x in range(20):
+                time.sleep(.01)
+                self.assertTrue(abs(fast.clock() - slow.clock()) <= .001 + 2400.0 / fwsim.FXOSC)
+            self.assertTrue(slow.clock() > .001)
+
+            # one that's paused doesn't hold the other up
+            with slow.paused():
+                before = fast.clock()
+                time.sleep(.1)
+                self.assertTrue(fast.clock() - before > .005)
+        finally:
+            fast.stop()
+            slow.stop()
+
+        # carrier sense sees a transmission while it's still going
+        va = air.VirtualAir()
+        tx, rx = fwsim.CC1111(air=va), fwsim.CC1111(air=va)
+        rx.wr(RFST, RFST_SRX)
+        self.assertTrue(rx.runUntil(lambda: rx.rdx(MARCSTATE) == MARC_STATE_RX, 100000))
+        rx.run(100000)
+        self.assertFalse(rx.rdx(PKTSTATUS) & 0x40)
+        tx.wr(RFST, RFST_STX)
+        self.assertTrue(tx.runUntil(lambda: tx.rdx(MARCSTATE) == MARC_STATE_TX, 100000))
+        self.assertTrue(rx.rdx(PKTSTATUS) & 0x40)
+        self.assertAlmostEqual(((rx.rdx(RSSI) ^ 0x80) / 2.0) - 88, -40)
+        tx.wr(RFST, RFST_SIDLE)
+        self.assertFalse(rx.rdx(PKTSTATUS) & 0x40)
@@ -1,4 +1,5 @@
 import os
+import time
 import tempfile
 import unittest
 from rflib.const import *
@@ -60,6 +61,17 @@ class TestApis(unittest.TestCase):
         self.assertEqual(self.d.getRadioConfig()[:-5], FAKE_MEM_DF00[:-5])
         self.d.printRadioConfig()
 
+        # batched register writes land together when the batch exits
+        orig = self.d.peek(0xdf09, 3)
+        with self.d.rfRegisterBatch():
+            self.d.setRFRegister(0xdf09, 0x10)
+            self.d.setRFRegisters({0xdf0a: 0xb0, 0x0b: 0x71})
+            self.assertEqual(self.d.peek(0xdf09, 3), orig)
+            self.assertEqual(self.d.getRadioConfig()[9:12], b'\x10\xb0\x71')
+        self.assertEqual(self.d.peek(0xdf09, 3), b'\x10\xb0\x71')
+        self.d.setRadioConfig(bytedef=FAKE_MEM_DF00)
+        self.assertEqual(self.d.peek(0xdf09, 3), orig)
+
         self.d.setRfMode(RFST_SRX)
         self.assertEqual(ord(self.d.peek(X_RFST)), RFST_SRX)
         self.d.setModeTX()
@@ -178,6 +190,94 @@ class TestApis(unittest.TestCase):
         '''
 
 
+    def test_radio_config_cache(self):
+        d = FakeRfCat()
+        st = d.radioConfigStats()
+        self.assertTrue(st['cached'])
+
+        # our own writes keep the shadow current, reads stay on the host
+        d.setMdmDRate(drate=38.4e3)
+        d.setFreq(433.92e6)
+        d.setRFbits(MDMCFG2, 4, 3, 1)
+        self.assertAlmostEqual(d.getMdmDRate(), 38.4e3, delta=100)
+        self.assertAlmostEqual(d.getFreq()[0], 433.92e6, delta=400)
+        d.reprRadioConfig()
+        self.assertEqual(d.radioConfigStats()['fetches'], st['fetches'])
+        self.assertTrue(d.radioConfigStats()['hits'] > st['hits'])
+        self.assertEqual(d.getRadioConfig()[:RF_CFG_REG_COUNT], d.peek(0xdf00, RF_CFG_REG_COUNT))
+
+        # the firmware retuning on its own says so, and only then is it read again
+        d._do.memory.writeMemory(CHANNR, b'\x21')
+        d._do.rfConfigChanged()
+        start = time.time()
+        while d.getChannel() != 0x21 and time.time() - start < 5:
+            time.sleep(.05)
+        self.assertEqual(d.getChannel(), 0x21)
+        self.assertEqual(d.radioConfigStats()['fetches'], st['fetches'] + 1)
+        self.assertEqual(d.radioConfigStats()['notices'], 1)
+
+        # commands known to retune don't wait for the notice
+        d.changeChannel(0x22)
+        self.assertEqual(d.getChannel(), 0x22)
+
+        d.setRadioConfigCache(False)
+        fetches = d.radioConfigStats()['fetches']
+        d.getFreq()
+        d.getFreq()
+        self.assertEqual(d.radioConfigStats()['fetches'], fetches + 2)
+
+    def test_memops(self):
+        d = self.d
+        ops = [(0xf300, bytes(range(200)) * 2), (0xf310, 4), (0xf301, b'\xaa'), (0xf300, 400), (0xdf00, 0)]
+        want = [bytes(range(16, 20)), bytes(range(1)) + b'\xaa' + (bytes(range(200)) * 2)[2:], b'']
+        self.assertEqual(d.memops(ops), want)
+        self.assertTrue(d._memops)
+
+        # the same ops as peeks and pokes, for firmware without SYS_CMD_MEMOP
+        d.poke(0xf300, b'\0' * 400)
+        d._memops = False
+        try:
+            self.assertEqual(d.memops(ops), want)
+        finally:
+            d._memops = True
+
+        # one round trip for a whole register write
+        sends = []
+        send = d.send
+        d.send = lambda *args, **kwargs: sends.append(args[:2]) or send(*args, **kwargs)
+        try:
+            d.setRFRegister(PKTLEN, 0x42)
+        finally:
+            del d.send
+        self.assertEqual(sends, [(APP_SYSTEM, SYS_CMD_MEMOP)])
+        self.assertEqual(d.peek(PKTLEN), b'\x42')
+        self.assertEqual(d.getRadioConfig()[PKTLEN - 0xdf00], 0x42)
+        d.setRadioConfig(bytedef=FAKE_MEM_DF00)
+
+    def test_stats(self):
+        d = self.d
+        stats = d.getStats(clear=True)
+        self.assertEqual((stats['version'], stats['size']), (STATS_VERSION, STATS_LEN))
+
+        for x in range(20):
+            d._do.txdata(APP_NIC, NIC_RECV, b'x' * 10)
+        for x in range(20):
+            d.RFrecv()
+        time.sleep(.2)
+
+        stats = d.getStats()
+        self.assertEqual((stats['rxDelivered'], stats['rxBytes']), (20, 200))
+        self.assertTrue(stats['interval'] >= .2)
+        self.assertAlmostEqual(stats['rates']['rxDelivered'], 20 / stats['interval'])
+        self.assertTrue('rxDelivered' in d.reprStats())
+
+        # older firmware answers "UNIMPLEMENTED"
+        d.send = lambda *args, **kwargs: (b'UNIMPLEMENTED', 0)
+        try:
+            self.assertEqual(d.getStats(), None)
+        finally:
+            del d.send
+
     def test_bits(self):
         import rflib.bits as rfbits
         
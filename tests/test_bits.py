@@ -1,5 +1,8 @@
+import random
 import unittest
 import rflib.bits as rfbits
+import rflib.bitkern as bitkern
+import rflib.linecode as linecode
 
 class BitsTest(unittest.TestCase):
     def test_bits(self):
@@ -104,17 +107,133 @@ class BitsTest(unittest.TestCase):
                 b'\xf5UUU'
                 )
 
+        self.assertEqual(
+                rfbits.pn9Whiten(b'\x00' * 8),
+                b'\xff\xe1\x1d\x9a\xed\x85\x33\x24'
+                )
+
+        self.assertEqual(
+                rfbits.manchester_encode(b'\xa5'),
+                b'\x99\x66'
+                )
+
+        self.assertEqual(
+                rfbits.manchester_decode(rfbits.manchester_encode(b'asdfasdf')),
+                b'asdfasdf'
+                )
+
+        self.assertEqual(
+                rfbits.biphase_mark_decode(rfbits.biphase_mark_encode(b'asdfasdf', 1)[0]),
+                b'asdfasdf'
+                )
+
         self.assertEqual(
                 rfbits.detectRepeatPatterns(b'asdfasdfasdfasdfasdfasdfasdfasdf'),
-                [(0x0, 0x80, 0x80, 0xc2e6c8ccc2e6c8cc)]
+                [(0x0, 0x20, 0xe0, 0x6173646661736466)]
                 )
 
+        # a 224-bit frame sent 4 times, starting 3 bits into a noisy capture
+        frame = b'\xaa\xaa\xaa\xaa\xd3\x91asdfqwerzxcvuiopjkl\x00\x00\x00'
+        capture = rfbits.shiftString(bytes(range(0, 250, 7)) + frame * 4 + bytes(range(1, 250, 11)), 3)
+        cands = rfbits.findPeriodicity(capture)
+        self.assertEqual(cands[0]['period'], 224)
+        self.assertEqual([rep[:3] for rep in cands[0]['repeats']], [(285, 509, 672)])
+
         '''
         305:def detectRepeatPatterns(data, size=64, minEntropy=.07):
-        525:def diff_manchester_decode(data, align=False):
         579:def biphase_mark_coding_encode(data):
         605:def manchester_decode(data, hilo=1):
         633:def manchester_encode(data, hilo=1):
-        655:def findManchesterData(data, hilo=1):
-        666:def findManchester(data, minbytes=10):
         '''
+
+    def test_bitkern(self):
+        # the native kernels (when built) must match the Python ones exactly
+        rand = random.Random(0x1111)
+        for size in (0, 1, 2, 7, 8, 9, 31, 64, 257):
+            data = bytes([rand.randrange(256) for x in range(size)])
+            for name in bitkern.KERNELS:
+                py = bitkern.PY_KERNELS[name]
+                kern = getattr(bitkern, name)
+                if name == 'shift':
+                    for bits in (0, 1, 3, 7, 8, 13, 70):
+                        self.assertEqual(kern(data, bits), py(data, bits), (name, size, bits))
+                elif name == 'extract':
+                    for start, end in ((0, 0), (0, 8), (3, 16), (5, 77), (9, 8*size+12)):
+                        self.assertEqual(kern(data, start, end), py(data, start, end), (name, size, start, end))
+                elif name in ('pn9', 'lfsr7'):
+                    for seed in (0, 1, 0x5a, 0x1ff, 0xffff):
+                        self.assertEqual(kern(data, seed), py(data, seed), (name, size, seed))
+                elif name == 'autocorr':
+                    for minlag, maxlag in ((1, 8*size+3), (0, 0), (5, 4)):
+                        self.assertEqual(kern(data, minlag, maxlag), py(data, minlag, maxlag), (name, size, minlag, maxlag))
+                elif name == 'biphase_encode':
+                    for level in (0, 1):
+                        self.assertEqual(kern(data, level), py(data, level), (name, size))
+                elif name.startswith('manchester'):
+                    for hilo in (0, 1):
+                        self.assertEqual(kern(data, hilo), py(data, hilo), (name, size))
+                else:
+                    self.assertEqual(kern(data), py(data), (name, size))
+
+            self.assertEqual(bitkern.shift(bytearray(data), 3), bitkern.shift(data, 3))
+            self.assertEqual(bitkern.invert(memoryview(data)), bitkern.invert(data))
+
+    def test_bitmatcher(self):
+        # 0xd391 at bit 13 of the first packet, with one bit flipped in the second
+        pkts = [rfbits.shiftString(b'\x00\x00\xd3\x91\x00\x00', 3),
+                rfbits.shiftString(b'\x00\x00\xd3\x90\x00\x00', 3)]
+
+        bm = rfbits.BitMatcher([0xd391, b'\xff'])
+        self.assertEqual(bm.searchBatch(pkts), [(0, 0xd391, 13, 0)])
+
+        bm = rfbits.BitMatcher([0xd391], maxerrors=1)
+        self.assertEqual(bm.searchBatch(pkts), [(0, 0xd391, 13, 0), (1, 0xd391, 13, 1)])
+        self.assertEqual(bm.search(pkts[1]), [(0xd391, 13, 1)])
+
+        # never across packet boundaries
+        bm = rfbits.BitMatcher([(0x1ff, 9)])
+        self.assertEqual(bm.searchBatch([b'\x00\xff', b'\x80\x00']), [])
+
+    def test_linecode(self):
+        rand = random.Random(0x1111)
+        payload = b'\xd3\x91' + bytes([rand.randrange(256) for x in range(12)])
+        noise = bytes([rand.randrange(256) for x in range(5)])
+
+        # manchester starting 3 bits into the byte after some noise
+        raw = rfbits.shiftString(noise + rfbits.manchester_encode(payload) + noise, 3)
+        best = linecode.detect(raw, syncwords=[0xd391])[0]
+        self.assertEqual((best.code, best.polarity, best.start + 2 * best.sync), ('manchester', 1, 37))
+        self.assertEqual(rfbits.bitSectString(best.data, best.sync, best.sync + 112)[0], payload)
+        self.assertEqual(best.score, best.length / (8 * len(raw) // 2))
+        self.assertEqual(rfbits.findManchester(raw, 4)[0][1:3], divmod(best.start, 8))
+        self.assertEqual(rfbits.findManchesterData(rfbits.manchester_encode(payload))[0], payload)
+
+        # differential manchester (IEEE: a transition at the start of a bit is a 0)
+        bits = []
+        level = 0
+        for bit in rfbits.genBitArray(payload, 0, 8 * len(payload))[0]:
+            level ^= not bit
+            bits += [level, level ^ 1]
+            level ^= 1
+        diffm = int(''.join([str(bit) for bit in bits]), 2).to_bytes(2 * len(payload), 'big')
+        self.assertEqual(linecode.diff_manchester_decode(diffm), payload)
+        self.assertEqual(rfbits.diff_manchester_decode(diffm, polarity=0), payload)
+        late = ((int.from_bytes(diffm, 'big') >> 1) | (1 << (16 * len(payload) - 1))).to_bytes(len(diffm), 'big')
+        self.assertEqual(rfbits.diff_manchester_decode(late, align=True, polarity=0)[1:-1], payload[1:-1])
+        self.assertRaises(Exception, rfbits.diff_manchester_decode, late)
+        self.assertRaises(Exception, rfbits.diff_manchester_decode, b'\x00\x00')
+        # (the first bit's edge depends on the noise before it, so allow for it being wrong)
+        cands = linecode.detect(noise + diffm, syncwords=[0xd391], maxerrors=1)
+        cands = [c for c in cands if (c.code, c.polarity) == ('diffmanchester', 0) and c.sync is not None]
+        self.assertEqual(cands[0].start + 2 * cands[0].sync, 40)
+        self.assertEqual(rfbits.bitSectString(cands[0].data, cands[0].sync + 1, cands[0].sync + 112)[0],
+                rfbits.bitSectString(payload, 1, 112)[0])
+
+        # biphase-mark after a line that was high, so the first bit's edge shows
+        bmc = rfbits.biphase_mark_encode(payload, 1)[0]
+        cands = linecode.detect(b'\x01' + bmc, codes=('biphase',), syncwords=[0xd391])
+        self.assertEqual((cands[0].start, cands[0].sync, cands[0].data), (8, 0, payload))
+
+        # and nothing in noise
+        self.assertEqual(linecode.detect(noise * 4, minbits=24), [])
+        self.assertEqual(len(linecode.detectBatch([raw, noise])), 2)
@@ -0,0 +1,200 @@
+import os
+import time
+import shutil
+import tempfile
+import unittest
+
+import rflib.capture as rfcapture
+from rflib.chipcon_nic import savePkts, loadPkts, EnDeCode
+from rflib.const import APP_NIC, NIC_RECV, RF_CFG_REG_COUNT
+from rflib.fakedongle_nic import FakeRfCat, ReplayRfCat, ReplayFinished
+
+
+class Upper(EnDeCode):
+    def decode(self, msg):
+        if msg == b'bad':
+            raise Exception("undecodable")
+        return msg.upper()
+
+
+class CaptureTest(unittest.TestCase):
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+
+    def tearDown(self):
+        shutil.rmtree(self.tmpdir)
+
+    def test_capture(self):
+        fn = os.path.join(self.tmpdir, 'test.rfcap')
+        cfg1 = b'\x01' * 0x3e
+        cfg2 = b'\x02' * 0x3e
+
+        with rfcapture.CaptureWriter(fn) as cap:
+            cap.setRadioConfig(cfg1)
+            cap.append(b'asdf', 1.5)
+            cap.append(b'qwer', 2.5, rssi=0x80, lqi=0x7f)
+            cap.setRadioConfig(cfg2)
+            cap.append(b'', 3.5)
+
+        with rfcapture.CaptureReader(fn) as cap:
+            self.assertEqual(len(cap), 3)
+            self.assertEqual(list(cap.packets()), [(b'asdf', 1.5), (b'qwer', 2.5), (b'', 3.5)])
+            self.assertEqual(cap[1].rssi, 0x80)
+            self.assertEqual(cap[1].lqi, 0x7f)
+            self.assertEqual(cap[0].rssi, None)
+            self.assertEqual(cap.radioConfig(cap[0]), cfg1)
+            self.assertEqual(cap.radioConfig(cap[-1]), cfg2)
+            self.assertEqual([pkt.data for pkt in cap[1:]], [b'qwer', b''])
+
+        # append to a closed file, then leave it unclosed with a torn record
+        cap = rfcapture.CaptureWriter(fn, append=True)
+        cap.setRadioConfig(cfg1)
+        cap.append(b'zxcv', 4.5)
+        cap.flush()
+        cap.fd.write(b'\x01\x00\xff')
+        cap.fd.flush()
+
+        with rfcapture.CaptureReader(fn) as rd:
+            self.assertEqual([pkt.data for pkt in rd], [b'asdf', b'qwer', b'', b'zxcv'])
+            self.assertEqual(rd.radioConfig(rd[3]), cfg1)
+
+        cap.fd.close()
+        cap = rfcapture.CaptureWriter(fn, append=True)
+        cap.append(b'uiop', 5.5)
+        cap.close()
+
+        with rfcapture.CaptureReader(fn) as rd:
+            self.assertEqual(len(rd), 5)
+            self.assertEqual(rd[4].data, b'uiop')
+            self.assertEqual(rd[4].fingerprint, 0)
+
+    def test_pickle(self):
+        pkl = os.path.join(self.tmpdir, 'test.pkl')
+        fn = os.path.join(self.tmpdir, 'test.rfcap')
+        savePkts([(b'asdf', 1.0), (b'qwer', 2.0)], pkl)
+        savePkts([(b'zxcv', 3.0)], pkl)
+        self.assertEqual(loadPkts(pkl), [(b'asdf', 1.0), (b'qwer', 2.0), (b'zxcv', 3.0)])
+
+        self.assertEqual(rfcapture.pickleToCapture(pkl, fn), 3)
+        os.unlink(pkl)
+        self.assertEqual(rfcapture.captureToPickle(fn, pkl), 3)
+        self.assertEqual(loadPkts(pkl), [(b'asdf', 1.0), (b'qwer', 2.0), (b'zxcv', 3.0)])
+
+    def test_rfcapture_interrupted(self):
+        # ^C is how a capture usually ends: the file still gets its index
+        import rflib.chipcon_nic as rfnic
+        fn = os.path.join(self.tmpdir, 'cap.rfcap')
+        d = FakeRfCat()
+        calls = []
+
+        def keystop(delay=0):
+            calls.append(delay)
+            if len(calls) == 1:
+                for x in range(3):
+                    d._do.txdata(APP_NIC, NIC_RECV, b'pkt%d' % x)
+            elif len(calls) == 5:
+                raise KeyboardInterrupt()
+            return False
+
+        saved = rfnic.keystop
+        rfnic.keystop = keystop
+        try:
+            self.assertRaises(KeyboardInterrupt, d.RFcapture, fn)
+        finally:
+            rfnic.keystop = saved
+            d.cleanup()
+
+        with open(fn, 'rb') as f:
+            f.seek(-rfcapture.TRAILER.size, 2)
+            self.assertEqual(rfcapture.TRAILER.unpack(f.read())[:2], (rfcapture.IDX_MAGIC, 3))
+        with rfcapture.CaptureReader(fn) as cap:
+            self.assertEqual([pkt.data for pkt in cap], [b'pkt0', b'pkt1', b'pkt2'])
+
+    def test_not_capture(self):
+        # a bad header is refused without leaking the mmap or the file
+        opened = []
+        rfcapture.open = lambda *args: opened.append(open(*args)) or opened[-1]
+        try:
+            for name, contents in (('empty', b''), ('short', b'rf'), ('text', b'not a capture file, honest\n' * 4)):
+                fn = os.path.join(self.tmpdir, name)
+                with open(fn, 'wb') as f:
+                    f.write(contents)
+                self.assertRaises(Exception, rfcapture.CaptureReader, fn)
+        finally:
+            del rfcapture.open
+        self.assertEqual(len(opened), 3)
+        self.assertTrue(all(f.closed for f in opened))
+
+    def test_recorder(self):
+        d = FakeRfCat()
+        base = os.path.join(self.tmpdir, 'rec')
+        rec = d.RFrecord(base, maxbytes=2000, maxfiles=3, compress=True)
+        for x in range(300):
+            d._do.txdata(APP_NIC, NIC_RECV, b'pkt%.4d' % x + b'x' * 20)
+
+        start = time.time()
+        while rec.packets < 300 and time.time() - start < 10:
+            time.sleep(.05)
+        rec.stop()
+
+        st = rec.stats()
+        self.assertEqual(st['packets'], 300)
+        self.assertEqual(st['dropped'], 0)
+        self.assertEqual(len(rec.files), 3)
+        self.assertEqual(sorted(os.listdir(self.tmpdir)), sorted([os.path.basename(fn) for fn in rec.files]))
+
+        # the newest segments survive rotation, in order, ending with the last packet
+        pkts = []
+        for fn in rec.files:
+            self.assertTrue(fn.endswith('.rfcap.gz'))
+            with rfcapture.CaptureReader(fn) as cap:
+                self.assertEqual(cap.radioConfig(cap[0]), rec.radiocfg)
+                pkts.extend([pkt.data[:7] for pkt in cap])
+        self.assertEqual(pkts[-1], b'pkt0299')
+        self.assertEqual(pkts, [b'pkt%.4d' % x for x in range(300 - len(pkts), 300)])
+
+    def test_replay(self):
+        fn = os.path.join(self.tmpdir, 'test.rfcap')
+        d = FakeRfCat()
+        cfg1 = d.getRadioConfig()
+        cfg2 = bytes([cfg1[0] ^ 0xff]) + cfg1[1:]
+
+        with rfcapture.CaptureWriter(fn) as cap:
+            cap.setRadioConfig(cfg1)
+            cap.append(b'asdf', 1.5)
+            cap.append(b'qwer', 2.5)
+            cap.setRadioConfig(cfg2)
+            cap.append(b'zxcv', 3.5)
+
+        r = ReplayRfCat(fn)
+        r.setEnDeCoder(Upper())
+        self.assertEqual(r.RFrecv(), (b'ASDF', 1.5))
+        self.assertEqual(r.getRadioConfig()[:RF_CFG_REG_COUNT], cfg1[:RF_CFG_REG_COUNT])
+        self.assertEqual(r.RFrecv(), (b'QWER', 2.5))
+        self.assertEqual(r.RFrecv(), (b'ZXCV', 3.5))
+        self.assertEqual(r.getRadioConfig()[:RF_CFG_REG_COUNT], cfg2[:RF_CFG_REG_COUNT])
+        self.assertRaises(ReplayFinished, r.RFrecv)
+        self.assertEqual(r.replayStats()[0], 3)
+
+        # plain (data, timestamp) lists replay too, optionally looping
+        r = ReplayRfCat([(b'a', 1.0), (b'b', 2.0)], loop=True)
+        self.assertEqual([r.RFrecv()[0] for x in range(5)], [b'a', b'b', b'a', b'b', b'a'])
+
+    def test_pipeline(self):
+        pkts = [(b'pkt%.4d' % x, float(x)) for x in range(500)]
+        pkts[100] = (b'bad', 100.0)
+        expected = [(msg.upper(), ts) for msg, ts in pkts if msg != b'bad']
+
+        for workers in (0, 2):
+            r = ReplayRfCat(pkts)
+            r.setEnDeCoder(Upper())
+            pipe = r.RFpipeline(workers=workers, batchsize=16, maxpending=2)
+            self.assertEqual(list(pipe), expected)
+            pipe.stop()
+
+            st = pipe.stats()
+            self.assertEqual(st['packets_in'], 500)
+            self.assertEqual(st['packets_out'], 499)
+            self.assertEqual(st['errors'], 1)
+            self.assertEqual(st['batches'], 32)
+            self.assertTrue(st['maxdepth'] <= 2)
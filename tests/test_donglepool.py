@@ -0,0 +1,123 @@
+import time
+import unittest
+
+import rflib.donglepool as donglepool
+from rflib.const import APP_NIC, NIC_RECV
+from rflib.chipcondefs import RSSI, PKTSTATUS
+from rflib.fakedongle_nic import FakeRfCat
+
+
+class BandRfCat(FakeRfCat):
+    '''
+    a fake dongle that hears a carrier on 'hot' and takes 'delay' to answer a peek
+    '''
+    hot = ()
+    delay = 0
+
+    def setFreq(self, freq=902000000, *args, **kwargs):
+        FakeRfCat.setFreq(self, freq, *args, **kwargs)
+        live = int(freq) in self.hot
+        self._do.memory.writeMemory(RSSI, (b'\x80', b'\x30')[live])
+        self._do.memory.writeMemory(PKTSTATUS, (b'\x00', b'\x40')[live])
+
+    def peek(self, addr, bytecount=1):
+        time.sleep(self.delay)
+        return FakeRfCat.peek(self, addr, bytecount)
+
+
+class DonglePoolTest(unittest.TestCase):
+    def test_clocksync(self):
+        cs = donglepool.ClockSync()
+        rate = donglepool.T1_RATE * 1.00005
+        base = 1000.0
+        ticks0 = donglepool.T1_WRAP - int(rate * 10)     # wraps 10 seconds in
+
+        for x in range(20):
+            hostts = base + x
+            rtt = (.004, .001)[x % 2]
+            # a slow round trip reads the clock late
+            ticks = (ticks0 + int((x + rtt / 2) * rate)) % donglepool.T1_WRAP
+            cs.add(ticks, hostts, rtt)
+
+        self.assertAlmostEqual(cs.latency, .0005)
+        self.assertAlmostEqual(cs.ppm(), 50, delta=1)
+        self.assertAlmostEqual(cs.hostTime(ticks0), base, delta=.001)
+        self.assertAlmostEqual(cs.hostTime((ticks0 + int(25 * rate)) % donglepool.T1_WRAP), base + 25, delta=.001)
+
+        # junk clocks fall back to the nominal rate
+        cs = donglepool.ClockSync()
+        for x in range(10):
+            cs.add(1234 * x, base + x, .001)
+        self.assertEqual(cs.rate, donglepool.T1_RATE)
+
+    def test_pool(self):
+        nics = [FakeRfCat() for x in range(3)]
+        pool = donglepool.DonglePool(nics, reorder=.05).start()
+        try:
+            self.assertEqual(pool.splitRange(900e6, 1e6, 10), [(900e6, 3), (903e6, 3), (906e6, 4)])
+
+            # packets from every dongle come out as one feed, in time order
+            for x in range(30):
+                nics[x % 3]._do.txdata(APP_NIC, NIC_RECV, b'pkt%.3d' % x)
+            pkts = [pool.recv(5) for x in range(30)]
+            self.assertEqual(sorted([data for data, ts, idx in pkts]), [b'pkt%.3d' % x for x in range(30)])
+            self.assertTrue(all([int(data[3:]) % 3 == idx for data, ts, idx in pkts]))
+            self.assertEqual([ts for data, ts, idx in pkts], sorted([ts for data, ts, idx in pkts]))
+            self.assertEqual(pool.packets, [10, 10, 10])
+
+            # each dongle starts on its own slice of the range, one look per channel
+            hits = pool.scan(900e6, 1e6, 10, dwell=.001, timeout=30)
+            self.assertEqual([hit[0] for hit in hits], [900e6 + x * 1e6 for x in range(10)])
+            self.assertTrue(set([hit[4] for hit in hits]) <= set([0, 1, 2]))
+            self.assertTrue(all([hit[3] in (0, 1) for hit in hits]))
+
+            task = pool.transmit(433.92e6, b'hello', device=2)
+            task.wait(10)
+            self.assertEqual(task.device, 2)
+            tasks = pool.capture([315e6, 433.92e6], .1)
+            for t in tasks:
+                t.wait(10)
+            # whatever each dongle captured on last is where it's still tuned
+            last = dict([(t.device, t) for t in sorted(tasks, key=lambda t: t.finished)])
+            for idx, t in last.items():
+                self.assertAlmostEqual(nics[idx].getFreq()[0], t.freq, delta=400)
+
+            class Broken(donglepool.PoolTask):
+                def run(self, pool, idx, nic):
+                    raise ValueError("nope")
+            self.assertRaises(ValueError, pool.submit(Broken()).wait, 10)
+
+            # each dongle's clock lines up with ours
+            for idx, nic in enumerate(nics):
+                self.assertTrue(pool.clocks[idx].synced())
+                self.assertAlmostEqual(pool.hostTime(idx, nic.getClock()), time.time(), delta=.5)
+            pool.reprStats()
+        finally:
+            pool.stop()
+
+    def test_bandscan(self):
+        hot = (int(906e6), int(911e6))
+        nics = [BandRfCat() for x in range(3)]
+        nics[0].delay = .2
+        for nic in nics:
+            nic.hot = hot
+
+        pool = donglepool.DonglePool(nics).start()
+        try:
+            scan = pool.bandScan(900e6, 250e3, 48, dwell=.002, maxdwell=.05, chunk=2, timeout=60)
+        finally:
+            pool.stop()
+
+        # every channel exactly once, however the work got shared out
+        self.assertEqual([step.freq for step in scan.steps], [900e6 + x * 250e3 for x in range(48)])
+        self.assertEqual(sum(scan.stepsby), 48)
+        self.assertTrue(scan.steals > 0)
+        self.assertTrue(scan.stepsby[0] < scan.stepsby[1] and scan.stepsby[0] < scan.stepsby[2], scan.stepsby)
+
+        # live channels get looked at until maxdwell, quiet ones once
+        hits = scan.hits()
+        self.assertEqual([step.freq for step in hits], list(hot))
+        self.assertTrue(all([step.samples > 1 and step.carriersense == step.samples for step in hits]))
+        self.assertAlmostEqual(hits[0].rssi, (0x30 ^ 0x80) / 2.0 - 88)
+        self.assertTrue(all([step.samples == 1 for step in scan.steps if step not in hits]))
+        scan.reprHits()
@@ -0,0 +1,285 @@
+import os
+import tempfile
+import unittest
+
+import usb
+
+import rflib.fwsim as fwsim
+from rflib.chipcondefs import *
+
+# EP5 echo: every packet the host sends comes straight back
+ECHO = bytes([
+    0x90, 0xde, 0x0e,       # 0000  MOV DPTR,#USBINDEX
+    0x74, 0x05,             # 0003  MOV A,#5
+    0xf0,                   # 0005  MOVX @DPTR,A
+    0x90, 0xde, 0x14,       # 0006 wait: MOV DPTR,#USBCSOL
+    0xe0,                   # 0009  MOVX A,@DPTR
+    0x30, 0xe0, 0xf9,       # 000a  JNB ACC.0,wait
+    0x90, 0xde, 0x16,       # 000d  MOV DPTR,#USBCNTL
+    0xe0,                   # 0010  MOVX A,@DPTR
+    0xff,                   # 0011  MOV R7,A
+    0x60, 0x07,             # 0012  JZ done
+    0x90, 0xde, 0x2a,       # 0014 copy: MOV DPTR,#USBF5
+    0xe0,                   # 0017  MOVX A,@DPTR
+    0xf0,                   # 0018  MOVX @DPTR,A
+    0xdf, 0xf9,             # 0019  DJNZ R7,copy
+    0x90, 0xde, 0x14,       # 001b done: MOV DPTR,#USBCSOL
+    0xe4,                   # 001e  CLR A
+    0xf0,                   # 001f  MOVX @DPTR,A
+    0x90, 0xde, 0x11,       # 0020  MOV DPTR,#USBCSIL
+    0x74, 0x01,             # 0023  MOV A,#1
+    0xf0,                   # 0025  MOVX @DPTR,A
+    0x80, 0xde,             # 0026  SJMP wait
+])
+
+
+def hexfile(data, addr=0):
+    lines = []
+    for off in range(0, len(data), 16):
+        chunk = data[off:off + 16]
+        rec = bytes([len(chunk), (addr + off) >> 8, (addr + off) & 0xff, 0]) + chunk
+        lines.append(':%s%.2X' % (rec.hex().upper(), -sum(rec) & 0xff))
+    lines.append(':00000001FF')
+    f = tempfile.NamedTemporaryFile('w', suffix='.hex', delete=False)
+    f.write('\n'.join(lines) + '\n')
+    f.close()
+    return f.name
+
+
+def sendPacket(cc, payload):
+    '''
+    what the firmware does to transmit, done from here
+    '''
+    data = bytes([len(payload)]) + payload
+    cc.wr(RFST, RFST_STX)
+    for b in data:
+        assert cc.runUntil(lambda: cc.sfr[TCON] & 2, 100000)
+        cc.sfr[TCON] &= ~2
+        cc.wr(RFD, b)
+    assert cc.runUntil(lambda: cc.sfr[RFIF] & (RFIF_IRQ_DONE | RFIF_IRQ_TXUNF), 100000)
+
+
+def recvPacket(cc, limit=500000):
+    got = bytearray()
+    while not cc.sfr[RFIF] & (RFIF_IRQ_DONE | RFIF_IRQ_RXOVF):
+        if not cc.runUntil(lambda: cc.sfr[TCON] & 2 or cc.sfr[RFIF] & (RFIF_IRQ_DONE | RFIF_IRQ_RXOVF), limit):
+            break
+        if cc.sfr[TCON] & 2:
+            cc.sfr[TCON] &= ~2
+            got.append(cc.rd(RFD))
+    return bytes(got)
+
+
+class FwSimTest(unittest.TestCase):
+    def test_cpu(self):
+        cc = fwsim.CC1111()
+        cc.loadBytes(bytes([
+            0x74, 0x37, 0x24, 0x25, 0xf5, 0x30,         # 0x37 + 0x25 -> 30h
+            0x74, 0xf0, 0x24, 0x20, 0x34, 0x00, 0xf5, 0x31,    # 0xf0 + 0x20, then + carry -> 31h
+            0x75, 0xf0, 0x0d, 0x74, 0x0f, 0xa4, 0xf5, 0x32,    # 0x0f * 0x0d -> 32h
+            0x74, 0x64, 0x75, 0xf0, 0x07, 0x84, 0xf5, 0x33, 0x85, 0xf0, 0x34,  # 100 / 7 -> 33h, 34h
+            0x74, 0x19, 0x24, 0x28, 0xd4, 0xf5, 0x35,   # BCD 19 + 28 -> 35h
+            0x78, 0x40, 0x76, 0xa5, 0xe6, 0xc4, 0xf5, 0x36,    # @R0, SWAP -> 36h
+            0x90, 0xf0, 0x00, 0x74, 0x5a, 0xf0,         # MOVX to f000
+            0x7f, 0x05, 0xe4, 0x04, 0xdf, 0xfd, 0xf5, 0x37,    # DJNZ five times -> 37h
+            0x12, 0x02, 0x00, 0xf5, 0x38,               # LCALL -> 38h
+            0x74, 0x05, 0xb4, 0x05, 0x03, 0x75, 0x39, 0x01,    # CJNE equal falls through -> 39h
+            0x80, 0xfe,
+        ]))
+        cc.loadBytes(bytes([0x74, 0x77, 0x22]), 0x200)
+        cc.run(1000)
+
+        self.assertEqual(list(cc.iram[0x30:0x3a]), [0x5c, 0x11, 0xc3, 0x0e, 0x02, 0x47, 0x5a, 5, 0x77, 1])
+        self.assertEqual(cc.xram[0xf000], 0x5a)
+        self.assertEqual(cc.sfr[SP], 7)
+
+        # flags
+        cc.sfr[ACC] = 0x7f
+        cc.sfr[PSW] = 0
+        cc._add(1, 0)
+        self.assertEqual(cc.sfr[PSW] & (fwsim.PSW_OV | fwsim.PSW_AC | fwsim.PSW_CY), fwsim.PSW_OV | fwsim.PSW_AC)
+        cc.sfr[ACC] = 0
+        cc._subb(1)
+        self.assertEqual((cc.sfr[ACC], cc.sfr[PSW] & fwsim.PSW_CY), (0xff, fwsim.PSW_CY))
+        self.assertEqual(cc.rd(PSW) & 1, 0)     # 0xff has even parity
+
+        # cycles: NOP, MOV DPTR (2), MUL (4)
+        cc.reset()
+        cc.loadBytes(bytes([0x00, 0x90, 0x12, 0x34, 0xa4, 0x80, 0xfe]))
+        start = cc.cycles
+        cc.run(7)
+        self.assertEqual((cc.cycles - start, cc.pc), (7, 5))
+
+    def test_timer_interrupt(self):
+        cc = fwsim.CC1111()
+        cc.loadBytes(bytes([0x02, 0x00, 0x60]))                 # LJMP main
+        cc.loadBytes(bytes([0x05, 0x30,                         # T1 vector: INC 30h
+                            0x53, 0xe4, 0xef,                   # ANL T1CTL,#~OVFIF
+                            0x32]), 0x4b)                       # RETI
+        cc.loadBytes(bytes([0x75, 0xc6, 0x80,                   # CLKCON: 24MHz, timer ticks at 24MHz
+                            0x75, 0xe4, 0x01,                   # T1CTL: free running, /1
+                            0xd2, 0xb9,                         # T1IE
+                            0xd2, 0xaf,                         # EA
+                            0x80, 0xfe]), 0x60)
+        cc.run(65536 * 3 + 500)
+        self.assertEqual(cc.iram[0x30], 3)
+        self.assertFalse(cc.active)
+
+        # /128 counts 128 times slower
+        cc.wr(T1CTL, T1CTL_DIV_128 | T1CTL_MODE_FREERUN)
+        before = cc.timer1.count()
+        cc.run(128 * 100)
+        self.assertAlmostEqual(cc.timer1.count() - before, 100, delta=1)
+        self.assertEqual(cc.iram[0x30], 3)
+
+    def test_dma(self):
+        cc = fwsim.CC1111()
+        cc.xram[0xf200:0xf208] = b'abcdefgh'
+        # f200 -> f300, 8 bytes, block, DMAREQ, both incrementing, irqmask
+        cc.xram[0xf100:0xf108] = bytes([0xf2, 0x00, 0xf3, 0x00, 0x00, 0x08, 0x20, 0x58])
+        cc.wr(DMA0CFGH, 0xf1)
+        cc.wr(DMA0CFGL, 0x00)
+        cc.wr(DMAARM, 0x01)
+        cc.wr(DMAREQ, 0x01)
+        self.assertEqual(bytes(cc.xram[0xf300:0xf308]), b'abcdefgh')
+        self.assertEqual((cc.sfr[DMAARM], cc.sfr[DMAIRQ], cc.sfr[IRCON] & 1), (0, 1, 1))
+
+        # aes: the blocks go through the coprocessor's dma triggers (and come out as they went in)
+        cc.xram[0xf110:0xf118] = bytes([0xf2, 0x00, 0xdf, 0xb1, 0x00, 0x10, 0x1d, 0x40])  # -> ENCDI
+        cc.xram[0xf118:0xf120] = bytes([0xdf, 0xb2, 0xf4, 0x00, 0x00, 0x10, 0x1e, 0x10])  # ENCDO ->
+        cc.xram[0xf200:0xf210] = b'0123456789abcdef'
+        cc.wr(DMA1CFGH, 0xf1)
+        cc.wr(DMA1CFGL, 0x10)
+        cc.wr(DMAARM, 0x06)
+        cc.wr(ENCCS, ENCCS_CMD_ENC | ENCCS_ST)
+        self.assertFalse(cc.sfr[ENCCS] & ENCCS_RDY)
+        cc.run(100)
+        self.assertTrue(cc.sfr[ENCCS] & ENCCS_RDY)
+        self.assertEqual(bytes(cc.xram[0xf400:0xf410]), b'0123456789abcdef')
+
+    def test_radio(self):
+        air = fwsim.VirtualAir()
+        tx, rx = fwsim.CC1111(air=air), fwsim.CC1111(air=air)
+        self.assertEqual(tx.rdx(PARTNUM), 0x11)
+        s = tx.radio.settings()
+        self.assertEqual((s.syncword, s.preamble, s.lengthconfig, s.crc), (0xd391, 4, 1, True))
+
+        rx.wr(RFST, RFST_SRX)
+        self.assertTrue(rx.runUntil(lambda: rx.rdx(MARCSTATE) == MARC_STATE_RX, 100000))
+
+        start = tx.cycles
+        sendPacket(tx, b'hello world')
+        self.assertEqual(tx.rdx(MARCSTATE), MARC_STATE_IDLE)
+        frame = air.frames[-1]
+        self.assertEqual(frame.data[:12], b'\x0bhello world')
+        self.assertEqual(len(frame.data), 14)
+        # settling, then preamble, sync, 12 bytes and the CRC
+        bc = fwsim.byteCycles(s)
+        self.assertAlmostEqual(tx.cycles - start, fwsim.RF_SETTLE_CYCLES + (4 + 2 + 12 + 2) * bc, delta=bc)
+        self.assertAlmostEqual((frame.end - frame.start) * fwsim.FXOSC, (4 + 2 + 12 + 2) * bc, delta=bc)
+
+        got = recvPacket(rx)
+        self.assertEqual(got[:12], b'\x0bhello world')
+        self.assertAlmostEqual(((got[12] ^ 0x80) / 2.0) - 88, -40)
+        self.assertTrue(got[13] & 0x80)             # CRC_OK
+        self.assertTrue(rx.sfr[RFIF] & RFIF_IRQ_SFD)
+        self.assertEqual(rx.rdx(MARCSTATE), MARC_STATE_IDLE)
+        self.assertEqual(rx.radio.rxframes, 1)
+
+        # a receiver that doesn't read RFD in time overflows
+        rx.sfr[RFIF] = 0
+        rx.wr(RFST, RFST_SRX)
+        rx.run(100000)
+        air.inject(b'x' * 20, s)
+        self.assertTrue(rx.runUntil(lambda: rx.sfr[RFIF] & RFIF_IRQ_RXOVF, 500000))
+        self.assertEqual(rx.rdx(MARCSTATE), MARC_STATE_RX_OVERFLOW)
+
+        # another channel isn't heard
+        rx.wr(RFST, RFST_SIDLE)
+        rx.sfr[RFIF] = 0
+        rx.wrx(CHANNR, 10)
+        rx.wr(RFST, RFST_SRX)
+        rx.run(100000)
+        air.inject(b'x' * 20, s)
+        rx.run(500000)
+        self.assertEqual((rx.sfr[RFIF], rx.rdx(MARCSTATE)), (0, MARC_STATE_RX))
+
+        # nothing to send
+        tx.sfr[RFIF] = 0
+        tx.wr(RFST, RFST_STX)
+        self.assertTrue(tx.runUntil(lambda: tx.sfr[RFIF] & RFIF_IRQ_TXUNF, 100000))
+        self.assertEqual(tx.rdx(MARCSTATE), MARC_STATE_TX_UNDERFLOW)
+
+    def test_ep0(self):
+        # the firmware's side of control transfers, played from here
+        cc = fwsim.CC1111()
+        cc.wrx(fwsim.USBIIE, 0xff)
+        usbc = cc.usb
+
+        def setup():
+            self.assertTrue(cc.sfr[IRCON2] & 1)
+            cc.sfr[IRCON2] = 0
+            self.assertEqual(cc.rdx(fwsim.USBIIF), fwsim.USBIIF_EP0IF)
+            cc.wrx(fwsim.USBINDEX, 0)
+            self.assertTrue(cc.rdx(0xde11) & fwsim.USBCS0_OUTPKT_RDY)
+            return bytes([cc.rdx(fwsim.USBF0) for x in range(cc.rdx(0xde16))])
+
+        # IN, two packets
+        req = fwsim.ControlRequest(0xc0, 0x12, 0x0100, 0, 40)
+        usbc.submit(req)
+        self.assertEqual(setup(), bytes([0xc0, 0x12, 0x00, 0x01, 0, 0, 40, 0]))
+        cc.wrx(0xde11, fwsim.USBCS0_CLR_OUTPKT_RDY)
+        for x in range(32):
+            cc.wrx(fwsim.USBF0, x)
+        cc.wrx(0xde11, fwsim.USBCS0_INPKT_RDY)
+        self.assertFalse(req.done.is_set())
+        for x in range(32, 40):
+            cc.wrx(fwsim.USBF0, x)
+        cc.wrx(0xde11, fwsim.USBCS0_INPKT_RDY | fwsim.USBCS0_DATA_END)
+        self.assertEqual(req.result, bytes(range(40)))
+
+        # OUT with data: the data packet comes once the setup's taken
+        req = fwsim.ControlRequest(0x42, 0x01, 0, 0, 5, b'abcde')
+        usbc.submit(req)
+        self.assertEqual(setup()[:2], b'\x42\x01')
+        cc.wrx(0xde11, fwsim.USBCS0_CLR_OUTPKT_RDY)
+        self.assertEqual(setup(), b'abcde')
+        cc.wrx(0xde11, fwsim.USBCS0_DATA_END)
+        cc.wrx(0xde11, fwsim.USBCS0_CLR_OUTPKT_RDY)
+        self.assertEqual(req.result, 5)
+
+        # a stall is an error on the host
+        req = fwsim.ControlRequest(0xc0, 0x99, 0, 0, 8)
+        usbc.submit(req)
+        setup()
+        cc.wrx(0xde11, fwsim.USBCS0_CLR_OUTPKT_RDY | fwsim.USBCS0_SEND_STALL)
+        self.assertEqual(req.error, 'Pipe error')
+        self.assertTrue(cc.rdx(0xde11) & fwsim.USBCS0_SENT_STALL)
+
+    def test_usb(self):
+        fn = hexfile(ECHO)
+        try:
+            sim = fwsim.SimDongle(fn, enumerate=False)
+        finally:
+            os.unlink(fn)
+        try:
+            self.assertEqual(sim.bulkWrite(5, b'0123456789', 100), 10)
+            self.assertEqual(sim.bulkRead(0x85, 500, 100), b'0123456789')
+
+            # a full packet doesn't end a read, the short one after it does
+            msg = bytes(range(74))
+            self.assertEqual(sim.bulkWrite(5, msg, 100), 74)
+            self.assertEqual(sim.bulkRead(0x85, 500, 100), msg)
+
+            # nothing there
+            self.assertRaises(usb.USBError, sim.bulkRead, 0x85, 500, 5)
+
+            # this firmware never answers on endpoint 0
+            self.assertRaises(usb.USBError, sim.controlMsg, 0xc2, 0, 64, 0, 0, 5)
+
+            with sim.paused() as cc:
+                self.assertEqual(cc.usb.index, 5)
+                self.assertTrue(cc.cycles > 0)
+        finally:
+            sim.stop()
+        self.assertFalse(sim.thread.is_alive())
@@ -0,0 +1,88 @@
+import random
+import unittest
+
+import rflib.bits as rfbits
+import rflib.pktengine as pktengine
+from rflib.const import FAKE_MEM_DF00
+
+
+class PacketEngineTest(unittest.TestCase):
+    def setUp(self):
+        rand = random.Random(0x1111)
+        self.noise = bytes([rand.randrange(256) for x in range(40)])
+        self.payloads = [b'asdfqwerzxcv', b'\x00\x01\x02\x03\xff']
+
+    def capture(self, pe, shift=3):
+        # two packets in noise, not byte aligned
+        raw = self.noise[:7] + pe.encode(self.payloads[0]) + self.noise[7:20] + pe.encode(self.payloads[1]) + self.noise[20:]
+        return rfbits.shiftString(raw, shift)
+
+    def test_crc(self):
+        self.assertEqual(pktengine.crc16(b'123456789'), 0xaee7)
+
+    def test_roundtrip(self):
+        variants = pktengine.configVariants(FAKE_MEM_DF00, syncwords=[0xd391],
+                syncmode=[1, 2, 3], lengthconfig=[1], pktlen=[64], crc=[True],
+                whitening=[False, True], fec=[False, True], manchester=[False, True])
+        self.assertEqual(len(variants), 24)
+
+        for settings, cfg in variants:
+            pe = pktengine.PacketEngine(cfg)
+            pkts = pe.process(self.capture(pe))
+            self.assertEqual([(pkt.data[1:], pkt.crcok) for pkt in pkts],
+                    [(payload, True) for payload in self.payloads], settings)
+            self.assertEqual(pkts[0].data[0], len(self.payloads[0]))
+
+    def test_options(self):
+        base = pktengine.configVariants(FAKE_MEM_DF00, syncwords=[0xd391], syncmode=[2], lengthconfig=[0],
+                pktlen=[12], crc=[True], fec=[True])[0][1]
+
+        # fixed length
+        pe = pktengine.PacketEngine(base)
+        pkts = pe.process(rfbits.shiftString(self.noise[:7] + pe.encode(self.payloads[0]) + self.noise[7:], 5))
+        self.assertEqual([(pkt.data, pkt.crcok) for pkt in pkts], [(self.payloads[0], True)])
+
+        # FEC fixes a few flipped bits
+        raw = bytearray(pe.encode(self.payloads[0]) + self.noise[:4])
+        raw[10] ^= 0x10
+        raw[17] ^= 0x01
+        pkt = pe.process(bytes(raw))[0]
+        self.assertEqual((pkt.data, pkt.crcok, pkt.fecerrors), (self.payloads[0], True, 2))
+
+        # status bytes carry CRC_OK, and a broken CRC is flagged
+        cfg = bytearray(pktengine.configVariants(base, fec=[False])[0][1])
+        cfg[3] |= 0x04          # PKTCTRL1.APPEND_STATUS
+        pe = pktengine.PacketEngine(bytes(cfg))
+        raw = bytearray(pe.encode(self.payloads[0]))
+        self.assertEqual(pe.process(bytes(raw))[0].data, self.payloads[0] + b'\x00\x80')
+        raw[-1] ^= 1
+        pkt = pe.process(bytes(raw))[0]
+        self.assertFalse(pkt.crcok)
+        self.assertEqual(pkt.data[-1], 0)
+
+        # address filtering drops other addresses
+        cfg = bytearray(pktengine.configVariants(base, fec=[False])[0][1])
+        cfg[3] |= 0x01          # PKTCTRL1.ADR_CHK: exact match
+        cfg[5] = 0x42           # ADDR
+        pe = pktengine.PacketEngine(bytes(cfg))
+        self.assertEqual(len(pe.process(pe.encode(self.payloads[0][:11]))), 1)
+        self.assertEqual(len(pe.process(pe.encode(self.payloads[0][:11], addr=0x43))), 0)
+
+        # too little preamble for the PQT
+        pe = pktengine.PacketEngine(pktengine.configVariants(base, pqt=[7], preamble=[2], fec=[False])[0][1])
+        self.assertEqual(pe.process(pe.encode(self.payloads[0])), [])
+        pe = pktengine.PacketEngine(pktengine.configVariants(base, pqt=[7], preamble=[4], fec=[False])[0][1])
+        self.assertEqual(len(pe.process(pe.encode(self.payloads[0]))), 1)
+
+    def test_scan(self):
+        variants = pktengine.configVariants(FAKE_MEM_DF00, syncwords=[0xd391, 0x0f0f], syncmode=[2],
+                lengthconfig=[1], pktlen=[64], crc=[True], whitening=[False, True], fec=[False, True])
+        target = [idx for idx, (settings, cfg) in enumerate(variants)
+                  if settings == dict(crc=True, fec=True, lengthconfig=1, pktlen=64, syncmode=2,
+                                      whitening=True, syncword=0xd391)][0]
+        captures = [self.capture(pktengine.PacketEngine(variants[target][1]), shift) for shift in range(4)]
+
+        for workers in (0, 2):
+            results = pktengine.scanConfigs(captures, variants, workers)
+            self.assertEqual(results[0], (target, 8, 8))
+            self.assertEqual(len(results), len(variants))
@@ -0,0 +1,135 @@
+import time
+import struct
+import unittest
+
+import rflib.rfserver as rfserver
+from rflib.const import APP_NIC, NIC_RECV, APP_SPECAN
+from rflib.fakedongle_nic import FakeRfCat
+
+
+class FakeSock(object):
+    def __init__(self, room):
+        self.room = room
+        self.data = b''
+
+    def send(self, data):
+        if not self.room:
+            raise BlockingIOError()
+        sent = data[:self.room]
+        self.room -= len(sent)
+        self.data += sent
+        return len(sent)
+
+
+class RfServerTest(unittest.TestCase):
+    def test_framing(self):
+        frames = [(rfserver.FRAME_RX, b'asdf'), (rfserver.FRAME_TX, b''), (rfserver.FRAME_DROPPED, b'x' * 300)]
+        stream = b''.join([rfserver.packFrame(ftype, payload) for ftype, payload in frames])
+
+        reader = rfserver.FrameReader()
+        out = []
+        for x in range(0, len(stream), 7):
+            out.extend(reader.feed(stream[x:x+7]))
+        self.assertEqual(out, frames)
+        self.assertRaises(ValueError, rfserver.packFrame, rfserver.FRAME_TX, b'x' * 0x10000)
+
+    def test_policies(self):
+        frames = [rfserver.packFrame(rfserver.FRAME_RX, b'%.3d' % x) for x in range(10)]
+
+        def run(policy):
+            client = rfserver.ServerClient(FakeSock(0), ('test', 0), 4 * len(frames[0]), policy, 1)
+            for frame in frames:
+                client.enqueue(frame)
+            client.control.append(rfserver.packFrame(rfserver.FRAME_TX_DONE, b'\0'))
+            client.sock.room = 1000
+            client.flush()
+            return client, rfserver.FrameReader().feed(client.sock.data)
+
+        client, out = run(rfserver.POLICY_DROP_OLDEST)
+        self.assertEqual(out, [(rfserver.FRAME_TX_DONE, b'\0'), (rfserver.FRAME_DROPPED, struct.pack("<I", 6))] +
+                              [(rfserver.FRAME_RX, b'%.3d' % x) for x in range(6, 10)])
+
+        client, out = run(rfserver.POLICY_DROP_NEWEST)
+        self.assertEqual(out[1:], [(rfserver.FRAME_DROPPED, struct.pack("<I", 6))] +
+                                  [(rfserver.FRAME_RX, b'%.3d' % x) for x in range(4)])
+
+        client, out = run(rfserver.POLICY_DISCONNECT)
+        self.assertTrue(client.closed)
+
+        client, out = run(rfserver.POLICY_BLOCK)
+        self.assertEqual(len(out), 11)
+
+    def test_backlog(self):
+        # a blocked client stops the fan-out, but the dongle's mailbox still gets emptied
+        d = FakeRfCat()
+        srv = rfserver.RfServer(d, '127.0.0.1', 0, policy=rfserver.POLICY_BLOCK, maxbacklog=4)
+        try:
+            client = rfserver.ServerClient(FakeSock(0), ('test', 0), 1, rfserver.POLICY_BLOCK, 1)
+            client.enqueue(rfserver.packFrame(rfserver.FRAME_RX, b'full'))
+            srv.clients[client.sock] = client
+
+            for x in range(10):
+                d._do.txdata(APP_NIC, NIC_RECV, b'pkt%.3d' % x)
+            start = time.time()
+            while len(d.recv_mbox.get(APP_NIC, {}).get(NIC_RECV, [])) < 10 and time.time() - start < 5:
+                time.sleep(.01)
+
+            srv._pump()
+            self.assertEqual(d.recv_mbox[APP_NIC][NIC_RECV], [])
+            st = srv.stats()
+            self.assertEqual((st['packets'], st['backlog'], st['overflows']), (0, 4, 6))
+
+            # once it drains, the newest survivors go out in order
+            client.sock.room = 1000
+            client.flush()
+            srv._pump()
+            client.flush()
+            out = rfserver.FrameReader().feed(client.sock.data)
+            self.assertEqual([payload[8:] for ftype, payload in out[1:]], [b'pkt%.3d' % x for x in range(6, 10)])
+            self.assertEqual(srv.stats()['backlog'], 0)
+        finally:
+            for sock in (srv._lsock, srv._wakeR, srv._wakeW):
+                sock.close()
+            d.cleanup()
+
+    def test_server(self):
+        d = FakeRfCat()
+        srv = rfserver.RfServer(d, '127.0.0.1', 0).start()
+        clients = []
+        try:
+            clients += [rfserver.RfServerClient(*srv.address) for x in range(3)]
+            start = time.time()
+            while len(srv.clients) < 3 and time.time() - start < 5:
+                time.sleep(.01)
+
+            # every client sees the whole RX stream, in order
+            for x in range(50):
+                d._do.txdata(APP_NIC, NIC_RECV, b'pkt%.3d' % x)
+            d._do.txdata(APP_SPECAN, 1, b'\x01\x02\x03')
+            for client in clients:
+                pkts = [client.recv(5) for x in range(50)]
+                self.assertEqual([pkt[0] for pkt in pkts], [b'pkt%.3d' % x for x in range(50)])
+                self.assertTrue(all([abs(pkt[1] - time.time()) < 60 for pkt in pkts]))
+
+            # transmits are acknowledged to the client that sent them
+            clients[1].xmit(b'hello')
+            clients[1].xmit(b'world')
+            self.assertEqual([clients[1].waitTxDone(5) for x in range(2)], [0, 0])
+            self.assertEqual(clients[0].waitTxDone(.2), None)
+            self.assertEqual(srv.stats()['transmitted'], 2)
+
+            start = time.time()
+            while not clients[2].specan and time.time() - start < 5:
+                clients[2].recv(.1)
+            self.assertEqual(clients[2].specan[0][:2], (1, b'\x01\x02\x03'))
+
+            clients[0].close()
+            start = time.time()
+            while len(srv.clients) > 2 and time.time() - start < 5:
+                time.sleep(.01)
+            self.assertEqual(len(srv.clients), 2)
+            srv.reprStats()
+        finally:
+            for client in clients:
+                client.close()
+            srv.stop()
@@ -0,0 +1,283 @@
+import sys
+import time
+import types
+import threading
+import unittest
+
+import usb
+
+from rflib import usbtransport
+from rflib.const import *
+
+
+######## just enough of python-libusb1 ########
+class USBError(Exception):
+    pass
+
+class USBErrorTimeout(USBError):
+    pass
+
+class USBErrorNoDevice(USBError):
+    pass
+
+class USBErrorInterrupted(USBError):
+    pass
+
+TRANSFER_COMPLETED, TRANSFER_ERROR, TRANSFER_TIMED_OUT, TRANSFER_CANCELLED, TRANSFER_STALL, \
+        TRANSFER_NO_DEVICE, TRANSFER_OVERFLOW = range(7)
+
+
+class FakeTransfer(object):
+    def __init__(self, handle):
+        self.handle = handle
+        self.submitted = False
+        self.status = None
+        self.cancelled = False
+
+    def setBulk(self, endpoint, buffer_or_len, callback=None, timeout=0):
+        self.endpoint = endpoint
+        self.buffer = bytearray(buffer_or_len)
+        self.callback = callback
+        self.length = 0
+
+    def submit(self):
+        if self.handle.gone:
+            raise USBErrorNoDevice()
+        self.submitted = True
+        self.cancelled = False
+        self.handle.queue.append(self)
+
+    def cancel(self):
+        self.cancelled = True
+
+    def isSubmitted(self):
+        return self.submitted
+
+    def getStatus(self):
+        return self.status
+
+    def getActualLength(self):
+        return self.length
+
+    def getBuffer(self):
+        return self.buffer
+
+
+class FakeHandle(object):
+    '''
+    a dongle with 'packets' waiting to come in on EP5.  OUT transfers
+    complete straight away, unless it's 'busy'
+    '''
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.queue = []
+        self.packets = []
+        self.sent = []
+        self.busy = False
+        self.gone = False
+        self.control = []
+
+    def getTransfer(self):
+        return FakeTransfer(self)
+
+    def claimInterface(self, intf):
+        pass
+
+    def releaseInterface(self, intf):
+        pass
+
+    def close(self):
+        pass
+
+    def controlWrite(self, requestType, request, value, index, data, timeout):
+        self.control.append((requestType, request, value, index, data))
+        return len(data)
+
+    def controlRead(self, requestType, request, value, index, length, timeout):
+        if self.gone:
+            raise USBErrorNoDevice()
+        return bytes(range(length))
+
+    def getASCIIStringDescriptor(self, index):
+        return 'rfcat%d' % index
+
+    def events(self):
+        done = []
+        with self.lock:
+            for t in list(self.queue):
+                if t.cancelled or self.gone:
+                    t.status = TRANSFER_CANCELLED if t.cancelled else TRANSFER_NO_DEVICE
+                elif t.endpoint & 0x80:
+                    if not self.packets:
+                        continue
+                    data = self.packets.pop(0)
+                    t.buffer[:len(data)] = data
+                    t.length = len(data)
+                    t.status = TRANSFER_COMPLETED
+                else:
+                    if self.busy:
+                        continue
+                    self.sent.append(bytes(t.buffer))
+                    t.length = len(t.buffer)
+                    t.status = TRANSFER_COMPLETED
+                self.queue.remove(t)
+                t.submitted = False
+                done.append(t)
+        for t in done:
+            t.callback(t)
+        return done
+
+
+class FakeDevice(object):
+    def __init__(self, vid, pid, address):
+        self.ids = (vid, pid, address)
+        self.handle = FakeHandle()
+
+    def getVendorID(self):
+        return self.ids[0]
+
+    def getProductID(self):
+        return self.ids[1]
+
+    def getDeviceAddress(self):
+        return self.ids[2]
+
+    def open(self):
+        return self.handle
+
+
+class FakeContext(object):
+    devices = []
+
+    def getDeviceList(self, skip_on_error=False):
+        return self.devices
+
+    def handleEventsTimeout(self, tv=0):
+        busy = False
+        for dev in self.devices:
+            busy |= bool(dev.handle.events())
+        if not busy:
+            time.sleep(.001)
+
+    def close(self):
+        pass
+
+
+usb1 = types.ModuleType('usb1')
+for name, value in list(globals().items()):
+    if name.startswith('USBError') or name.startswith('TRANSFER_'):
+        setattr(usb1, name, value)
+usb1.USBContext = FakeContext
+
+
+class LibUSB1Test(unittest.TestCase):
+    def setUp(self):
+        self.saved = sys.modules.get('usb1')
+        sys.modules['usb1'] = usb1
+        FakeContext.devices = [FakeDevice(0x1d50, 0x6047, 9), FakeDevice(0x1234, 0x5678, 2),
+                               FakeDevice(0x1d50, 0x605b, 4)]
+        self.t = None
+
+    def tearDown(self):
+        if self.t is not None:
+            self.t.close()
+        if self.saved is None:
+            del sys.modules['usb1']
+        else:
+            sys.modules['usb1'] = self.saved
+
+    def open(self, idx=0, **kwargs):
+        self.t = usbtransport.LibUSB1Transport.open(idx, **kwargs)
+        return self.t, self.t.handle
+
+    def test_open(self):
+        self.assertEqual([d.getDeviceAddress() for d in usbtransport.LibUSB1Transport.devices()], [9, 4])
+        t, h = self.open(0)
+        self.assertEqual((t.devnum, t.maxi, t.maxo), (4, EP5IN_MAX_PACKET_SIZE, EP5OUT_MAX_PACKET_SIZE))
+        self.assertEqual(t.getString(2, 100), 'rfcat2')
+        self.assertTrue(isinstance(usbtransport.openTransport(t), usbtransport.LibUSB1Transport))
+
+        FakeContext.devices = []
+        self.assertRaises(Exception, usbtransport.LibUSB1Transport.open)
+
+    def test_in(self):
+        t, h = self.open(inflight=4)
+        # they're all waiting on the dongle before anyone asks for anything
+        time.sleep(.05)
+        self.assertEqual(len([x for x in h.queue if x.endpoint == 0x85]), 4)
+
+        self.assertRaises(usb.USBError, t.bulkRead, 0x85, 500, 10)
+        try:
+            t.bulkRead(0x85, 500, 10)
+        except usb.USBError as e:
+            self.assertTrue('timed out' in str(e))
+
+        packets = [bytes([x]) * 64 for x in range(10)] + [b'', b'end']
+        h.packets.extend(packets)
+        got = b''
+        while len(got) < 643:
+            got += t.bulkRead(0x85, 100, 1000)
+        self.assertEqual(got, b''.join(packets))
+        # ...and they went straight back on
+        time.sleep(.05)
+        self.assertEqual(len([x for x in h.queue if x.endpoint == 0x85]), 4)
+        self.assertEqual(t.stats['inTransfers'], 12)
+
+    def test_out(self):
+        t, h = self.open(outflight=2)
+        self.assertEqual(t.bulkWrite(5, b'one', 100), 3)
+        self.assertEqual(t.bulkWrite(5, bytearray(b'two'), 100), 3)
+        time.sleep(.05)
+        self.assertEqual(h.sent, [b'one', b'two'])
+
+        # the dongle stops taking them: bulkWrite() doesn't wait until there's 'outflight' out
+        h.busy = True
+        start = time.time()
+        t.bulkWrite(5, b'3', 500)
+        t.bulkWrite(5, b'4', 500)
+        self.assertTrue(time.time() - start < .25)
+        self.assertRaises(usb.USBError, t.bulkWrite, 5, b'5', 50)
+        h.busy = False
+        t.bulkWrite(5, b'5', 500)
+        time.sleep(.05)
+        self.assertEqual(h.sent, [b'one', b'two', b'3', b'4', b'5'])
+        self.assertEqual(t.stats['outWaits'], 2)
+
+    def test_control(self):
+        t, h = self.open()
+        self.assertEqual(t.controlMsg(USB_BM_REQTYPE_DIR_IN | USB_BM_REQTYPE_TYPE_VENDOR, 1, 4, 0x200, 0), b'\0\1\2\3')
+        self.assertEqual(t.controlMsg(USB_BM_REQTYPE_TYPE_VENDOR, 2, b'ab', 0x200, 0), 2)
+        self.assertEqual(h.control[-1], (USB_BM_REQTYPE_TYPE_VENDOR, 2, 0x200, 0, b'ab'))
+
+    def test_unplugged(self):
+        t, h = self.open()
+        h.gone = True
+        # what USBDongle's threads look for to resetup()
+        for call in (lambda: t.bulkRead(0x85, 500, 1000), lambda: t.bulkWrite(5, b'x', 100),
+                     lambda: t.controlMsg(USB_BM_REQTYPE_DIR_IN, 1, 4)):
+            try:
+                call()
+                self.fail("didn't notice")
+            except usb.USBError as e:
+                self.assertTrue('No such device' in str(e))
+
+
+class TransportTest(unittest.TestCase):
+    def test_choose(self):
+        self.assertEqual(usbtransport.getTransport('libusb1'), usbtransport.LibUSB1Transport)
+        self.assertEqual(usbtransport.getTransport(), usbtransport.TRANSPORTS[usbtransport.default])
+        self.assertRaises(ValueError, usbtransport.getTransport, 'carrierpigeon')
+
+    def test_fake(self):
+        import rflib
+        d = rflib.RfCat(transport='fake')
+        try:
+            self.assertTrue(isinstance(d._do, usbtransport.FakeTransport))
+            self.assertEqual(d.ping(3, silent=True)[0], 3)
+            self.assertEqual(d.getPartNum(), FAKE_PARTNUM)
+        finally:
+            d.cleanup()
+
+
+if __name__ == '__main__':
+    unittest.main()